@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+"""Сквозной замер команд theo на синтетической базе (только Linux).
+
+Генерирует базу командой `theo gen` (или берёт готовую), запускает на ней каждую команду, включая
+режимы dedup и randomize с выгрузкой на диск, и записывает для каждого запуска время выполнения,
+пиковое потребление памяти (RSS) и объём прочитанных и записанных данных в JSON-файл результатов.
+Результаты двух версий сравниваются подкомандой compare:
+
+    python3 benchmark_commands.py run --theo ./theo --size 10240 --duplicates 30 -o new.json
+    python3 benchmark_commands.py compare old.json new.json
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import shutil
+import socket
+import statistics
+import subprocess
+import sys
+import time
+
+# Версия формата файла результатов: увеличивается при несовместимых изменениях полей
+RESULTS_FORMAT_VERSION = 1
+
+# Все сценарии по порядку запуска. Сценарий - команда theo с опциями, запускаемая на сгенерированной базе
+ALL_SCENARIOS = ["n", "d", "d-spill", "s", "m", "c", "t", "r", "r-spill"]
+
+# Размер блока, в котором ядро считает ru_inblock и ru_oublock
+RUSAGE_BLOCK_SIZE = 512
+
+
+def read_meminfo():
+    """Возвращает поля /proc/meminfo в байтах."""
+    meminfo = {}
+    with open("/proc/meminfo") as meminfo_file:
+        for line in meminfo_file:
+            name, value = line.split(":", 1)
+            meminfo[name] = int(value.split()[0]) * 1024
+    return meminfo
+
+
+def get_randomize_spill_memory_percent(corpus_size):
+    """Подбирает значение --memory для randomize, при котором база не помещается в оперативную память.
+
+    randomize перемешивает файл в памяти, если свободной памяти сверх запрещённых (100 - memory + 5)%
+    хватает на две копии файла и указатели на строки (около 2.5 размера файла). Выбирается наибольший процент,
+    при котором разрешённой памяти не хватает, но она всё же есть (иначе randomize завершается с ошибкой).
+    Возвращает None, если такого процента нет, например, база меньше шага в 1% памяти.
+    """
+    meminfo = read_meminfo()
+    total, available = meminfo["MemTotal"], meminfo["MemAvailable"]
+    required = corpus_size * 2.5
+    suitable_percents = [percent for percent in range(1, 101) if 0 < available - total * (100 - percent + 5) / 100 < required]
+    return max(suitable_percents) if suitable_percents else None
+
+
+def get_scenario_command(scenario, theo, corpus, output_dir):
+    """Возвращает аргументы запуска сценария и список входных файлов (для подсчёта входного объёма)."""
+    if scenario == "n":
+        return [theo, "n", "-d", output_dir, corpus], [corpus]
+    if scenario == "d":
+        return [theo, "d", "-d", output_dir, corpus], [corpus]
+    if scenario == "d-spill":
+        # При лимите в 1% хеши сразу переносятся на диск в отсортированные прогоны с фильтрами Блума
+        return [theo, "d", "--memory", "1", "-d", output_dir, corpus], [corpus]
+    if scenario == "s":
+        return [theo, "s", "-p", "8", "-d", output_dir, corpus], [corpus]
+    if scenario == "m":
+        # Объединяется две копии базы, чтобы замер не зависел от результатов других сценариев
+        return [theo, "m", "-d", os.path.join(output_dir, "merged.txt"), corpus, corpus], [corpus, corpus]
+    if scenario == "c":
+        return [theo, "c", corpus], [corpus]
+    if scenario == "t":
+        return [theo, "t", "-d", output_dir, corpus], [corpus]
+    if scenario == "r":
+        return [theo, "r", "-d", os.path.join(output_dir, "randomized.txt"), corpus], [corpus]
+    if scenario == "r-spill":
+        memory_percent = get_randomize_spill_memory_percent(os.path.getsize(corpus))
+        if memory_percent is None:
+            return None, [corpus]
+        return [theo, "r", "--memory", str(memory_percent), "-d", os.path.join(output_dir, "randomized.txt"), corpus], [corpus]
+    raise ValueError("unknown scenario " + scenario)
+
+
+def get_directory_size(path):
+    size = 0
+    for root, _, files in os.walk(path):
+        for name in files:
+            file_path = os.path.join(root, name)
+            if not os.path.islink(file_path):
+                size += os.path.getsize(file_path)
+    return size
+
+
+def drop_caches():
+    """Сбрасывает системный кеш, чтобы каждый запуск читал базу с диска. Нужны права root."""
+    os.sync()
+    try:
+        with open("/proc/sys/vm/drop_caches", "w") as drop_caches_file:
+            drop_caches_file.write("3\n")
+        return True
+    except OSError as error:
+        print("Warning: cannot drop page cache ({}), runs will use cached data".format(error), file=sys.stderr)
+        return False
+
+
+def measure_command(command, working_dir, log_path):
+    """Запускает команду и возвращает код возврата, время выполнения и статистику ресурсов.
+
+    Статистика берётся из wait4: она включает и все дочерние процессы, которых дождалась команда
+    (randomize с выгрузкой на диск запускает split и merge отдельными процессами theo). Прочитанные
+    и записанные байты - обращения к диску (ru_inblock/ru_oublock), данные из кеша в них не входят.
+    """
+    with open(log_path, "ab") as log_file:
+        log_file.write(("$ " + " ".join(command) + "\n").encode())
+        log_file.flush()
+        begin = time.perf_counter()
+        process = subprocess.Popen(command, cwd=working_dir, stdin=subprocess.DEVNULL, stdout=log_file, stderr=subprocess.STDOUT)
+        _, status, rusage = os.wait4(process.pid, 0)
+        wall_seconds = time.perf_counter() - begin
+        process.returncode = os.waitstatus_to_exitcode(status)
+    return {
+        "exit_code": process.returncode,
+        "wall_seconds": round(wall_seconds, 6),
+        "user_seconds": round(rusage.ru_utime, 6),
+        "system_seconds": round(rusage.ru_stime, 6),
+        "peak_rss_bytes": rusage.ru_maxrss * 1024,
+        "bytes_read": rusage.ru_inblock * RUSAGE_BLOCK_SIZE,
+        "bytes_written": rusage.ru_oublock * RUSAGE_BLOCK_SIZE,
+        "major_page_faults": rusage.ru_majflt,
+        "voluntary_context_switches": rusage.ru_nvcsw,
+    }
+
+
+def get_theo_version(theo):
+    """Версия theo для сравнения результатов: коммит репозитория рядом с исполняемым файлом, если он есть."""
+    theo_path = shutil.which(theo) or theo
+    try:
+        return subprocess.run(["git", "-C", os.path.dirname(os.path.abspath(theo_path)), "describe", "--always", "--dirty"],
+                              capture_output=True, text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def get_host_info():
+    cpu_model = None
+    try:
+        with open("/proc/cpuinfo") as cpuinfo_file:
+            for line in cpuinfo_file:
+                if line.startswith("model name"):
+                    cpu_model = line.split(":", 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    return {
+        "hostname": socket.gethostname(),
+        "kernel": platform.release(),
+        "cpu_model": cpu_model,
+        "cpu_count": os.cpu_count(),
+        "memory_bytes": read_meminfo()["MemTotal"],
+    }
+
+
+def run_benchmarks(arguments):
+    theo = shutil.which(arguments.theo) or os.path.abspath(arguments.theo)
+    work_dir = os.path.abspath(arguments.work_dir)
+    os.makedirs(work_dir, exist_ok=True)
+    log_path = os.path.join(work_dir, "theo.log")
+    scenarios = arguments.scenarios.split(",")
+    for scenario in scenarios:
+        if scenario not in ALL_SCENARIOS:
+            sys.exit("Error: unknown scenario '{}', valid scenarios: {}".format(scenario, ",".join(ALL_SCENARIOS)))
+
+    results = {
+        "format_version": RESULTS_FORMAT_VERSION,
+        "started_at": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+        "theo": theo,
+        "theo_version": get_theo_version(theo),
+        "host": get_host_info(),
+        "corpus": {},
+        "runs": [],
+    }
+
+    if arguments.corpus:
+        corpus = os.path.abspath(arguments.corpus)
+        results["corpus"] = {"path": corpus, "generated": False}
+    else:
+        # База генерируется заново при каждом запуске скрипта, одинаковые опции дают одинаковый файл
+        corpus = os.path.join(work_dir, "corpus.txt")
+        if os.path.exists(corpus):
+            os.remove(corpus)
+        generate_command = [theo, "gen", "-s", str(arguments.size), "-d", corpus, "--seed", str(arguments.seed),
+                            "--min-length", str(arguments.min_length), "--max-length", str(arguments.max_length),
+                            "--duplicates", str(arguments.duplicates), "--invalid", str(arguments.invalid),
+                            "--crlf", str(arguments.crlf), "--utf8", str(arguments.utf8), "--latin1", str(arguments.latin1),
+                            "--separators", arguments.separators]
+        if arguments.skewed:
+            generate_command.append("--skewed")
+        print("Generating corpus: " + " ".join(generate_command[1:]))
+        generation = measure_command(generate_command, work_dir, log_path)
+        if generation["exit_code"] != 0:
+            sys.exit("Error: corpus generation failed, see " + log_path)
+        results["corpus"] = {"path": corpus, "generated": True, "generator_arguments": generate_command[2:], "generation": generation}
+    results["corpus"]["size_bytes"] = os.path.getsize(corpus)
+
+    for scenario in scenarios:
+        output_dir = os.path.join(work_dir, "output_" + scenario)
+        for repeat in range(1, arguments.repeats + 1):
+            shutil.rmtree(output_dir, ignore_errors=True)
+            os.makedirs(output_dir)
+            command, input_files = get_scenario_command(scenario, theo, corpus, output_dir)
+            run = {"scenario": scenario, "repeat": repeat}
+            if command is None:
+                run["skipped"] = "cannot choose --memory value forcing shuffle on disk for this corpus size and free RAM"
+                print("{:>8} #{}: skipped, {}".format(scenario, repeat, run["skipped"]))
+                results["runs"].append(run)
+                break
+            if arguments.drop_caches:
+                drop_caches()
+            run["arguments"] = command[1:]
+            run.update(measure_command(command, output_dir, log_path))
+            run["input_bytes"] = sum(os.path.getsize(path) for path in input_files)
+            run["output_bytes"] = get_directory_size(output_dir)
+            run["input_mb_per_second"] = round(run["input_bytes"] / 1024 / 1024 / max(run["wall_seconds"], 1e-9), 2)
+            results["runs"].append(run)
+            print("{:>8} #{}: {:9.2f} s, {:9.1f} MB/s, peak RSS {:8.1f} MB, read {:9.1f} MB, written {:9.1f} MB{}".format(
+                scenario, repeat, run["wall_seconds"], run["input_mb_per_second"], run["peak_rss_bytes"] / 1024 / 1024,
+                run["bytes_read"] / 1024 / 1024, run["bytes_written"] / 1024 / 1024,
+                "" if run["exit_code"] == 0 else ", FAILED with code {}, see {}".format(run["exit_code"], log_path)))
+        if not arguments.keep_outputs:
+            shutil.rmtree(output_dir, ignore_errors=True)
+
+    if results["corpus"]["generated"] and not arguments.keep_outputs:
+        os.remove(corpus)
+    with open(arguments.output, "w") as results_file:
+        json.dump(results, results_file, indent=2)
+        results_file.write("\n")
+    print("Results saved to " + arguments.output)
+    return 0 if all(run.get("exit_code", 0) == 0 for run in results["runs"]) else 1
+
+
+def get_median_runs(results):
+    """Медианы времени, памяти и обращений к диску по всем успешным повторам каждого сценария."""
+    medians = {}
+    for scenario in ALL_SCENARIOS:
+        runs = [run for run in results["runs"] if run["scenario"] == scenario and run.get("exit_code") == 0]
+        if runs:
+            medians[scenario] = {field: statistics.median(run[field] for run in runs)
+                                 for field in ("wall_seconds", "peak_rss_bytes", "bytes_read", "bytes_written")}
+    return medians
+
+
+def compare_results(arguments):
+    with open(arguments.baseline) as baseline_file, open(arguments.candidate) as candidate_file:
+        baseline, candidate = json.load(baseline_file), json.load(candidate_file)
+    if baseline["corpus"].get("size_bytes") != candidate["corpus"].get("size_bytes"):
+        print("Warning: corpora sizes differ, results are not directly comparable", file=sys.stderr)
+    baseline_medians, candidate_medians = get_median_runs(baseline), get_median_runs(candidate)
+    print("{:>8} {:>12} {:>12} {:>9} {:>14} {:>14}".format("scenario", "old time, s", "new time, s", "speedup", "old RSS, MB", "new RSS, MB"))
+    for scenario in ALL_SCENARIOS:
+        if scenario not in baseline_medians or scenario not in candidate_medians:
+            continue
+        old, new = baseline_medians[scenario], candidate_medians[scenario]
+        print("{:>8} {:12.2f} {:12.2f} {:8.2f}x {:14.1f} {:14.1f}".format(
+            scenario, old["wall_seconds"], new["wall_seconds"], old["wall_seconds"] / max(new["wall_seconds"], 1e-9),
+            old["peak_rss_bytes"] / 1024 / 1024, new["peak_rss_bytes"] / 1024 / 1024))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End-to-end benchmark of theo commands on synthetic login:password base")
+    subparsers = parser.add_subparsers(dest="action", required=True)
+
+    run_parser = subparsers.add_parser("run", help="generate corpus, run commands and save results to JSON file")
+    run_parser.add_argument("--theo", default="theo", help="path to theo executable (default - theo from PATH)")
+    run_parser.add_argument("-w", "--work-dir", default="theo_benchmark", help="directory for corpus and results of commands")
+    run_parser.add_argument("-o", "--output", default="benchmark_results.json", help="path to JSON file with results")
+    run_parser.add_argument("--scenarios", default=",".join(ALL_SCENARIOS), help="comma-separated scenarios (default - all: %(default)s)")
+    run_parser.add_argument("-r", "--repeats", type=int, default=1, help="how many times every scenario runs (default - 1)")
+    run_parser.add_argument("--drop-caches", action="store_true", help="drop page cache before every run, requires root")
+    run_parser.add_argument("--keep-outputs", action="store_true", help="don't delete corpus and results of commands")
+    corpus_group = run_parser.add_argument_group("corpus options (passed to 'theo gen')")
+    corpus_group.add_argument("--corpus", help="use existing base instead of generating new one")
+    corpus_group.add_argument("-s", "--size", type=int, default=1024, help="size of corpus in megabytes, 1024-102400 for 1-100 GB (default - 1024)")
+    corpus_group.add_argument("--seed", type=int, default=0x7468656F)
+    corpus_group.add_argument("--min-length", type=int, default=20)
+    corpus_group.add_argument("--max-length", type=int, default=60)
+    corpus_group.add_argument("--skewed", action="store_true")
+    corpus_group.add_argument("--duplicates", type=int, default=30)
+    corpus_group.add_argument("--invalid", type=int, default=5)
+    corpus_group.add_argument("--crlf", type=int, default=10)
+    corpus_group.add_argument("--utf8", type=int, default=5)
+    corpus_group.add_argument("--latin1", type=int, default=5)
+    corpus_group.add_argument("--separators", default=":;")
+    run_parser.set_defaults(handler=run_benchmarks)
+
+    compare_parser = subparsers.add_parser("compare", help="compare medians of two results files")
+    compare_parser.add_argument("baseline", help="results of old version")
+    compare_parser.add_argument("candidate", help="results of new version")
+    compare_parser.set_defaults(handler=compare_results)
+
+    arguments = parser.parse_args()
+    return arguments.handler(arguments)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
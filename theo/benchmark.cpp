@@ -0,0 +1,233 @@
+﻿#include <iomanip>
+#include <sstream>
+#include "utils.hpp"
+
+/* Параметры сгенерированного в памяти набора строк (корпуса), на котором замеряется скорость обработчиков.
+* Строки похожи на строки обычной базы формата email:password, доли указываются в процентах от всех строк */
+struct BenchmarkCorpus {
+	string name;
+	size_t averageLineLength = 40; // Средняя длина строки в байтах без переноса, реальные длины от половины до полутора средних
+	unsigned crlfPercent = 0; // Строки, заканчивающиеся на \r\n вместо \n
+	unsigned duplicatesPercent = 0; // Строки, повторяющие одну из уже сгенерированных ранее
+	unsigned invalidPercent = 0; // Невалидные строки: без разделителя, с запрещёнными символами или без пароля
+};
+
+// Наборы строк, на которых замеряются обработчики, если пользователь не задал свой
+static const BenchmarkCorpus BENCH_DEFAULT_CORPORA[] = {
+	{ "short", 16, 0, 0, 0 },
+	{ "medium", 40, 0, 0, 0 },
+	{ "long", 120, 0, 0, 0 },
+	{ "crlf", 40, 50, 0, 0 },
+	{ "duplicates", 40, 0, 50, 0 },
+	{ "invalid", 40, 0, 0, 30 },
+	{ "mixed", 40, 20, 30, 10 },
+};
+
+/* Замеряемая функция: обработчик чанка одной из команд или обёртка над горячим циклом с такой же сигнатурой.
+* reset вызывается перед каждым замером вне замеряемого времени (например, очищает хеши dedup), может быть NULL */
+struct BenchmarkKernel {
+	string name;
+	chunk_processor process = NULL;
+	void (*reset)(void) = NULL;
+};
+
+// Сколько строк в одной части при замере цикла разбиения файла (как у 'theo split -l 100000')
+constexpr size_t BENCH_SPLIT_LINES_IN_PART = 100000;
+
+/* Результаты обёрток записываются сюда, чтобы компилятор не выбросил вычисления, результат которых
+* больше нигде не используется */
+static volatile size_t benchmarkResultSink = 0;
+
+/* Параметры генератора строк (corpus.hpp) для корпуса замера: длины строк - от половины до полутора средней,
+* начальное значение генератора - по умолчанию, поэтому корпус одинаковый при каждом запуске */
+static CorpusParameters getBenchmarkCorpusParameters(const BenchmarkCorpus& corpus);
+
+/* Замеряет обработчик repeatsCount раз на копии корпуса и возвращает время каждого замера в секундах,
+* отсортированное по возрастанию. Перед замерами обработчик один раз запускается для прогрева */
+static vector<double> measureKernel(const BenchmarkKernel& kernel, const char* corpusBuffer, size_t corpusLength, char* inputBuffer, char* resultBuffer, unsigned repeatsCount);
+
+// Разбирает список названий через запятую. Пустой список (NULL) - все названия
+static bool isNameSelected(const char* namesList, const string& name);
+
+// Считает строки в буфере так же, как count (getStringCountInFile)
+static size_t countLinesKernel(char* inputBuffer, size_t inputBufferLength, char*) {
+	return getLinesCountInBuffer(inputBuffer, inputBufferLength);
+}
+
+// Делит буфер на части по BENCH_SPLIT_LINES_IN_PART строк так же, как split, возвращает количество частей
+static size_t splitLinesKernel(char* inputBuffer, size_t inputBufferLength, char*) {
+	size_t partsCount = 0;
+	for (size_t pos = 0; pos < inputBufferLength; partsCount++) {
+		size_t remainingStrings = BENCH_SPLIT_LINES_IN_PART;
+		pos = readBufferByLinesUntilCount(inputBuffer, inputBufferLength, pos, &remainingStrings);
+	}
+	return partsCount;
+}
+
+// Опции для ввода аргументов вызова программы из cmd, показыаемые пользователю при использовании флага --help или -h
+static const char* const usages[] = {
+	"theo bench [options]",
+	NULL,
+};
+
+int benchKernels(int argc, const char** argv) {
+	int corpusSizeInMegabytes = 64;
+	int repeatsCount = 5;
+	const char* kernelsList = NULL;
+	const char* corporaList = NULL;
+	int averageLineLength = 0;
+	int crlfPercent = -1;
+	int duplicatesPercent = -1;
+	int invalidPercent = -1;
+	int isCsvOutput = 0;
+	const char* newlineKernelName = NULL;
+
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_GROUP("Basic options"),
+		OPT_INTEGER('s', "size", &corpusSizeInMegabytes, "size of generated strings in megabytes, one chunk processed at once (default - 64)"),
+		OPT_INTEGER('r', "repeats", &repeatsCount, "how many times every function is measured, median is shown (default - 5)"),
+		OPT_STRING('k', "kernels", &kernelsList, "comma-separated functions to measure: normalize, dedup, tokenize, count, split (default - all)"),
+		OPT_STRING('c', "corpora", &corporaList, "comma-separated corpora: short, medium, long, crlf, duplicates, invalid, mixed (default - all)"),
+		OPT_BOOLEAN(0, "csv", &isCsvOutput, "print results as CSV table for scripts and comparing versions (default - false)"),
+		OPT_STRING(0, "simd", &newlineKernelName, "instructions used to find line breaks: scalar, sse2, avx2 or avx512 (default - fastest supported by CPU)"),
+		OPT_GROUP("Custom corpus options (if any is specified, only custom corpus is measured)"),
+		OPT_INTEGER(0, "line-length", &averageLineLength, "average length of line in bytes (default - 40)"),
+		OPT_INTEGER(0, "crlf", &crlfPercent, "percent of lines ending with \\r\\n (default - 0)"),
+		OPT_INTEGER(0, "duplicates", &duplicatesPercent, "percent of lines repeating previous ones (default - 0)"),
+		OPT_INTEGER(0, "invalid", &invalidPercent, "percent of invalid lines: without separator, with forbidden symbols or empty password (default - 0)"),
+		OPT_GROUP("Measures speed of chunk processing functions of commands on strings generated in memory, without disk.\n\
+Every function runs in one thread on one chunk. Example command: 'theo bench -k normalize,dedup -c mixed'"),
+		OPT_END(),
+	};
+	struct argparse argparse;
+	argparse_init(&argparse, options, usages, 0);
+	argparse_parse(&argparse, argc, argv);
+
+	if (corpusSizeInMegabytes < 1) {
+		cout << "Error: invalid '--size' parameter value, it must be positive number of megabytes" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (repeatsCount < 1) {
+		cout << "Error: invalid '--repeats' parameter value, it must be positive number" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (averageLineLength < 0 or crlfPercent > 100 or duplicatesPercent > 100 or invalidPercent > 100) {
+		cout << "Error: invalid custom corpus parameters, line length must be positive and percents must be from 0 to 100" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (newlineKernelName != NULL and not setNewlineKernel(newlineKernelName)) {
+		size_t supportedKernelsCount = 0;
+		const NewlineKernel* const* supportedKernels = getAvailableNewlineKernels(&supportedKernelsCount);
+		cout << "Error: invalid '--simd' parameter value - [" << newlineKernelName << "]. Supported by this CPU:";
+		for (size_t i = 0; i < supportedKernelsCount; i++) cout << ' ' << supportedKernels[i]->name;
+		cout << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	// Если задан хоть один параметр своего корпуса, замеряется только он, остальные параметры - по умолчанию
+	vector<BenchmarkCorpus> corpora;
+	if (averageLineLength > 0 or crlfPercent >= 0 or duplicatesPercent >= 0 or invalidPercent >= 0) {
+		BenchmarkCorpus customCorpus;
+		customCorpus.name = "custom";
+		if (averageLineLength > 0) customCorpus.averageLineLength = averageLineLength;
+		customCorpus.crlfPercent = max(crlfPercent, 0);
+		customCorpus.duplicatesPercent = max(duplicatesPercent, 0);
+		customCorpus.invalidPercent = max(invalidPercent, 0);
+		corpora.push_back(customCorpus);
+	}
+	else for (const BenchmarkCorpus& corpus : BENCH_DEFAULT_CORPORA) if (isNameSelected(corporaList, corpus.name)) corpora.push_back(corpus);
+
+	/* Обработчики получаем так же, как этапы pipe, с параметрами команд по умолчанию. Хеши dedup хранятся только
+	* в оперативной памяти (100%), чтобы замер не зависел от занятой другими программами памяти */
+	vector<BenchmarkKernel> kernels;
+	if (isNameSelected(kernelsList, "normalize")) kernels.push_back({ "normalize", getNormalizePipeStage("emailpass"), NULL });
+	if (isNameSelected(kernelsList, "dedup")) kernels.push_back({ "dedup", getDeduplicatePipeStage("100", getWorkingDirectoryPath()), clearDeduplicatePipeStage });
+	if (isNameSelected(kernelsList, "tokenize")) kernels.push_back({ "tokenize", getTokenizePipeStage("first"), NULL });
+	if (isNameSelected(kernelsList, "count")) kernels.push_back({ "count", countLinesKernel, NULL });
+	if (isNameSelected(kernelsList, "split")) kernels.push_back({ "split", splitLinesKernel, NULL });
+
+	if (corpora.empty() or kernels.empty()) {
+		cout << "Error: nothing to measure, check names in '--kernels' and '--corpora' parameters" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	/* Корпус генерируется один раз, а перед каждым замером копируется во входной буфер, поскольку обработчик
+	* может изменять входной буфер. Все буферы выровнены так же, как буферы чанков в командах */
+	size_t corpusBufferSize = static_cast<size_t>(corpusSizeInMegabytes) * 1024 * 1024;
+	char* corpusBuffer = allocateIOBuffer(corpusBufferSize + 2);
+	char* inputBuffer = allocateIOBuffer(corpusBufferSize + 2);
+	char* resultBuffer = allocateIOBuffer(corpusBufferSize + 2);
+
+	if (isCsvOutput) cout << "corpus,average_line_length,crlf_percent,duplicates_percent,invalid_percent,kernel,bytes,lines,median_seconds,median_gb_per_second,median_lines_per_second,best_gb_per_second,simd" << endl;
+	else cout << "Line breaks search: " << newlineKernel->name << endl;
+	for (const BenchmarkCorpus& corpus : corpora) {
+		size_t linesCount = 0;
+		size_t corpusLength = CorpusGenerator(getBenchmarkCorpusParameters(corpus)).fillBuffer(0, corpusBuffer, corpusBufferSize, &linesCount);
+
+		if (not isCsvOutput) {
+			cout << "\nCorpus '" << corpus.name << "': average line " << corpus.averageLineLength << " bytes, CRLF " << corpus.crlfPercent << "%, duplicates "
+				<< corpus.duplicatesPercent << "%, invalid " << corpus.invalidPercent << "%, " << corpusLength / (1024 * 1024) << "MB, " << linesCount << " lines\n" << endl;
+			cout << setw(12) << "function" << setw(12) << "GB/s" << setw(14) << "Mlines/s" << setw(14) << "best GB/s" << endl;
+		}
+		for (const BenchmarkKernel& kernel : kernels) {
+			vector<double> repeatsSeconds = measureKernel(kernel, corpusBuffer, corpusLength, inputBuffer, resultBuffer, repeatsCount);
+			double medianSeconds = max(repeatsSeconds[repeatsSeconds.size() / 2], 1e-9);
+			double bestSeconds = max(repeatsSeconds.front(), 1e-9);
+			double medianGigabytesPerSecond = corpusLength / medianSeconds / 1e9;
+			double medianLinesPerSecond = linesCount / medianSeconds;
+			double bestGigabytesPerSecond = corpusLength / bestSeconds / 1e9;
+
+			if (isCsvOutput) {
+				cout << corpus.name << ',' << corpus.averageLineLength << ',' << corpus.crlfPercent << ',' << corpus.duplicatesPercent << ',' << corpus.invalidPercent << ','
+					<< kernel.name << ',' << corpusLength << ',' << linesCount << ',' << fixed << setprecision(6) << medianSeconds << ',' << setprecision(3) << medianGigabytesPerSecond << ','
+					<< setprecision(0) << medianLinesPerSecond << ',' << setprecision(3) << bestGigabytesPerSecond << ',' << newlineKernel->name << endl;
+			}
+			else {
+				cout << setw(12) << kernel.name << fixed << setprecision(3) << setw(12) << medianGigabytesPerSecond << setprecision(1) << setw(14) << medianLinesPerSecond / 1e6
+					<< setprecision(3) << setw(14) << bestGigabytesPerSecond << endl;
+			}
+		}
+	}
+
+	freeIOBuffer(corpusBuffer);
+	freeIOBuffer(inputBuffer);
+	freeIOBuffer(resultBuffer);
+	if (not isCsvOutput) cout << endl;
+	return ERROR_SUCCESS;
+}
+
+static CorpusParameters getBenchmarkCorpusParameters(const BenchmarkCorpus& corpus) {
+	CorpusParameters corpusParameters;
+	corpusParameters.minLineLength = corpus.averageLineLength / 2;
+	corpusParameters.maxLineLength = corpus.averageLineLength + corpus.averageLineLength / 2;
+	corpusParameters.crlfPercent = corpus.crlfPercent;
+	corpusParameters.duplicatesPercent = corpus.duplicatesPercent;
+	corpusParameters.invalidPercent = corpus.invalidPercent;
+	return corpusParameters;
+}
+
+static vector<double> measureKernel(const BenchmarkKernel& kernel, const char* corpusBuffer, size_t corpusLength, char* inputBuffer, char* resultBuffer, unsigned repeatsCount) {
+	vector<double> repeatsSeconds;
+	// Нулевой повтор - прогрев: первые обращения к буферам и таблицам вызывают page faults, которые не должны попасть в замер
+	for (unsigned repeat = 0; repeat <= repeatsCount; repeat++) {
+		memcpy(inputBuffer, corpusBuffer, corpusLength);
+		if (kernel.reset != NULL) kernel.reset();
+
+		chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+		benchmarkResultSink = kernel.process(inputBuffer, corpusLength, resultBuffer);
+		chrono::steady_clock::time_point end = chrono::steady_clock::now();
+		if (repeat > 0) repeatsSeconds.push_back(chrono::duration<double>(end - begin).count());
+	}
+	if (kernel.reset != NULL) kernel.reset();
+	sort(repeatsSeconds.begin(), repeatsSeconds.end());
+	return repeatsSeconds;
+}
+
+static bool isNameSelected(const char* namesList, const string& name) {
+	if (namesList == NULL) return true;
+	stringstream namesStream(namesList);
+	string selectedName;
+	while (getline(namesStream, selectedName, ',')) if (selectedName == name) return true;
+	return false;
+}
@@ -0,0 +1,197 @@
+﻿#include <iomanip>
+#include "utils.hpp"
+
+// Размеры блока одного чтения (в мегабайтах), для которых замеряется скорость диска
+static const size_t BENCH_BLOCK_SIZES_IN_MEGABYTES[] = { 1, 4, 16, 64, 256 };
+// Сколько читателей одновременно читают разные части тестового файла (глубина очереди запросов к диску)
+static const size_t BENCH_QUEUE_DEPTHS[] = { 1, 2, 4, 8, 16 };
+// Сколько раз повторяется каждый замер: скорость диска сильно скачет, поэтому берётся медиана повторов
+constexpr unsigned BENCH_REPEATS_COUNT = 3;
+
+// Создаёт тестовый файл указанного размера, заполненный строками формата login:password. Возвращает false, если не удалось
+static bool createBenchmarkFile(const wstring& filePath, ull fileSizeInBytes);
+
+/* Читает тестовый файл queueDepth потоками одновременно (каждый поток - свою часть файла) блоками по blockSizeInBytes,
+* предварительно сбросив файл из системного кеша. Возвращает скорость чтения в байтах в секунду, при ошибке - 0 */
+static double measureReadSpeed(const wstring& filePath, ull fileSizeInBytes, size_t blockSizeInBytes, size_t queueDepth);
+
+// Опции для ввода аргументов вызова программы из cmd, показыаемые пользователю при использовании флага --help или -h
+static const char* const usages[] = {
+	"theo bench-io [options]",
+	NULL,
+};
+
+int benchIO(int argc, const char** argv) {
+	const char* testDirectoryPath = ".";
+	const char* profilePath = NULL;
+	int testFileSizeInMegabytes = 1024;
+
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_GROUP("Basic options"),
+		OPT_INTEGER('s', "size", &testFileSizeInMegabytes, "size of test file in megabytes, the larger - the more accurate (default - 1024)"),
+		OPT_GROUP("File options"),
+		OPT_STRING('d', "directory", &testDirectoryPath, "directory on the disk that needs to be calibrated, test file is created there\n\t\t\t      (current directory by default)"),
+		OPT_STRING('o', "output", &profilePath, "path where disk profile will be saved (default - profile in user config directory)"),
+		OPT_GROUP("Performance options"),
+		OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+		OPT_GROUP("Measures disk read speed for different block sizes and numbers of simultaneous readers and saves it to profile,\nwhich other commands use to choose chunk size. Example command: 'theo bench-io -d D:\\bases'"),
+		OPT_END(),
+	};
+	struct argparse argparse;
+	argparse_init(&argparse, options, usages, 0);
+	argparse_parse(&argparse, argc, argv);
+
+	if (testFileSizeInMegabytes < 1) {
+		cout << "Invalid '--size' parameter value, it must be positive number of megabytes" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+	// Тестовый файл создаётся на том диске, который надо откалибровать, и удаляется после замеров
+	wstring testDirectory = toWstring(testDirectoryPath);
+	checkDestinationDirectory(testDirectory);
+	wstring testFilePath = joinPaths(testDirectory, L"theo_bench_io_" + to_wstring(chrono::system_clock::now().time_since_epoch().count()) + L".tmp");
+	ull testFileSizeInBytes = static_cast<ull>(testFileSizeInMegabytes) * 1024 * 1024;
+	error_code _;
+
+	wcout << "Creating test file of " << testFileSizeInMegabytes << "MB [" << testFilePath << "]" << endl;
+	if (not createBenchmarkFile(testFilePath, testFileSizeInBytes)) {
+		wcout << "Error: cannot create test file [" << testFilePath << "], check free disk space and access rights" << endl;
+		fs::remove(toFilesystemPath(testFilePath), _);
+		return ERROR_WRITE_FAULT;
+	}
+
+	IOProfile ioProfile;
+	ull availableMemoryInBytes = getAvailableMemoryInBytes();
+	cout << "\nRead speed (MB/s) with " << getFileIOBackendName() << " backend, rows - block size, columns - simultaneous readers (queue depth):\n" << endl;
+	cout << setw(10) << "block";
+	for (size_t queueDepth : BENCH_QUEUE_DEPTHS) cout << setw(10) << "QD " + to_string(queueDepth);
+	cout << endl;
+
+	for (size_t blockSizeInMegabytes : BENCH_BLOCK_SIZES_IN_MEGABYTES) {
+		size_t blockSizeInBytes = blockSizeInMegabytes * 1024 * 1024;
+		cout << setw(8) << blockSizeInMegabytes << "MB";
+		for (size_t queueDepth : BENCH_QUEUE_DEPTHS) {
+			/* Каждый читатель должен прочитать хотя бы один полный блок, иначе замер показывает скорость меньшего блока,
+			* а буферы всех читателей должны поместиться в оперативную память. Такие сочетания пропускаются */
+			ull allBuffersSize = static_cast<ull>(blockSizeInBytes) * queueDepth;
+			if (allBuffersSize > testFileSizeInBytes or allBuffersSize > availableMemoryInBytes / 2) {
+				cout << setw(10) << "-";
+				continue;
+			}
+			vector<double> repeatsSpeeds;
+			for (unsigned repeat = 0; repeat < BENCH_REPEATS_COUNT; repeat++) repeatsSpeeds.push_back(measureReadSpeed(testFilePath, testFileSizeInBytes, blockSizeInBytes, queueDepth));
+			sort(repeatsSpeeds.begin(), repeatsSpeeds.end());
+			// Если хоть один повтор завершился ошибкой (скорость 0), замер не учитывается
+			double bytesPerSecond = repeatsSpeeds.front() > 0 ? repeatsSpeeds[repeatsSpeeds.size() / 2] : 0;
+			if (bytesPerSecond <= 0) {
+				cout << setw(10) << "error";
+				continue;
+			}
+			ioProfile.measurements.push_back({ blockSizeInBytes, queueDepth, bytesPerSecond });
+			cout << setw(10) << fixed << setprecision(0) << bytesPerSecond / (1024 * 1024);
+		}
+		cout << endl;
+	}
+	fs::remove(toFilesystemPath(testFilePath), _);
+
+	if (ioProfile.measurements.empty()) {
+		cout << "\nError: no measurement succeeded, profile is not saved. Try to increase test file size with '--size'" << endl;
+		return ERROR_OPEN_FAILED;
+	}
+
+	wstring ioProfilePath = profilePath != NULL ? toWstring(profilePath) : getDefaultIOProfilePath();
+	wstring calibratedVolumePath = fromFilesystemPath(fs::absolute(toFilesystemPath(testDirectory)).lexically_normal());
+	if (not ioProfile.save(ioProfilePath, calibratedVolumePath, getFileIOBackendName())) {
+		wcout << "\nError: cannot save disk profile to [" << ioProfilePath << "]" << endl;
+		return ERROR_WRITE_FAULT;
+	}
+
+	// Показываем пользователю, какие чанки теперь будут выбираться при разном количестве потоков
+	cout << "\nChunk size chosen by profile (before limiting by free RAM):" << endl;
+	for (size_t workersCount = 1; workersCount <= BENCH_QUEUE_DEPTHS[_countof(BENCH_QUEUE_DEPTHS) - 1]; workersCount *= 2) {
+		cout << "  " << setw(2) << workersCount << (workersCount == 1 ? " thread  - " : " threads - ") << ioProfile.getBestBlockSize(workersCount) / (1024 * 1024) << "MB" << endl;
+	}
+
+	wcout << "\nDisk profile saved to [" << ioProfilePath << "]" << endl;
+	if (profilePath != NULL) cout << "Pass it to other commands with '--io-profile' option to use it" << endl;
+
+	chrono::steady_clock::time_point end = chrono::steady_clock::now();
+	cout << "\nExecution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+	return ERROR_SUCCESS;
+}
+
+static bool createBenchmarkFile(const wstring& filePath, ull fileSizeInBytes) {
+	File* testFile = fileOpen(filePath, "wb+");
+	if (testFile == NULL) return false;
+
+	/* Заполняем буфер строками, похожими на строки обычной базы, и записываем его в файл столько раз, сколько нужно.
+	* Содержимое на скорость чтения не влияет, но файл остаётся читаемым, если его не удалось удалить */
+	size_t bufferSizeInBytes = static_cast<size_t>(min(static_cast<ull>(OPTIMAL_DISK_CHUNK_SIZE), fileSizeInBytes));
+	char* buffer = new char[bufferSizeInBytes];
+	Xoshiro256PlusPlus randomGenerator(fileSizeInBytes);
+	for (size_t i = 0; i < bufferSizeInBytes; i++) {
+		size_t positionInLine = i % AVERAGE_STRING_LEGTH_IN_FILE;
+		if (positionInLine == AVERAGE_STRING_LEGTH_IN_FILE - 1) buffer[i] = '\n';
+		else if (positionInLine == AVERAGE_STRING_LEGTH_IN_FILE / 2) buffer[i] = ':';
+		else buffer[i] = 'a' + randomGenerator() % 26;
+	}
+
+	bool isCreated = true;
+	for (ull bytesWrited = 0; bytesWrited < fileSizeInBytes and isCreated;) {
+		size_t bytesToWrite = static_cast<size_t>(min(static_cast<ull>(bufferSizeInBytes), fileSizeInBytes - bytesWrited));
+		isCreated = testFile->write(buffer, bytesToWrite) == bytesToWrite;
+		bytesWrited += bytesToWrite;
+	}
+
+	delete[] buffer;
+	fileClose(testFile);
+	return isCreated;
+}
+
+static double measureReadSpeed(const wstring& filePath, ull fileSizeInBytes, size_t blockSizeInBytes, size_t queueDepth) {
+	// Без сброса кеша после первого замера файл читался бы из оперативной памяти, а не с диска
+	dropFileCache(filePath);
+
+	vector<char*> buffers(queueDepth);
+	for (char*& buffer : buffers) buffer = new char[blockSizeInBytes];
+
+	ull partSizeInBytes = fileSizeInBytes / queueDepth;
+	atomic<ull> totalBytesReaded{ 0 };
+	atomic<bool> isReadFailed{ false };
+
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	vector<thread> readers;
+	for (size_t readerNumber = 0; readerNumber < queueDepth; readerNumber++) {
+		readers.emplace_back([&, readerNumber]() {
+			// У каждого читателя свой открытый файл, чтобы запросы к диску шли независимо друг от друга
+			File* testFile = fileOpen(filePath, "rb");
+			if (testFile == NULL) {
+				isReadFailed = true;
+				return;
+			}
+			ull partStart = readerNumber * partSizeInBytes;
+			ull partEnd = readerNumber == queueDepth - 1 ? fileSizeInBytes : partStart + partSizeInBytes;
+			ull currentPos = partStart;
+			if (not testFile->seek(partStart)) isReadFailed = true;
+			while (currentPos < partEnd and not isReadFailed) {
+				size_t bytesToRead = static_cast<size_t>(min(static_cast<ull>(blockSizeInBytes), partEnd - currentPos));
+				size_t bytesReaded = testFile->read(buffers[readerNumber], bytesToRead);
+				currentPos += bytesReaded;
+				if (bytesReaded < bytesToRead) isReadFailed = true;
+			}
+			totalBytesReaded += currentPos - partStart;
+			fileClose(testFile);
+		});
+	}
+	for (thread& reader : readers) reader.join();
+	chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+	for (char* buffer : buffers) delete[] buffer;
+
+	double secondsElapsed = chrono::duration<double>(end - begin).count();
+	if (isReadFailed or secondsElapsed <= 0) return 0;
+	return totalBytesReaded / secondsElapsed;
+}
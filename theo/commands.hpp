@@ -11,6 +11,14 @@ int count(int argc, const char** argv); // Команда для подсчёт
 int tokenize(int argc, const char** argv); 
 // Команда для перемешивания файлов (рандомизации позиций строк в них)
 int randomize(int argc, const char** argv);
+// Команда для калибровки диска: замеряет скорость чтения и сохраняет профиль, по которому выбирается размер чанка
+int benchIO(int argc, const char** argv);
+// Команда для замера скорости обработчиков чанков (normalize, dedup, tokenize, count, split) на строках в памяти
+int benchKernels(int argc, const char** argv);
+// Команда для генерации файла с синтетическими строками login:password для замеров команд на больших базах
+int generate(int argc, const char** argv);
+// Команда для обработки файлов цепочкой команд (например, normalize, dedup и tokenize) за одно чтение и одну запись
+int runPipeline(int argc, const char** argv);
 
 struct cmd_struct {
     const char* cmd;
@@ -31,7 +39,12 @@ struct cmd_struct commands[] = {
     {"t", tokenize},
     {"tokenize", tokenize},
     {"randomize", randomize},
-    {"r", randomize}
+    {"r", randomize},
+    {"bench-io", benchIO},
+    {"bench", benchKernels},
+    {"gen", generate},
+    {"pipe", runPipeline},
+    {"p", runPipeline}
 };
 
 const char* const commandsDescription = "Commands:\n\
@@ -41,6 +54,10 @@ const char* const commandsDescription = "Commands:\n\
             dedup, d        Delete duplicate lines in file\n\
             count, c        Count number of strings in files\n\
             tokenize, t     Get only passwords or only emails, numbers or logins from file\n\
-            randomize, r    Random shuffle strings in file\n";
+            randomize, r    Random shuffle strings in file\n\
+            pipe, p         Run chain of commands (normalize, dedup, tokenize) over files in one pass\n\
+            bench-io        Measure disk speed and save profile used to choose chunk size\n\
+            bench           Measure speed of chunk processing functions on generated strings\n\
+            gen             Generate file with synthetic login:password lines for benchmarks\n";
 
 #endif // !THEO_COMMANDS
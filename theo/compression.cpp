@@ -0,0 +1,463 @@
+﻿#include "compression.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <zlib.h> // https://zlib.net
+#include <zstd.h> // https://github.com/facebook/zstd
+#include <lz4frame.h> // https://github.com/lz4/lz4
+
+CompressionParameters compressionParameters;
+
+/* Размер блока, которым сжатые данные читаются из файла и записываются в файл. Сжатые данные обычно в несколько раз
+* меньше распакованных, поэтому блок меньше чанка, но достаточно большой, чтобы диск не получал мелких запросов */
+constexpr size_t COMPRESSED_BLOCK_SIZE = 4 * 1024 * 1024;
+
+// Сколько первых байт файла нужно, чтобы определить формат сжатия по сигнатуре (magic bytes)
+constexpr size_t COMPRESSION_SIGNATURE_LENGTH = 4;
+
+#ifdef _WIN32
+static const NativeFileHandle INVALID_NATIVE_FILE_HANDLE = INVALID_HANDLE_VALUE;
+#else
+static const NativeFileHandle INVALID_NATIVE_FILE_HANDLE = -1;
+#endif
+
+/* Файл, у которого первые байты уже прочитаны (для определения формата по сигнатуре), а перемотать его в начало
+* нельзя, как стандартный ввод. Сначала возвращает сохранённые байты, потом читает сам файл дальше */
+class PrefixedFile : public File {
+private:
+	File* file;
+	std::string prefix;
+	size_t prefixPos = 0;
+public:
+	PrefixedFile(File* file, std::string prefix) : file(file), prefix(std::move(prefix)) {}
+	~PrefixedFile() override { fileClose(file); }
+
+	size_t read(char* buffer, size_t bytesCount) override {
+		size_t bytesFromPrefix = std::min(bytesCount, prefix.length() - prefixPos);
+		memcpy(buffer, prefix.data() + prefixPos, bytesFromPrefix);
+		prefixPos += bytesFromPrefix;
+		size_t bytesReaded = bytesFromPrefix;
+		if (bytesReaded < bytesCount and not file->isEndOfFile()) bytesReaded += file->read(buffer + bytesReaded, bytesCount - bytesReaded);
+		if (bytesReaded < bytesCount) isEndReached = true;
+		return bytesReaded;
+	}
+	size_t write(const char*, size_t) override { return 0; }
+	long long size(void) override { return file->size(); }
+	NativeFileHandle getNativeHandle(void) override { return file->getNativeHandle(); }
+	bool seek(unsigned long long) override { return false; }
+};
+
+/* Общая часть всех распаковывающих файлов: читает сжатые данные блоками из исходного файла в свой буфер,
+* а распаковку очередной порции выполняет реализация конкретного формата */
+class DecompressingFile : public File {
+protected:
+	File* compressedFile;
+	std::vector<char> compressedBuffer;
+	size_t compressedPos = 0; // Сколько байт буфера уже передано распаковщику
+	size_t compressedLength = 0; // Сколько байт в буфере сейчас
+	/* Распаковщик мог не вернуть все распакованные данные, если они не поместились в выходной буфер,
+	* тогда его надо вызвать ещё раз, даже если сжатые данные уже закончились */
+	bool hasPendingOutput = false;
+
+	/* Если все считанные сжатые данные уже переданы распаковщику, считывает следующий блок.
+	* Возвращает false, если сжатых данных больше нет */
+	bool fillCompressedBuffer() {
+		if (compressedPos < compressedLength) return true;
+		if (compressedFile->isEndOfFile()) return false;
+		compressedLength = compressedFile->read(compressedBuffer.data(), compressedBuffer.size());
+		compressedPos = 0;
+		return compressedLength > 0;
+	}
+
+	// Файл обрезан или повреждён: распакованные до этого места данные остаются, дальше файл считается законченным
+	bool isCorrupted = false;
+
+	// Предупреждает пользователя, что обработана только часть файла, и прекращает распаковку
+	void reportCorruption() {
+		if (isCorrupted) return;
+		isCorrupted = true;
+		std::cout << "Warning: compressed file is truncated or corrupted, only its readable part is processed" << std::endl;
+	}
+
+	/* Распаковывает следующую порцию данных в buffer (не больше bytesCount байт), возвращает количество
+	* распакованных байт. Ноль - если сжатые данные закончились или повреждены */
+	virtual size_t decompress(char* buffer, size_t bytesCount) = 0;
+public:
+	explicit DecompressingFile(File* compressedFile) : compressedFile(compressedFile), compressedBuffer(COMPRESSED_BLOCK_SIZE) {}
+	~DecompressingFile() override { fileClose(compressedFile); }
+
+	size_t read(char* buffer, size_t bytesCount) override {
+		size_t bytesReaded = 0;
+		while (bytesReaded < bytesCount and not isCorrupted) {
+			size_t bytesDecompressed = decompress(buffer + bytesReaded, bytesCount - bytesReaded);
+			if (bytesDecompressed == 0) break;
+			bytesReaded += bytesDecompressed;
+		}
+		if (bytesReaded < bytesCount) isEndReached = true;
+		return bytesReaded;
+	}
+	size_t write(const char*, size_t) override { return 0; }
+	long long size(void) override { return -1; }
+	// Отображать в память можно только несжатый файл, поэтому у распаковываемого системного дескриптора нет
+	NativeFileHandle getNativeHandle(void) override { return INVALID_NATIVE_FILE_HANDLE; }
+	bool seek(unsigned long long) override { return false; }
+};
+
+// Распаковка gzip. Архив может состоять из нескольких склеенных gzip-файлов (как после cat a.gz b.gz), они читаются подряд
+class GzipDecompressingFile : public DecompressingFile {
+private:
+	z_stream stream = {};
+	bool isInsideMember = false; // Начат, но ещё не закончен очередной gzip-файл в архиве
+public:
+	explicit GzipDecompressingFile(File* compressedFile) : DecompressingFile(compressedFile) {
+		// 15 - максимальное окно, +32 - автоматически определять заголовок gzip или zlib
+		inflateInit2(&stream, 15 + 32);
+	}
+	~GzipDecompressingFile() override { inflateEnd(&stream); }
+
+	size_t decompress(char* buffer, size_t bytesCount) override {
+		// Размеры буферов в zlib 32-битные
+		uInt outputSize = static_cast<uInt>(std::min(bytesCount, static_cast<size_t>(UINT_MAX)));
+		stream.next_out = reinterpret_cast<Bytef*>(buffer);
+		stream.avail_out = outputSize;
+		while (stream.avail_out == outputSize) {
+			bool hasInput = fillCompressedBuffer();
+			if (not hasInput and not hasPendingOutput) {
+				if (isInsideMember) reportCorruption();
+				break;
+			}
+			stream.next_in = reinterpret_cast<Bytef*>(compressedBuffer.data() + compressedPos);
+			stream.avail_in = static_cast<uInt>(compressedLength - compressedPos);
+			int result = inflate(&stream, Z_NO_FLUSH);
+			compressedPos = compressedLength - stream.avail_in;
+			hasPendingOutput = stream.avail_out == 0;
+			if (result == Z_STREAM_END) {
+				// Следующий gzip-файл в архиве начинается сразу после конца предыдущего
+				inflateReset(&stream);
+				isInsideMember = false;
+				continue;
+			}
+			if (result != Z_OK and result != Z_BUF_ERROR) {
+				reportCorruption();
+				break;
+			}
+			// Если сжатые данные кончились сразу после конца gzip-файла, новый ещё не начат
+			isInsideMember = stream.total_in > 0;
+		}
+		return outputSize - stream.avail_out;
+	}
+};
+
+// Распаковка zstd. Несколько склеенных zstd-фреймов библиотека читает подряд сама
+class ZstdDecompressingFile : public DecompressingFile {
+private:
+	ZSTD_DCtx* context;
+	size_t lastResult = 0; // Не ноль, если текущий фрейм ещё не распакован до конца
+public:
+	explicit ZstdDecompressingFile(File* compressedFile) : DecompressingFile(compressedFile), context(ZSTD_createDCtx()) {}
+	~ZstdDecompressingFile() override { ZSTD_freeDCtx(context); }
+
+	size_t decompress(char* buffer, size_t bytesCount) override {
+		ZSTD_outBuffer output = { buffer, bytesCount, 0 };
+		while (output.pos == 0) {
+			bool hasInput = fillCompressedBuffer();
+			if (not hasInput and not hasPendingOutput) {
+				if (lastResult != 0) reportCorruption();
+				break;
+			}
+			ZSTD_inBuffer input = { compressedBuffer.data(), compressedLength, compressedPos };
+			size_t result = ZSTD_decompressStream(context, &output, &input);
+			// Вызов без новых сжатых данных только отдаёт оставшийся вывод и о состоянии фрейма ничего не говорит
+			bool isInputConsumed = input.pos > compressedPos;
+			compressedPos = input.pos;
+			hasPendingOutput = output.pos == output.size;
+			if (ZSTD_isError(result)) {
+				reportCorruption();
+				break;
+			}
+			if (isInputConsumed) lastResult = result;
+		}
+		return output.pos;
+	}
+};
+
+// Распаковка lz4 (формат lz4 frame, как у консольной утилиты lz4). Склеенные фреймы тоже читаются подряд
+class Lz4DecompressingFile : public DecompressingFile {
+private:
+	LZ4F_dctx* context = NULL;
+	size_t lastResult = 0; // Не ноль, если текущий фрейм ещё не распакован до конца
+public:
+	explicit Lz4DecompressingFile(File* compressedFile) : DecompressingFile(compressedFile) {
+		LZ4F_createDecompressionContext(&context, LZ4F_VERSION);
+	}
+	~Lz4DecompressingFile() override { LZ4F_freeDecompressionContext(context); }
+
+	size_t decompress(char* buffer, size_t bytesCount) override {
+		size_t bytesDecompressed = 0;
+		while (bytesDecompressed == 0) {
+			bool hasInput = fillCompressedBuffer();
+			if (not hasInput and not hasPendingOutput) {
+				if (lastResult != 0) reportCorruption();
+				break;
+			}
+			size_t outputSize = bytesCount, inputSize = compressedLength - compressedPos;
+			size_t result = LZ4F_decompress(context, buffer, &outputSize, compressedBuffer.data() + compressedPos, &inputSize, NULL);
+			compressedPos += inputSize;
+			bytesDecompressed = outputSize;
+			hasPendingOutput = outputSize == bytesCount;
+			if (LZ4F_isError(result)) {
+				reportCorruption();
+				break;
+			}
+			if (inputSize > 0) lastResult = result;
+		}
+		return bytesDecompressed;
+	}
+};
+
+/* Общая часть всех сжимающих файлов: сжатые данные копятся в буфере и записываются в итоговый файл
+* большими блоками, когда буфер заполнится, а при закрытии - всё, что осталось */
+class CompressingFile : public File {
+protected:
+	File* resultFile;
+	std::vector<char> compressedBuffer;
+	size_t compressedLength = 0; // Сколько сжатых байт в буфере ещё не записано
+	bool isWriteFailed = false;
+
+	// Записывает накопленные сжатые данные в итоговый файл
+	void flushCompressedBuffer() {
+		if (compressedLength > 0 and resultFile->write(compressedBuffer.data(), compressedLength) != compressedLength) isWriteFailed = true;
+		compressedLength = 0;
+	}
+
+	// Сжимает bytesCount байт из buffer в compressedBuffer (записывая его в файл по мере заполнения). false - при ошибке
+	virtual bool compress(const char* buffer, size_t bytesCount) = 0;
+public:
+	CompressingFile(File* resultFile, size_t compressedBufferSize) : resultFile(resultFile), compressedBuffer(compressedBufferSize) {}
+	// Реализации форматов дописывают конец сжатого потока в своих деструкторах, здесь остаётся только закрыть файл
+	~CompressingFile() override { fileClose(resultFile); }
+
+	size_t read(char*, size_t) override { return 0; }
+	size_t write(const char* buffer, size_t bytesCount) override {
+		if (not compress(buffer, bytesCount) or isWriteFailed) return 0;
+		return bytesCount;
+	}
+	long long size(void) override { return -1; }
+	NativeFileHandle getNativeHandle(void) override { return INVALID_NATIVE_FILE_HANDLE; }
+	bool seek(unsigned long long) override { return false; }
+};
+
+class GzipCompressingFile : public CompressingFile {
+private:
+	z_stream stream = {};
+
+	// Прогоняет данные через deflate, пока они не будут сжаты полностью (а при Z_FINISH - пока поток не будет закончен)
+	bool deflateBuffer(const char* buffer, size_t bytesCount, int flushMode) {
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(buffer));
+		stream.avail_in = static_cast<uInt>(bytesCount);
+		while (true) {
+			stream.next_out = reinterpret_cast<Bytef*>(compressedBuffer.data() + compressedLength);
+			stream.avail_out = static_cast<uInt>(compressedBuffer.size() - compressedLength);
+			int result = deflate(&stream, flushMode);
+			compressedLength = compressedBuffer.size() - stream.avail_out;
+			if (result == Z_STREAM_ERROR) return false;
+			if (compressedLength == compressedBuffer.size()) flushCompressedBuffer();
+			else if (flushMode == Z_FINISH ? result == Z_STREAM_END : stream.avail_in == 0) return true;
+		}
+	}
+public:
+	GzipCompressingFile(File* resultFile, int level) : CompressingFile(resultFile, COMPRESSED_BLOCK_SIZE) {
+		// 15 - максимальное окно, +16 - записывать заголовок gzip, а не zlib, чтобы файл открывался обычными архиваторами
+		deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+	}
+	~GzipCompressingFile() override {
+		deflateBuffer(NULL, 0, Z_FINISH);
+		flushCompressedBuffer();
+		deflateEnd(&stream);
+	}
+
+	bool compress(const char* buffer, size_t bytesCount) override {
+		// Размеры буферов в zlib 32-битные, поэтому огромный буфер сжимается по частям
+		for (size_t pos = 0; pos < bytesCount; pos += UINT_MAX) {
+			if (not deflateBuffer(buffer + pos, std::min(bytesCount - pos, static_cast<size_t>(UINT_MAX)), Z_NO_FLUSH)) return false;
+		}
+		return true;
+	}
+};
+
+class ZstdCompressingFile : public CompressingFile {
+private:
+	ZSTD_CCtx* context;
+
+	// Сжимает данные в режиме endMode, пока они не будут сжаты полностью (а при ZSTD_e_end - пока фрейм не будет закончен)
+	bool compressStream(const char* buffer, size_t bytesCount, ZSTD_EndDirective endMode) {
+		ZSTD_inBuffer input = { buffer, bytesCount, 0 };
+		while (true) {
+			ZSTD_outBuffer output = { compressedBuffer.data(), compressedBuffer.size(), compressedLength };
+			size_t remaining = ZSTD_compressStream2(context, &output, &input, endMode);
+			compressedLength = output.pos;
+			if (ZSTD_isError(remaining)) return false;
+			if (compressedLength == compressedBuffer.size()) flushCompressedBuffer();
+			else if (endMode == ZSTD_e_end ? remaining == 0 : input.pos == input.size) return true;
+		}
+	}
+public:
+	ZstdCompressingFile(File* resultFile, int level) : CompressingFile(resultFile, COMPRESSED_BLOCK_SIZE), context(ZSTD_createCCtx()) {
+		ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+		/* Сжатие намного медленнее распаковки, а записывающий поток у файла один, поэтому zstd сжимает в потоках
+		* по количеству ядер. Если библиотека собрана без поддержки потоков, параметр не применяется и сжатие идёт в одном */
+		ZSTD_CCtx_setParameter(context, ZSTD_c_nbWorkers, static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u)));
+	}
+	~ZstdCompressingFile() override {
+		compressStream(NULL, 0, ZSTD_e_end);
+		flushCompressedBuffer();
+		ZSTD_freeCCtx(context);
+	}
+
+	bool compress(const char* buffer, size_t bytesCount) override {
+		return compressStream(buffer, bytesCount, ZSTD_e_continue);
+	}
+};
+
+class Lz4CompressingFile : public CompressingFile {
+private:
+	// Сколько несжатых байт передаётся в LZ4F_compressUpdate за один вызов, под это рассчитан размер буфера
+	static constexpr size_t LZ4_INPUT_PART_SIZE = COMPRESSED_BLOCK_SIZE;
+	LZ4F_cctx* context = NULL;
+	LZ4F_preferences_t preferences = {};
+	size_t maxPartCompressedSize; // Максимальный размер сжатой части (LZ4F_compressBound), столько места должно быть в буфере
+
+	// Если в буфере может не хватить места для следующей сжатой части, записывает его в файл
+	void ensureCompressedBufferSpace() {
+		if (compressedBuffer.size() - compressedLength < maxPartCompressedSize) flushCompressedBuffer();
+	}
+public:
+	Lz4CompressingFile(File* resultFile, int level) : CompressingFile(resultFile, 0) {
+		preferences.compressionLevel = level;
+		maxPartCompressedSize = LZ4F_compressBound(LZ4_INPUT_PART_SIZE, &preferences);
+		compressedBuffer.resize(maxPartCompressedSize + COMPRESSED_BLOCK_SIZE);
+		LZ4F_createCompressionContext(&context, LZ4F_VERSION);
+		// Заголовок фрейма записывается сразу, он занимает не больше LZ4F_HEADER_SIZE_MAX байт
+		size_t headerSize = LZ4F_compressBegin(context, compressedBuffer.data(), compressedBuffer.size(), &preferences);
+		if (not LZ4F_isError(headerSize)) compressedLength = headerSize;
+	}
+	~Lz4CompressingFile() override {
+		ensureCompressedBufferSpace();
+		size_t endSize = LZ4F_compressEnd(context, compressedBuffer.data() + compressedLength, compressedBuffer.size() - compressedLength, NULL);
+		if (not LZ4F_isError(endSize)) compressedLength += endSize;
+		flushCompressedBuffer();
+		LZ4F_freeCompressionContext(context);
+	}
+
+	bool compress(const char* buffer, size_t bytesCount) override {
+		for (size_t pos = 0; pos < bytesCount; pos += LZ4_INPUT_PART_SIZE) {
+			ensureCompressedBufferSpace();
+			size_t partSize = std::min(bytesCount - pos, LZ4_INPUT_PART_SIZE);
+			size_t compressedPartSize = LZ4F_compressUpdate(context, compressedBuffer.data() + compressedLength, compressedBuffer.size() - compressedLength, buffer + pos, partSize, NULL);
+			if (LZ4F_isError(compressedPartSize)) return false;
+			compressedLength += compressedPartSize;
+		}
+		return true;
+	}
+};
+
+// Определяет формат сжатия по первым байтам файла (сигнатуре), если сигнатура неизвестна - CompressionFormat::None
+static CompressionFormat getCompressionFormatBySignature(const std::string& firstBytes) noexcept {
+	static const unsigned char GZIP_SIGNATURE[] = { 0x1F, 0x8B };
+	static const unsigned char ZSTD_SIGNATURE[] = { 0x28, 0xB5, 0x2F, 0xFD };
+	static const unsigned char LZ4_SIGNATURE[] = { 0x04, 0x22, 0x4D, 0x18 };
+	auto startsWith = [&firstBytes](const unsigned char* signature, size_t signatureLength) {
+		return firstBytes.length() >= signatureLength and memcmp(firstBytes.data(), signature, signatureLength) == 0;
+	};
+	if (startsWith(GZIP_SIGNATURE, sizeof(GZIP_SIGNATURE))) return CompressionFormat::Gzip;
+	if (startsWith(ZSTD_SIGNATURE, sizeof(ZSTD_SIGNATURE))) return CompressionFormat::Zstd;
+	if (startsWith(LZ4_SIGNATURE, sizeof(LZ4_SIGNATURE))) return CompressionFormat::Lz4;
+	return CompressionFormat::None;
+}
+
+bool setOutputCompression(const char* compressionString) noexcept {
+	std::string compression = compressionString;
+	size_t levelSeparatorPos = compression.find(':');
+	std::string formatName = compression.substr(0, levelSeparatorPos);
+
+	// Допустимые уровни сжатия и уровень по умолчанию - как у консольных утилит каждого формата
+	int minLevel, maxLevel;
+	if (formatName == "zstd") {
+		compressionParameters.outputFormat = CompressionFormat::Zstd;
+		compressionParameters.outputLevel = ZSTD_CLEVEL_DEFAULT;
+		minLevel = 1;
+		maxLevel = ZSTD_maxCLevel();
+	}
+	else if (formatName == "gzip" or formatName == "gz") {
+		compressionParameters.outputFormat = CompressionFormat::Gzip;
+		compressionParameters.outputLevel = 6;
+		minLevel = 1;
+		maxLevel = 9;
+	}
+	else if (formatName == "lz4") {
+		compressionParameters.outputFormat = CompressionFormat::Lz4;
+		compressionParameters.outputLevel = 1;
+		minLevel = 1;
+		maxLevel = LZ4F_compressionLevel_max();
+	}
+	else return false;
+
+	if (levelSeparatorPos == std::string::npos) return true;
+	char* levelEnd = NULL;
+	long level = strtol(compression.c_str() + levelSeparatorPos + 1, &levelEnd, 10);
+	if (levelEnd == compression.c_str() + levelSeparatorPos + 1 or *levelEnd != '\0' or level < minLevel or level > maxLevel) return false;
+	compressionParameters.outputLevel = static_cast<int>(level);
+	return true;
+}
+
+CompressionFormat getCompressionFormatByExtension(const std::wstring& filePath) noexcept {
+	std::wstring extension = toFilesystemPath(filePath).extension().wstring();
+	if (extension == L".gz") return CompressionFormat::Gzip;
+	if (extension == L".zst" or extension == L".zstd") return CompressionFormat::Zstd;
+	if (extension == L".lz4") return CompressionFormat::Lz4;
+	return CompressionFormat::None;
+}
+
+std::wstring getCompressionExtension(CompressionFormat format) noexcept {
+	switch (format) {
+	case CompressionFormat::Gzip: return L".gz";
+	case CompressionFormat::Zstd: return L".zst";
+	case CompressionFormat::Lz4: return L".lz4";
+	default: return L"";
+	}
+}
+
+File* openDecompressingFileIfCompressed(File* file, const std::wstring& filePath) noexcept {
+	if (file == NULL) return NULL;
+
+	CompressionFormat format = getCompressionFormatByExtension(filePath);
+	if (format == CompressionFormat::None) {
+		// Расширение обычное, но файл всё равно может быть сжат (например, base.txt, который на самом деле gzip)
+		std::string firstBytes(COMPRESSION_SIGNATURE_LENGTH, '\0');
+		firstBytes.resize(file->read(firstBytes.data(), firstBytes.length()));
+		format = getCompressionFormatBySignature(firstBytes);
+		// Если файл перемотать в начало нельзя (стандартный ввод), прочитанные байты вернутся при чтении первыми
+		if (not file->seek(0)) file = new PrefixedFile(file, firstBytes);
+	}
+
+	switch (format) {
+	case CompressionFormat::Gzip: return new GzipDecompressingFile(file);
+	case CompressionFormat::Zstd: return new ZstdDecompressingFile(file);
+	case CompressionFormat::Lz4: return new Lz4DecompressingFile(file);
+	default: return file;
+	}
+}
+
+File* openCompressingFileIfNeeded(File* resultFile) noexcept {
+	if (resultFile == NULL) return NULL;
+	switch (compressionParameters.outputFormat) {
+	case CompressionFormat::Gzip: return new GzipCompressingFile(resultFile, compressionParameters.outputLevel);
+	case CompressionFormat::Zstd: return new ZstdCompressingFile(resultFile, compressionParameters.outputLevel);
+	case CompressionFormat::Lz4: return new Lz4CompressingFile(resultFile, compressionParameters.outputLevel);
+	default: return resultFile;
+	}
+}
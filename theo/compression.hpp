@@ -0,0 +1,43 @@
+﻿#pragma once
+#ifndef THEO_COMPRESSION
+#define THEO_COMPRESSION
+
+#include <string>
+#include "fileio.hpp"
+
+/* Потоковое сжатие и распаковка файлов. Сжатый входной файл оборачивается в File, чтение из которого возвращает
+* уже распакованные байты, а итоговый файл - в File, который сжимает всё записанное в него. Поэтому команды работают
+* со сжатыми файлами так же, как с обычными, и распакованный файл целиком нигде не хранится - ни на диске, ни в памяти.
+* Поддерживаются форматы zstd (https://github.com/facebook/zstd), gzip (zlib) и lz4 (https://github.com/lz4/lz4) */
+
+enum class CompressionFormat { None, Gzip, Zstd, Lz4 };
+
+// Параметры сжатия итоговых файлов, задаются опцией --compress. По умолчанию итоговые файлы не сжимаются
+struct CompressionParameters {
+	CompressionFormat outputFormat = CompressionFormat::None;
+	int outputLevel = 0; // Уровень сжатия, у каждого формата свой диапазон
+};
+extern CompressionParameters compressionParameters;
+
+/* Устанавливает сжатие итоговых файлов по значению опции --compress: формат и, через двоеточие, уровень сжатия,
+* например "zstd:3", "gzip:9" или просто "lz4" (уровень по умолчанию для формата). Возвращает false, если формат
+* неизвестен или уровень вне допустимого для формата диапазона */
+bool setOutputCompression(const char* compressionString) noexcept;
+
+// Формат сжатия по расширению файла (.gz, .zst, .lz4). Если расширение другое - CompressionFormat::None
+CompressionFormat getCompressionFormatByExtension(const std::wstring& filePath) noexcept;
+
+// Расширение файлов указанного формата (например, L".zst"), для CompressionFormat::None - пустая строка
+std::wstring getCompressionExtension(CompressionFormat format) noexcept;
+
+/* Если открытый на чтение файл сжат (определяется по расширению, а если оно не сжатого формата - по первым
+* байтам содержимого, magic bytes), возвращает File, из которого читаются распакованные данные, иначе - сам файл.
+* Размер распакованного файла заранее неизвестен (size() возвращает -1), перемещаться по нему нельзя.
+* Сжатый стандартный ввод тоже определяется по первым байтам, они не теряются, а возвращаются при чтении первыми */
+File* openDecompressingFileIfCompressed(File* file, const std::wstring& filePath) noexcept;
+
+/* Если в compressionParameters задано сжатие итоговых файлов, возвращает File, который сжимает всё записанное
+* в него и записывает в resultFile, иначе - сам resultFile. Сжатые данные дописываются при закрытии через fileClose */
+File* openCompressingFileIfNeeded(File* resultFile) noexcept;
+
+#endif // !THEO_COMPRESSION
@@ -0,0 +1,134 @@
+﻿#pragma once
+#ifndef THEO_CONCURRENCY
+#define THEO_CONCURRENCY
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/* Ограниченная по размеру потокобезопасная очередь для передачи данных (например, указателей на буферы)
+* между потоками конвейера чтение -> обработка -> запись. Если очередь заполнена, push ждёт, пока в ней
+* не освободится место, если пуста - pop ждёт появления элемента. После вызова close() новые элементы
+* не принимаются, а pop, когда очередь опустеет, возвращает false, сигнализируя о завершении работы */
+template <typename T>
+class BoundedQueue {
+private:
+	std::deque<T> items;
+	size_t capacity;
+	bool isClosed = false;
+	std::mutex queueMutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+public:
+	explicit BoundedQueue(size_t maxItemsCount) : capacity(maxItemsCount) {}
+
+	// Добавляет элемент в конец очереди. Возвращает false, если очередь уже закрыта и элемент не добавлен
+	bool push(T item) {
+		std::unique_lock<std::mutex> lock(queueMutex);
+		notFull.wait(lock, [this] { return isClosed || items.size() < capacity; });
+		if (isClosed) return false;
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	// Забирает элемент из начала очереди. Возвращает false, если очередь закрыта и в ней больше нет элементов
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(queueMutex);
+		notEmpty.wait(lock, [this] { return isClosed || !items.empty(); });
+		if (items.empty()) return false;
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	// Закрывает очередь: уже добавленные элементы можно забрать, новые добавлять нельзя
+	void close() {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		isClosed = true;
+		notEmpty.notify_all();
+		notFull.notify_all();
+	}
+};
+
+/* Постоянные потоки для этапов, в которых одна работа делится на много одинаковых задач (например, на части
+* одного чанка): run(tasksCount, task) выполняет task(0), ..., task(tasksCount - 1) во всех потоках пула и в вызывающем
+* потоке и возвращается, когда выполнены все задачи. Потоки создаются один раз, а не на каждый этап, поэтому пул
+* подходит для коротких этапов, повторяющихся для каждого чанка. run можно вызывать только из одного потока */
+class ParallelTasksPool {
+private:
+	std::vector<std::thread> workers;
+	std::mutex poolMutex;
+	std::condition_variable tasksStarted;
+	std::condition_variable tasksFinished;
+	std::function<void(size_t)> currentTask;
+	size_t tasksCount = 0;
+	std::atomic<size_t> nextTaskIndex{ 0 };
+	// Номер текущего запуска run: по его изменению потоки пула узнают о новых задачах
+	size_t generation = 0;
+	// Сколько потоков пула ещё не закончили текущий запуск
+	size_t busyWorkersCount = 0;
+	bool isStopping = false;
+
+	void executeTasks() {
+		size_t taskIndex;
+		while ((taskIndex = nextTaskIndex.fetch_add(1, std::memory_order_relaxed)) < tasksCount) currentTask(taskIndex);
+	}
+
+	void workerLoop() {
+		size_t finishedGeneration = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(poolMutex);
+				tasksStarted.wait(lock, [&] { return isStopping || generation != finishedGeneration; });
+				if (isStopping) return;
+				finishedGeneration = generation;
+			}
+			executeTasks();
+			std::lock_guard<std::mutex> lock(poolMutex);
+			if (--busyWorkersCount == 0) tasksFinished.notify_one();
+		}
+	}
+public:
+	// Создаёт пул, в котором вместе с потоком, вызывающим run, работают threadsCount потоков
+	explicit ParallelTasksPool(size_t threadsCount) {
+		for (size_t workerIndex = 1; workerIndex < threadsCount; workerIndex++) workers.emplace_back([this] { workerLoop(); });
+	}
+
+	~ParallelTasksPool() {
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			isStopping = true;
+		}
+		tasksStarted.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	ParallelTasksPool(const ParallelTasksPool&) = delete;
+	ParallelTasksPool& operator=(const ParallelTasksPool&) = delete;
+
+	size_t getThreadsCount() const noexcept { return workers.size() + 1; }
+
+	// Выполняет задачи с номерами от 0 до count - 1 во всех потоках пула и ждёт, пока все они не будут выполнены
+	void run(size_t count, std::function<void(size_t)> task) {
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			currentTask = std::move(task);
+			tasksCount = count;
+			nextTaskIndex.store(0, std::memory_order_relaxed);
+			busyWorkersCount = workers.size();
+			generation++;
+		}
+		tasksStarted.notify_all();
+		executeTasks();
+		std::unique_lock<std::mutex> lock(poolMutex);
+		tasksFinished.wait(lock, [this] { return busyWorkersCount == 0; });
+	}
+};
+
+#endif // !THEO_CONCURRENCY
@@ -0,0 +1,127 @@
+﻿#include "utils.hpp"
+
+// Домены email-строк корпуса
+static const char* const CORPUS_DOMAINS[] = { "gmail.com", "mail.ru", "yahoo.com", "outlook.com", "example.org", "yandex.ru", "hotmail.com", "rambler.ru" };
+// Символы логинов и паролей в ASCII
+static const char CORPUS_SYMBOLS[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.";
+
+/* Разные "соли" для номера строки: от номера строки независимо зависят её содержимое, то, является ли
+* она дубликатом, и то, какую строку она повторяет */
+constexpr ull CORPUS_CONTENT_SALT = 0x9E3779B97F4A7C15ULL;
+constexpr ull CORPUS_DUPLICATE_SALT = 0xC2B2AE3D27D4EB4FULL;
+constexpr ull CORPUS_ORIGINAL_SALT = 0x165667B19E3779F9ULL;
+
+// Перемешивает биты числа (финализатор SplitMix64): близкие номера строк дают совершенно разные значения
+static inline ull mixBits(ull value) noexcept {
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+	return value ^ (value >> 31);
+}
+
+CorpusGenerator::CorpusGenerator(const CorpusParameters& corpusParameters) noexcept : parameters(corpusParameters) {
+	if (parameters.minLineLength < MIN_CORPUS_LINE_LENGTH) parameters.minLineLength = MIN_CORPUS_LINE_LENGTH;
+	if (parameters.maxLineLength < parameters.minLineLength) parameters.maxLineLength = parameters.minLineLength;
+	if (parameters.separators.empty()) parameters.separators.push_back(':');
+}
+
+bool CorpusGenerator::isDuplicateLine(ull lineNumber) const noexcept {
+	// Первая строка корпуса никогда не дубликат, поэтому у любого дубликата есть что повторять
+	return lineNumber > 0 and mixBits(parameters.seed ^ (lineNumber * CORPUS_DUPLICATE_SALT)) % 100 < parameters.duplicatesPercent;
+}
+
+ull CorpusGenerator::getOriginalLineNumber(ull lineNumber) const noexcept {
+	/* Строка на выбранном месте сама может оказаться дубликатом, тогда её содержимое в корпусе - другое, и выбор
+	* повторяется среди ещё более ранних строк. Номер каждый раз уменьшается, поэтому цикл всегда заканчивается */
+	ull originalLineNumber = lineNumber;
+	do originalLineNumber = mixBits(parameters.seed ^ (originalLineNumber * CORPUS_ORIGINAL_SALT)) % originalLineNumber;
+	while (isDuplicateLine(originalLineNumber));
+	return originalLineNumber;
+}
+
+size_t CorpusGenerator::writeLine(ull lineNumber, char* buffer) const noexcept {
+	return writeUniqueLine(isDuplicateLine(lineNumber) ? getOriginalLineNumber(lineNumber) : lineNumber, buffer);
+}
+
+size_t CorpusGenerator::writeUniqueLine(ull lineNumber, char* buffer) const noexcept {
+	ull randomState = mixBits(parameters.seed ^ (lineNumber * CORPUS_CONTENT_SALT));
+	auto randomBelow = [&randomState](size_t limit) {
+		randomState += 0x9E3779B97F4A7C15ULL;
+		return static_cast<size_t>(mixBits(randomState) % limit);
+	};
+	auto randomSymbol = [&randomBelow]() { return CORPUS_SYMBOLS[randomBelow(sizeof(CORPUS_SYMBOLS) - 1)]; };
+
+	size_t lengthRange = parameters.maxLineLength - parameters.minLineLength;
+	size_t lineLength = parameters.minLineLength + randomBelow(lengthRange + 1);
+	if (parameters.isLengthSkewed) {
+		// Куб равномерного числа от 0 до 1: половина строк попадает в первую восьмую часть диапазона длин
+		double uniform = randomBelow(1ULL << 24) / static_cast<double>(1ULL << 24);
+		lineLength = parameters.minLineLength + static_cast<size_t>(uniform * uniform * uniform * (lengthRange + 1));
+	}
+
+	bool isInvalid = randomBelow(100) < parameters.invalidPercent;
+	size_t invalidKind = randomBelow(3);
+	size_t encodingRoll = randomBelow(100);
+	bool isUtf8 = encodingRoll < parameters.utf8Percent;
+	bool isLatin1 = not isUtf8 and encodingRoll < parameters.utf8Percent + parameters.latin1Percent;
+	char separator = parameters.separators[randomBelow(parameters.separators.length())];
+	const char* domain = CORPUS_DOMAINS[randomBelow(_countof(CORPUS_DOMAINS))];
+	size_t domainLength = strlen(domain);
+
+	size_t passwordLength = max(lineLength / 3, (size_t)4);
+	// Если строка слишком короткая для email с доменом, генерируется строка формата login:password
+	bool isEmail = lineLength >= passwordLength + domainLength + 3;
+	size_t loginLength = lineLength - passwordLength - 1 - (isEmail ? domainLength + 1 : 0);
+
+	size_t length = 0;
+	for (size_t i = 0; i < loginLength; i++) buffer[length++] = randomSymbol();
+	// Невалидная строка: логин с запрещёнными символами, строка без разделителя или с пустым паролем
+	if (isInvalid and invalidKind == 0) {
+		buffer[loginLength / 2] = ' ';
+		if (loginLength > 2) buffer[loginLength / 2 + 1] = '#';
+	}
+	if (isEmail) {
+		buffer[length++] = '@';
+		memcpy(&buffer[length], domain, domainLength);
+		length += domainLength;
+	}
+	if (not (isInvalid and invalidKind == 1)) buffer[length++] = separator;
+	if (not (isInvalid and invalidKind == 2)) {
+		if (isUtf8) {
+			// Строчные кириллические буквы в UTF-8 занимают по два байта: а-п - D0 B0..BF, р-я - D1 80..8F
+			for (size_t remainingBytes = passwordLength; remainingBytes > 0;) {
+				if (remainingBytes == 1) {
+					buffer[length++] = '0' + static_cast<char>(randomBelow(10));
+					break;
+				}
+				size_t letter = randomBelow(32);
+				buffer[length++] = letter < 16 ? '\xD0' : '\xD1';
+				buffer[length++] = static_cast<char>(letter < 16 ? 0xB0 + letter : 0x80 + letter - 16);
+				remainingBytes -= 2;
+			}
+		}
+		// В однобайтовой кодировке примерно половина символов пароля - байты от C0 до FF (буквы cp1251 или Latin-1)
+		else if (isLatin1) for (size_t i = 0; i < passwordLength; i++) buffer[length++] = randomBelow(2) ? static_cast<char>(0xC0 + randomBelow(64)) : randomSymbol();
+		else for (size_t i = 0; i < passwordLength; i++) buffer[length++] = randomSymbol();
+	}
+	if (randomBelow(100) < parameters.crlfPercent) buffer[length++] = '\r';
+	buffer[length++] = '\n';
+	return length;
+}
+
+size_t CorpusGenerator::fillBuffer(ull firstLineNumber, char* buffer, size_t bufferSize, size_t* linesCountPtr) const noexcept {
+	size_t length = 0;
+	size_t linesCount = 0;
+	// Пока в буфере хватает места на строку максимальной длины, строки пишутся прямо в него
+	while (bufferSize - length >= getMaxLineLength()) length += writeLine(firstLineNumber + linesCount++, &buffer[length]);
+	// Остальные строки сначала пишутся во временный буфер, чтобы проверить, поместятся ли они
+	string lineBuffer(getMaxLineLength(), '\0');
+	while (true) {
+		size_t lineLength = writeLine(firstLineNumber + linesCount, lineBuffer.data());
+		if (length + lineLength > bufferSize) break;
+		memcpy(&buffer[length], lineBuffer.data(), lineLength);
+		length += lineLength;
+		linesCount++;
+	}
+	*linesCountPtr = linesCount;
+	return length;
+}
@@ -0,0 +1,56 @@
+﻿#pragma once
+#ifndef THEO_CORPUS
+#define THEO_CORPUS
+
+#include <string>
+
+// Начальное значение генератора по умолчанию: корпус одинаковый при каждом запуске, поэтому замеры разных версий можно сравнивать
+constexpr unsigned long long DEFAULT_CORPUS_SEED = 0x7468656F;
+// Минимальная длина строки корпуса без переноса: хватает на логин, разделитель и пароль из четырёх символов
+constexpr size_t MIN_CORPUS_LINE_LENGTH = 8;
+
+/* Параметры синтетического набора строк (корпуса) формата login:password или email:password.
+* Доли указываются в процентах от всех строк корпуса */
+struct CorpusParameters {
+	size_t minLineLength = 20; // Минимальная длина строки в байтах без переноса
+	size_t maxLineLength = 60; // Максимальная длина строки в байтах без переноса
+	// Длины распределены не равномерно, а с перекосом к коротким строкам и редкими длинными, как в реальных базах
+	bool isLengthSkewed = false;
+	unsigned crlfPercent = 0; // Строки, заканчивающиеся на \r\n вместо \n
+	unsigned duplicatesPercent = 0; // Строки, повторяющие одну из строк раньше в корпусе
+	unsigned invalidPercent = 0; // Невалидные строки: без разделителя, с запрещёнными символами или без пароля
+	unsigned utf8Percent = 0; // Строки с паролем из кириллицы в UTF-8
+	unsigned latin1Percent = 0; // Строки с паролем в однобайтовой кодировке (Latin-1/cp1251), невалидные для UTF-8
+	std::string separators = ":"; // Разделители между логином и паролем, в каждой строке - случайный из них
+	unsigned long long seed = DEFAULT_CORPUS_SEED;
+};
+
+/* Генератор строк корпуса. Содержимое строки с номером N зависит только от параметров и N, а дубликат
+* ссылается на строку с меньшим номером, которая восстанавливается по её номеру, без хранения уже
+* сгенерированных строк. Поэтому память не зависит от размера корпуса, а любые части корпуса можно
+* генерировать независимо (в разных потоках) с одинаковым результатом */
+class CorpusGenerator {
+private:
+	CorpusParameters parameters;
+
+	// Является ли строка с указанным номером дубликатом одной из предыдущих
+	bool isDuplicateLine(unsigned long long lineNumber) const noexcept;
+	// Номер строки, которую повторяет дубликат: выбирается среди предыдущих, пока не попадётся не дубликат
+	unsigned long long getOriginalLineNumber(unsigned long long lineNumber) const noexcept;
+	// Записывает в буфер уникальную строку с указанным номером (вместе с переносом), возвращает её длину
+	size_t writeUniqueLine(unsigned long long lineNumber, char* buffer) const noexcept;
+public:
+	explicit CorpusGenerator(const CorpusParameters& corpusParameters) noexcept;
+
+	// Максимальная длина одной строки с переносом (\r\n) - столько места в буфере нужно для writeLine
+	size_t getMaxLineLength(void) const noexcept { return parameters.maxLineLength + 2; }
+
+	// Записывает в буфер строку с указанным номером, возвращает её длину вместе с переносом
+	size_t writeLine(unsigned long long lineNumber, char* buffer) const noexcept;
+
+	/* Заполняет буфер строками, начиная с firstLineNumber, пока следующая строка помещается в буфер.
+	* Возвращает длину записанных строк в байтах, по указателю linesCountPtr - их количество */
+	size_t fillBuffer(unsigned long long firstLineNumber, char* buffer, size_t bufferSize, size_t* linesCountPtr) const noexcept;
+};
+
+#endif // !THEO_CORPUS
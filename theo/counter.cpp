@@ -15,6 +15,14 @@ int count(int argc, const char** argv) {
 		OPT_HELP(),
 		OPT_GROUP("File options"),
 		OPT_BOOLEAN('r', "recursive", &checkSourceDirectoriesRecursive, "check source directories recursive (default - false)"),
+		OPT_BOOLEAN(0, "profile", &(datasetProfileParameters.isEnabled), "in the same pass, estimate distinct lines and RAM for dedup hashes, build line length histogram,\n\t\t\t      count shares of lines with ':' and ';', CRLF lines and non-ASCII bytes (default - false)"),
+		OPT_GROUP("Performance options"),
+		OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+		OPT_STRING(0, "io-profile", &(fileIOParameters.ioProfilePath), "disk profile from 'theo bench-io' used to pick chunk size (default - profile saved by last calibration)"),
+		OPT_INTEGER(0, "threads", &(chunksProcessingParameters.threadsCount), "number of threads counting files and parts of large files simultaneously (default - all CPU cores)"),
+		OPT_BOOLEAN(0, "index", &(lineIndexParameters.isEnabled), "take line counts from index files next to inputs (file.txt.tidx), build them while counting if missing (default - false)"),
+		OPT_BOOLEAN(0, "progress", &(progressParameters.isEnabled), "show percent done, speed and remaining time in stderr while counting (default - false)"),
+		OPT_BOOLEAN(0, "perf-counters", &(perfCountersParameters.isEnabled), "measure hardware counters (cycles, instructions, cache and branch misses) of read and counting phases (Linux only, default - false)"),
 		OPT_GROUP("All unmarked arguments are considered paths to files and folders with bases that need to be merged."),
 		OPT_END(),
 	};
@@ -29,21 +37,20 @@ int count(int argc, const char** argv) {
 	// Получаем список всех валидных файлов, которые надо токенизировать
 	sourcefiles_info sourceFilesPaths = getSourceFilesFromUserInput(remainingArgumentsCount, argv, checkSourceDirectoriesRecursive);
 
-	// Читаем по 64 мегабайта за одну итерацию, поскольку это оптимальный размер для чтения блока данных с ssd
-	size_t countBytesToReadInOneIteration = OPTIMAL_DISK_CHUNK_SIZE;
-	// Создаём буфер, в который будут считываться данные из файла
-	char* buffer = new char[countBytesToReadInOneIteration + 1];
-	if (buffer == NULL) {
-		cout << "Error: not enough memory in heap to allocate 64MB temporary buffer" << endl;
-		exit(1);
+	if (chunksProcessingParameters.threadsCount < 0) {
+		cout << "Error: invalid '--threads' parameter value, it must be positive number (or zero to use all CPU cores)" << endl;
+		return ERROR_INVALID_PARAMETER;
 	}
 
+	processPerfCountersOption();
 	unsigned long long stringsCount = 0;
 
 	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
-	for (const wstring& sourceFilePath : sourceFilesPaths) {
-		long long stringsInCurrentFile = getStringCountInFile(sourceFilePath, countBytesToReadInOneIteration, buffer);
-		// Если функция вернула -1, это значит, что она не смогла открыть файл.
+	startProgress("count", getSourceFilesTotalSize(sourceFilesPaths));
+	/* Файлы считаются одновременно в нескольких потоках, а большие файлы - ещё и по частям, поэтому скорость
+	* подсчёта ограничена скоростью чтения с диска, а не одним ядром процессора */
+	for (const auto& [sourceFilePath, stringsInCurrentFile] : getStringCountInFiles(sourceFilesPaths)) {
+		// Если для файла получено -1, это значит, что его не удалось открыть или считать
 		if (stringsInCurrentFile == -1) {
 			wcout << "File is skipped. Cannot open [" << sourceFilePath << "] because of invalid path or due to security policy reasons." << endl; 
 			continue;
@@ -51,11 +58,13 @@ int count(int argc, const char** argv) {
 		// Если нет - добавляем к общему числу строк количество строк текущем в файле
 		else stringsCount += static_cast<ull>(stringsInCurrentFile);
 	}
-	delete[] buffer;
+	finishProgress();
 
 	chrono::steady_clock::time_point end = chrono::steady_clock::now();
 	cout << "Execution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
 	cout << "Strings count " << (sourceFilesPaths.size() == 1 ? "in file" : "in all files") << ": " << stringsCount << endl;
+	printDatasetProfiles();
+	printPerfCounters("count");
 
 	return ERROR_SUCCESS;
 }
\ No newline at end of file
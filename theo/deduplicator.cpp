@@ -1,48 +1,324 @@
 ﻿#include "utils.hpp"
 
-// Хранилище для всех хешей уникальных строк
-static robin_hood::unordered_flat_set<ull> stringHashes;
-
 /* Максимальный процент оперативной памяти, которая может быть занята при работе программы.
 * Если этот процент превышается, программа начинает использовать диск для хранения хешей */
-static int memoryUsageMaxPercent = 90;
+static int memoryUsageMaxPercent = DEDUP_DEFAULT_MEMORY_USAGE_MAX_PERCENT;
+
+/* Точный режим (--exact): кроме хешей хранятся и сами уникальные строки, а строка с уже встречавшимся хешем
+* считается дубликатом, только если совпадают и её байты. Так ни одна уникальная строка не теряется из-за
+* случайного совпадения хешей, но памяти на каждую уникальную строку нужно больше - на её длину */
+static int isExactMode = 0;
+
+/* Приближённый режим (--approx): вместо 64-битных хешей хранятся короткие отпечатки строк в фильтрах кукушки,
+* и памяти на уникальную строку нужно в 5-10 раз меньше. Значение - допустимая доля уникальных строк, которые могут
+* быть ошибочно удалены как дубликаты из-за совпадения отпечатков, ноль - режим выключен */
+static float approxFalsePositiveRate = 0;
+
+// Допустимые значения --approx: при меньшей доле отпечатки не помещаются в 32 бита, а большая бессмысленна
+constexpr float APPROX_MIN_FALSE_POSITIVE_RATE = 1e-8f;
+constexpr float APPROX_MAX_FALSE_POSITIVE_RATE = 0.1f;
+
+/* Средняя длина строки (с переносом), по которой из размера входных данных оценивается количество уникальных строк,
+* чтобы сразу выделить первый фильтр отпечатков нужного размера. Если строк больше, добавляются новые фильтры */
+constexpr ull APPROX_AVERAGE_LINE_LENGTH = 32;
+
+// Размер всех входных файлов при --merge: фильтры отпечатков общие для всех файлов и рассчитываются на все строки
+static ull approxMergedInputSize = 0;
+
+// Ожидаемое количество ошибочно удалённых строк во всех файлах (--approx), которое выводится в конце
+static double approxExpectedFalseDropsCount = 0;
+static mutex approxStatisticsMutex;
+
+// Уникальная строка точного режима: её хеш и байты (без переноса строки), скопированные в арену потока
+struct StoredString {
+    ull hash;
+    const char* data;
+    size_t length;
+};
+struct StoredStringHash {
+    size_t operator()(const StoredString& string) const noexcept { return static_cast<size_t>(string.hash); }
+};
+struct StoredStringEqual {
+    bool operator()(const StoredString& first, const StoredString& second) const noexcept {
+        return first.hash == second.hash and first.length == second.length and memcmp(first.data, second.data, first.length) == 0;
+    }
+};
+// Размер блока арены, в которую копируются уникальные строки точного режима
+constexpr size_t STRINGS_ARENA_BLOCK_SIZE = 16 * 1024 * 1024;
+
+/* Арена для байт уникальных строк точного режима: строки копируются подряд в большие блоки, которые никогда
+* не перемещаются и освобождаются все сразу, поэтому на каждую строку не тратится отдельное выделение памяти */
+class StringsArena {
+private:
+    vector<unique_ptr<char[]>> blocks;
+    char* freeSpace = NULL;
+    size_t freeSpaceSize = 0;
+public:
+    // Копирует строку в арену и возвращает указатель на копию
+    const char* store(const char* string, size_t stringLength);
+    // Освобождает все блоки арены
+    void clear(void) noexcept;
+};
+
+class HashRuns;
+
+/* Уникальные строки в оперативной памяти: их хеши, а в точном режиме - сами строки (в арене) вместе с хешами */
+struct UniqueLines {
+    FlatHashSet stringHashes;
+    robin_hood::unordered_flat_set<StoredString, StoredStringHash, StoredStringEqual> storedStrings;
+    StringsArena stringsArena;
+    // Отпечатки строк приближённого режима, хеши и строки в нём не хранятся
+    FingerprintFilters fingerprints;
+
+    size_t size(void) const noexcept {
+        if (approxFalsePositiveRate > 0) return fingerprints.size();
+        return isExactMode ? storedStrings.size() : stringHashes.size();
+    }
+    double getLoadFactor(void) const noexcept {
+        if (approxFalsePositiveRate > 0) return fingerprints.getLoadFactor();
+        return isExactMode ? storedStrings.load_factor() : stringHashes.load_factor();
+    }
+    /* По хешу (а в точном режиме - и по байтам строки) определяет, была ли уже такая строка здесь или в прогонах
+    * хешей на диске, если не было - запоминает её. contentLength - длина строки без переноса строки */
+    bool isStringSeenBefore(ull stringHash, const char* string, size_t contentLength, const HashRuns& hashRuns);
+    /* Заранее запрашивает у памяти всё, что понадобится isStringSeenBefore для этого хеша: корзину таблицы
+    * (или корзины фильтров отпечатков) и блоки фильтров Блума прогонов на диске. В точном режиме строки хранятся
+    * в robin_hood, и запрашивать нечего */
+    void prefetch(ull stringHash, const HashRuns& hashRuns) const noexcept;
+    // Дописывает все хеши в вектор hashes и освобождает занятую ими память
+    void moveHashesTo(vector<uint64_t>& hashes);
+    void clear(void) noexcept;
+};
+
+/* Хранилище для всех уникальных строк. У каждого потока своё, поскольку при обработке нескольких
+* файлов одновременно (без --merge) каждый поток дедуплицирует свой файл независимо от остальных */
+static thread_local UniqueLines uniqueLines;
+
+/* Хеши уникальных строк на диске, в которые переносится хеш-таблица, когда оперативной памяти становится мало.
+* У каждого потока свои, в отдельной директории, чтобы потоки, дедуплицирующие разные файлы, не мешали друг другу */
+static thread_local HashRuns hashRuns;
+
+/* Момент первого переноса хешей текущего потока на диск (секунды от запуска программы, отрицательный - переноса
+* не было) и количество хешей в оперативной памяти в этот момент. Столько хешей в памяти помещается и дальше:
+* каждый раз, когда таблица снова дорастает до этого размера, она переносится на диск новым прогоном */
+static thread_local double diskFallbackSecond = -1;
+static thread_local size_t hashesCountAtDiskFallback = 0;
+
+/* Удаляются ли дубликаты одного файла (или всех файлов вместе при --merge) в нескольких потоках. Тогда каждый
+* чанк обрабатывается пулом потоков в три этапа:
+* 1. чанк делится на части по границам строк, каждый поток хеширует строки своей части и раскладывает их номера
+*    по частям хешей (shard), выбирая часть по старшим битам хеша;
+* 2. каждый поток проверяет строки своей части хешей по порядку частей чанка, то есть в порядке входного файла,
+*    поэтому из одинаковых строк уникальной остаётся первая, как и в одном потоке. Каждая часть хешей принадлежит
+*    одному потоку, поэтому общих блокировок нет;
+* 3. каждый поток копирует уникальные строки своей части чанка в итоговый буфер по заранее подсчитанному смещению */
+static bool isParallelMode = false;
+
+// Минимальный размер части чанка на поток: на меньших частях раздача задач потокам дороже самой работы
+constexpr size_t PARALLEL_DEDUP_MIN_SLICE_SIZE = 256 * 1024;
+
+// Строка части чанка при удалении дубликатов в нескольких потоках: её хеш, начало в части и длина без '\n'
+struct SliceLine {
+    ull hash;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Часть чанка, которую на первом и третьем этапе обрабатывает один поток
+struct ChunkSlice {
+    const char* start = NULL;
+    size_t length = 0;
+    vector<SliceLine> lines;
+    // Уникальна ли каждая строка, заполняется на втором этапе потоками частей хешей
+    vector<uint8_t> uniqueFlags;
+    // Номера строк части, попавших в каждую часть хешей, по порядку
+    vector<vector<uint32_t>> shardsLinesNumbers;
+    // Сколько байт уникальных строк части нашёл поток каждой части хешей
+    vector<size_t> shardsUniqueBytes;
+};
+
+static struct ParallelDeduplication {
+    unique_ptr<ParallelTasksPool> pool;
+    // Части хешей, по одной на поток: часть строки выбирается по старшим битам её хеша
+    vector<UniqueLines> shards;
+    vector<ChunkSlice> slices;
+
+    // Создаёт пул потоков и части хешей, если их ещё нет
+    void prepare(size_t threadsCount);
+    size_t getShardNumber(ull stringHash) const noexcept { return static_cast<size_t>(((stringHash >> 32) * shards.size()) >> 32); }
+    // Очищает части хешей и освобождает пул потоков
+    void clear(void) noexcept;
+} parallelDeduplication;
+
+/* Обработчик чанков при удалении дубликатов в нескольких потоках (isParallelMode): то же, что и
+* deduplicateBufferLineByLine, с тем же результатом, но строки хешируются и проверяются всеми потоками пула */
+static size_t deduplicateBufferInParallel(char* buffer, size_t buflen, char* resultBuffer);
+
+/* Внешнее удаление дубликатов (--external) для баз, которые не помещаются в оперативную память. Вместо переноса хешей
+* на диск, где каждый прогон хешей - ещё одна проверка для каждой строки, строки обрабатываются в два прохода: сначала
+* они раскладываются по временным файлам-корзинам по старшим битам хеша (одинаковые строки всегда попадают в одну
+* корзину), затем каждая корзина целиком дедуплицируется в оперативной памяти. Оба прохода читают и пишут файлы
+* только последовательно, а памяти нужно только на хеши одной корзины (на каждый поток) */
+static int isExternalMode = 0;
+
+// Количество корзин внешнего удаления дубликатов, ноль - подобрать по размеру входных файлов и свободной памяти
+static int externalBucketsCount = 0;
+
+/* Сохранять ли при --external порядок первых вхождений строк, как в обычном режиме. Тогда перед каждой строкой
+* в корзине записывается её номер, и уникальные строки всех корзин в конце сливаются в итоговый файл по номерам */
+static int needKeepOrder = 0;
+
+/* Максимальное количество корзин: все файлы корзин открыты одновременно, а многие системы по умолчанию
+* разрешают процессу не больше 1024 открытых файлов */
+constexpr size_t EXTERNAL_MAX_BUCKETS_COUNT = 1000;
+
+// Количество корзин, если размер входных данных заранее неизвестен (стандартный ввод, сжатые файлы)
+constexpr size_t EXTERNAL_DEFAULT_BUCKETS_COUNT = 256;
+
+// Минимальный размер корзины при подборе их количества: меньшие корзины только добавляют открытых файлов
+constexpr ull EXTERNAL_MIN_BUCKET_SIZE = 64ull * 1024 * 1024;
+
+// Границы размера буфера записи (и чтения при слиянии) каждой корзины
+constexpr size_t BUCKET_MIN_BUFFER_SIZE = 64 * 1024;
+constexpr size_t BUCKET_MAX_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// Количество шестнадцатеричных цифр номера строки, записываемого перед строкой в корзине при --keep-order
+constexpr size_t LINE_NUMBER_DIGITS_COUNT = 16;
+
+/* Временные файлы-корзины внешнего удаления дубликатов в отдельной директории. Строки дописываются в корзины через
+* буферы, по буферу на корзину, чтобы на диск уходили большие последовательные блоки, а не отдельные строки */
+static class DeduplicationBuckets {
+private:
+    // Счётчик созданных директорий корзин, чтобы у каждого входного файла (без --merge) была своя директория
+    static size_t createdDirectoriesCount;
+    wstring directory;
+    size_t bucketsCount = 0;
+    vector<File*> files;
+    vector<char*> buffers;
+    vector<size_t> bufferLengths;
+    size_t bufferSize = 0;
+
+    void flushBuffer(size_t bucketNumber);
+public:
+    /* Создаёт в parentDirectory директорию с bucketsCount пустыми файлами корзин и буферы записи размером bufferSize.
+    * Возвращает false, если директорию или файлы создать не удалось */
+    bool create(const wstring& parentDirectory, size_t bucketsCount, size_t bufferSize);
+    size_t getBucketsCount(void) const noexcept { return bucketsCount; }
+    // Путь к файлу корзины, а если suffix не пустой - к файлу её уникальных строк
+    wstring getBucketPath(size_t bucketNumber, const wstring& suffix = L"") const;
+    // Номер корзины, в которую попадает строка с хешем stringHash: по старшим битам хеша, младшие использует хеш-таблица
+    size_t getBucketNumber(ull stringHash) const noexcept { return static_cast<size_t>(((stringHash >> 32) * bucketsCount) >> 32); }
+    // Дописывает данные в буфер корзины, полный буфер записывается в файл
+    void write(size_t bucketNumber, const char* data, size_t length);
+    // Записывает остатки буферов, закрывает файлы корзин и освобождает буферы
+    void finishWriting(void);
+    // Удаляет директорию корзин со всеми файлами
+    void remove(void) noexcept;
+} deduplicationBuckets;
+
+size_t DeduplicationBuckets::createdDirectoriesCount = 0;
 
-/* Класс для хранения всей информации о базе данных с хешами: stl-контейнер для взаимодействия с 
-базой, функции для инициализации/открытия/закрытия базы, технические переменные с информацией
-о файлах, представляющих базу данных на диске. */
-static class HashesDB {
+// Номер следующей строки входных файлов при раскладывании по корзинам с --keep-order
+static ull nextLineNumber = 0;
+
+// Читает строки файла большими блоками, по одной, для слияния уникальных строк корзин по номерам
+class BucketLinesReader {
 private:
-    // Директория, в которой будет хранится временный файл базы данных и технические файлы
-    wstring dbParentDirectory;
-    // Имя временного файла базы данных, при инициализации будет заменено на полный путь
-    wstring dbFilePath = L"dedup.db";
-    // Технические файлы Berkeley DB, создаваемые при инициализации базы, их тоже надо чистить
-    const vector<wstring> dbTechFiles = { L"__db.001", L"__db.002", L"__db.003" };
+    File* file;
+    vector<char> buffer;
+    size_t lineStart = 0;
+    size_t dataEnd = 0;
 public:
-    // Используется ли база данных для хранения хешей или хватает оперативной памяти
-    bool isDBUsed = false;
-    /* Хранилище для числовых хешей уникальных строк в дисковой памяти (если закончилась
-    * оперативная память, программа начинается пользоваться этим хешсетом).
-    * Доступ осуществляется через указатель, поскольку иначе программа не запускается, так как
-    * объекты BerkeleyDB не должны быть в глобальной области видимости. */
-    db_hashset* stringHashes = NULL;
-    // Сохраняет информацию информацию о директории, где будут храниться временные файлы базы
-    void init(wstring destinationUserFilePath);
-    /* Создает файл базы данных в той же директории, в которой создается пользовательский 
-    * итоговый файл с дедуплицированными строками. Инициализирует stringHashes и линкует его к базе */
-    void createDB(void);
-    // Закрывает базу данных и удаляет файл базы с диска
-    void clearDBs(void);
-} hashesDB;
-
-
-// По хешу определяет, была ли уже такая строка, если не было - добавляет её в итоговый буфер и меняет переменную с длиной итогового буфера
-static void addStringToDestinationBufferCheckingHash(ull stringHash, char* sourceBuffer, size_t sourceBufferPos, size_t stringStartPosInSourceBuffer, char* destinationBuffer, size_t* destinationBufferStringStartPosPtr);
+    BucketLinesReader(File* file, size_t bufferSize) : file(file), buffer(bufferSize) {}
+    /* Записывает в linePtr и lineLengthPtr следующую строку файла вместе с переносом строки. Строка действительна до
+    * следующего вызова. Возвращает false, если строки закончились */
+    bool readLine(const char** linePtr, size_t* lineLengthPtr);
+};
+
+/* Обработчик чанков первого прохода --external: раскладывает строки буфера по корзинам (с номерами строк при
+* --keep-order) и ничего не записывает в итоговый буфер */
+static size_t scatterBufferLinesToBuckets(char* buffer, size_t buflen, char*);
+
+/* Обработчик чанков второго прохода --external с --keep-order: то же, что deduplicateBufferLineByLine, но перед каждой
+* строкой записан её номер, который не входит в хеш и записывается в итоговый буфер вместе со строкой */
+static size_t deduplicateNumberedBufferLineByLine(char* buffer, size_t buflen, char* resultBuffer);
+
+/* Удаляет дубликаты из строк файлов inputFilesPaths внешним способом (--external) и записывает уникальные строки
+* в resultFile. Корзины создаются в директории tempParentDirectory. Статистика записывается с путём statisticsPath */
+static void deduplicateSourceFilesExternally(const vector<wstring>& inputFilesPaths, File* resultFile, const wstring& tempParentDirectory, const wstring& statisticsPath);
+
+// Записывает номер строки в digits шестнадцатеричными цифрами фиксированной длины, чтобы в номере не было переноса строки
+static void writeLineNumber(ull lineNumber, char* digits) noexcept;
+
+// Читает номер строки, записанный writeLineNumber
+static ull readLineNumber(const char* digits) noexcept;
+
+/* Количество корзин для входных данных размером inputSize: указанное пользователем или такое, чтобы одновременно
+* дедуплицируемые корзины (по одной на поток) помещались в память, разрешённую --memory */
+static size_t getExternalBucketsCount(ull inputSize, size_t threadsCount);
+
+// Размер буфера каждой корзины: буферы всех корзин вместе должны занимать небольшую часть свободной памяти
+static size_t getBucketBufferSize(size_t bucketsCount);
+
+/* Второй проход --external: дедуплицирует каждую корзину отдельно, корзины обрабатываются одновременно в нескольких
+* потоках, если их указано в --threads. Уникальные строки корзин пишутся сразу в resultFile, если корзины обрабатываются
+* по одной и порядок строк восстанавливать не надо, иначе - в отдельные файлы рядом с корзинами */
+static void deduplicateBuckets(File* resultFile, const wstring& dbParentDirectory, FileStatistics& statistics);
+
+/* Третий проход --external с --keep-order: сливает уникальные строки всех корзин в resultFile в порядке их номеров,
+* то есть в порядке первых вхождений во входных файлах, а сами номера отбрасывает */
+static void mergeUniqueBucketsLinesByNumbers(File* resultFile, size_t bufferSize, FileStatistics& statistics);
+
+// Третий проход --external в нескольких потоках без --keep-order: дописывает уникальные строки всех корзин в resultFile
+static void appendUniqueBucketsLines(File* resultFile);
+
+/* Сколько строк подряд хешируется, с запросом их корзин у памяти (prefetch), прежде чем проверяется первая из них.
+* Почти каждая проверка большой таблицы - промах кеша, а так процессор ждёт промахи всей пачки одновременно */
+constexpr size_t DEDUP_BATCH_SIZE = 32;
+
+/* Строка пачки, ожидающая проверки: запись, которая копируется в итоговый буфер (длиной recordLength без '\n'),
+* и строка внутри неё, по которой ищутся дубликаты (длиной contentLength без переноса строки), с её хешем */
+struct BatchLine {
+    const char* record;
+    size_t recordLength;
+    const char* string;
+    size_t contentLength;
+    ull hash;
+};
+
+/* Проверяет строки пачки по порядку (поэтому из одинаковых строк по-прежнему остаётся первая) и записи уникальных
+* копирует вместе с переносом строки в итоговый буфер, меняя переменную с его длиной */
+static void copyUniqueBatchLines(const BatchLine* batch, size_t batchSize, char* destinationBuffer, size_t* destinationBufferLengthPtr);
 
 /* Считывает входной буфер посимвольно, хеширует каждую считанную строку, уникальные записывает в итоговый буфер.
 *  Возвращает размер итогового буфера в байтах (чтобы впоследствии записать все данные из него в файл) */
 static size_t deduplicateBufferLineByLine(char* buffer, size_t buflen, char* resultBuffer);
 
+/* Длина строки без переноса каретки в конце: он на представление строки не влияет, а используется как вспомогательный
+* для разделителя строк в Windows ('\r\n' вместо '\n'), поэтому не входит ни в хеш строки, ни в её сравнение */
+static size_t getStringContentLength(const char* string, size_t stringLength) noexcept {
+    return stringLength > 0 and string[stringLength - 1] == '\r' ? stringLength - 1 : stringLength;
+}
+
+/* Переносит уникальные строки setsCount наборов (обычно - одного набора текущего потока) на диск, если памяти
+* занято больше разрешённого процента (в первый раз) или наборы снова доросли до размера, при котором был первый перенос */
+static void moveHashesToDiskIfNeeded(UniqueLines* sets, size_t setsCount);
+
+/* Замораживает хеши уникальных строк из наборов в оперативной памяти в новый прогон на диске текущего потока
+* и освобождает занятую ими память. В точном режиме сами строки при этом отбрасываются, на диске остаются только хеши */
+static void moveHashesToDisk(UniqueLines* sets, size_t setsCount);
+
+/* Дедуплицирует один входной файл и записывает уникальные строки в итоговый файл (при needMerge - в общий resultFile,
+* иначе - в отдельный файл в директории destinationPathW). Хеши строк хранятся в хранилищах текущего потока */
+static void deduplicateSourceFile(const wstring& inputFilePath, bool needMerge, File* resultFile, const wstring& destinationPathW, const wstring& dbParentDirectory);
+
+/* В приближённом режиме задаёт фильтрам отпечатков текущего потока (или всем частям хешей в параллельном режиме)
+* долю ложных срабатываний и начальный размер по размеру входных данных inputSize, если они ещё не заданы */
+static void prepareFingerprintFilters(ull inputSize);
+
+// Ожидаемое количество ошибочно удалённых строк (--approx) во всех фильтрах отпечатков текущего потока и частей хешей
+static double getExpectedFalseDropsCount(void) noexcept;
+
 // Опции для ввода аргументов вызова программы из cmd, показыаемые пользователю при использовании флага --help или -h
 static const char* const usages[] = {
 	"theo d [options] [path]",
@@ -52,6 +328,8 @@ static const char* const usages[] = {
 int deduplicate(int argc, const char** argv) {
     // Путь к итоговому файлу, куда будут записаны строки без дубликатов.
     const char* destinationPath = NULL;
+    // Формат и уровень сжатия итоговых файлов, если их надо сжимать
+    const char* outputCompression = NULL;
     // Надо ли объединять все итоговые файлы в один и удалять общие дубликаты в разных файлах
     int needMerge = 0; 
     // Нужно ли проверить поданные пользователем директории рекурсивно
@@ -62,13 +340,31 @@ int deduplicate(int argc, const char** argv) {
 		OPT_HELP(),
         OPT_GROUP("Basic options"),
         OPT_INTEGER(0, "memory", &memoryUsageMaxPercent, "Maximum percentage of RAM usage. Only number (whout percent symbol).\n\t\t\t      After reaching limit, deduplication continues on disk (default - 90%)"),
+        OPT_BOOLEAN(0, "exact", &isExactMode, "keep unique lines in RAM besides their hashes and compare lines with equal hashes byte by byte,\n\t\t\t      so no unique line is lost on hash collision (needs RAM for all unique lines, default - false)"),
+        OPT_FLOAT(0, "approx", &approxFalsePositiveRate, "approximate mode: keep short fingerprints of lines instead of hashes (5-10 times less RAM),\n\t\t\t      but given share of unique lines, e.g. 0.001, may be dropped as duplicates (default - 0, off)"),
+        OPT_BOOLEAN(0, "external", &isExternalMode, "for bases larger than RAM: scatter lines to temporary bucket files by hash, then deduplicate\n\t\t\t      every bucket in RAM. Lines of result are grouped by buckets (default - false)"),
+        OPT_INTEGER(0, "buckets", &externalBucketsCount, "number of bucket files with '--external', up to 1000 (default - 0, by input size and free RAM)"),
+        OPT_BOOLEAN(0, "keep-order", &needKeepOrder, "with '--external' keep lines in order of their first occurrence, as without it (default - false)"),
         OPT_GROUP("File options"),
         OPT_BOOLEAN('m', "merge", &needMerge, "remove duplicates from all lines of input files together and put result to one file"),
         OPT_STRING('d', "destination", &destinationPath, "absolute or relative path to result folder(default: current directory)\n\t\t\t      or file, if merge parameter is specified (default: dedup_merged.txt)"),
         OPT_BOOLEAN('r', "recursive", &checkSourceDirectoriesRecursive, "check source directories recursive (default - false)"),
+        OPT_STRING(0, "compress", &outputCompression, "compress result files: 'zstd', 'gzip' or 'lz4' with optional level after colon,\n\t\t\t      e.g. 'zstd:3' (default - without compression)"),
+        OPT_GROUP("Performance options"),
+        OPT_BOOLEAN(0, "mmap", &(chunksProcessingParameters.useMemoryMapping), "read input files via memory mapping, without copying to buffers (default - false)"),
+        OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+        OPT_BOOLEAN(0, "direct-io", &(fileIOParameters.useDirectIO), "read and write files bypassing page cache (O_DIRECT) and preallocate result files\n\t\t\t      (Linux only, default - false)"),
+        OPT_STRING(0, "io-profile", &(fileIOParameters.ioProfilePath), "disk profile from 'theo bench-io' used to pick chunk size (default - profile saved by last calibration)"),
+        OPT_INTEGER(0, "threads", &(chunksProcessingParameters.threadsCount), "number of threads: with several files and without merge - files deduplicated simultaneously,\n\t\t\t      with '--external' - buckets, otherwise lines of every chunk (default - 1, 0 - all processor cores)"),
+        OPT_STRING(0, "stats", &(statisticsParameters.format), "print statistics of every file and total (bytes, lines, read, processing and write time)\n\t\t\t      after processing: 'json' - one line of JSON (default - don't print)"),
+        OPT_BOOLEAN(0, "progress", &(progressParameters.isEnabled), "show percent done, speed and remaining time in stderr while processing (default - false)"),
+        OPT_BOOLEAN(0, "perf-counters", &(perfCountersParameters.isEnabled), "measure hardware counters (cycles, instructions, cache and branch misses) of read, deduplication\n\t\t\t      and write phases and print them at the end (Linux only, default - false)"),
         OPT_GROUP("All unmarked (positional) arguments are considered paths to files and folders with bases that need to be deduplicated.\nExample command: 'theo d -d result base1.txt base2.txt'. More: github.com/Theodikes/theo-bases-soft"),
 		OPT_END(),
 	};
+	/* По умолчанию всё обрабатывается в одном потоке: в нескольких потоках хеш-таблица делится на части,
+	* и на каждую уникальную строку памяти нужно немного больше */
+	chunksProcessingParameters.threadsCount = 1;
 	struct argparse argparse;
 	argparse_init(&argparse, options, usages, 0);
 	int remainingArgumentsCount = argparse_parse(&argparse, argc, argv);
@@ -83,148 +379,794 @@ int deduplicate(int argc, const char** argv) {
     // Получаем список всех валидных файлов, которые надо дедуплицировать
     sourcefiles_info sourceFilesPaths = getSourceFilesFromUserInput(remainingArgumentsCount, argv, checkSourceDirectoriesRecursive);
 
-    FILE* resultFile = NULL; 
-    processDestinationPath(&destinationPath, needMerge, &resultFile, "dedup_merged.txt");
+    File* resultFile = NULL; 
+    processOutputCompressionOption(outputCompression);
+    processDestinationPath(&destinationPath, &needMerge, &resultFile, "dedup_merged.txt");
 
     if (memoryUsageMaxPercent < 1 or memoryUsageMaxPercent > 100) {
         cout << "Invalid '--memory' parameter value, it must be lower than 100 and higher than 0" << endl;
         return ERROR_INVALID_PARAMETER;
     }
 
-    wstring destinationPathW = toWstring(destinationPath);
-    /* Инициализируем базу данных в итоговой директории, указанной пользователем.
-    * Если пользователь указал итоговый файл, инициализируем в той же директории, где он находится */
-    hashesDB.init(needMerge ? getDirectoryFromFilePath(destinationPathW) : destinationPathW);
+    if (chunksProcessingParameters.threadsCount < 0) {
+        cout << "Invalid '--threads' parameter value, it must be not negative" << endl;
+        return ERROR_INVALID_PARAMETER;
+    }
 
-    for (const wstring& inputFilePath : sourceFilesPaths) {
-        FILE* inputBaseFile = fileOpen(inputFilePath, "rb");
-        if (inputBaseFile == NULL) {
-            wcout << "File is skipped. Cannot open [" << inputFilePath << "] because of invalid path or due to security policy reasons." << endl;
-            continue;
-        }
+    if (externalBucketsCount < 0 or externalBucketsCount > static_cast<int>(EXTERNAL_MAX_BUCKETS_COUNT)) {
+        cout << "Invalid '--buckets' parameter value, it must be not negative and not higher than " << EXTERNAL_MAX_BUCKETS_COUNT << endl;
+        return ERROR_INVALID_PARAMETER;
+    }
 
-        ull inputFileSizeInBytes = getFileSize(inputFilePath.c_str());
-        if (getAvailableMemoryInBytes() < static_cast<ull>(inputFileSizeInBytes)) {
-            cout << "Warning: there may not be enough RAM to remove duplicates (if there are few duplicates in specified file). After starting disk space usage, the execution speed will slow down a lot.\n";
-        }
+    if (needKeepOrder and not isExternalMode) {
+        cout << "Parameter '--keep-order' works only with '--external', without it lines are always kept in order" << endl;
+        return ERROR_INVALID_PARAMETER;
+    }
 
-        /* Если мы не складываем всё в один файл, то каждую итерацию цикла создаём под каждый входной файл
-        * свой итоговый файл, в котором будут находиться нормализованные строки из входного.
-        * Кроме того, очищаем хранилище хешей строк с предыдущего файла, поскольку нам нужно искать
-        * дубликаты в каждом входном файле отдельно, а не во всех сразу.*/
-        if (not needMerge) {
-            // Очищаем хештаблицы строк прошлых файлов, если надо
-            if(not stringHashes.empty()) stringHashes.clear();
-            if (hashesDB.isDBUsed) hashesDB.clearDBs();
+    if (approxFalsePositiveRate != 0 and (approxFalsePositiveRate < APPROX_MIN_FALSE_POSITIVE_RATE or approxFalsePositiveRate > APPROX_MAX_FALSE_POSITIVE_RATE)) {
+        cout << "Invalid '--approx' parameter value, it must be from " << APPROX_MIN_FALSE_POSITIVE_RATE << " to " << APPROX_MAX_FALSE_POSITIVE_RATE << " (or 0 to disable)" << endl;
+        return ERROR_INVALID_PARAMETER;
+    }
 
-            resultFile = getResultFilePtr(destinationPathW, inputFilePath, L"dedup");
-            if (resultFile == NULL) {
-                wcout << "Error: cannot open result file [" << joinPaths(destinationPathW, inputFilePath) << "] in write mode" << endl;
-                continue;
+    if (approxFalsePositiveRate > 0 and (isExactMode or isExternalMode)) {
+        cout << "Parameter '--approx' can't be used with '--exact' or '--external'" << endl;
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (not processStatisticsOption()) return ERROR_INVALID_PARAMETER;
+    processPerfCountersOption();
+
+    wstring destinationPathW = toWstring(destinationPath);
+    /* Директория, в которой будут создаваться прогоны хешей, если не хватит оперативной памяти: итоговая директория,
+    * указанная пользователем, или директория, где находится итоговый файл, если пользователь указал его.
+    * При выводе в стандартный вывод итогового файла нет, и прогоны создаются в рабочей директории */
+    wstring dbParentDirectory = needMerge ? getDirectoryFromFilePath(destinationPathW) : destinationPathW;
+    if (isStandardStreamPath(destinationPathW)) dbParentDirectory = getWorkingDirectoryPath();
+
+    /* Хеши строк хранятся отдельно для каждого потока, поэтому файлы (если их не надо объединять) можно
+    * дедуплицировать одновременно: каждый файл целиком обрабатывается одним потоком, начиная с самых больших,
+    * чтобы в конце не остался один поток с огромным файлом. Без указания --threads всё работает как раньше, по одному файлу */
+    size_t processingThreadsCount = getProcessingThreadsCount();
+    if (needMerge) approxMergedInputSize = getSourceFilesTotalSize(sourceFilesPaths);
+    if (isExternalMode) {
+        /* При внешнем удалении дубликатов потоки обрабатывают корзины одного файла (или всех сразу при --merge),
+        * а входные файлы обрабатываются по одному, у каждого свои этапы прогресса */
+        if (needMerge) deduplicateSourceFilesExternally(vector<wstring>(sourceFilesPaths.begin(), sourceFilesPaths.end()), resultFile, dbParentDirectory, destinationPathW);
+        else {
+            for (const wstring& inputFilePath : sourceFilesPaths) {
+                File* fileResult = getResultFilePtr(destinationPathW, inputFilePath, L"dedup");
+                if (fileResult == NULL) {
+                    wcout << "Error: cannot open result file [" << joinPaths(destinationPathW, inputFilePath) << "] in write mode" << endl;
+                    continue;
+                }
+                deduplicateSourceFilesExternally({ inputFilePath }, fileResult, dbParentDirectory, inputFilePath);
+                fileClose(fileResult);
             }
         }
-
-        processStringsInFileByChunks(inputBaseFile, resultFile, deduplicateBufferLineByLine);
-        if (not needMerge) fclose(resultFile);
-        // Закрываем входной файл
-        fclose(inputBaseFile);
+    }
+    else if (not needMerge and processingThreadsCount > 1 and sourceFilesPaths.size() > 1) {
+        startProgress("dedup", getSourceFilesTotalSize(sourceFilesPaths));
+        WorkStealingScheduler scheduler(processingThreadsCount);
+        for (const wstring& inputFilePath : getSourceFilesSortedBySize(sourceFilesPaths)) {
+            scheduler.submit(WorkStealingScheduler::TaskKind::File, [&, inputFilePath]() {
+                deduplicateSourceFile(inputFilePath, needMerge, resultFile, destinationPathW, dbParentDirectory);
+            });
+        }
+        scheduler.run();
+        finishProgress();
+    }
+    else {
+        /* Если все строки дедуплицируются вместе (один файл или --merge), потоки делят между собой строки каждого
+        * чанка и части хешей, а порядок строк остаётся таким же, как в одном потоке */
+        isParallelMode = processingThreadsCount > 1;
+        startProgress("dedup", getSourceFilesTotalSize(sourceFilesPaths));
+        for (const wstring& inputFilePath : sourceFilesPaths) deduplicateSourceFile(inputFilePath, needMerge, resultFile, destinationPathW, dbParentDirectory);
+        finishProgress();
+        if (isParallelMode) parallelDeduplication.clear();
     }
 
-    _fcloseall();
+    // При объединении файлов хеши на диске (если они понадобились) общие для всех файлов, удаляем их в конце
+    if (hashRuns.isUsed()) hashRuns.clear();
+    if (needMerge) fileClose(resultFile);
 
     chrono::steady_clock::time_point end = chrono::steady_clock::now();
     cout << "\nFile deduplicated successfully! Execution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+    if (approxFalsePositiveRate > 0) {
+        cout << "Approximate mode: about " << static_cast<ull>(llround(approxExpectedFalseDropsCount)) << " unique lines (expected count) may have been dropped as duplicates, false positive rate - "
+            << approxFalsePositiveRate << " per unique line\n" << endl;
+    }
+    printStatistics("dedup");
+    printPerfCounters("dedup");
 
 	return ERROR_SUCCESS;
 }
 
 
-static void addStringToDestinationBufferCheckingHash(ull stringHash, char* sourceBuffer, size_t sourceBufferPos, size_t stringStartPosInSourceBuffer, char* destinationBuffer, size_t* destinationBufferStringStartPosPtr) {
+
+static void deduplicateSourceFile(const wstring& inputFilePath, bool needMerge, File* resultFile, const wstring& destinationPathW, const wstring& dbParentDirectory) {
+    // Хеши на диске у каждого потока свои, поэтому и инициализируются отдельно в каждом потоке
+    if (not hashRuns.isInitialized) hashRuns.init(dbParentDirectory);
+
+    File* inputBaseFile = fileOpen(inputFilePath, "rb");
+    if (inputBaseFile == NULL) {
+        wcout << "File is skipped. Cannot open [" << inputFilePath << "] because of invalid path or due to security policy reasons." << endl;
+        return;
+    }
+
+    // Размер стандартного ввода заранее неизвестен (-1), предупреждать о нехватке памяти для него не о чем
+    long long inputFileSizeInBytes = getFileSize(inputFilePath.c_str());
+    if (approxFalsePositiveRate > 0) prepareFingerprintFilters(needMerge ? approxMergedInputSize : static_cast<ull>(max(inputFileSizeInBytes, 0ll)));
+    // Отпечаткам приближённого режима памяти нужно в разы меньше, чем хешам, и о её нехватке не предупреждаем
+    else if (inputFileSizeInBytes > 0 and getAvailableMemoryInBytes() < static_cast<ull>(inputFileSizeInBytes)) {
+        cout << "Warning: there may not be enough RAM to remove duplicates (if there are few duplicates in specified file). After starting disk space usage, the execution speed will slow down a lot. Use '--external' for such files.\n";
+    }
+
+    /* Если мы не складываем всё в один файл, то под каждый входной файл создаём свой итоговый файл,
+    * в котором будут находиться дедуплицированные строки из входного */
+    if (not needMerge) {
+        resultFile = getResultFilePtr(destinationPathW, inputFilePath, L"dedup");
+        if (resultFile == NULL) {
+            wcout << "Error: cannot open result file [" << joinPaths(destinationPathW, inputFilePath) << "] in write mode" << endl;
+            fileClose(inputBaseFile);
+            return;
+        }
+    }
+
+    /* Хеши хранятся отдельно для каждого потока, поэтому чанки одного файла всегда обрабатываются
+    * в том потоке, который взял файл (чтение и запись при этом всё равно идут в отдельных потоках).
+    * В параллельном режиме этот поток по очереди раздаёт строки каждого чанка пулу потоков */
+    double expectedFalseDropsCountBefore = getExpectedFalseDropsCount();
+    FileStatistics statistics = processStringsInFileByChunks(inputBaseFile, resultFile, isParallelMode ? deduplicateBufferInParallel : deduplicateBufferLineByLine);
+    statistics.path = inputFilePath;
+    if (isParallelMode) statistics.threadsCount = getProcessingThreadsCount();
+    fillDeduplicationStatistics(&statistics);
+    // При --merge фильтры общие для всех файлов, поэтому к файлу относятся только ложные удаления за время его обработки
+    if (approxFalsePositiveRate > 0) {
+        statistics.expectedFalseDropsCount = getExpectedFalseDropsCount() - expectedFalseDropsCountBefore;
+        lock_guard<mutex> lock(approxStatisticsMutex);
+        approxExpectedFalseDropsCount += statistics.expectedFalseDropsCount;
+    }
+    addFileStatistics(statistics);
+    // Закрываем входной файл
+    fileClose(inputBaseFile);
+
+    /* Дубликаты в каждом входном файле ищутся отдельно, а не во всех сразу, поэтому после обработки файла
+    * закрываем его итоговый файл и очищаем хранилища хешей строк, чтобы поток мог взять следующий файл */
+    if (not needMerge) {
+        fileClose(resultFile);
+        clearDeduplicatePipeStage();
+    }
+}
+
+chunk_processor getDeduplicatePipeStage(const char* memoryUsageMaxPercentString, const wstring& dbParentDirectory) noexcept {
+    if (memoryUsageMaxPercentString != NULL) {
+        memoryUsageMaxPercent = atoi(memoryUsageMaxPercentString);
+        if (memoryUsageMaxPercent < 1 or memoryUsageMaxPercent > 100) return NULL;
+    }
+    // Этап конвейера хранит хеши в том потоке, который обрабатывает чанки, поэтому и хеши на диске инициализируются в нём
+    if (not hashRuns.isInitialized) hashRuns.init(dbParentDirectory);
+    return deduplicateBufferLineByLine;
+}
+
+static void prepareFingerprintFilters(ull inputSize) {
+    // Первый фильтр не должен занять больше половины свободной памяти, даже если строки входных данных очень короткие
+    size_t expectedLinesCount = static_cast<size_t>(min(inputSize / APPROX_AVERAGE_LINE_LENGTH, getAvailableMemoryInBytes() / 2 / sizeof(uint32_t)));
+    if (not isParallelMode) {
+        if (not uniqueLines.fingerprints.isInitialized()) uniqueLines.fingerprints.init(approxFalsePositiveRate, expectedLinesCount);
+        return;
+    }
+    parallelDeduplication.prepare(getProcessingThreadsCount());
+    for (UniqueLines& shard : parallelDeduplication.shards) {
+        if (not shard.fingerprints.isInitialized()) shard.fingerprints.init(approxFalsePositiveRate, expectedLinesCount / parallelDeduplication.shards.size());
+    }
+}
+
+static double getExpectedFalseDropsCount(void) noexcept {
+    double expectedFalseDropsCount = uniqueLines.fingerprints.getExpectedFalsePositivesCount();
+    for (const UniqueLines& shard : parallelDeduplication.shards) expectedFalseDropsCount += shard.fingerprints.getExpectedFalsePositivesCount();
+    return expectedFalseDropsCount;
+}
+
+void clearDeduplicatePipeStage(void) noexcept {
+    uniqueLines.clear();
+    for (UniqueLines& shard : parallelDeduplication.shards) shard.clear();
+    if (hashRuns.isUsed()) hashRuns.clear();
+    diskFallbackSecond = -1;
+    hashesCountAtDiskFallback = 0;
+}
+
+void fillDeduplicationStatistics(FileStatistics* statistics) noexcept {
+    if (not hashRuns.isInitialized) return;
+    statistics->hasDeduplicationStatistics = true;
+    statistics->hashSetSize = uniqueLines.size();
+    statistics->hashSetLoadFactor = uniqueLines.getLoadFactor();
+    // В нескольких потоках хеши разделены на части: размер - сумма частей, а заполненность - средняя
+    if (isParallelMode and not parallelDeduplication.shards.empty()) {
+        statistics->hashSetSize = 0;
+        statistics->hashSetLoadFactor = 0;
+        for (const UniqueLines& shard : parallelDeduplication.shards) {
+            statistics->hashSetSize += shard.size();
+            statistics->hashSetLoadFactor += shard.getLoadFactor() / static_cast<double>(parallelDeduplication.shards.size());
+        }
+    }
+    statistics->diskFallbackSecond = diskFallbackSecond;
+    statistics->hashSetSizeAtDiskFallback = hashesCountAtDiskFallback;
+}
+
+bool UniqueLines::isStringSeenBefore(ull stringHash, const char* string, size_t contentLength, const HashRuns& hashRuns) {
+    // В приближённом режиме нет ни хешей, ни прогонов на диске, только отпечатки
+    if (approxFalsePositiveRate > 0) return fingerprints.containsOrInsert(stringHash);
+    // Строки в оперативной памяти сравниваются побайтово, а перенесённые на диск хранятся там только хешами
+    if (isExactMode and storedStrings.contains(StoredString{ stringHash, string, contentLength })) return true;
     // Если хеш строки уже присутствует в таблице, добавлять его снова не надо
-    if (stringHashes.contains(stringHash)) return; 
-    if (hashesDB.isDBUsed and hashesDB.stringHashes->count(stringHash)) return;
+    if (not isExactMode and stringHashes.contains(stringHash)) return true;
+    // Перенесённые на диск хеши проверяются после таблицы: для новых строк почти всегда хватает фильтров Блума
+    if (hashRuns.isUsed() and hashRuns.contains(stringHash)) return true;
+    // Новые строки всегда добавляются в таблицу в памяти, на диск она переносится целиком
+    if (isExactMode) storedStrings.insert(StoredString{ stringHash, stringsArena.store(string, contentLength), contentLength });
+    else stringHashes.insert(stringHash);
+    return false;
+}
+
+void UniqueLines::moveHashesTo(vector<uint64_t>& hashes) {
+    if (isExactMode) {
+        for (const StoredString& storedString : storedStrings) hashes.push_back(storedString.hash);
+        // Пересоздаём таблицу, а не очищаем её, чтобы освободить память: clear оставляет таблицу прежнего размера
+        storedStrings = decltype(storedStrings)();
+        stringsArena.clear();
+    }
+    else {
+        stringHashes.forEach([&](uint64_t stringHash) { hashes.push_back(stringHash); });
+        stringHashes = FlatHashSet();
+    }
+}
+
+void UniqueLines::clear(void) noexcept {
+    if (fingerprints.isInitialized()) fingerprints.clear();
+    if (not stringHashes.empty()) stringHashes.clear();
+    if (not storedStrings.empty()) {
+        storedStrings.clear();
+        stringsArena.clear();
+    }
+}
+
+void UniqueLines::prefetch(ull stringHash, const HashRuns& hashRuns) const noexcept {
+    if (approxFalsePositiveRate > 0) {
+        fingerprints.prefetch(stringHash);
+        return;
+    }
+    if (not isExactMode) stringHashes.prefetch(stringHash);
+    if (hashRuns.isUsed()) hashRuns.prefetch(stringHash);
+}
 
-    // Добавляем в хеш-таблицу хеш строки для последующих проверок
-    if (hashesDB.isDBUsed) hashesDB.stringHashes->insert(stringHash);
-    else stringHashes.insert(stringHash); 
-    // Вычисляем длину текущей строки (добавляем единицу, так как последний символ (перенос строки) надо оставить
-    size_t currentStringLength = sourceBufferPos - stringStartPosInSourceBuffer + 1;
-    // Сохраняем строку в итоговый буфер, копируя напрямую из изначального буфера
-    memcpy(&destinationBuffer[*destinationBufferStringStartPosPtr], &sourceBuffer[stringStartPosInSourceBuffer], currentStringLength);
+static void copyUniqueBatchLines(const BatchLine* batch, size_t batchSize, char* destinationBuffer, size_t* destinationBufferLengthPtr) {
+    for (size_t lineNumber = 0; lineNumber < batchSize; lineNumber++) {
+        const BatchLine& line = batch[lineNumber];
+        if (uniqueLines.isStringSeenBefore(line.hash, line.string, line.contentLength, hashRuns)) continue;
+        /* Сохраняем запись в итоговый буфер, копируя напрямую из изначального буфера вместе с переносом строки
+        * (добавляем единицу к длине, так как последний символ (перенос строки) надо оставить) */
+        memcpy(&destinationBuffer[*destinationBufferLengthPtr], line.record, line.recordLength + 1);
+        *destinationBufferLengthPtr += line.recordLength + 1;
+    }
+}
 
-    // Вычисляем позицию конца в итоговом буфере и изменяем значение переменной, указывающей на начало следующей строки
-    // в итоговом буфере, по указателю, чтобы при новом вызове функции сразу было верное значение
-    *destinationBufferStringStartPosPtr += currentStringLength;
+
+static void moveHashesToDiskIfNeeded(UniqueLines* sets, size_t setsCount) {
+    // Отпечатки приближённого режима на диск не переносятся: на диске остались бы только хеши, а их в этом режиме нет
+    if (approxFalsePositiveRate > 0) return;
+    // Фоновое слияние прогонов могло закончиться, пока обрабатывался предыдущий чанк
+    if (hashRuns.isUsed()) hashRuns.applyFinishedCompaction();
+    size_t hashesInMemoryCount = 0;
+    for (size_t setNumber = 0; setNumber < setsCount; setNumber++) hashesInMemoryCount += sets[setNumber].size();
+    if (hashesInMemoryCount == 0) return;
+    /* Если хеши ещё не переносились на диск, однако оперативной памяти уже недостаточно (количество затраченной
+    * превышает разрешённый процент), запоминаем размер таблицы и оповещаем об этом пользователя */
+    if (diskFallbackSecond < 0) {
+        if (getMemoryUsagePercent() <= static_cast<size_t>(memoryUsageMaxPercent)) return;
+        diskFallbackSecond = getSecondsSinceProgramStart();
+        hashesCountAtDiskFallback = hashesInMemoryCount;
+        cout << "Not enough RAM. Start moving hashes of unique lines to disk, speed may decrease." << endl;
+        if (isExactMode) cout << "Warning: unique lines moved to disk are kept there only as hashes, lines with colliding hashes may be lost." << endl;
+        if (isExternalMode) cout << "Bucket does not fit in RAM, specify more buckets with '--buckets' to avoid using disk." << endl;
+    }
+    else if (hashesInMemoryCount < hashesCountAtDiskFallback) return;
+    moveHashesToDisk(sets, setsCount);
 }
 
+static void moveHashesToDisk(UniqueLines* sets, size_t setsCount) {
+    vector<uint64_t> hashes;
+    size_t hashesCount = 0;
+    for (size_t setNumber = 0; setNumber < setsCount; setNumber++) hashesCount += sets[setNumber].size();
+    hashes.reserve(hashesCount);
+    for (size_t setNumber = 0; setNumber < setsCount; setNumber++) sets[setNumber].moveHashesTo(hashes);
+    hashRuns.addRun(hashes);
+}
 
 static size_t deduplicateBufferLineByLine(char* buffer, size_t buflen, char* resultBuffer) {
-    /* Если диск для хранения хешей строк в базе данных ещё не используется, однако
-    * оперативной памяти уже недостаточно (количество затраченной превышает разрешённый процент),
-    * то создаем базу данных и связанный с ней хешсет, а также оповещаем об этом пользователя */
-    if (not hashesDB.isDBUsed and getMemoryUsagePercent() > memoryUsageMaxPercent) {
-        hashesDB.createDB();
-        cout << "Not enough RAM. Start using disk space to deduplicate. Speed will be decreased." << endl;
-    }
-    // Изначальное оптимальное значения для хеширования символов - 5381 (почему так - смотреть http://www.cse.yorku.ca/~oz/hash.html)
-    ull hashStartValue = 5381, currentHash = hashStartValue;
-
-    // Индекс начала текущей строки в буфере со входными данными, чтобы впоследствии можно было скопировать из него всю строку
-    size_t currentStringStartPosInInputBufferIdx = 0;
-    
+    moveHashesToDiskIfNeeded(&uniqueLines, 1);
+
     // Длина итогового буфера с валидными данными, которые надо полностью записать в итоговый файл
     size_t resultBufferLength = 0;
+    BatchLine batch[DEDUP_BATCH_SIZE];
+    size_t batchSize = 0;
 
-    // Пробегаемся по каждому символу буфера
-    for (size_t bufferPos = 0; bufferPos < buflen; bufferPos++) {
-        /* Если текущий символ - перенос каретки, то пропускаем его без обработки и добавления в хеш, 
-        *  поскольку это незначащий символ и на представление строки не влияет, а используется как вспомогательный
-        *  для разделителя строк в Windows (разделение строк там не '\n', а '\r\n') */
-        if (buffer[bufferPos] == '\r') continue;
-        // Если это символ переноса строки, надо строку обработать, хеш проверить, и если его не было, строку записать
-        if (buffer[bufferPos] == '\n') {
-            // Проверяем хеш и записываем строку в итоговый буфер, а также меняем указатель конца итогового буфера, если строка уникальна
-            addStringToDestinationBufferCheckingHash(currentHash, buffer, bufferPos, currentStringStartPosInInputBufferIdx, resultBuffer, &resultBufferLength);
-            // Устанавливаем корректное значение начала новой строки во входном буфере, который мы читаем
-            currentStringStartPosInInputBufferIdx = bufferPos + 1;
-            // Сбрасываем хеш до значения инициализации, так как высчитывать хеш переноса строки нет смысла
-            currentHash = hashStartValue;
-            continue;
+    // Проходим по всем строкам буфера, переносы строк ищутся векторно, а хеш считается сразу по всей строке
+    forEachLine(buffer, buflen, [&](const char* string, size_t stringLength) {
+        size_t contentLength = getStringContentLength(string, stringLength);
+        ull stringHash = hashLine(string, contentLength);
+        uniqueLines.prefetch(stringHash, hashRuns);
+        batch[batchSize++] = BatchLine{ string, stringLength, string, contentLength, stringHash };
+        if (batchSize < DEDUP_BATCH_SIZE) return;
+        copyUniqueBatchLines(batch, batchSize, resultBuffer, &resultBufferLength);
+        batchSize = 0;
+    });
+    copyUniqueBatchLines(batch, batchSize, resultBuffer, &resultBufferLength);
+
+    return resultBufferLength;
+}
+
+static size_t deduplicateNumberedBufferLineByLine(char* buffer, size_t buflen, char* resultBuffer) {
+    moveHashesToDiskIfNeeded(&uniqueLines, 1);
+
+    size_t resultBufferLength = 0;
+    BatchLine batch[DEDUP_BATCH_SIZE];
+    size_t batchSize = 0;
+    forEachLine(buffer, buflen, [&](const char* record, size_t recordLength) {
+        // Корзины пишет сама программа, поэтому номер есть перед каждой строкой, но на всякий случай проверяем длину
+        if (recordLength < LINE_NUMBER_DIGITS_COUNT) return;
+        const char* string = record + LINE_NUMBER_DIGITS_COUNT;
+        size_t contentLength = getStringContentLength(string, recordLength - LINE_NUMBER_DIGITS_COUNT);
+        ull stringHash = hashLine(string, contentLength);
+        uniqueLines.prefetch(stringHash, hashRuns);
+        // Строка записывается вместе с номером и переносом строки: номер понадобится при слиянии корзин
+        batch[batchSize++] = BatchLine{ record, recordLength, string, contentLength, stringHash };
+        if (batchSize < DEDUP_BATCH_SIZE) return;
+        copyUniqueBatchLines(batch, batchSize, resultBuffer, &resultBufferLength);
+        batchSize = 0;
+    });
+    copyUniqueBatchLines(batch, batchSize, resultBuffer, &resultBufferLength);
+    return resultBufferLength;
+}
+
+static size_t deduplicateBufferInParallel(char* buffer, size_t buflen, char* resultBuffer) {
+    ParallelDeduplication& deduplication = parallelDeduplication;
+    deduplication.prepare(getProcessingThreadsCount());
+    moveHashesToDiskIfNeeded(deduplication.shards.data(), deduplication.shards.size());
+    // Прогоны хешей на диске принадлежат текущему потоку, а проверяются из потоков пула
+    const HashRuns& threadHashRuns = hashRuns;
+
+    // Делим чанк на части примерно одинакового размера, каждая часть заканчивается переносом строки
+    size_t shardsCount = deduplication.shards.size();
+    size_t slicesCount = max(min(buflen / PARALLEL_DEDUP_MIN_SLICE_SIZE, deduplication.pool->getThreadsCount()), static_cast<size_t>(1));
+    deduplication.slices.resize(slicesCount);
+    size_t sliceStart = 0;
+    for (size_t sliceNumber = 0; sliceNumber < slicesCount; sliceNumber++) {
+        size_t sliceEnd = buflen;
+        if (sliceNumber + 1 < slicesCount) {
+            sliceEnd = max(buflen / slicesCount * (sliceNumber + 1), sliceStart);
+            const char* newline = static_cast<const char*>(memchr(&buffer[sliceEnd], '\n', buflen - sliceEnd));
+            sliceEnd = newline != NULL ? static_cast<size_t>(newline - buffer) + 1 : buflen;
         }
-        // Высчитываем хеш строки, внося в него влияние текущего символа (меняем значение хеша в зависимости от символа)
-        currentHash = ((currentHash << 5) + currentHash) + buffer[bufferPos];
+        ChunkSlice& slice = deduplication.slices[sliceNumber];
+        slice.start = &buffer[sliceStart];
+        slice.length = sliceEnd - sliceStart;
+        sliceStart = sliceEnd;
     }
-    
+
+    // Первый этап: хешируем строки частей чанка и раскладываем их номера по частям хешей
+    deduplication.pool->run(slicesCount, [&](size_t sliceNumber) {
+        ChunkSlice& slice = deduplication.slices[sliceNumber];
+        slice.lines.clear();
+        slice.shardsLinesNumbers.resize(shardsCount);
+        for (vector<uint32_t>& shardLinesNumbers : slice.shardsLinesNumbers) shardLinesNumbers.clear();
+        forEachLine(slice.start, slice.length, [&](const char* string, size_t stringLength) {
+            ull stringHash = hashLine(string, getStringContentLength(string, stringLength));
+            slice.shardsLinesNumbers[deduplication.getShardNumber(stringHash)].push_back(static_cast<uint32_t>(slice.lines.size()));
+            slice.lines.push_back(SliceLine{ stringHash, static_cast<uint32_t>(string - slice.start), static_cast<uint32_t>(stringLength) });
+        });
+        slice.uniqueFlags.assign(slice.lines.size(), 0);
+        slice.shardsUniqueBytes.assign(shardsCount, 0);
+    });
+
+    // Второй этап: каждая часть хешей проверяет свои строки в порядке входного файла
+    deduplication.pool->run(shardsCount, [&](size_t shardNumber) {
+        UniqueLines& shard = deduplication.shards[shardNumber];
+        for (ChunkSlice& slice : deduplication.slices) {
+            size_t uniqueBytesCount = 0;
+            const vector<uint32_t>& linesNumbers = slice.shardsLinesNumbers[shardNumber];
+            // Хеши всех строк уже посчитаны, поэтому корзины запрашиваются у памяти на DEDUP_BATCH_SIZE строк вперёд
+            for (size_t index = 0; index < min(DEDUP_BATCH_SIZE, linesNumbers.size()); index++) shard.prefetch(slice.lines[linesNumbers[index]].hash, threadHashRuns);
+            for (size_t index = 0; index < linesNumbers.size(); index++) {
+                if (index + DEDUP_BATCH_SIZE < linesNumbers.size()) shard.prefetch(slice.lines[linesNumbers[index + DEDUP_BATCH_SIZE]].hash, threadHashRuns);
+                uint32_t lineNumber = linesNumbers[index];
+                const SliceLine& line = slice.lines[lineNumber];
+                const char* string = slice.start + line.offset;
+                // Байты строки нужны только точному режиму, без него строка проверяется по одному хешу
+                size_t contentLength = isExactMode ? getStringContentLength(string, line.length) : line.length;
+                if (shard.isStringSeenBefore(line.hash, string, contentLength, threadHashRuns)) continue;
+                slice.uniqueFlags[lineNumber] = 1;
+                uniqueBytesCount += line.length + 1;
+            }
+            slice.shardsUniqueBytes[shardNumber] = uniqueBytesCount;
+        }
+    });
+
+    // Уникальные строки каждой части чанка идут в итоговом буфере сразу после уникальных строк предыдущих частей
+    vector<size_t> slicesResultOffsets(slicesCount);
+    size_t resultBufferLength = 0;
+    for (size_t sliceNumber = 0; sliceNumber < slicesCount; sliceNumber++) {
+        slicesResultOffsets[sliceNumber] = resultBufferLength;
+        for (size_t uniqueBytesCount : deduplication.slices[sliceNumber].shardsUniqueBytes) resultBufferLength += uniqueBytesCount;
+    }
+
+    // Третий этап: копируем уникальные строки частей чанка вместе с переносами строк в итоговый буфер
+    deduplication.pool->run(slicesCount, [&](size_t sliceNumber) {
+        const ChunkSlice& slice = deduplication.slices[sliceNumber];
+        char* destination = &resultBuffer[slicesResultOffsets[sliceNumber]];
+        for (size_t lineNumber = 0; lineNumber < slice.lines.size(); lineNumber++) {
+            if (not slice.uniqueFlags[lineNumber]) continue;
+            const SliceLine& line = slice.lines[lineNumber];
+            memcpy(destination, slice.start + line.offset, line.length + 1);
+            destination += line.length + 1;
+        }
+    });
+
     return resultBufferLength;
 }
 
-void HashesDB::init(wstring destinationUserFilePath) {
-    // Устанавливаем внутренние переменные класса: путь к папке с базой и полный путь к файлу базы
-    dbParentDirectory = getDirectoryFromFilePath(destinationUserFilePath);
-    dbFilePath = joinPaths(dbParentDirectory, dbFilePath);
+void ParallelDeduplication::prepare(size_t threadsCount) {
+    if (pool == NULL) pool = make_unique<ParallelTasksPool>(threadsCount);
+    if (shards.size() != threadsCount) shards.resize(threadsCount);
+}
+
+void ParallelDeduplication::clear(void) noexcept {
+    shards.clear();
+    slices.clear();
+    pool.reset();
+}
+
+static size_t scatterBufferLinesToBuckets(char* buffer, size_t buflen, char*) {
+    forEachLine(buffer, buflen, [&](const char* string, size_t stringLength) {
+        size_t bucketNumber = deduplicationBuckets.getBucketNumber(hashLine(string, getStringContentLength(string, stringLength)));
+        if (needKeepOrder) {
+            char lineNumberDigits[LINE_NUMBER_DIGITS_COUNT];
+            writeLineNumber(nextLineNumber++, lineNumberDigits);
+            deduplicationBuckets.write(bucketNumber, lineNumberDigits, LINE_NUMBER_DIGITS_COUNT);
+        }
+        // Строка записывается вместе с переносом строки, который в буфере всегда идёт после неё
+        deduplicationBuckets.write(bucketNumber, string, stringLength + 1);
+    });
+    return 0;
+}
+
+static void writeLineNumber(ull lineNumber, char* digits) noexcept {
+    for (size_t digitPos = LINE_NUMBER_DIGITS_COUNT; digitPos > 0; digitPos--) {
+        digits[digitPos - 1] = "0123456789abcdef"[lineNumber & 0xF];
+        lineNumber >>= 4;
+    }
 }
 
-void HashesDB::createDB(void) {
-    // Устанавливаем флаг, что теперь для хранения хешей используется DB, а не оперативная память
-    isDBUsed = true; 
-    DbEnv* penv = open_env(fromWstring(dbParentDirectory).c_str(), 0u, DB_CREATE | DB_INIT_MPOOL);
-    Db* db = open_db(penv, fromWstring(dbFilePath).c_str(), DB_BTREE, DB_CREATE, 0u);
-    stringHashes = new db_hashset(db, penv);
+static ull readLineNumber(const char* digits) noexcept {
+    ull lineNumber = 0;
+    for (size_t digitPos = 0; digitPos < LINE_NUMBER_DIGITS_COUNT; digitPos++) {
+        char digit = digits[digitPos];
+        lineNumber = (lineNumber << 4) | static_cast<ull>(digit <= '9' ? digit - '0' : digit - 'a' + 10);
+    }
+    return lineNumber;
 }
-void HashesDB::clearDBs(void) {
-    /* Устанавливаем isDBUseed на false, поскольку запуск базы данных может не требоваться
-    * для обработки следующего файла, который может быть меньшего размера */
-    isDBUsed = false;
 
-    // Удаляем саму базу
-    delete this->stringHashes;
-    this->stringHashes = NULL;
+static size_t getExternalBucketsCount(ull inputSize, size_t threadsCount) {
+    if (externalBucketsCount > 0) return static_cast<size_t>(externalBucketsCount);
+    if (inputSize == 0) return max(EXTERNAL_DEFAULT_BUCKETS_COUNT, threadsCount);
+    /* Хеш-таблице корзины нужно меньше памяти, чем весит сама корзина, но пока таблица растёт, старая и новая
+    * существуют одновременно, а в точном режиме в памяти лежат ещё и сами строки. Поэтому корзина должна вдвое
+    * (в точном режиме - втрое) помещаться в память, которую ещё можно занять до предела --memory, причём
+    * одновременно в памяти столько корзин, сколько потоков */
+    ull totalMemory = getTotalMemoryInBytes();
+    ull usedMemory = totalMemory - min(getAvailableMemoryInBytes(), totalMemory);
+    ull memoryLimit = totalMemory / 100 * static_cast<ull>(memoryUsageMaxPercent);
+    ull allowedMemory = memoryLimit > usedMemory ? memoryLimit - usedMemory : 0;
+    ull bucketMaxSize = max(allowedMemory / threadsCount / (isExactMode ? 3 : 2), EXTERNAL_MIN_BUCKET_SIZE);
+    size_t bucketsCount = static_cast<size_t>((inputSize + bucketMaxSize - 1) / bucketMaxSize);
+    // Корзин не меньше, чем потоков, иначе часть потоков будет простаивать
+    return min(max(bucketsCount, threadsCount), EXTERNAL_MAX_BUCKETS_COUNT);
+}
 
-    // Закрываем все окружения баз и все базы
-    close_all_db_envs();
-    close_all_dbs();
+static size_t getBucketBufferSize(size_t bucketsCount) {
+    // На буферы всех корзин тратится не больше восьмой части свободной памяти
+    ull bufferSize = getAvailableMemoryInBytes() / 8 / bucketsCount;
+    bufferSize = min(max(bufferSize, static_cast<ull>(BUCKET_MIN_BUFFER_SIZE)), static_cast<ull>(BUCKET_MAX_BUFFER_SIZE));
+    return static_cast<size_t>(bufferSize / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT);
+}
 
-    // Удаляем файл с временной базой данных и все технические файлы базы
-    fs::remove(dbFilePath);
-    for (wstring techDBFile : dbTechFiles) fs::remove(joinPaths(dbParentDirectory, techDBFile));
-}
\ No newline at end of file
+static void deduplicateSourceFilesExternally(const vector<wstring>& inputFilesPaths, File* resultFile, const wstring& tempParentDirectory, const wstring& statisticsPath) {
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    size_t threadsCount = getProcessingThreadsCount();
+    FileStatistics statistics;
+    statistics.path = statisticsPath;
+    statistics.threadsCount = threadsCount;
+
+    sourcefiles_info inputFilesSet(inputFilesPaths.begin(), inputFilesPaths.end());
+    ull inputSize = getSourceFilesTotalSize(inputFilesSet);
+    size_t bucketsCount = getExternalBucketsCount(inputSize, threadsCount);
+    size_t bufferSize = getBucketBufferSize(bucketsCount);
+    if (not deduplicationBuckets.create(tempParentDirectory, bucketsCount, bufferSize)) {
+        wcout << "Error: cannot create " << bucketsCount << " temporary bucket files in [" << tempParentDirectory << "]" << endl;
+        deduplicationBuckets.finishWriting();
+        deduplicationBuckets.remove();
+        exit(ERROR_CREATE_FAILED);
+    }
+
+    // Первый проход: строки всех входных файлов по порядку раскладываются по корзинам
+    startProgress("dedup: scattering lines", inputSize);
+    nextLineNumber = 0;
+    for (const wstring& inputFilePath : inputFilesPaths) {
+        File* inputFile = fileOpen(inputFilePath, "rb");
+        if (inputFile == NULL) {
+            wcout << "File is skipped. Cannot open [" << inputFilePath << "] because of invalid path or due to security policy reasons." << endl;
+            continue;
+        }
+        statistics.add(processStringsInFileByChunks(inputFile, NULL, scatterBufferLinesToBuckets));
+        fileClose(inputFile);
+    }
+    deduplicationBuckets.finishWriting();
+    finishProgress();
+
+    // Второй проход: каждая корзина дедуплицируется в памяти
+    deduplicateBuckets(resultFile, tempParentDirectory, statistics);
+
+    // Третий проход, если уникальные строки корзин записаны в отдельные файлы: собираем их в итоговый
+    if (needKeepOrder) mergeUniqueBucketsLinesByNumbers(resultFile, bufferSize, statistics);
+    else if (threadsCount > 1) appendUniqueBucketsLines(resultFile);
+    deduplicationBuckets.remove();
+
+    statistics.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    addFileStatistics(statistics);
+}
+
+static void deduplicateBuckets(File* resultFile, const wstring& dbParentDirectory, FileStatistics& statistics) {
+    size_t threadsCount = getProcessingThreadsCount();
+    size_t bucketsCount = deduplicationBuckets.getBucketsCount();
+    bool needSeparateResults = needKeepOrder or threadsCount > 1;
+
+    ull bucketsTotalSize = 0;
+    for (size_t bucketNumber = 0; bucketNumber < bucketsCount; bucketNumber++) {
+        bucketsTotalSize += static_cast<ull>(max(getFileSize(deduplicationBuckets.getBucketPath(bucketNumber)), 0ll));
+    }
+    startProgress("dedup: deduplicating buckets", bucketsTotalSize);
+
+    mutex statisticsMutex;
+    auto deduplicateBucket = [&](size_t bucketNumber) {
+        // Хранилища хешей у каждого потока свои, хеши на диске тоже инициализируются в том потоке, который взял корзину
+        if (not hashRuns.isInitialized) hashRuns.init(dbParentDirectory);
+        wstring bucketPath = deduplicationBuckets.getBucketPath(bucketNumber);
+        wstring bucketResultPath = deduplicationBuckets.getBucketPath(bucketNumber, L"_unique");
+        File* bucketFile = openPlatformFile(bucketPath, FileOpenMode::Read);
+        File* bucketResultFile = needSeparateResults ? openPlatformFile(bucketResultPath, FileOpenMode::Write) : resultFile;
+        if (bucketFile == NULL or bucketResultFile == NULL) {
+            wcout << "Error: cannot open temporary bucket file [" << (bucketFile == NULL ? bucketPath : bucketResultPath) << "]" << endl;
+            deduplicationBuckets.remove();
+            exit(ERROR_OPEN_FAILED);
+        }
+
+        FileStatistics bucketStatistics = processStringsInFileByChunks(bucketFile, bucketResultFile, needKeepOrder ? deduplicateNumberedBufferLineByLine : deduplicateBufferLineByLine);
+        fillDeduplicationStatistics(&bucketStatistics);
+        clearDeduplicatePipeStage();
+        fileClose(bucketFile);
+        if (needSeparateResults) fileClose(bucketResultFile);
+        // Корзина больше не нужна: удаляем её сразу, чтобы на диске не лежали одновременно все корзины и все их результаты
+        error_code removingError;
+        fs::remove(toFilesystemPath(bucketPath), removingError);
+
+        // Входные строки корзин уже учтены в статистике первого прохода, а номера строк в итоговый файл не попадут
+        bucketStatistics.bytesIn = 0;
+        bucketStatistics.linesIn = 0;
+        bucketStatistics.chunksCount = 0;
+        if (needKeepOrder) bucketStatistics.bytesOut = 0;
+        lock_guard<mutex> lock(statisticsMutex);
+        statistics.add(bucketStatistics);
+    };
+
+    if (threadsCount > 1) {
+        WorkStealingScheduler scheduler(threadsCount);
+        for (size_t bucketNumber = 0; bucketNumber < bucketsCount; bucketNumber++) {
+            scheduler.submit(WorkStealingScheduler::TaskKind::File, [&, bucketNumber]() { deduplicateBucket(bucketNumber); });
+        }
+        scheduler.run();
+    }
+    else {
+        for (size_t bucketNumber = 0; bucketNumber < bucketsCount; bucketNumber++) deduplicateBucket(bucketNumber);
+    }
+    finishProgress();
+}
+
+static void mergeUniqueBucketsLinesByNumbers(File* resultFile, size_t bufferSize, FileStatistics& statistics) {
+    size_t bucketsCount = deduplicationBuckets.getBucketsCount();
+    vector<File*> files(bucketsCount, NULL);
+    vector<unique_ptr<BucketLinesReader>> readers;
+    ull uniqueLinesTotalSize = 0;
+    for (size_t bucketNumber = 0; bucketNumber < bucketsCount; bucketNumber++) {
+        wstring bucketResultPath = deduplicationBuckets.getBucketPath(bucketNumber, L"_unique");
+        uniqueLinesTotalSize += static_cast<ull>(max(getFileSize(bucketResultPath), 0ll));
+        files[bucketNumber] = openPlatformFile(bucketResultPath, FileOpenMode::Read);
+        if (files[bucketNumber] == NULL) {
+            wcout << "Error: cannot open temporary bucket file [" << bucketResultPath << "]" << endl;
+            deduplicationBuckets.remove();
+            exit(ERROR_OPEN_FAILED);
+        }
+        readers.push_back(make_unique<BucketLinesReader>(files[bucketNumber], bufferSize));
+    }
+    startProgress("dedup: restoring order", uniqueLinesTotalSize);
+
+    /* Текущая строка каждой корзины и очередь корзин по номеру их текущей строки, наименьший номер - первый.
+    * В каждой корзине номера строк возрастают, поэтому строки выходят из очереди в порядке номеров */
+    vector<const char*> currentLines(bucketsCount, NULL);
+    vector<size_t> currentLinesLengths(bucketsCount, 0);
+    priority_queue<pair<ull, size_t>, vector<pair<ull, size_t>>, greater<pair<ull, size_t>>> bucketsByLineNumber;
+    auto readNextLine = [&](size_t bucketNumber) {
+        if (not readers[bucketNumber]->readLine(&currentLines[bucketNumber], &currentLinesLengths[bucketNumber])) return;
+        if (currentLinesLengths[bucketNumber] <= LINE_NUMBER_DIGITS_COUNT) return;
+        bucketsByLineNumber.emplace(readLineNumber(currentLines[bucketNumber]), bucketNumber);
+    };
+    for (size_t bucketNumber = 0; bucketNumber < bucketsCount; bucketNumber++) readNextLine(bucketNumber);
+
+    vector<char> resultBuffer(BUCKET_MAX_BUFFER_SIZE);
+    size_t resultBufferLength = 0;
+    ull readedBytesCount = 0, readedLinesCount = 0;
+    auto flushResultBuffer = [&]() {
+        resultFile->write(resultBuffer.data(), resultBufferLength);
+        statistics.bytesOut += resultBufferLength;
+        addProgress(readedBytesCount, readedLinesCount);
+        resultBufferLength = 0;
+        readedBytesCount = 0;
+        readedLinesCount = 0;
+    };
+    while (not bucketsByLineNumber.empty()) {
+        size_t bucketNumber = bucketsByLineNumber.top().second;
+        bucketsByLineNumber.pop();
+        // Номер строки в итоговый файл не записывается, только сама строка с переносом строки
+        const char* string = currentLines[bucketNumber] + LINE_NUMBER_DIGITS_COUNT;
+        size_t stringLength = currentLinesLengths[bucketNumber] - LINE_NUMBER_DIGITS_COUNT;
+        if (resultBufferLength + stringLength > resultBuffer.size()) flushResultBuffer();
+        if (stringLength > resultBuffer.size()) resultBuffer.resize(stringLength);
+        memcpy(&resultBuffer[resultBufferLength], string, stringLength);
+        resultBufferLength += stringLength;
+        readedBytesCount += currentLinesLengths[bucketNumber];
+        readedLinesCount++;
+        readNextLine(bucketNumber);
+    }
+    flushResultBuffer();
+
+    for (File* file : files) fileClose(file);
+    finishProgress();
+}
+
+static void appendUniqueBucketsLines(File* resultFile) {
+    size_t bucketsCount = deduplicationBuckets.getBucketsCount();
+    ull uniqueLinesTotalSize = 0;
+    for (size_t bucketNumber = 0; bucketNumber < bucketsCount; bucketNumber++) {
+        uniqueLinesTotalSize += static_cast<ull>(max(getFileSize(deduplicationBuckets.getBucketPath(bucketNumber, L"_unique")), 0ll));
+    }
+    startProgress("dedup: joining buckets", uniqueLinesTotalSize);
+
+    vector<char> buffer(BUCKET_MAX_BUFFER_SIZE);
+    for (size_t bucketNumber = 0; bucketNumber < bucketsCount; bucketNumber++) {
+        wstring bucketResultPath = deduplicationBuckets.getBucketPath(bucketNumber, L"_unique");
+        File* bucketResultFile = openPlatformFile(bucketResultPath, FileOpenMode::Read);
+        if (bucketResultFile == NULL) {
+            wcout << "Error: cannot open temporary bucket file [" << bucketResultPath << "]" << endl;
+            deduplicationBuckets.remove();
+            exit(ERROR_OPEN_FAILED);
+        }
+        size_t readedBytesCount;
+        while ((readedBytesCount = bucketResultFile->read(buffer.data(), buffer.size())) > 0) {
+            resultFile->write(buffer.data(), readedBytesCount);
+            addProgress(readedBytesCount);
+        }
+        fileClose(bucketResultFile);
+    }
+    finishProgress();
+}
+
+bool DeduplicationBuckets::create(const wstring& parentDirectory, size_t count, size_t size) {
+    directory = joinPaths(parentDirectory, L"theo_dedup_buckets_" + to_wstring(createdDirectoriesCount++));
+    bucketsCount = count;
+    bufferSize = size;
+    error_code creatingError;
+    fs::create_directories(toFilesystemPath(directory), creatingError);
+    if (creatingError) return false;
+    /* Корзины - временные файлы, поэтому открываются напрямую, без сжатия --compress: иначе каждой из сотен открытых
+    * корзин понадобились бы свой буфер и контекст сжатия, а промежуточные данные сжимались бы и распаковывались зря */
+    for (size_t bucketNumber = 0; bucketNumber < bucketsCount; bucketNumber++) {
+        File* file = openPlatformFile(getBucketPath(bucketNumber), FileOpenMode::Write);
+        char* buffer = file != NULL ? allocateIOBuffer(bufferSize) : NULL;
+        files.push_back(file);
+        buffers.push_back(buffer);
+        bufferLengths.push_back(0);
+        if (buffer == NULL) return false;
+    }
+    return true;
+}
+
+wstring DeduplicationBuckets::getBucketPath(size_t bucketNumber, const wstring& suffix) const {
+    return joinPaths(directory, L"bucket_" + to_wstring(bucketNumber) + suffix + L".txt");
+}
+
+void DeduplicationBuckets::write(size_t bucketNumber, const char* data, size_t length) {
+    while (length > 0) {
+        size_t copiedLength = min(length, bufferSize - bufferLengths[bucketNumber]);
+        memcpy(buffers[bucketNumber] + bufferLengths[bucketNumber], data, copiedLength);
+        bufferLengths[bucketNumber] += copiedLength;
+        data += copiedLength;
+        length -= copiedLength;
+        if (bufferLengths[bucketNumber] == bufferSize) flushBuffer(bucketNumber);
+    }
+}
+
+void DeduplicationBuckets::flushBuffer(size_t bucketNumber) {
+    if (files[bucketNumber]->write(buffers[bucketNumber], bufferLengths[bucketNumber]) != bufferLengths[bucketNumber]) {
+        wcout << "Error: cannot write to temporary bucket file [" << getBucketPath(bucketNumber) << "], disk may be full" << endl;
+        remove();
+        exit(ERROR_WRITE_FAULT);
+    }
+    bufferLengths[bucketNumber] = 0;
+}
+
+void DeduplicationBuckets::finishWriting(void) {
+    for (size_t bucketNumber = 0; bucketNumber < files.size(); bucketNumber++) {
+        if (files[bucketNumber] != NULL) {
+            if (bufferLengths[bucketNumber] > 0) flushBuffer(bucketNumber);
+            fileClose(files[bucketNumber]);
+        }
+        if (buffers[bucketNumber] != NULL) freeIOBuffer(buffers[bucketNumber]);
+    }
+    files.clear();
+    buffers.clear();
+    bufferLengths.clear();
+}
+
+void DeduplicationBuckets::remove(void) noexcept {
+    error_code removingError;
+    fs::remove_all(toFilesystemPath(directory), removingError);
+}
+
+bool BucketLinesReader::readLine(const char** linePtr, size_t* lineLengthPtr) {
+    while (true) {
+        char* lineEnd = static_cast<char*>(memchr(buffer.data() + lineStart, '\n', dataEnd - lineStart));
+        if (lineEnd != NULL) {
+            *linePtr = buffer.data() + lineStart;
+            *lineLengthPtr = static_cast<size_t>(lineEnd - *linePtr) + 1;
+            lineStart += *lineLengthPtr;
+            return true;
+        }
+        // Незаконченная строка переносится в начало буфера, а если она занимает весь буфер - буфер увеличивается
+        memmove(buffer.data(), buffer.data() + lineStart, dataEnd - lineStart);
+        dataEnd -= lineStart;
+        lineStart = 0;
+        if (dataEnd == buffer.size()) buffer.resize(buffer.size() * 2);
+        size_t readedBytesCount = file->read(buffer.data() + dataEnd, buffer.size() - dataEnd);
+        if (readedBytesCount == 0) return false;
+        dataEnd += readedBytesCount;
+    }
+}
+
+const char* StringsArena::store(const char* string, size_t stringLength) {
+    if (stringLength > freeSpaceSize) {
+        // Строки длиннее блока получают свой отдельный блок, а остаток текущего блока не используется
+        size_t blockSize = max(STRINGS_ARENA_BLOCK_SIZE, stringLength);
+        blocks.push_back(unique_ptr<char[]>(new char[blockSize]));
+        freeSpace = blocks.back().get();
+        freeSpaceSize = blockSize;
+    }
+    char* storedString = freeSpace;
+    memcpy(storedString, string, stringLength);
+    freeSpace += stringLength;
+    freeSpaceSize -= stringLength;
+    return storedString;
+}
+
+void StringsArena::clear(void) noexcept {
+    blocks.clear();
+    freeSpace = NULL;
+    freeSpaceSize = 0;
+}
@@ -0,0 +1,796 @@
+﻿#include "fileio.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <vector>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define THEO_IO_URING_SUPPORTED
+#endif
+#endif
+
+FileIOParameters fileIOParameters;
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+
+// Файл, открытый через стандартные потоки C, единственный бэкенд на Windows
+class StdioFile : public File {
+private:
+	FILE* stream;
+public:
+	explicit StdioFile(FILE* openedStream) : stream(openedStream) {}
+	~StdioFile() override { fclose(stream); }
+
+	size_t read(char* buffer, size_t bytesCount) override {
+		size_t bytesReaded = fread(buffer, sizeof(char), bytesCount, stream);
+		if (bytesReaded < bytesCount) isEndReached = true;
+		return bytesReaded;
+	}
+
+	size_t write(const char* buffer, size_t bytesCount) override {
+		return fwrite(buffer, sizeof(char), bytesCount, stream);
+	}
+
+	long long size(void) override {
+		long long currentPos = _ftelli64(stream); // Получаем текущую позицию в файле по указателю
+		_fseeki64(stream, 0L, SEEK_END); // Перемещаем указатель в самый конец файла
+		// Получаем позицию в конце файла (то есть, по сути, количество байт в нём)
+		long long fileSizeInBytes = _ftelli64(stream);
+		// Возвращаем позицию указателя на начальную, которая была до наших манипуляций
+		_fseeki64(stream, currentPos, SEEK_SET);
+		return fileSizeInBytes;
+	}
+
+	NativeFileHandle getNativeHandle(void) override {
+		return (HANDLE)_get_osfhandle(_fileno(stream));
+	}
+
+	bool seek(unsigned long long offset) override {
+		isEndReached = false;
+		return _fseeki64(stream, static_cast<long long>(offset), SEEK_SET) == 0;
+	}
+};
+
+File* openPlatformFile(const std::wstring& filePath, FileOpenMode mode) noexcept {
+	FILE* stream = _wfopen(filePath.c_str(), mode == FileOpenMode::Read ? L"rb" : L"wb+");
+	if (stream == NULL) return NULL;
+	return new StdioFile(stream);
+}
+
+// Стандартный ввод или вывод. В отличие от StdioFile, поток при закрытии не закрывается, а только сбрасывается
+class StandardStreamFile : public File {
+private:
+	FILE* stream;
+public:
+	explicit StandardStreamFile(FILE* standardStream) : stream(standardStream) {
+		// Иначе Windows заменяет \n на \r\n при записи и останавливает чтение на символе Ctrl+Z
+		_setmode(_fileno(stream), _O_BINARY);
+	}
+	~StandardStreamFile() override { fflush(stream); }
+
+	size_t read(char* buffer, size_t bytesCount) override {
+		size_t bytesReaded = fread(buffer, sizeof(char), bytesCount, stream);
+		if (bytesReaded < bytesCount) isEndReached = true;
+		return bytesReaded;
+	}
+
+	size_t write(const char* buffer, size_t bytesCount) override {
+		return fwrite(buffer, sizeof(char), bytesCount, stream);
+	}
+
+	long long size(void) override { return -1; }
+
+	NativeFileHandle getNativeHandle(void) override {
+		return (HANDLE)_get_osfhandle(_fileno(stream));
+	}
+
+	bool seek(unsigned long long) override { return false; }
+};
+
+File* openStandardStream(FileOpenMode mode) noexcept {
+	return new StandardStreamFile(mode == FileOpenMode::Read ? stdin : stdout);
+}
+
+#else
+
+/* Файл, открытый POSIX-вызовом open. Читается и записывается через pread/pwrite с собственной текущей позицией:
+* за один вызов ядро может прочитать или записать меньше, чем запрошено (например, не больше ~2 гигабайт),
+* поэтому вызовы повторяются, пока не будет обработан весь буфер */
+class PosixFile : public File {
+protected:
+	int descriptor;
+	unsigned long long position = 0; // Смещение в файле, с которого начнётся следующее чтение или запись
+	bool isPreallocated = false; // Выделялось ли место за концом файла, которое надо освободить при закрытии
+public:
+	explicit PosixFile(int openedDescriptor) : descriptor(openedDescriptor) {}
+	~PosixFile() override {
+		/* Место, выделенное с FALLOC_FL_KEEP_SIZE, остаётся за концом файла и после закрытия. Обрезка файла
+		* до его же текущего размера освобождает всё, что не понадобилось */
+		struct stat fileInfo;
+		if (isPreallocated && fstat(descriptor, &fileInfo) == 0) (void)!ftruncate(descriptor, fileInfo.st_size);
+		close(descriptor);
+	}
+
+	size_t read(char* buffer, size_t bytesCount) override {
+		size_t bytesReaded = 0;
+		while (bytesReaded < bytesCount) {
+			ssize_t result = pread(descriptor, &buffer[bytesReaded], bytesCount - bytesReaded, position);
+			if (result < 0 && errno == EINTR) continue;
+			if (result <= 0) break;
+			bytesReaded += result;
+			position += result;
+		}
+		if (bytesReaded < bytesCount) isEndReached = true;
+		return bytesReaded;
+	}
+
+	size_t write(const char* buffer, size_t bytesCount) override {
+		size_t bytesWrited = 0;
+		while (bytesWrited < bytesCount) {
+			ssize_t result = pwrite(descriptor, &buffer[bytesWrited], bytesCount - bytesWrited, position);
+			if (result < 0 && errno == EINTR) continue;
+			if (result <= 0) break;
+			bytesWrited += result;
+			position += result;
+		}
+		return bytesWrited;
+	}
+
+	long long size(void) override {
+		struct stat fileInfo;
+		if (fstat(descriptor, &fileInfo) != 0) return -1;
+		return fileInfo.st_size;
+	}
+
+	NativeFileHandle getNativeHandle(void) override {
+		return descriptor;
+	}
+
+	bool seek(unsigned long long offset) override {
+		isEndReached = false;
+		position = offset;
+		return true;
+	}
+
+	bool preallocate(unsigned long long bytesCount) override {
+#ifdef FALLOC_FL_KEEP_SIZE
+		// Размер файла не меняется, поэтому, даже если программа прервётся, в конце файла не останется нулевых байт
+		if (bytesCount == 0 || fallocate(descriptor, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(position), static_cast<off_t>(bytesCount)) != 0) return false;
+		isPreallocated = true;
+		return true;
+#else
+		return false;
+#endif
+	}
+};
+
+/* Стандартный ввод или вывод: это может быть канал (pipe) или терминал, в которых нет смещений, поэтому вместо
+* pread/pwrite используются read/write. Дескриптор при закрытии не закрывается, он принадлежит процессу */
+class StandardStreamFile : public File {
+private:
+	int descriptor;
+public:
+	explicit StandardStreamFile(int standardDescriptor) : descriptor(standardDescriptor) {}
+
+	// Из канала за один вызов приходит столько, сколько успел записать другой процесс, поэтому читаем до конца буфера или ввода
+	size_t read(char* buffer, size_t bytesCount) override {
+		size_t bytesReaded = 0;
+		while (bytesReaded < bytesCount) {
+			ssize_t result = ::read(descriptor, &buffer[bytesReaded], bytesCount - bytesReaded);
+			if (result < 0 && errno == EINTR) continue;
+			if (result <= 0) break;
+			bytesReaded += result;
+		}
+		if (bytesReaded < bytesCount) isEndReached = true;
+		return bytesReaded;
+	}
+
+	size_t write(const char* buffer, size_t bytesCount) override {
+		size_t bytesWrited = 0;
+		while (bytesWrited < bytesCount) {
+			ssize_t result = ::write(descriptor, &buffer[bytesWrited], bytesCount - bytesWrited);
+			if (result < 0 && errno == EINTR) continue;
+			if (result <= 0) break;
+			bytesWrited += result;
+		}
+		return bytesWrited;
+	}
+
+	long long size(void) override { return -1; }
+
+	NativeFileHandle getNativeHandle(void) override {
+		return descriptor;
+	}
+
+	bool seek(unsigned long long) override { return false; }
+};
+
+File* openStandardStream(FileOpenMode mode) noexcept {
+	return new StandardStreamFile(mode == FileOpenMode::Read ? STDIN_FILENO : STDOUT_FILENO);
+}
+
+#ifdef THEO_IO_URING_SUPPORTED
+
+// Размер одного блока, на которые разбивается большое чтение или запись, и сколько блоков может быть в ядре одновременно
+constexpr size_t IO_URING_BLOCK_SIZE = 1024 * 1024 * 2;
+constexpr unsigned IO_URING_QUEUE_DEPTH = 32;
+
+/* Кольца отправки и завершения io_uring, работа с ними напрямую через системные вызовы, без liburing.
+* Заполняет запросы и забирает результаты только один поток, поэтому синхронизация нужна лишь с ядром */
+class IoUringQueue {
+private:
+	int ringDescriptor = -1;
+	void* submissionRingMemory = MAP_FAILED;
+	size_t submissionRingSize = 0;
+	void* completionRingMemory = MAP_FAILED;
+	size_t completionRingSize = 0;
+	io_uring_sqe* submissionEntries = (io_uring_sqe*)MAP_FAILED;
+	size_t submissionEntriesSize = 0;
+
+	unsigned* submissionHead = NULL;
+	unsigned* submissionTail = NULL;
+	unsigned submissionRingMask = 0;
+	unsigned* submissionArray = NULL;
+	unsigned* completionHead = NULL;
+	unsigned* completionTail = NULL;
+	unsigned completionRingMask = 0;
+	io_uring_cqe* completionEntries = NULL;
+public:
+	~IoUringQueue() {
+		if (submissionEntries != MAP_FAILED) munmap(submissionEntries, submissionEntriesSize);
+		if (completionRingMemory != MAP_FAILED && completionRingMemory != submissionRingMemory) munmap(completionRingMemory, completionRingSize);
+		if (submissionRingMemory != MAP_FAILED) munmap(submissionRingMemory, submissionRingSize);
+		if (ringDescriptor >= 0) close(ringDescriptor);
+	}
+
+	/* Создаёт кольца на entriesCount запросов. Возвращает false, если ядро не поддерживает io_uring, он запрещён
+	* или в ядре нет запросов чтения и записи */
+	bool init(unsigned entriesCount) {
+		io_uring_params parameters = {};
+		ringDescriptor = static_cast<int>(syscall(__NR_io_uring_setup, entriesCount, &parameters));
+		if (ringDescriptor < 0) return false;
+
+		submissionRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+		completionRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+		// Новые ядра отображают оба кольца одним участком памяти
+		bool isSingleMapping = parameters.features & IORING_FEAT_SINGLE_MMAP;
+		if (isSingleMapping) submissionRingSize = completionRingSize = std::max(submissionRingSize, completionRingSize);
+
+		submissionRingMemory = mmap(NULL, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQ_RING);
+		if (submissionRingMemory == MAP_FAILED) return false;
+		completionRingMemory = isSingleMapping ? submissionRingMemory : mmap(NULL, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_CQ_RING);
+		if (completionRingMemory == MAP_FAILED) return false;
+		submissionEntriesSize = parameters.sq_entries * sizeof(io_uring_sqe);
+		submissionEntries = (io_uring_sqe*)mmap(NULL, submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQES);
+		if (submissionEntries == MAP_FAILED) return false;
+
+		char* submissionRing = (char*)submissionRingMemory;
+		submissionHead = (unsigned*)(submissionRing + parameters.sq_off.head);
+		submissionTail = (unsigned*)(submissionRing + parameters.sq_off.tail);
+		submissionRingMask = *(unsigned*)(submissionRing + parameters.sq_off.ring_mask);
+		submissionArray = (unsigned*)(submissionRing + parameters.sq_off.array);
+		char* completionRing = (char*)completionRingMemory;
+		completionHead = (unsigned*)(completionRing + parameters.cq_off.head);
+		completionTail = (unsigned*)(completionRing + parameters.cq_off.tail);
+		completionRingMask = *(unsigned*)(completionRing + parameters.cq_off.ring_mask);
+		completionEntries = (io_uring_cqe*)(completionRing + parameters.cq_off.cqes);
+		return isReadWriteSupported();
+	}
+
+	/* Поддерживает ли ядро запросы IORING_OP_READ и IORING_OP_WRITE. Они появились в Linux 5.6 вместе с проверкой
+	* IORING_REGISTER_PROBE, а более старые ядра создают кольца, но на каждый такой запрос возвращают -EINVAL */
+	bool isReadWriteSupported(void) {
+		constexpr unsigned probeOperationsCount = 256;
+		std::vector<char> probeMemory(sizeof(io_uring_probe) + probeOperationsCount * sizeof(io_uring_probe_op), 0);
+		io_uring_probe* probe = (io_uring_probe*)probeMemory.data();
+		if (syscall(__NR_io_uring_register, ringDescriptor, IORING_REGISTER_PROBE, probe, probeOperationsCount) < 0) return false;
+		auto isSupported = [probe](unsigned opcode) { return opcode <= probe->last_op && opcode < probe->ops_len && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED); };
+		return isSupported(IORING_OP_READ) && isSupported(IORING_OP_WRITE);
+	}
+
+	// Добавляет в кольцо отправки запрос чтения или записи, в ядро он уйдёт при следующем вызове submitAndWait
+	void prepare(bool isWrite, int fileDescriptor, char* buffer, unsigned bytesCount, unsigned long long offset, unsigned long long userData) {
+		unsigned tail = *submissionTail;
+		unsigned index = tail & submissionRingMask;
+		io_uring_sqe& entry = submissionEntries[index];
+		entry = {};
+		entry.opcode = isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+		entry.fd = fileDescriptor;
+		entry.addr = (unsigned long long)buffer;
+		entry.len = bytesCount;
+		entry.off = offset;
+		entry.user_data = userData;
+		submissionArray[index] = index;
+		// Ядро должно увидеть заполненный запрос раньше, чем новый хвост кольца
+		__atomic_store_n(submissionTail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	// Отправляет в ядро все подготовленные запросы и ждёт хотя бы одного завершения. Возвращает false при ошибке io_uring
+	bool submitAndWait(void) {
+		while (true) {
+			unsigned notSubmittedCount = *submissionTail - __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE);
+			long result = syscall(__NR_io_uring_enter, ringDescriptor, notSubmittedCount, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (result >= 0) return true;
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+		}
+	}
+
+	/* Ждёт, пока в кольце завершения появится хотя бы один результат, ничего не отправляя в ядро. Если не работает
+	* и ожидание через io_uring_enter, результата дожидаемся опросом кольца */
+	void waitCompletion(void) {
+		while (*completionHead == __atomic_load_n(completionTail, __ATOMIC_ACQUIRE)) {
+			long result = syscall(__NR_io_uring_enter, ringDescriptor, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) sched_yield();
+		}
+	}
+
+	/* Убирает из кольца отправки запросы, которые ядро ещё не забрало, и возвращает их количество. Без SQPOLL
+	* ядро забирает запросы только внутри io_uring_enter, поэтому хвост кольца можно безопасно вернуть назад */
+	unsigned discardNotSubmitted(void) {
+		unsigned head = __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE);
+		unsigned notSubmittedCount = *submissionTail - head;
+		__atomic_store_n(submissionTail, head, __ATOMIC_RELEASE);
+		return notSubmittedCount;
+	}
+
+	// Забирает один результат из кольца завершения, если он там есть
+	bool popCompletion(io_uring_cqe& completion) {
+		unsigned head = *completionHead;
+		if (head == __atomic_load_n(completionTail, __ATOMIC_ACQUIRE)) return false;
+		completion = completionEntries[head & completionRingMask];
+		__atomic_store_n(completionHead, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+};
+
+/* Файл, чтение и запись которого идут через io_uring: буфер делится на блоки по IO_URING_BLOCK_SIZE, и до
+* IO_URING_QUEUE_DEPTH блоков одновременно находятся в ядре. Каждому файлу - свои кольца, поскольку файлом
+* всегда пользуется один поток (например, входной файл - поток чтения, итоговый - поток записи) */
+class IoUringFile : public PosixFile {
+private:
+	IoUringQueue queue;
+
+	/* Читает или записывает буфер блоками, пока все блоки не будут обработаны полностью. Возвращает количество
+	* байт от начала буфера, обработанных без пропусков: при чтении - до конца файла, при записи - до первой ошибки.
+	* Если какой-то блок завершился ошибкой (или сломался сам io_uring), в isFailedPtr записывается true: тогда
+	* остаток буфера - не конец файла, его надо дочитать или дописать обычными pread/pwrite. Возвращается, только
+	* когда в ядре не осталось ни одного запроса к этому буферу */
+	size_t transfer(bool isWrite, char* buffer, size_t bytesCount, bool* isFailedPtr) {
+		size_t blocksCount = (bytesCount + IO_URING_BLOCK_SIZE - 1) / IO_URING_BLOCK_SIZE;
+		std::vector<size_t> blocksDoneBytes(blocksCount, 0);
+		auto getBlockLength = [&](size_t block) { return std::min(IO_URING_BLOCK_SIZE, bytesCount - block * IO_URING_BLOCK_SIZE); };
+		// Отправляет в ядро (оставшуюся) часть блока
+		auto prepareBlock = [&](size_t block) {
+			size_t blockStart = block * IO_URING_BLOCK_SIZE + blocksDoneBytes[block];
+			queue.prepare(isWrite, descriptor, &buffer[blockStart], static_cast<unsigned>(getBlockLength(block) - blocksDoneBytes[block]), position + blockStart, block);
+		};
+
+		size_t nextBlockToPrepare = 0;
+		unsigned blocksInFlightCount = 0;
+		bool isFailed = false;
+		bool isSubmissionBroken = false;
+		while (true) {
+			while (!isFailed && blocksInFlightCount < IO_URING_QUEUE_DEPTH && nextBlockToPrepare < blocksCount) {
+				prepareBlock(nextBlockToPrepare++);
+				blocksInFlightCount++;
+			}
+			if (blocksInFlightCount == 0) break;
+			/* Если отправка в io_uring сломалась, больше к этому файлу через io_uring не обращаемся, а ещё не отправленные
+			* блоки убираем из кольца. Но уже отправленные блоки ядро продолжает читать в буфер (или записывать из него),
+			* поэтому буфер нельзя вернуть вызывающему, пока не придут результаты всех этих блоков */
+			if (isSubmissionBroken) queue.waitCompletion();
+			else if (!queue.submitAndWait()) {
+				isUringBroken = true;
+				isSubmissionBroken = true;
+				isFailed = true;
+				blocksInFlightCount -= queue.discardNotSubmitted();
+				continue;
+			}
+
+			io_uring_cqe completion;
+			while (queue.popCompletion(completion)) {
+				size_t block = static_cast<size_t>(completion.user_data);
+				int result = completion.res;
+				// Прерванный запрос просто повторяем, ошибку запоминаем и больше новых блоков не отправляем
+				if ((result == -EINTR || result == -EAGAIN) && !isSubmissionBroken) {
+					prepareBlock(block);
+					continue;
+				}
+				blocksInFlightCount--;
+				if (result < 0) {
+					// Запрос, не поддерживаемый ядром или файловой системой, не заработает и дальше
+					if (result == -EINVAL || result == -EOPNOTSUPP) isUringBroken = true;
+					isFailed = true;
+					continue;
+				}
+				blocksDoneBytes[block] += result;
+				/* Ядро может обработать блок не полностью, тогда оставшаяся часть отправляется ещё раз.
+				* Ноль при чтении означает конец файла, а при записи - ошибку */
+				if (result > 0 && blocksDoneBytes[block] < getBlockLength(block) && !isFailed) {
+					prepareBlock(block);
+					blocksInFlightCount++;
+				}
+			}
+		}
+
+		size_t processedBytesCount = 0;
+		for (size_t block = 0; block < blocksCount; block++) {
+			processedBytesCount += blocksDoneBytes[block];
+			if (blocksDoneBytes[block] < getBlockLength(block)) break;
+		}
+		position += processedBytesCount;
+		*isFailedPtr = isFailed;
+		return processedBytesCount;
+	}
+public:
+	// Если io_uring перестал работать, файл дальше читается и записывается обычными pread/pwrite
+	bool isUringBroken = false;
+
+	explicit IoUringFile(int openedDescriptor) : PosixFile(openedDescriptor) {}
+
+	bool init(void) {
+		return queue.init(IO_URING_QUEUE_DEPTH);
+	}
+
+	/* Ошибка блока - не конец файла: остаток буфера после последнего целого блока дочитывается (или дописывается)
+	* обычными pread/pwrite, которые сами определят конец файла или ошибку так же, как без io_uring */
+	size_t read(char* buffer, size_t bytesCount) override {
+		if (isUringBroken) return PosixFile::read(buffer, bytesCount);
+		bool isFailed = false;
+		size_t bytesReaded = transfer(false, buffer, bytesCount, &isFailed);
+		if (bytesReaded < bytesCount && isFailed) return bytesReaded + PosixFile::read(&buffer[bytesReaded], bytesCount - bytesReaded);
+		if (bytesReaded < bytesCount) isEndReached = true;
+		return bytesReaded;
+	}
+
+	size_t write(const char* buffer, size_t bytesCount) override {
+		if (isUringBroken) return PosixFile::write(buffer, bytesCount);
+		bool isFailed = false;
+		size_t bytesWrited = transfer(true, const_cast<char*>(buffer), bytesCount, &isFailed);
+		if (bytesWrited < bytesCount && isFailed) return bytesWrited + PosixFile::write(&buffer[bytesWrited], bytesCount - bytesWrited);
+		return bytesWrited;
+	}
+};
+
+#endif // THEO_IO_URING_SUPPORTED
+
+// Размер буфера, в котором при direct I/O копятся записываемые данные, пока не наберётся блок выровненной длины
+constexpr size_t DIRECT_IO_WRITE_BUFFER_SIZE = 1024 * 1024 * 8;
+
+/* Файл, открытый с O_DIRECT, поверх обычного или io_uring-файла с тем же дескриптором. Ядро выполняет такие
+* чтение и запись мимо системного кеша, только если адрес буфера, смещение и длина кратны DIRECT_IO_ALIGNMENT:
+* - чтение выровненного запроса (буферы чанков выделяются через allocateIOBuffer) идёт прямо в буфер вызывающего,
+*   а невыровненного - обычным образом, через кеш, с временно снятым с дескриптора флагом O_DIRECT;
+* - записываемые данные копятся в собственном выровненном буфере и записываются на диск блоками выровненной длины,
+*   и только хвост файла короче DIRECT_IO_ALIGNMENT при закрытии записывается через кеш */
+class DirectIOFile : public File {
+private:
+	File* file;
+	int descriptor;
+	bool isDirectModeEnabled = true; // Установлен ли сейчас на дескрипторе флаг O_DIRECT
+	unsigned long long position = 0; // Смещение следующего чтения или записи с учётом ещё не записанных данных
+	char* writeBuffer = NULL;
+	size_t writeBufferLength = 0;
+	bool isWriteFailed = false;
+
+	void setDirectMode(bool isEnabled) {
+		if (isEnabled == isDirectModeEnabled) return;
+		int flags = fcntl(descriptor, F_GETFL);
+		if (flags < 0 || fcntl(descriptor, F_SETFL, isEnabled ? flags | O_DIRECT : flags & ~O_DIRECT) != 0) return;
+		isDirectModeEnabled = isEnabled;
+	}
+
+	static bool isAligned(unsigned long long value) { return value % DIRECT_IO_ALIGNMENT == 0; }
+
+	/* Записывает накопленные данные: блоки выровненной длины - мимо кеша, а остаток (если needWriteTail)
+	* - через кеш. Без needWriteTail остаток переносится в начало буфера и ждёт следующих данных */
+	void flushWriteBuffer(bool needWriteTail) {
+		size_t alignedLength = writeBufferLength - writeBufferLength % DIRECT_IO_ALIGNMENT;
+		if (alignedLength > 0) {
+			setDirectMode(true);
+			if (file->write(writeBuffer, alignedLength) != alignedLength) isWriteFailed = true;
+		}
+		size_t tailLength = writeBufferLength - alignedLength;
+		if (tailLength > 0 && needWriteTail) {
+			setDirectMode(false);
+			if (file->write(&writeBuffer[alignedLength], tailLength) != tailLength) isWriteFailed = true;
+			tailLength = 0;
+		}
+		if (tailLength > 0) memmove(writeBuffer, &writeBuffer[alignedLength], tailLength);
+		writeBufferLength = tailLength;
+	}
+public:
+	explicit DirectIOFile(File* openedFile) : file(openedFile), descriptor(openedFile->getNativeHandle()) {}
+	~DirectIOFile() override {
+		if (writeBufferLength > 0) flushWriteBuffer(true);
+		freeIOBuffer(writeBuffer);
+		delete file;
+	}
+
+	size_t read(char* buffer, size_t bytesCount) override {
+		setDirectMode(isAligned(reinterpret_cast<uintptr_t>(buffer)) && isAligned(bytesCount) && isAligned(position));
+		size_t bytesReaded = file->read(buffer, bytesCount);
+		position += bytesReaded;
+		if (bytesReaded < bytesCount) isEndReached = true;
+		return bytesReaded;
+	}
+
+	size_t write(const char* buffer, size_t bytesCount) override {
+		if (writeBuffer == NULL) writeBuffer = allocateIOBuffer(DIRECT_IO_WRITE_BUFFER_SIZE);
+		size_t bytesWrited = 0;
+		while (bytesWrited < bytesCount && !isWriteFailed) {
+			size_t partLength = std::min(bytesCount - bytesWrited, DIRECT_IO_WRITE_BUFFER_SIZE - writeBufferLength);
+			memcpy(&writeBuffer[writeBufferLength], &buffer[bytesWrited], partLength);
+			writeBufferLength += partLength;
+			bytesWrited += partLength;
+			if (writeBufferLength == DIRECT_IO_WRITE_BUFFER_SIZE) flushWriteBuffer(false);
+		}
+		position += bytesWrited;
+		return isWriteFailed ? 0 : bytesWrited;
+	}
+
+	long long size(void) override {
+		return std::max(file->size(), static_cast<long long>(position));
+	}
+
+	NativeFileHandle getNativeHandle(void) override {
+		return descriptor;
+	}
+
+	bool seek(unsigned long long offset) override {
+		if (writeBufferLength > 0) flushWriteBuffer(true);
+		isEndReached = false;
+		position = offset;
+		return file->seek(offset);
+	}
+
+	bool preallocate(unsigned long long bytesCount) override {
+		// Позиция вложенного файла отстаёт на ещё не записанные данные из буфера
+		return file->preallocate(bytesCount + writeBufferLength);
+	}
+};
+
+File* openPlatformFile(const std::wstring& filePath, FileOpenMode mode) noexcept {
+	std::filesystem::path systemPath = toFilesystemPath(filePath);
+	int openFlags = mode == FileOpenMode::Read ? O_RDONLY : O_RDWR | O_CREAT | O_TRUNC;
+	bool isDirectIO = fileIOParameters.useDirectIO;
+	int descriptor = open(systemPath.c_str(), openFlags | O_CLOEXEC | (isDirectIO ? O_DIRECT : 0), 0666);
+	// Некоторые файловые системы (например, tmpfs) не поддерживают O_DIRECT, их файлы работают через кеш
+	if (descriptor < 0 && isDirectIO && errno == EINVAL) {
+		isDirectIO = false;
+		descriptor = open(systemPath.c_str(), openFlags | O_CLOEXEC, 0666);
+		static std::once_flag warningShown;
+		if (descriptor >= 0) std::call_once(warningShown, []() { std::cout << "Warning: direct I/O is not supported by file system, some files will be read and written via page cache" << std::endl; });
+	}
+	if (descriptor < 0) return NULL;
+	// Входные файлы всегда читаются последовательно от начала до конца, ядро может читать с диска наперёд
+	if (mode == FileOpenMode::Read && !isDirectIO) posix_fadvise(descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	File* file = NULL;
+#ifdef THEO_IO_URING_SUPPORTED
+	if (fileIOParameters.useIoUring) {
+		IoUringFile* uringFile = new IoUringFile(descriptor);
+		// Если io_uring недоступен, дескриптор закрывать не надо, файл дальше работает как обычный
+		if (!uringFile->init()) {
+			uringFile->isUringBroken = true;
+			static std::once_flag warningShown;
+			std::call_once(warningShown, []() { std::cout << "Warning: io_uring is not available on this system, regular I/O will be used" << std::endl; });
+		}
+		file = uringFile;
+	}
+#endif
+	if (file == NULL) file = new PosixFile(descriptor);
+	if (isDirectIO) return new DirectIOFile(file);
+	return file;
+}
+
+#endif // _WIN32
+
+#ifdef _WIN32
+
+std::filesystem::path toFilesystemPath(const std::wstring& path) {
+	return std::filesystem::path(path);
+}
+
+std::wstring fromFilesystemPath(const std::filesystem::path& path) {
+	return path.wstring();
+}
+
+#else
+
+// wchar_t на Linux 32-битный, поэтому каждый символ wide-строки - отдельный код символа Unicode
+std::filesystem::path toFilesystemPath(const std::wstring& path) {
+	std::string utf8Path;
+	utf8Path.reserve(path.length());
+	for (wchar_t symbol : path) {
+		unsigned int code = static_cast<unsigned int>(symbol);
+		if (code < 0x80) utf8Path += static_cast<char>(code);
+		else if (code < 0x800) {
+			utf8Path += static_cast<char>(0xC0 | (code >> 6));
+			utf8Path += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000) {
+			utf8Path += static_cast<char>(0xE0 | (code >> 12));
+			utf8Path += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			utf8Path += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else {
+			utf8Path += static_cast<char>(0xF0 | ((code >> 18) & 0x07));
+			utf8Path += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+			utf8Path += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			utf8Path += static_cast<char>(0x80 | (code & 0x3F));
+		}
+	}
+	return std::filesystem::path(utf8Path);
+}
+
+/* Имена файлов на Linux - просто байты и не обязаны быть корректным UTF-8, поэтому байты, которые не удалось
+* разобрать как UTF-8, переводятся как есть, по одному символу на байт, чтобы путь не потерялся */
+std::wstring fromFilesystemPath(const std::filesystem::path& path) {
+	const std::string& utf8Path = path.native();
+	std::wstring widePath;
+	widePath.reserve(utf8Path.length());
+	for (size_t i = 0; i < utf8Path.length(); i++) {
+		unsigned char leadByte = static_cast<unsigned char>(utf8Path[i]);
+		size_t continuationBytesCount = leadByte >= 0xF0 && leadByte < 0xF8 ? 3 : leadByte >= 0xE0 ? 2 : leadByte >= 0xC0 ? 1 : 0;
+		unsigned int code = continuationBytesCount == 3 ? leadByte & 0x07 : continuationBytesCount == 2 ? leadByte & 0x0F : leadByte & 0x1F;
+		bool isValidSequence = continuationBytesCount > 0 && i + continuationBytesCount < utf8Path.length();
+		for (size_t j = 1; isValidSequence && j <= continuationBytesCount; j++) {
+			unsigned char nextByte = static_cast<unsigned char>(utf8Path[i + j]);
+			isValidSequence = (nextByte & 0xC0) == 0x80;
+			code = (code << 6) | (nextByte & 0x3F);
+		}
+		if (!isValidSequence) {
+			widePath += static_cast<wchar_t>(leadByte);
+			continue;
+		}
+		widePath += static_cast<wchar_t>(code);
+		i += continuationBytesCount;
+	}
+	return widePath;
+}
+
+#endif // _WIN32
+
+void fileClose(File* file) noexcept {
+	delete file;
+}
+
+char* allocateIOBuffer(size_t bytesCount) {
+	return static_cast<char*>(::operator new[](bytesCount, std::align_val_t(DIRECT_IO_ALIGNMENT)));
+}
+
+void freeIOBuffer(char* buffer) noexcept {
+	::operator delete[](buffer, std::align_val_t(DIRECT_IO_ALIGNMENT));
+}
+
+bool isStandardStreamPath(const std::wstring& path) noexcept {
+	return path == L"-";
+}
+
+void dropFileCache(const std::wstring& filePath) noexcept {
+#ifdef _WIN32
+	/* Открытие файла без системного кеширования (FILE_FLAG_NO_BUFFERING) заставляет систему записать
+	* и выбросить из кеша все закешированные страницы этого файла */
+	HANDLE file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+	int descriptor = open(toFilesystemPath(filePath).c_str(), O_RDONLY | O_CLOEXEC);
+	if (descriptor < 0) return;
+	// Ядро выбрасывает из кеша только уже записанные на диск страницы, поэтому сначала дожидаемся записи
+	fdatasync(descriptor);
+	posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+	close(descriptor);
+#endif
+}
+
+bool IOProfile::load(const std::wstring& profilePath) noexcept {
+	File* profileFile = openPlatformFile(profilePath, FileOpenMode::Read);
+	if (profileFile == NULL) return false;
+	long long profileSize = profileFile->size();
+	std::string profileContent(profileSize > 0 ? static_cast<size_t>(profileSize) : 0, '\0');
+	profileContent.resize(profileFile->read(profileContent.data(), profileContent.size()));
+	fileClose(profileFile);
+
+	measurements.clear();
+	std::istringstream profileStream(profileContent);
+	std::string line;
+	while (std::getline(profileStream, line)) {
+		if (line.empty() || line[0] == '#') continue;
+		std::istringstream lineStream(line);
+		IOProfileMeasurement measurement;
+		if (!(lineStream >> measurement.blockSizeInBytes >> measurement.queueDepth >> measurement.bytesPerSecond)) continue;
+		if (measurement.blockSizeInBytes == 0 || measurement.queueDepth == 0 || measurement.bytesPerSecond <= 0) continue;
+		measurements.push_back(measurement);
+	}
+	return !measurements.empty();
+}
+
+bool IOProfile::save(const std::wstring& profilePath, const std::wstring& volumePath, const std::string& backendName) const noexcept {
+	std::error_code _;
+	std::filesystem::create_directories(toFilesystemPath(profilePath).parent_path(), _);
+	File* profileFile = openPlatformFile(profilePath, FileOpenMode::Write);
+	if (profileFile == NULL) return false;
+
+	std::ostringstream profileStream;
+	profileStream << "# theo I/O profile, created by `theo bench-io`. Read speed for different block sizes and queue depths\n";
+	std::u8string volumeUtf8Path = toFilesystemPath(volumePath).u8string();
+	profileStream << "# volume: " << std::string(volumeUtf8Path.begin(), volumeUtf8Path.end()) << "\n";
+	profileStream << "# backend: " << backendName << "\n";
+	profileStream << "# block_size_bytes queue_depth bytes_per_second\n";
+	profileStream << std::fixed;
+	profileStream.precision(0);
+	for (const IOProfileMeasurement& measurement : measurements) {
+		profileStream << measurement.blockSizeInBytes << ' ' << measurement.queueDepth << ' ' << measurement.bytesPerSecond << "\n";
+	}
+
+	std::string profileContent = profileStream.str();
+	bool isSaved = profileFile->write(profileContent.data(), profileContent.size()) == profileContent.size();
+	fileClose(profileFile);
+	return isSaved;
+}
+
+size_t IOProfile::getBestBlockSize(size_t workersCount) const noexcept {
+	if (measurements.empty()) return 0;
+
+	// Ближайшая глубина очереди, не превышающая количество читателей (или самая маленькая из замеренных)
+	size_t queueDepth = 0, minQueueDepth = measurements.front().queueDepth;
+	for (const IOProfileMeasurement& measurement : measurements) {
+		minQueueDepth = std::min(minQueueDepth, measurement.queueDepth);
+		if (measurement.queueDepth <= workersCount) queueDepth = std::max(queueDepth, measurement.queueDepth);
+	}
+	if (queueDepth == 0) queueDepth = minQueueDepth;
+
+	double maxBytesPerSecond = 0;
+	for (const IOProfileMeasurement& measurement : measurements) {
+		if (measurement.queueDepth == queueDepth) maxBytesPerSecond = std::max(maxBytesPerSecond, measurement.bytesPerSecond);
+	}
+	// Блоки меньше - меньше памяти на буферы, поэтому почти такая же скорость на меньшем блоке лучше
+	size_t bestBlockSize = 0;
+	for (const IOProfileMeasurement& measurement : measurements) {
+		if (measurement.queueDepth != queueDepth || measurement.bytesPerSecond < maxBytesPerSecond * 0.95) continue;
+		if (bestBlockSize == 0 || measurement.blockSizeInBytes < bestBlockSize) bestBlockSize = measurement.blockSizeInBytes;
+	}
+	return bestBlockSize;
+}
+
+std::wstring getDefaultIOProfilePath(void) {
+#ifdef _WIN32
+	const wchar_t* configDirectory = _wgetenv(L"APPDATA");
+	std::filesystem::path configPath = configDirectory != NULL ? std::filesystem::path(configDirectory) : std::filesystem::current_path();
+	return fromFilesystemPath(configPath / L"theo" / L"io_profile.txt");
+#else
+	const char* configDirectory = getenv("XDG_CONFIG_HOME");
+	const char* homeDirectory = getenv("HOME");
+	std::filesystem::path configPath;
+	if (configDirectory != NULL && configDirectory[0] != '\0') configPath = configDirectory;
+	else if (homeDirectory != NULL && homeDirectory[0] != '\0') configPath = std::filesystem::path(homeDirectory) / ".config";
+	else configPath = std::filesystem::current_path();
+	return fromFilesystemPath(configPath / "theo" / "io_profile.txt");
+#endif
+}
+
+std::string getFileIOBackendName(void) {
+#ifdef _WIN32
+	return "stdio";
+#elif defined(THEO_IO_URING_SUPPORTED)
+	return fileIOParameters.useIoUring ? "io_uring" : "posix";
+#else
+	return "posix";
+#endif
+}
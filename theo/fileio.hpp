@@ -0,0 +1,133 @@
+﻿#pragma once
+#ifndef THEO_FILEIO
+#define THEO_FILEIO
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <filesystem>
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+/* Платформенный слой файлового ввода-вывода. Все команды работают с файлами только через класс File,
+* а конкретная реализация (бэкенд) выбирается при открытии файла:
+* - на Windows - стандартные потоки C (_wfopen, fread, fwrite);
+* - на Linux - POSIX-вызовы open/pread/pwrite с подсказкой ядру о последовательном чтении (posix_fadvise);
+* - на Linux при включённом io_uring - каждое большое чтение или запись разбивается на блоки, которые
+*   отправляются в ядро одновременно, чтобы очередь диска (NVMe) всё время была заполнена;
+* - на Linux при включённом прямом вводе-выводе (direct I/O) файлы открываются с O_DIRECT и читаются и записываются
+*   мимо системного кеша (page cache), поверх любого из двух предыдущих бэкендов. */
+
+// Параметры файлового ввода-вывода, общие для всех команд, значения задаются опциями запуска команды
+struct FileIOParameters {
+	// Использовать io_uring для чтения и записи файлов (только Linux, на других системах опция игнорируется)
+	int useIoUring = 0;
+	/* Читать и записывать файлы мимо системного кеша (O_DIRECT, только Linux), а итоговые файлы заранее выделять
+	* на диске. Однократный проход по огромному файлу тогда не вытесняет из кеша данные других программ */
+	int useDirectIO = 0;
+	// Путь к профилю диска, созданному `theo bench-io`. Если не задан - используется профиль по умолчанию (getDefaultIOProfilePath)
+	const char* ioProfilePath = NULL;
+};
+extern FileIOParameters fileIOParameters;
+
+/* Выравнивание адреса буфера, смещения в файле и длины чтения или записи, при котором они выполняются мимо
+* системного кеша. 4 килобайта - размер логического блока практически всех современных дисков */
+constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+/* Выделяет буфер, выровненный по DIRECT_IO_ALIGNMENT, чтобы чтение и запись в него при direct I/O шли напрямую
+* с диска, без промежуточного копирования. Освобождать нужно через freeIOBuffer */
+char* allocateIOBuffer(size_t bytesCount);
+void freeIOBuffer(char* buffer) noexcept;
+
+// Режим открытия файла: только чтение существующего или запись в новый (существующий файл перезаписывается)
+enum class FileOpenMode { Read, Write };
+
+#ifdef _WIN32
+typedef HANDLE NativeFileHandle;
+#else
+typedef int NativeFileHandle;
+#endif
+
+/* Открытый файл. Чтение и запись последовательные, как у fread/fwrite: каждый вызов продолжает с того места,
+* на котором закончил предыдущий. Один объект нельзя одновременно использовать из нескольких потоков */
+class File {
+protected:
+	bool isEndReached = false;
+public:
+	virtual ~File() = default;
+	/* Считывает в буфер до bytesCount байт, возвращает количество реально считанных. Если считано меньше, чем
+	* запрошено, значит, файл закончился (или чтение невозможно), после этого isEndOfFile() возвращает true */
+	virtual size_t read(char* buffer, size_t bytesCount) = 0;
+	// Записывает bytesCount байт из буфера, возвращает количество реально записанных (меньше - при ошибке записи)
+	virtual size_t write(const char* buffer, size_t bytesCount) = 0;
+	// Возвращает размер файла в байтах, если размер получить не удалось - -1
+	virtual long long size(void) = 0;
+	// Системный дескриптор файла, нужен, например, для отображения файла в память
+	virtual NativeFileHandle getNativeHandle(void) = 0;
+	// Переносит позицию следующего чтения или записи на offset байт от начала файла. Возвращает false при ошибке
+	virtual bool seek(unsigned long long offset) = 0;
+	/* Заранее выделяет на диске место под bytesCount байт, которые будут записаны начиная с текущей позиции,
+	* чтобы файл не рос множеством мелких расширений. Размер файла при этом не меняется, а неиспользованное место
+	* освобождается при закрытии. Возвращает false, если файловая система или бэкенд этого не поддерживают */
+	virtual bool preallocate(unsigned long long) { return false; }
+	// Аналог feof: true, если при последнем чтении файл закончился
+	bool isEndOfFile(void) const noexcept { return isEndReached; }
+};
+
+/* Путь, который вместо файла означает стандартный ввод (при чтении) или стандартный вывод (при записи), как
+* у большинства консольных утилит. Позволяет соединять команды theo через конвейер (pipe) без промежуточных файлов */
+bool isStandardStreamPath(const std::wstring& path) noexcept;
+
+/* Открывает стандартный ввод (FileOpenMode::Read) или вывод (FileOpenMode::Write) в бинарном режиме как File.
+* Размер такого файла неизвестен (size() возвращает -1), перемещаться по нему нельзя, а при закрытии сам поток
+* не закрывается. Чтение, как и у обычного файла, возвращает меньше запрошенного только в конце ввода */
+File* openStandardStream(FileOpenMode mode) noexcept;
+
+/* Открывает файл по уже подготовленному системному пути бэкендом, подходящим для текущей системы и параметров
+* в fileIOParameters. При невозможности открыть возвращает NULL. Закрывать файл нужно через fileClose */
+File* openPlatformFile(const std::wstring& filePath, FileOpenMode mode) noexcept;
+
+/* Переводят путь из wide-строки в объект std::filesystem::path и обратно. На Linux filesystem переводит wide-строки
+* в системную кодировку по локали "C" и бросает исключение на любом символе не из ASCII (например, кириллице),
+* поэтому пути в файловую систему всегда передаются через эти функции, в UTF-8 */
+std::filesystem::path toFilesystemPath(const std::wstring& path);
+std::wstring fromFilesystemPath(const std::filesystem::path& path);
+
+/* Сбрасывает из системного кеша (page cache) закешированное содержимое файла, предварительно записав на диск
+* изменённые данные, чтобы следующее чтение шло с самого диска. Нужно для честного замера скорости чтения */
+void dropFileCache(const std::wstring& filePath) noexcept;
+
+// Один замер скорости чтения диска: размер блока одного чтения, сколько читателей читали одновременно и общая скорость
+struct IOProfileMeasurement {
+	size_t blockSizeInBytes = 0;
+	size_t queueDepth = 0;
+	double bytesPerSecond = 0;
+};
+
+/* Профиль диска (тома), созданный командой `theo bench-io`: скорость чтения при разных размерах блока и количестве
+* одновременных читателей. По нему команды выбирают размер чанка вместо фиксированного OPTIMAL_DISK_CHUNK_SIZE.
+* Хранится в текстовом файле, по одному замеру на строку, строки с # - комментарии */
+struct IOProfile {
+	std::vector<IOProfileMeasurement> measurements;
+	// Загружает профиль из файла, возвращает false, если файла нет или в нём нет ни одного замера
+	bool load(const std::wstring& profilePath) noexcept;
+	// Сохраняет профиль в файл (создавая недостающие директории), в комментариях указывается, какой том замерялся
+	bool save(const std::wstring& profilePath, const std::wstring& volumePath, const std::string& backendName) const noexcept;
+	/* Лучший размер блока, если диск одновременно читают workersCount читателей: берутся замеры с ближайшей
+	* не большей глубиной очереди, из них - самый маленький блок, скорость которого не более чем на 5% ниже максимальной.
+	* Если замеров нет, возвращает 0 */
+	size_t getBestBlockSize(size_t workersCount) const noexcept;
+};
+
+/* Путь к профилю диска по умолчанию: %APPDATA%\theo\io_profile.txt на Windows,
+* $XDG_CONFIG_HOME/theo/io_profile.txt (или ~/.config/theo/io_profile.txt) на Linux */
+std::wstring getDefaultIOProfilePath(void);
+
+// Название бэкенда, которым будут открываться файлы при текущих параметрах (для профиля и вывода пользователю)
+std::string getFileIOBackendName(void);
+
+// Закрывает файл (записываемый - с записью всех ещё не записанных данных) и освобождает объект. NULL игнорируется
+void fileClose(File* file) noexcept;
+
+#endif // !THEO_FILEIO
@@ -0,0 +1,209 @@
+﻿#include <cmath>
+#include "utils.hpp"
+
+// Число для перемешивания хеша строки перед выбором корзины и отпечатка, чтобы они не зависели от частей хешей dedup
+constexpr uint64_t FINGERPRINT_FILTERS_HASH_SEED = 0x4b33a62ed433d4a3ull;
+// Число для перемешивания отпечатка при вычислении его второй корзины
+constexpr uint64_t CUCKOO_ALTERNATE_BUCKET_SEED = 0x4d5a2da51de1aa47ull;
+
+// Сколько раз при вставке отпечатки вытесняются в свои вторые корзины, прежде чем фильтр признаётся заполненным
+constexpr size_t CUCKOO_MAX_KICKS_COUNT = 500;
+
+// Допустимая длина отпечатка в битах: короче - слишком много ложных срабатываний, длиннее - не нужно
+constexpr unsigned FINGERPRINT_MIN_BITS = 4;
+constexpr unsigned FINGERPRINT_MAX_BITS = 32;
+
+/* Фильтр кукушки с отпечатками произвольной длины (от 4 до 32 бит), упакованными подряд без выравнивания. Корзина
+* отпечатка выбирается по старшим битам хеша, а сам отпечаток - младшие биты. Сумма номеров двух корзин отпечатка
+* по модулю количества корзин равна перемешанному отпечатку, поэтому из любой корзины отпечатка можно найти другую,
+* не зная исходного хеша, а количество корзин может быть любым, не только степенью двойки. Если в обеих корзинах
+* нет места, отпечаток вытесняет случайный отпечаток корзины, а тот переезжает в свою вторую корзину, и так далее */
+struct CuckooFilter {
+	vector<uint64_t> words;
+	size_t bucketsCount = 0;
+	unsigned fingerprintBits = 0;
+	uint64_t fingerprintMask = 0;
+	size_t fingerprintsCount = 0;
+	size_t maxFingerprintsCount = 0;
+	// Вероятность ложного срабатывания, добавляемая каждым отпечатком: 2 корзины * 4 ячейки * заполненность / 2^bits
+	double falsePositiveProbabilityPerFingerprint = 0;
+	// Отпечаток, которому не нашлось места после всех вытеснений, хранится отдельно, и фильтр считается заполненным
+	bool hasVictim = false;
+	size_t victimBucket = 0;
+	uint64_t victimFingerprint = 0;
+	// Состояние xorshift для выбора вытесняемой ячейки
+	uint64_t randomState = 0x2545f4914f6cdd1dull;
+
+	// Выделяет память под capacity отпечатков длиной bits бит
+	void init(size_t capacity, unsigned bits);
+	bool isFull(void) const noexcept { return hasVictim or fingerprintsCount >= maxFingerprintsCount; }
+	double getFalsePositiveProbability(void) const noexcept { return static_cast<double>(fingerprintsCount) * falsePositiveProbabilityPerFingerprint; }
+
+	// Число от 0 до bucketsCount по всем битам value: старшая половина произведения, без деления по модулю
+	size_t reduceToBucket(uint64_t value) const noexcept {
+		uint64_t bucket = bucketsCount;
+		multiplyToHalves(&value, &bucket);
+		return static_cast<size_t>(bucket);
+	}
+	// Отпечаток - младшие биты хеша, а ноль означает пустую ячейку, поэтому нулевой отпечаток заменяется единицей
+	uint64_t getFingerprint(uint64_t hash) const noexcept {
+		uint64_t fingerprint = hash & fingerprintMask;
+		return fingerprint != 0 ? fingerprint : 1;
+	}
+	size_t getBucket(uint64_t hash) const noexcept { return reduceToBucket(hash); }
+	size_t getAlternateBucket(size_t bucket, uint64_t fingerprint) const noexcept {
+		size_t bucketsSum = reduceToBucket(mixHashes(fingerprint, CUCKOO_ALTERNATE_BUCKET_SEED));
+		return bucketsSum >= bucket ? bucketsSum - bucket : bucketsSum + bucketsCount - bucket;
+	}
+
+	// Читает и записывает отпечаток ячейки с номером slotNumber (от начала фильтра), который может лежать в двух словах
+	uint64_t readSlot(size_t slotNumber) const noexcept {
+		size_t bitPosition = slotNumber * fingerprintBits, wordNumber = bitPosition / 64;
+		unsigned shift = bitPosition % 64;
+		uint64_t value = words[wordNumber] >> shift;
+		if (shift + fingerprintBits > 64) value |= words[wordNumber + 1] << (64 - shift);
+		return value & fingerprintMask;
+	}
+	void writeSlot(size_t slotNumber, uint64_t fingerprint) noexcept {
+		size_t bitPosition = slotNumber * fingerprintBits, wordNumber = bitPosition / 64;
+		unsigned shift = bitPosition % 64;
+		words[wordNumber] = (words[wordNumber] & ~(fingerprintMask << shift)) | (fingerprint << shift);
+		if (shift + fingerprintBits <= 64) return;
+		unsigned writtenBits = 64 - shift;
+		words[wordNumber + 1] = (words[wordNumber + 1] & ~(fingerprintMask >> writtenBits)) | (fingerprint >> writtenBits);
+	}
+
+	bool bucketContains(size_t bucket, uint64_t fingerprint) const noexcept {
+		for (size_t slotNumber = bucket * CUCKOO_BUCKET_SLOTS_COUNT; slotNumber < (bucket + 1) * CUCKOO_BUCKET_SLOTS_COUNT; slotNumber++) {
+			if (readSlot(slotNumber) == fingerprint) return true;
+		}
+		return false;
+	}
+	// Кладёт отпечаток в свободную ячейку корзины. Возвращает false, если свободных ячеек нет
+	bool tryPlace(size_t bucket, uint64_t fingerprint) noexcept {
+		for (size_t slotNumber = bucket * CUCKOO_BUCKET_SLOTS_COUNT; slotNumber < (bucket + 1) * CUCKOO_BUCKET_SLOTS_COUNT; slotNumber++) {
+			if (readSlot(slotNumber) != 0) continue;
+			writeSlot(slotNumber, fingerprint);
+			return true;
+		}
+		return false;
+	}
+
+	bool contains(uint64_t hash) const noexcept;
+	// Добавляет отпечаток хеша. Фильтр не должен быть заполнен (isFull)
+	void insert(uint64_t hash) noexcept;
+	void prefetch(uint64_t hash) const noexcept;
+};
+
+void CuckooFilter::init(size_t capacity, unsigned bits) {
+	fingerprintBits = bits;
+	fingerprintMask = (1ull << bits) - 1;
+	bucketsCount = max(static_cast<size_t>(ceil(static_cast<double>(capacity) / (CUCKOO_BUCKET_SLOTS_COUNT * CUCKOO_FILTER_MAX_LOAD_FACTOR))), static_cast<size_t>(1));
+	// Лишнее слово в конце, чтобы последний отпечаток можно было читать двумя словами
+	words.assign((bucketsCount * CUCKOO_BUCKET_SLOTS_COUNT * bits + 63) / 64 + 1, 0);
+	maxFingerprintsCount = static_cast<size_t>(static_cast<double>(bucketsCount * CUCKOO_BUCKET_SLOTS_COUNT) * CUCKOO_FILTER_MAX_LOAD_FACTOR);
+	falsePositiveProbabilityPerFingerprint = 2.0 / static_cast<double>(bucketsCount) / ldexp(1.0, static_cast<int>(bits));
+}
+
+bool CuckooFilter::contains(uint64_t hash) const noexcept {
+	uint64_t fingerprint = getFingerprint(hash);
+	size_t bucket = getBucket(hash), alternateBucket = getAlternateBucket(bucket, fingerprint);
+	if (bucketContains(bucket, fingerprint) or bucketContains(alternateBucket, fingerprint)) return true;
+	return hasVictim and victimFingerprint == fingerprint and (victimBucket == bucket or victimBucket == alternateBucket);
+}
+
+void CuckooFilter::insert(uint64_t hash) noexcept {
+	uint64_t fingerprint = getFingerprint(hash);
+	size_t bucket = getBucket(hash);
+	fingerprintsCount++;
+	if (tryPlace(bucket, fingerprint)) return;
+	bucket = getAlternateBucket(bucket, fingerprint);
+	if (tryPlace(bucket, fingerprint)) return;
+	for (size_t kickNumber = 0; kickNumber < CUCKOO_MAX_KICKS_COUNT; kickNumber++) {
+		// Вытесняем случайный отпечаток корзины, а его пробуем положить в его вторую корзину
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 7;
+		randomState ^= randomState << 17;
+		size_t slotNumber = bucket * CUCKOO_BUCKET_SLOTS_COUNT + static_cast<size_t>(randomState % CUCKOO_BUCKET_SLOTS_COUNT);
+		uint64_t evictedFingerprint = readSlot(slotNumber);
+		writeSlot(slotNumber, fingerprint);
+		fingerprint = evictedFingerprint;
+		bucket = getAlternateBucket(bucket, fingerprint);
+		if (tryPlace(bucket, fingerprint)) return;
+	}
+	hasVictim = true;
+	victimBucket = bucket;
+	victimFingerprint = fingerprint;
+}
+
+void CuckooFilter::prefetch(uint64_t hash) const noexcept {
+	size_t bucket = getBucket(hash);
+	prefetchMemory(&words[bucket * CUCKOO_BUCKET_SLOTS_COUNT * fingerprintBits / 64]);
+	prefetchMemory(&words[getAlternateBucket(bucket, getFingerprint(hash)) * CUCKOO_BUCKET_SLOTS_COUNT * fingerprintBits / 64]);
+}
+
+FingerprintFilters::FingerprintFilters() = default;
+FingerprintFilters::~FingerprintFilters() = default;
+FingerprintFilters::FingerprintFilters(FingerprintFilters&&) noexcept = default;
+FingerprintFilters& FingerprintFilters::operator=(FingerprintFilters&&) noexcept = default;
+
+void FingerprintFilters::init(double rate, size_t expectedLinesCount) noexcept {
+	clear();
+	falsePositiveRate = rate;
+	initialCapacity = max(expectedLinesCount, FINGERPRINT_FILTERS_MIN_CAPACITY);
+}
+
+void FingerprintFilters::addFilter(void) {
+	size_t level = filters.size();
+	if (not filters.empty()) fullFiltersFalsePositiveProbability += filters.back()->getFalsePositiveProbability();
+	/* Доля ложных срабатываний фильтра уровня level - rate / 2^(level + 1), а у заполненного фильтра вероятность
+	* ложного срабатывания 2 * 4 * CUCKOO_FILTER_MAX_LOAD_FACTOR / 2^bits, отсюда и длина отпечатка */
+	double filterFalsePositiveRate = ldexp(falsePositiveRate, -static_cast<int>(level + 1));
+	double requiredBits = ceil(log2(2 * CUCKOO_BUCKET_SLOTS_COUNT * CUCKOO_FILTER_MAX_LOAD_FACTOR / filterFalsePositiveRate));
+	unsigned fingerprintBits = static_cast<unsigned>(min(max(requiredBits, static_cast<double>(FINGERPRINT_MIN_BITS)), static_cast<double>(FINGERPRINT_MAX_BITS)));
+	size_t capacity = initialCapacity;
+	for (size_t filterNumber = 0; filterNumber < level and capacity <= SIZE_MAX / FINGERPRINT_FILTERS_GROWTH_FACTOR; filterNumber++) capacity *= FINGERPRINT_FILTERS_GROWTH_FACTOR;
+	unique_ptr<CuckooFilter> filter = make_unique<CuckooFilter>();
+	filter->init(capacity, fingerprintBits);
+	filters.push_back(move(filter));
+}
+
+bool FingerprintFilters::containsOrInsert(uint64_t hash) {
+	uint64_t filterHash = mixHashes(hash, FINGERPRINT_FILTERS_HASH_SEED);
+	for (const unique_ptr<CuckooFilter>& filter : filters) {
+		if (filter->contains(filterHash)) return true;
+	}
+	if (filters.empty() or filters.back()->isFull()) addFilter();
+	// Если бы эта строка уже была ложно найдена в фильтрах, она была бы удалена, а вероятность этого известна
+	expectedFalsePositivesCount += fullFiltersFalsePositiveProbability + filters.back()->getFalsePositiveProbability();
+	filters.back()->insert(filterHash);
+	fingerprintsCount++;
+	return false;
+}
+
+void FingerprintFilters::prefetch(uint64_t hash) const noexcept {
+	if (filters.empty()) return;
+	uint64_t filterHash = mixHashes(hash, FINGERPRINT_FILTERS_HASH_SEED);
+	for (const unique_ptr<CuckooFilter>& filter : filters) filter->prefetch(filterHash);
+}
+
+void FingerprintFilters::clear(void) noexcept {
+	filters.clear();
+	filters.shrink_to_fit();
+	falsePositiveRate = 0;
+	initialCapacity = 0;
+	fullFiltersFalsePositiveProbability = 0;
+	expectedFalsePositivesCount = 0;
+	fingerprintsCount = 0;
+}
+
+double FingerprintFilters::getLoadFactor(void) const noexcept {
+	if (filters.empty()) return 0;
+	return static_cast<double>(filters.back()->fingerprintsCount) / static_cast<double>(filters.back()->bucketsCount * CUCKOO_BUCKET_SLOTS_COUNT);
+}
+
+unsigned long long FingerprintFilters::getMemorySize(void) const noexcept {
+	unsigned long long memorySize = 0;
+	for (const unique_ptr<CuckooFilter>& filter : filters) memorySize += filter->words.size() * sizeof(uint64_t);
+	return memorySize;
+}
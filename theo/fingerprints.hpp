@@ -0,0 +1,75 @@
+﻿#pragma once
+#ifndef THEO_FINGERPRINTS
+#define THEO_FINGERPRINTS
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* Приближённое удаление дубликатов (dedup --approx): вместо 64-битных хешей уникальных строк хранятся короткие
+* отпечатки (fingerprints) в фильтрах кукушки (cuckoo filter). У каждого отпечатка две возможные корзины по 4 ячейки,
+* поэтому проверка строки затрагивает две кеш-линии, а на строку уходит столько бит, сколько нужно для заданной доли
+* ложных срабатываний (около 15 бит при 0.1%), вместо 10-20 байт хеш-таблицы. Ложное срабатывание - уникальная
+* строка, отпечаток которой совпал с отпечатком другой строки: она ошибочно удаляется как дубликат */
+
+// Ячеек в корзине фильтра кукушки
+constexpr size_t CUCKOO_BUCKET_SLOTS_COUNT = 4;
+
+/* Максимальная заполненность фильтра: при 4 ячейках в корзине вставка начинает всё чаще не находить места ближе
+* к 95%, поэтому, дойдя до этого предела, фильтр считается заполненным и следующие отпечатки идут в новый фильтр */
+constexpr double CUCKOO_FILTER_MAX_LOAD_FACTOR = 0.94;
+
+// Минимальное количество отпечатков в первом фильтре, если размер входных данных неизвестен или мал
+constexpr size_t FINGERPRINT_FILTERS_MIN_CAPACITY = 1024 * 1024;
+
+// Во сколько раз каждый следующий фильтр вмещает больше отпечатков, чем предыдущий
+constexpr size_t FINGERPRINT_FILTERS_GROWTH_FACTOR = 4;
+
+struct CuckooFilter;
+
+/* Цепочка фильтров кукушки одного набора уникальных строк. Отпечаток нельзя перенести в фильтр большего размера
+* (исходного хеша уже нет), поэтому, когда фильтр заполняется, новые строки добавляются в следующий, в 4 раза больший,
+* а проверяются строки по всем фильтрам. Чтобы общая доля ложных срабатываний не превышала заданную, каждому следующему
+* фильтру достаётся вдвое меньшая её часть (и на бит более длинные отпечатки): 1/2 + 1/4 + ... < 1 */
+class FingerprintFilters {
+private:
+	std::vector<std::unique_ptr<CuckooFilter>> filters;
+	double falsePositiveRate = 0;
+	size_t initialCapacity = 0;
+	// Вероятность ложного срабатывания для новой строки со стороны заполненных фильтров (они больше не меняются)
+	double fullFiltersFalsePositiveProbability = 0;
+	// Сумма вероятностей ложного срабатывания для всех строк, признанных уникальными
+	double expectedFalsePositivesCount = 0;
+	size_t fingerprintsCount = 0;
+
+	// Добавляет в цепочку следующий фильтр, который вмещает в FINGERPRINT_FILTERS_GROWTH_FACTOR раз больше предыдущего
+	void addFilter(void);
+public:
+	FingerprintFilters();
+	~FingerprintFilters();
+	FingerprintFilters(FingerprintFilters&&) noexcept;
+	FingerprintFilters& operator=(FingerprintFilters&&) noexcept;
+
+	/* Задаёт допустимую долю ложных срабатываний на одну уникальную строку (от 0 до 1) и ожидаемое количество
+	* уникальных строк, под которое сразу выделяется первый фильтр. Память выделяется с первой строкой */
+	void init(double rate, size_t expectedLinesCount) noexcept;
+	bool isInitialized(void) const noexcept { return falsePositiveRate > 0; }
+	/* Есть ли отпечаток строки с хешем hash в одном из фильтров. Если нет - добавляет его и прибавляет к ожидаемому
+	* количеству ложных срабатываний вероятность того, что строка с таким отпечатком оказалась бы ложно удалена */
+	bool containsOrInsert(uint64_t hash);
+	// Заранее запрашивает у памяти корзины, которые проверит containsOrInsert для этого хеша
+	void prefetch(uint64_t hash) const noexcept;
+	// Удаляет все фильтры и освобождает их память. Перед следующим использованием надо снова вызвать init
+	void clear(void) noexcept;
+
+	size_t size(void) const noexcept { return fingerprintsCount; }
+	// Заполненность последнего фильтра, в который добавляются отпечатки, от 0 до 1
+	double getLoadFactor(void) const noexcept;
+	// Сколько байт памяти занимают все фильтры
+	unsigned long long getMemorySize(void) const noexcept;
+	/* Ожидаемое количество уникальных строк, ошибочно удалённых как дубликаты: сумма вероятностей ложного
+	* срабатывания в момент проверки каждой строки, признанной уникальной */
+	double getExpectedFalsePositivesCount(void) const noexcept { return expectedFalsePositivesCount; }
+};
+
+#endif // !THEO_FINGERPRINTS
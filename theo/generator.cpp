@@ -0,0 +1,193 @@
+﻿#include "utils.hpp"
+
+/* Сколько байт строк один поток генерирует за раз (блок). Количество строк в блоке фиксировано (зависит только от
+* максимальной длины строки), поэтому номера строк каждого блока известны заранее и блоки генерируются параллельно */
+constexpr size_t GENERATOR_BLOCK_SIZE = 1024 * 1024 * 16;
+// Максимальная длина строки корпуса: длиннее строк в реальных базах практически не бывает
+constexpr int GENERATOR_MAX_LINE_LENGTH = 4096;
+
+/* Сгенерированные потоками блоки одной партии, которые записываются в файл по порядку,
+* пока генерируется следующая партия. Длины блоков уже обрезаны до нужного размера корпуса */
+struct GeneratedBatch {
+	vector<char*> blocks;
+	vector<size_t> blocksLengths;
+};
+
+/* Записывает блоки партии в итоговый файл по порядку. Если записать не удалось, выставляет isWriteFailed,
+* а следующие партии уже не записываются */
+static void writeGeneratedBatch(File* resultFile, const GeneratedBatch& batch, atomic<bool>* isWriteFailed);
+
+// Опции для ввода аргументов вызова программы из cmd, показыаемые пользователю при использовании флага --help или -h
+static const char* const usages[] = {
+	"theo gen [options]",
+	NULL,
+};
+
+int generate(int argc, const char** argv) {
+	int corpusSizeInMegabytes = 1024;
+	const char* destinationPath = "generated.txt";
+	const char* outputCompression = NULL; // Формат и уровень сжатия итогового файла, если его надо сжимать
+	int minLineLength = 20;
+	int maxLineLength = 60;
+	int isLengthSkewed = 0;
+	int duplicatesPercent = 0;
+	int invalidPercent = 0;
+	int crlfPercent = 0;
+	int utf8Percent = 0;
+	int latin1Percent = 0;
+	const char* separators = ":";
+	int seed = static_cast<int>(DEFAULT_CORPUS_SEED);
+
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_GROUP("Basic options"),
+		OPT_INTEGER('s', "size", &corpusSizeInMegabytes, "size of generated file in megabytes, e.g. 102400 for 100 GB (default - 1024)"),
+		OPT_INTEGER(0, "seed", &seed, "initial value of random generator, same seed and options give same file (default - constant)"),
+		OPT_GROUP("Lines options"),
+		OPT_INTEGER(0, "min-length", &minLineLength, "minimal length of line in bytes, without line break (default - 20)"),
+		OPT_INTEGER(0, "max-length", &maxLineLength, "maximal length of line in bytes, without line break (default - 60)"),
+		OPT_BOOLEAN(0, "skewed", &isLengthSkewed, "most lines are short and few are long, like in real bases (default - uniform lengths)"),
+		OPT_INTEGER(0, "duplicates", &duplicatesPercent, "percent of lines repeating previous ones (default - 0)"),
+		OPT_INTEGER(0, "invalid", &invalidPercent, "percent of invalid lines: without separator, with forbidden symbols or empty password (default - 0)"),
+		OPT_INTEGER(0, "crlf", &crlfPercent, "percent of lines ending with \\r\\n (default - 0)"),
+		OPT_INTEGER(0, "utf8", &utf8Percent, "percent of lines with cyrillic password in UTF-8 (default - 0)"),
+		OPT_INTEGER(0, "latin1", &latin1Percent, "percent of lines with password in one-byte encoding, invalid for UTF-8 (default - 0)"),
+		OPT_STRING(0, "separators", &separators, "separators between login and password, random one in every line (default - \":\")"),
+		OPT_GROUP("File options"),
+		OPT_STRING('d', "destination", &destinationPath, "path to result file (default - generated.txt)"),
+		OPT_STRING(0, "compress", &outputCompression, "compress result file: 'zstd', 'gzip' or 'lz4' with optional level after colon,\n\t\t\t      e.g. 'zstd:3' (default - without compression)"),
+		OPT_GROUP("Performance options"),
+		OPT_INTEGER(0, "threads", &(chunksProcessingParameters.threadsCount), "number of threads generating lines simultaneously (default - all CPU cores)"),
+		OPT_GROUP("Generates file with synthetic login:password lines for benchmarks of commands on big bases.\n\
+Example command: 'theo gen -s 10240 --duplicates 30 --crlf 10 --separators \":;\" -d base.txt'"),
+		OPT_END(),
+	};
+	struct argparse argparse;
+	argparse_init(&argparse, options, usages, 0);
+	argparse_parse(&argparse, argc, argv);
+
+	if (corpusSizeInMegabytes < 1) {
+		cout << "Error: invalid '--size' parameter value, it must be positive number of megabytes" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (minLineLength < static_cast<int>(MIN_CORPUS_LINE_LENGTH) or maxLineLength < minLineLength or maxLineLength > GENERATOR_MAX_LINE_LENGTH) {
+		cout << "Error: invalid lines length, it must be from " << MIN_CORPUS_LINE_LENGTH << " to " << GENERATOR_MAX_LINE_LENGTH << " and '--max-length' can't be lower than '--min-length'" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (duplicatesPercent < 0 or invalidPercent < 0 or crlfPercent < 0 or utf8Percent < 0 or latin1Percent < 0 or duplicatesPercent > 100
+		or invalidPercent > 100 or crlfPercent > 100 or utf8Percent + latin1Percent > 100) {
+		cout << "Error: invalid lines percents, every percent must be from 0 to 100, and '--utf8' with '--latin1' together can't exceed 100" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (strlen(separators) == 0) {
+		cout << "Error: '--separators' parameter can't be empty" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (chunksProcessingParameters.threadsCount < 0) {
+		cout << "Error: invalid '--threads' parameter value, it must be positive number (or zero to use all CPU cores)" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	wstring destinationFilePath = toWstring(destinationPath);
+	if (not isStandardStreamPath(destinationFilePath) and fs::exists(toFilesystemPath(destinationFilePath))) {
+		wcout << "Error: something already exists on destination file path [" << destinationFilePath << "]" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	// Засекаем время выполнения программы
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+	processOutputCompressionOption(outputCompression);
+	File* resultFile = fileOpen(destinationFilePath, L"wb");
+	if (resultFile == NULL) {
+		wcout << "Error: cannot create result file [" << destinationFilePath << "]" << endl;
+		return ERROR_OPEN_FAILED;
+	}
+
+	CorpusParameters corpusParameters;
+	corpusParameters.minLineLength = minLineLength;
+	corpusParameters.maxLineLength = maxLineLength;
+	corpusParameters.isLengthSkewed = isLengthSkewed;
+	corpusParameters.duplicatesPercent = duplicatesPercent;
+	corpusParameters.invalidPercent = invalidPercent;
+	corpusParameters.crlfPercent = crlfPercent;
+	corpusParameters.utf8Percent = utf8Percent;
+	corpusParameters.latin1Percent = latin1Percent;
+	corpusParameters.separators = separators;
+	corpusParameters.seed = static_cast<unsigned int>(seed);
+	const CorpusGenerator corpusGenerator(corpusParameters);
+
+	size_t linesInBlock = GENERATOR_BLOCK_SIZE / corpusGenerator.getMaxLineLength();
+	size_t blockBufferSize = linesInBlock * corpusGenerator.getMaxLineLength();
+	size_t threadsCount = getProcessingThreadsCount();
+
+	/* Две партии буферов: пока одна записывается в файл отдельным потоком, в другую генерируется следующая.
+	* В каждой партии по блоку на поток генерации */
+	GeneratedBatch batches[2];
+	for (GeneratedBatch& batch : batches) {
+		for (size_t i = 0; i < threadsCount; i++) batch.blocks.push_back(allocateIOBuffer(blockBufferSize));
+		batch.blocksLengths.resize(threadsCount);
+	}
+
+	ull corpusSizeInBytes = static_cast<ull>(corpusSizeInMegabytes) * 1024 * 1024;
+	ull generatedBytesCount = 0;
+	ull generatedLinesCount = 0;
+	ull nextBlockNumber = 0;
+	bool isCorpusComplete = false;
+	atomic<bool> isWriteFailed = false;
+	thread writerThread;
+	for (size_t batchNumber = 0; not isCorpusComplete and not isWriteFailed; batchNumber++) {
+		GeneratedBatch& batch = batches[batchNumber % 2];
+
+		vector<thread> generatorThreads;
+		for (size_t i = 0; i < threadsCount; i++) {
+			ull firstLineNumber = (nextBlockNumber + i) * linesInBlock;
+			generatorThreads.emplace_back([&corpusGenerator, &batch, i, firstLineNumber, linesInBlock]() {
+				size_t blockLength = 0;
+				for (size_t line = 0; line < linesInBlock; line++) blockLength += corpusGenerator.writeLine(firstLineNumber + line, &batch.blocks[i][blockLength]);
+				batch.blocksLengths[i] = blockLength;
+			});
+		}
+		for (thread& generatorThread : generatorThreads) generatorThread.join();
+		nextBlockNumber += threadsCount;
+
+		/* Блоки после нужного размера корпуса отбрасываются, а последний нужный обрезается по концу последней строки,
+		* которая помещается в корпус целиком, поэтому итоговый файл может быть меньше заданного размера на часть строки */
+		for (size_t i = 0; i < threadsCount; i++) {
+			size_t blockLength = isCorpusComplete ? 0 : batch.blocksLengths[i];
+			if (generatedBytesCount + blockLength >= corpusSizeInBytes) {
+				blockLength = corpusSizeInBytes - generatedBytesCount;
+				while (blockLength > 0 and batch.blocks[i][blockLength - 1] != '\n') blockLength--;
+				isCorpusComplete = true;
+			}
+			generatedLinesCount += blockLength == batch.blocksLengths[i] ? linesInBlock : getLinesCountInBuffer(batch.blocks[i], blockLength);
+			generatedBytesCount += blockLength;
+			batch.blocksLengths[i] = blockLength;
+		}
+
+		if (writerThread.joinable()) writerThread.join();
+		writerThread = thread(writeGeneratedBatch, resultFile, cref(batch), &isWriteFailed);
+	}
+	if (writerThread.joinable()) writerThread.join();
+	fileClose(resultFile);
+
+	for (GeneratedBatch& batch : batches) for (char* block : batch.blocks) freeIOBuffer(block);
+
+	if (isWriteFailed) {
+		wcout << "Error: cannot write to result file [" << destinationFilePath << "], perhaps disk is full" << endl;
+		return ERROR_WRITE_FAULT;
+	}
+
+	chrono::steady_clock::time_point end = chrono::steady_clock::now();
+	cout << "\nFile generated successfully! Lines: " << generatedLinesCount << ", size: " << generatedBytesCount / (1024 * 1024) << "MB. Execution time: "
+		<< chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+
+	return ERROR_SUCCESS;
+}
+
+static void writeGeneratedBatch(File* resultFile, const GeneratedBatch& batch, atomic<bool>* isWriteFailed) {
+	for (size_t i = 0; i < batch.blocks.size() and not *isWriteFailed; i++) {
+		if (batch.blocksLengths[i] == 0) continue;
+		if (resultFile->write(batch.blocks[i], batch.blocksLengths[i]) != batch.blocksLengths[i]) *isWriteFailed = true;
+	}
+}
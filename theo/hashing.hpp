@@ -0,0 +1,94 @@
+﻿#pragma once
+#ifndef THEO_HASHING
+#define THEO_HASHING
+
+#include <cstdint>
+#include <cstring>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+/* Хеширование строк для удаления дубликатов и оценки уникальных строк: wyhash (final version 4, public domain,
+* github.com/wangyi-fudan/wyhash). Строка обрабатывается блоками по 16 и 48 байт через умножение 64x64 -> 128 бит,
+* а не по одному символу, и у хеша хорошее распределение всех 64 бит, поэтому случайные совпадения хешей
+* разных строк практически исключены, пока уникальных строк меньше нескольких миллиардов */
+
+// Перемножает 64-битные числа и записывает младшие 64 бита 128-битного произведения в a, а старшие - в b
+inline void multiplyToHalves(uint64_t* a, uint64_t* b) noexcept {
+#if defined(_MSC_VER) && defined(_M_X64)
+	*a = _umul128(*a, *b, b);
+#elif defined(__SIZEOF_INT128__)
+	__uint128_t product = static_cast<__uint128_t>(*a) * *b;
+	*a = static_cast<uint64_t>(product);
+	*b = static_cast<uint64_t>(product >> 64);
+#else
+	// Без 128-битного умножения произведение собирается из четырёх 32-битных
+	uint64_t aHigh = *a >> 32, aLow = static_cast<uint32_t>(*a), bHigh = *b >> 32, bLow = static_cast<uint32_t>(*b);
+	uint64_t highHigh = aHigh * bHigh, highLow = aHigh * bLow, lowHigh = aLow * bHigh, lowLow = aLow * bLow;
+	uint64_t middle = (lowLow >> 32) + static_cast<uint32_t>(highLow) + static_cast<uint32_t>(lowHigh);
+	*a = (middle << 32) | static_cast<uint32_t>(lowLow);
+	*b = highHigh + (highLow >> 32) + (lowHigh >> 32) + (middle >> 32);
+#endif
+}
+
+// Перемешивает два числа: XOR младшей и старшей половин их 128-битного произведения
+inline uint64_t mixHashes(uint64_t a, uint64_t b) noexcept {
+	multiplyToHalves(&a, &b);
+	return a ^ b;
+}
+
+inline uint64_t readHashBlock8(const uint8_t* data) noexcept {
+	uint64_t value;
+	memcpy(&value, data, 8);
+	return value;
+}
+
+inline uint64_t readHashBlock4(const uint8_t* data) noexcept {
+	uint32_t value;
+	memcpy(&value, data, 4);
+	return value;
+}
+
+// Возвращает 64-битный хеш length байт строки. Одинаковые строки всегда дают одинаковый хеш при одном seed
+inline uint64_t hashLine(const void* line, size_t length, uint64_t seed = 0) noexcept {
+	static constexpr uint64_t secret[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+	const uint8_t* data = static_cast<const uint8_t*>(line);
+	seed ^= mixHashes(seed ^ secret[0], secret[1]);
+	uint64_t a = 0, b = 0;
+	if (length <= 16) {
+		// Короткие строки (а их в базах большинство) читаются четырьмя перекрывающимися 4-байтными блоками без цикла
+		if (length >= 4) {
+			a = (readHashBlock4(data) << 32) | readHashBlock4(data + ((length >> 3) << 2));
+			b = (readHashBlock4(data + length - 4) << 32) | readHashBlock4(data + length - 4 - ((length >> 3) << 2));
+		}
+		else if (length > 0) a = (static_cast<uint64_t>(data[0]) << 16) | (static_cast<uint64_t>(data[length >> 1]) << 8) | data[length - 1];
+	}
+	else {
+		size_t remaining = length;
+		if (remaining >= 48) {
+			// Три независимые цепочки умножений, чтобы процессор выполнял их одновременно
+			uint64_t seed1 = seed, seed2 = seed;
+			do {
+				seed = mixHashes(readHashBlock8(data) ^ secret[1], readHashBlock8(data + 8) ^ seed);
+				seed1 = mixHashes(readHashBlock8(data + 16) ^ secret[2], readHashBlock8(data + 24) ^ seed1);
+				seed2 = mixHashes(readHashBlock8(data + 32) ^ secret[3], readHashBlock8(data + 40) ^ seed2);
+				data += 48;
+				remaining -= 48;
+			} while (remaining >= 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (remaining > 16) {
+			seed = mixHashes(readHashBlock8(data) ^ secret[1], readHashBlock8(data + 8) ^ seed);
+			data += 16;
+			remaining -= 16;
+		}
+		a = readHashBlock8(data + remaining - 16);
+		b = readHashBlock8(data + remaining - 8);
+	}
+	a ^= secret[1];
+	b ^= seed;
+	multiplyToHalves(&a, &b);
+	return mixHashes(a ^ secret[0] ^ length, b ^ secret[1]);
+}
+
+#endif // !THEO_HASHING
@@ -0,0 +1,331 @@
+﻿#include "utils.hpp"
+
+atomic<size_t> HashRuns::createdDirectoriesCount = 0;
+
+// Числа для перемешивания хеша перед выбором блока фильтра Блума и битов в блоке, чтобы они не зависели друг от друга
+constexpr uint64_t BLOOM_BLOCK_SEED = 0x2d358dccaa6c78a5ull;
+constexpr uint64_t BLOOM_BITS_SEED = 0x8bb84b93962eacc9ull;
+
+// Слов в блоке фильтра Блума: 8 слов по 64 бита - ровно одна кеш-линия
+constexpr size_t BLOOM_BLOCK_WORDS_COUNT = 8;
+
+// Сколько хешей за раз записывается в файл прогона и читается из сливаемого прогона
+constexpr size_t HASH_RUN_IO_BUFFER_HASHES_COUNT = 1024 * 1024;
+
+/* Блочный фильтр Блума: хеш выставляет по одному биту в каждом из 8 слов одного 64-байтного блока, поэтому
+* и добавление, и проверка хеша затрагивают одну кеш-линию, а не 8 случайных мест в памяти */
+class HashBloomFilter {
+private:
+	vector<uint64_t> words;
+	uint64_t blocksCount = 0;
+
+	size_t getBlockStart(uint64_t hash) const noexcept {
+		uint64_t mixedHash = mixHashes(hash, BLOOM_BLOCK_SEED), blockNumber = blocksCount;
+		// Старшая половина произведения - число от 0 до blocksCount, без деления по модулю
+		multiplyToHalves(&mixedHash, &blockNumber);
+		return static_cast<size_t>(blockNumber) * BLOOM_BLOCK_WORDS_COUNT;
+	}
+public:
+	void init(size_t hashesCount) {
+		blocksCount = max(hashesCount * HASH_RUN_BLOOM_BITS_PER_HASH / (BLOOM_BLOCK_WORDS_COUNT * 64), static_cast<size_t>(1));
+		words.assign(static_cast<size_t>(blocksCount) * BLOOM_BLOCK_WORDS_COUNT, 0);
+	}
+
+	void add(uint64_t hash) noexcept {
+		uint64_t* block = &words[getBlockStart(hash)];
+		uint64_t bitsNumbers = mixHashes(hash, BLOOM_BITS_SEED);
+		for (size_t wordNumber = 0; wordNumber < BLOOM_BLOCK_WORDS_COUNT; wordNumber++, bitsNumbers >>= 6) block[wordNumber] |= 1ull << (bitsNumbers & 63);
+	}
+
+	void prefetch(uint64_t hash) const noexcept { prefetchMemory(&words[getBlockStart(hash)]); }
+
+	bool mayContain(uint64_t hash) const noexcept {
+		const uint64_t* block = &words[getBlockStart(hash)];
+		uint64_t bitsNumbers = mixHashes(hash, BLOOM_BITS_SEED);
+		for (size_t wordNumber = 0; wordNumber < BLOOM_BLOCK_WORDS_COUNT; wordNumber++, bitsNumbers >>= 6) {
+			if ((block[wordNumber] & (1ull << (bitsNumbers & 63))) == 0) return false;
+		}
+		return true;
+	}
+};
+
+/* Прогон: файл с отсортированными 64-битными хешами без повторов, отображённый в память только для чтения,
+* и фильтр Блума его хешей. Уровень прогона - сколько раз его хеши сливались (у замороженной таблицы - 0) */
+struct HashRun {
+	wstring path;
+	size_t level = 0;
+	HashBloomFilter filter;
+	File* file = NULL;
+	MappedFile mapping;
+	const uint64_t* hashes = NULL;
+	size_t hashesCount = 0;
+
+	// Открывает записанный файл прогона и отображает его в память. Возвращает false, если не получилось
+	bool open(void) noexcept;
+	/* Есть ли хеш в прогоне. Хеши распределены равномерно, поэтому позиция хеша сначала угадывается по его значению,
+	* а потом уточняется поиском с удвоением шага и двоичным поиском - это несколько обращений к одной-двум страницам */
+	bool contains(uint64_t hash) const noexcept;
+	// Закрывает отображение и файл прогона
+	void close(void) noexcept;
+};
+
+bool HashRun::open(void) noexcept {
+	file = openPlatformFile(path, FileOpenMode::Read);
+	if (file == NULL or not mapping.map(file)) return false;
+#ifndef _WIN32
+	// В прогоне ищутся отдельные хеши в случайных местах, читать файл наперёд незачем
+	madvise(mapping.data, static_cast<size_t>(mapping.size), MADV_RANDOM);
+#endif
+	hashes = reinterpret_cast<const uint64_t*>(mapping.data);
+	hashesCount = static_cast<size_t>(mapping.size / sizeof(uint64_t));
+	return true;
+}
+
+bool HashRun::contains(uint64_t hash) const noexcept {
+	if (hashesCount == 0 or hash < hashes[0] or hash > hashes[hashesCount - 1]) return false;
+	size_t lastPos = hashesCount - 1;
+	uint64_t hashesRange = hashes[lastPos] - hashes[0];
+	size_t guessedPos = hashesRange == 0 ? 0 : static_cast<size_t>(static_cast<double>(hash - hashes[0]) / static_cast<double>(hashesRange) * static_cast<double>(lastPos));
+	guessedPos = min(guessedPos, lastPos);
+	if (hashes[guessedPos] == hash) return true;
+
+	// Отрезок [lowPos, highPos], на котором должен быть хеш, если он есть: от угаданной позиции шаг удваивается
+	size_t lowPos = guessedPos, highPos = guessedPos, step = 1;
+	if (hashes[guessedPos] < hash) {
+		highPos = min(guessedPos + step, lastPos);
+		while (hashes[highPos] < hash and highPos < lastPos) {
+			lowPos = highPos;
+			step *= 2;
+			highPos = min(guessedPos + step, lastPos);
+		}
+	}
+	else {
+		lowPos = guessedPos >= step ? guessedPos - step : 0;
+		while (hashes[lowPos] > hash and lowPos > 0) {
+			highPos = lowPos;
+			step *= 2;
+			lowPos = guessedPos >= step ? guessedPos - step : 0;
+		}
+	}
+	return binary_search(hashes + lowPos, hashes + highPos + 1, hash);
+}
+
+void HashRun::close(void) noexcept {
+	mapping.unmap();
+	if (file != NULL) fileClose(file);
+	file = NULL;
+	hashes = NULL;
+	hashesCount = 0;
+}
+
+// Записывает хеши в файл прогона. При ошибке записи выводит сообщение и завершает программу
+static void writeHashes(File* file, const wstring& path, const uint64_t* hashes, size_t hashesCount) {
+	size_t bytesCount = hashesCount * sizeof(uint64_t);
+	if (file->write(reinterpret_cast<const char*>(hashes), bytesCount) != bytesCount) {
+		wcout << "Error: cannot write hashes of unique lines to temporary file [" << path << "], disk may be full" << endl;
+		exit(ERROR_WRITE_FAULT);
+	}
+}
+
+// Последовательно читает хеши сливаемого прогона блоками, не трогая его отображение, в котором ищутся хеши
+class HashRunReader {
+private:
+	File* file = NULL;
+	vector<uint64_t> buffer;
+	size_t position = 0;
+	size_t hashesInBuffer = 0;
+public:
+	explicit HashRunReader(const wstring& path) : file(openPlatformFile(path, FileOpenMode::Read)), buffer(HASH_RUN_IO_BUFFER_HASHES_COUNT) {}
+	~HashRunReader() { if (file != NULL) fileClose(file); }
+	HashRunReader(const HashRunReader&) = delete;
+	HashRunReader& operator=(const HashRunReader&) = delete;
+
+	bool isOpened(void) const noexcept { return file != NULL; }
+	// Текущий хеш прогона, действителен, пока hasHash() возвращает true
+	uint64_t getHash(void) const noexcept { return buffer[position]; }
+	bool hasHash(void) noexcept {
+		if (position < hashesInBuffer) return true;
+		size_t readedBytesCount = file->read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(uint64_t));
+		position = 0;
+		hashesInBuffer = readedBytesCount / sizeof(uint64_t);
+		return hashesInBuffer > 0;
+	}
+	void next(void) noexcept { position++; }
+};
+
+/* Сливает прогоны sourceRuns в один новый прогон уровня level по пути path и строит его фильтр Блума.
+* Выполняется в фоновом потоке: сами сливаемые прогоны при этом не меняются, их файлы читаются отдельно */
+static unique_ptr<HashRun> mergeHashRuns(const vector<HashRun*>& sourceRuns, const wstring& path, size_t level) {
+	unique_ptr<HashRun> mergedRun = make_unique<HashRun>();
+	mergedRun->path = path;
+	mergedRun->level = level;
+
+	size_t hashesCount = 0;
+	vector<unique_ptr<HashRunReader>> readers;
+	for (HashRun* sourceRun : sourceRuns) {
+		hashesCount += sourceRun->hashesCount;
+		readers.push_back(make_unique<HashRunReader>(sourceRun->path));
+		if (not readers.back()->isOpened()) {
+			wcout << "Error: cannot open temporary file with hashes of unique lines [" << sourceRun->path << "]" << endl;
+			exit(ERROR_OPEN_FAILED);
+		}
+	}
+	mergedRun->filter.init(hashesCount);
+
+	File* mergedFile = openPlatformFile(path, FileOpenMode::Write);
+	if (mergedFile == NULL) {
+		wcout << "Error: cannot create temporary file for hashes of unique lines [" << path << "]" << endl;
+		exit(ERROR_CREATE_FAILED);
+	}
+	vector<uint64_t> buffer;
+	buffer.reserve(HASH_RUN_IO_BUFFER_HASHES_COUNT);
+	bool hasLastHash = false;
+	uint64_t lastHash = 0;
+	// Сливаемых прогонов немного (HASH_RUNS_COMPACTION_FACTOR), поэтому наименьший хеш ищется простым перебором
+	while (true) {
+		HashRunReader* minReader = NULL;
+		for (unique_ptr<HashRunReader>& reader : readers) {
+			if (reader->hasHash() and (minReader == NULL or reader->getHash() < minReader->getHash())) minReader = reader.get();
+		}
+		if (minReader == NULL) break;
+		uint64_t hash = minReader->getHash();
+		minReader->next();
+		// Одинаковые хеши в разных прогонах бывают только у разных строк точного режима, хранить их дважды незачем
+		if (hasLastHash and hash == lastHash) continue;
+		hasLastHash = true;
+		lastHash = hash;
+		mergedRun->filter.add(hash);
+		buffer.push_back(hash);
+		if (buffer.size() == HASH_RUN_IO_BUFFER_HASHES_COUNT) {
+			writeHashes(mergedFile, path, buffer.data(), buffer.size());
+			buffer.clear();
+		}
+	}
+	writeHashes(mergedFile, path, buffer.data(), buffer.size());
+	fileClose(mergedFile);
+
+	if (not mergedRun->open()) {
+		wcout << "Error: cannot map temporary file with hashes of unique lines [" << path << "] to memory" << endl;
+		exit(ERROR_OPEN_FAILED);
+	}
+	return mergedRun;
+}
+
+HashRuns::HashRuns() = default;
+
+HashRuns::~HashRuns() {
+	clear();
+}
+
+void HashRuns::init(const wstring& destinationUserFilePath) {
+	isInitialized = true;
+	directory = joinPaths(getDirectoryFromFilePath(destinationUserFilePath), L"theo_dedup_runs_" + to_wstring(createdDirectoriesCount++));
+}
+
+wstring HashRuns::getNextRunPath(void) {
+	return joinPaths(directory, L"run_" + to_wstring(createdRunsCount++) + L".bin");
+}
+
+void HashRuns::addRun(vector<uint64_t>& hashes) {
+	error_code creatingError;
+	if (runs.empty()) fs::create_directories(toFilesystemPath(directory), creatingError);
+	if (creatingError) {
+		wcout << "Error: cannot create temporary directory for hashes of unique lines [" << directory << "]" << endl;
+		exit(ERROR_CREATE_FAILED);
+	}
+
+	sort(hashes.begin(), hashes.end());
+	hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+	unique_ptr<HashRun> run = make_unique<HashRun>();
+	run->path = getNextRunPath();
+	run->filter.init(hashes.size());
+	for (uint64_t hash : hashes) run->filter.add(hash);
+
+	File* runFile = openPlatformFile(run->path, FileOpenMode::Write);
+	if (runFile == NULL) {
+		wcout << "Error: cannot create temporary file for hashes of unique lines [" << run->path << "]" << endl;
+		exit(ERROR_CREATE_FAILED);
+	}
+	writeHashes(runFile, run->path, hashes.data(), hashes.size());
+	fileClose(runFile);
+	// Хеши теперь в файле, а память под них нужна снова заполняющейся таблице
+	vector<uint64_t>().swap(hashes);
+
+	if (not run->open()) {
+		wcout << "Error: cannot map temporary file with hashes of unique lines [" << run->path << "] to memory" << endl;
+		exit(ERROR_OPEN_FAILED);
+	}
+	runs.push_back(move(run));
+	startCompactionIfNeeded();
+}
+
+bool HashRuns::contains(uint64_t hash) const noexcept {
+	for (const unique_ptr<HashRun>& run : runs) {
+		if (run->filter.mayContain(hash) and run->contains(hash)) return true;
+	}
+	return false;
+}
+
+void HashRuns::prefetch(uint64_t hash) const noexcept {
+	for (const unique_ptr<HashRun>& run : runs) run->filter.prefetch(hash);
+}
+
+void HashRuns::startCompactionIfNeeded(void) {
+	if (compactionThread.joinable()) return;
+	// Сливаются прогоны самого низкого уровня, которых набралось достаточно: так каждый хеш переписывается log(N) раз
+	for (size_t level = 0; compactingRuns.empty(); level++) {
+		bool hasHigherLevels = false;
+		for (const unique_ptr<HashRun>& run : runs) {
+			if (run->level == level and compactingRuns.size() < HASH_RUNS_COMPACTION_FACTOR) compactingRuns.push_back(run.get());
+			if (run->level > level) hasHigherLevels = true;
+		}
+		if (compactingRuns.size() < HASH_RUNS_COMPACTION_FACTOR) compactingRuns.clear();
+		if (compactingRuns.empty() and not hasHigherLevels) return;
+	}
+
+	size_t mergedLevel = compactingRuns.front()->level + 1;
+	wstring mergedPath = getNextRunPath();
+	isCompactionFinished.store(false, memory_order_relaxed);
+	compactionThread = thread([this, mergedPath, mergedLevel]() {
+		compactedRun = mergeHashRuns(compactingRuns, mergedPath, mergedLevel);
+		isCompactionFinished.store(true, memory_order_release);
+	});
+}
+
+void HashRuns::removeRun(HashRun* run) noexcept {
+	run->close();
+	error_code removingError;
+	fs::remove(toFilesystemPath(run->path), removingError);
+}
+
+void HashRuns::applyFinishedCompaction(void) {
+	if (not compactionThread.joinable() or not isCompactionFinished.load(memory_order_acquire)) return;
+	compactionThread.join();
+	// Хеши слитых прогонов теперь есть в новом прогоне, сами прогоны больше не нужны
+	runs.erase(remove_if(runs.begin(), runs.end(), [&](const unique_ptr<HashRun>& run) {
+		if (find(compactingRuns.begin(), compactingRuns.end(), run.get()) == compactingRuns.end()) return false;
+		removeRun(run.get());
+		return true;
+	}), runs.end());
+	compactingRuns.clear();
+	runs.push_back(move(compactedRun));
+	startCompactionIfNeeded();
+}
+
+void HashRuns::clear(void) noexcept {
+	if (compactionThread.joinable()) compactionThread.join();
+	if (compactedRun != NULL) removeRun(compactedRun.get());
+	compactedRun.reset();
+	compactingRuns.clear();
+	for (unique_ptr<HashRun>& run : runs) removeRun(run.get());
+	runs.clear();
+	if (directory.empty()) return;
+	error_code removingError;
+	fs::remove_all(toFilesystemPath(directory), removingError);
+}
+
+unsigned long long HashRuns::getHashesCount(void) const noexcept {
+	ull hashesCount = 0;
+	for (const unique_ptr<HashRun>& run : runs) hashesCount += run->hashesCount;
+	return hashesCount;
+}
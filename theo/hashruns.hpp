@@ -0,0 +1,81 @@
+﻿#pragma once
+#ifndef THEO_HASH_RUNS
+#define THEO_HASH_RUNS
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Хеши уникальных строк dedup на диске, когда они перестают помещаться в оперативную память. Хеш-таблица в памяти,
+* дойдя до предела, целиком замораживается в отсортированный массив хешей - файл-прогон (run), который потом
+* только читается через отображение в память, а таблица очищается и заполняется дальше. Для каждого прогона
+* в памяти хранится фильтр Блума, во много раз меньший ~16 байт на хеш в таблице (см. HASH_RUN_BLOOM_BITS_PER_HASH):
+* новая строка почти всегда отсекается фильтрами без единого обращения к диску, и только при срабатывании фильтра
+* ищется в самом прогоне.
+* Чтобы прогонов, которые надо проверять, не становилось слишком много, прогоны одного уровня в фоновом потоке
+* сливаются в один прогон следующего уровня, как в LSM-деревьях */
+
+/* Размер фильтра Блума в битах на один хеш: 10 бит, то есть 1.25 байта. Каждый хеш выставляет 8 бит в одном
+* 64-байтном блоке фильтра, и при таком размере доля ложных срабатываний около 1% - на такую долю новых строк
+* придётся поиск в прогоне */
+constexpr size_t HASH_RUN_BLOOM_BITS_PER_HASH = 10;
+
+// Сколько прогонов одного уровня сливаются в один прогон следующего уровня
+constexpr size_t HASH_RUNS_COMPACTION_FACTOR = 4;
+
+struct HashRun;
+
+/* Прогоны хешей одного потока в отдельной временной директории. Объект используется только из одного потока,
+* фоновое слияние трогает лишь неизменяемые прогоны, а его результат подменяет слитые прогоны в applyFinishedCompaction */
+class HashRuns {
+private:
+	// Счётчик созданных директорий, чтобы у каждого потока была своя
+	static std::atomic<size_t> createdDirectoriesCount;
+	std::wstring directory;
+	size_t createdRunsCount = 0;
+	std::vector<std::unique_ptr<HashRun>> runs;
+
+	// Фоновое слияние: поток, прогоны, которые он сливает, его результат и флаг завершения
+	std::thread compactionThread;
+	std::vector<HashRun*> compactingRuns;
+	std::unique_ptr<HashRun> compactedRun;
+	std::atomic<bool> isCompactionFinished = false;
+
+	std::wstring getNextRunPath(void);
+	// Запускает фоновое слияние, если какого-то уровня набралось HASH_RUNS_COMPACTION_FACTOR прогонов и слияние не идёт
+	void startCompactionIfNeeded(void);
+	// Удаляет прогон из памяти и с диска
+	static void removeRun(HashRun* run) noexcept;
+public:
+	bool isInitialized = false;
+
+	HashRuns();
+	~HashRuns();
+	HashRuns(const HashRuns&) = delete;
+	HashRuns& operator=(const HashRuns&) = delete;
+
+	// Запоминает директорию для прогонов рядом с destinationUserFilePath, сама директория создаётся с первым прогоном
+	void init(const std::wstring& destinationUserFilePath);
+	// Есть ли на диске хотя бы один прогон
+	bool isUsed(void) const noexcept { return not runs.empty(); }
+	/* Сортирует хеши, записывает их на диск новым прогоном и строит для него фильтр Блума. Вектор хешей при этом
+	* освобождается. При ошибке записи выводит сообщение и завершает программу */
+	void addRun(std::vector<uint64_t>& hashes);
+	// Есть ли хеш в одном из прогонов: сначала проверяются фильтры, и только при их срабатывании - сами прогоны
+	bool contains(uint64_t hash) const noexcept;
+	// Заранее запрашивает у памяти блоки фильтров, которые проверит contains для этого хеша
+	void prefetch(uint64_t hash) const noexcept;
+	/* Если фоновое слияние закончилось, заменяет слитые прогоны полученным и запускает следующее слияние, если оно
+	* нужно. Вызывается из потока, который проверяет хеши, между проверками */
+	void applyFinishedCompaction(void);
+	// Дожидается фонового слияния и удаляет все прогоны с директорией
+	void clear(void) noexcept;
+
+	size_t getRunsCount(void) const noexcept { return runs.size(); }
+	unsigned long long getHashesCount(void) const noexcept;
+};
+
+#endif // !THEO_HASH_RUNS
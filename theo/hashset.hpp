@@ -0,0 +1,129 @@
+﻿#pragma once
+#ifndef THEO_HASH_SET
+#define THEO_HASH_SET
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+/* Просит процессор заранее загрузить в кеш кеш-линию по адресу address, не дожидаясь загрузки. Если потом
+* понадобится эта линия, она уже будет в кеше (или в пути), а несколько таких запросов выполняются одновременно */
+inline void prefetchMemory(const void* address) noexcept {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#elif defined(__GNUC__) || defined(__clang__)
+	// Линия загружается для записи: после проверки в неё, скорее всего, будет добавлен хеш
+	__builtin_prefetch(address, 1, 3);
+#else
+	(void)address;
+#endif
+}
+
+// Хешей в корзине хеш-таблицы: 8 хешей по 8 байт - ровно одна кеш-линия
+constexpr size_t HASH_SET_BUCKET_SLOTS_COUNT = 8;
+
+/* Максимальная заполненность хеш-таблицы, после которой она увеличивается вдвое. Как и у robin_hood, на хеш
+* уходит не больше 8 / 0.8 = 10 байт, но без байта служебной информации на каждую ячейку */
+constexpr double HASH_SET_MAX_LOAD_FACTOR = 0.8;
+
+/* Хеш-таблица 64-битных хешей с открытой адресацией для dedup. Хеши лежат в 64-байтных корзинах по 8 штук, корзина
+* выбирается по младшим битам хеша, а если она заполнена - хеш кладётся в следующую. Ноль означает пустую ячейку
+* (нулевой хеш хранится отдельным флагом), поэтому других служебных данных нет: почти любая проверка затрагивает
+* ровно одну кеш-линию, и её можно заранее запросить у памяти через prefetch, пока хешируются следующие строки */
+class FlatHashSet {
+private:
+	struct alignas(64) Bucket {
+		uint64_t hashes[HASH_SET_BUCKET_SLOTS_COUNT];
+	};
+
+	std::unique_ptr<Bucket[]> buckets;
+	// Количество корзин - степень двойки, поэтому номер корзины - младшие биты хеша под этой маской
+	size_t bucketsMask = 0;
+	size_t hashesCount = 0;
+	// После скольких хешей таблица увеличивается
+	size_t maxHashesCount = 0;
+	bool containsZeroHash = false;
+
+	// Кладёт хеш в первую свободную ячейку, начиная с его корзины. Хеша в таблице быть не должно, а место - должно
+	void place(uint64_t hash) noexcept {
+		for (size_t bucketNumber = hash & bucketsMask;; bucketNumber = (bucketNumber + 1) & bucketsMask) {
+			uint64_t* slots = buckets[bucketNumber].hashes;
+			for (size_t slotNumber = 0; slotNumber < HASH_SET_BUCKET_SLOTS_COUNT; slotNumber++) {
+				if (slots[slotNumber] != 0) continue;
+				slots[slotNumber] = hash;
+				return;
+			}
+		}
+	}
+
+	// Увеличивает таблицу до bucketsCount корзин (степень двойки) и раскладывает по ним все хеши заново
+	void rehash(size_t bucketsCount) {
+		std::unique_ptr<Bucket[]> oldBuckets = std::move(buckets);
+		size_t oldBucketsCount = oldBuckets != nullptr ? bucketsMask + 1 : 0;
+		buckets = std::make_unique<Bucket[]>(bucketsCount);
+		bucketsMask = bucketsCount - 1;
+		maxHashesCount = static_cast<size_t>(static_cast<double>(bucketsCount * HASH_SET_BUCKET_SLOTS_COUNT) * HASH_SET_MAX_LOAD_FACTOR);
+		for (size_t bucketNumber = 0; bucketNumber < oldBucketsCount; bucketNumber++) {
+			for (uint64_t hash : oldBuckets[bucketNumber].hashes) {
+				if (hash != 0) place(hash);
+			}
+		}
+	}
+public:
+	size_t size(void) const noexcept { return hashesCount + containsZeroHash; }
+	bool empty(void) const noexcept { return size() == 0; }
+	double load_factor(void) const noexcept { return buckets != nullptr ? static_cast<double>(hashesCount) / static_cast<double>((bucketsMask + 1) * HASH_SET_BUCKET_SLOTS_COUNT) : 0; }
+
+	// Запрашивает у памяти корзину хеша заранее, чтобы следующая проверка этого хеша не ждала промаха кеша
+	void prefetch(uint64_t hash) const noexcept {
+		if (buckets != nullptr) prefetchMemory(&buckets[hash & bucketsMask]);
+	}
+
+	bool contains(uint64_t hash) const noexcept {
+		if (hash == 0) return containsZeroHash;
+		if (buckets == nullptr) return false;
+		// Таблица никогда не заполняется полностью, поэтому пустая ячейка, на которой поиск заканчивается, всегда найдётся
+		for (size_t bucketNumber = hash & bucketsMask;; bucketNumber = (bucketNumber + 1) & bucketsMask) {
+			const uint64_t* slots = buckets[bucketNumber].hashes;
+			for (size_t slotNumber = 0; slotNumber < HASH_SET_BUCKET_SLOTS_COUNT; slotNumber++) {
+				if (slots[slotNumber] == hash) return true;
+				if (slots[slotNumber] == 0) return false;
+			}
+		}
+	}
+
+	// Добавляет хеш, которого ещё нет в таблице (перед добавлением его надо проверить через contains)
+	void insert(uint64_t hash) {
+		if (hash == 0) {
+			containsZeroHash = true;
+			return;
+		}
+		if (hashesCount >= maxHashesCount) rehash(buckets != nullptr ? (bucketsMask + 1) * 2 : 16);
+		place(hash);
+		hashesCount++;
+	}
+
+	// Вызывает processHash(hash) для каждого хеша таблицы в произвольном порядке
+	template <typename HashFunctor>
+	void forEach(HashFunctor&& processHash) const {
+		if (containsZeroHash) processHash(static_cast<uint64_t>(0));
+		if (buckets == nullptr) return;
+		for (size_t bucketNumber = 0; bucketNumber <= bucketsMask; bucketNumber++) {
+			for (uint64_t hash : buckets[bucketNumber].hashes) {
+				if (hash != 0) processHash(hash);
+			}
+		}
+	}
+
+	// Удаляет все хеши, но оставляет память таблицы под следующие
+	void clear(void) noexcept {
+		if (buckets != nullptr) memset(buckets.get(), 0, (bucketsMask + 1) * sizeof(Bucket));
+		hashesCount = 0;
+		containsZeroHash = false;
+	}
+};
+
+#endif // !THEO_HASH_SET
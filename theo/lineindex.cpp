@@ -0,0 +1,173 @@
+﻿#include <atomic>
+#include "utils.hpp"
+
+LineIndexParameters lineIndexParameters;
+
+/* Заголовок файла индекса, после него идут blocksCount 32-битных количеств переносов строк в блоках.
+* Числа записываются в порядке байт процессора, так как индекс используется на той же машине, где построен */
+struct LineIndexFileHeader {
+	char signature[4];
+	uint32_t version;
+	uint32_t blockSize;
+	uint32_t reserved;
+	uint64_t fileSize;
+	int64_t modificationTime;
+	uint64_t linesCount;
+	uint64_t blocksCount;
+};
+static const char LINE_INDEX_SIGNATURE[4] = { 'T', 'I', 'D', 'X' };
+constexpr uint32_t LINE_INDEX_VERSION = 1;
+
+// Размер и время изменения файла, по которым проверяется, что индекс построен именно для текущего содержимого
+static bool getFileSizeAndModificationTime(const wstring& filePath, ull* fileSizePtr, long long* modificationTimePtr) noexcept {
+	error_code errorCode;
+	fs::path path = toFilesystemPath(filePath);
+	*fileSizePtr = fs::file_size(path, errorCode);
+	if (errorCode) return false;
+	fs::file_time_type modificationTime = fs::last_write_time(path, errorCode);
+	if (errorCode) return false;
+	*modificationTimePtr = static_cast<long long>(modificationTime.time_since_epoch().count());
+	return true;
+}
+
+wstring LineIndex::getIndexPath(const wstring& filePath) {
+	return filePath + L".tidx";
+}
+
+bool LineIndex::isIndexable(const wstring& filePath) noexcept {
+	return not isStandardStreamPath(filePath) and getCompressionFormatByExtension(filePath) == CompressionFormat::None;
+}
+
+void LineIndex::computeNewlinesBeforeBlocks(void) {
+	newlinesBeforeBlocks.assign(blocksNewlinesCounts.size() + 1, 0);
+	for (size_t i = 0; i < blocksNewlinesCounts.size(); i++) newlinesBeforeBlocks[i + 1] = newlinesBeforeBlocks[i] + blocksNewlinesCounts[i];
+}
+
+bool LineIndex::load(const wstring& filePath) noexcept {
+	ull currentFileSize = 0;
+	long long currentModificationTime = 0;
+	if (not getFileSizeAndModificationTime(filePath, &currentFileSize, &currentModificationTime)) return false;
+
+	File* indexFile = openPlatformFile(getIndexPath(filePath), FileOpenMode::Read);
+	if (indexFile == NULL) return false;
+	LineIndexFileHeader header;
+	bool isValid = indexFile->read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header)
+		and memcmp(header.signature, LINE_INDEX_SIGNATURE, sizeof(LINE_INDEX_SIGNATURE)) == 0 and header.version == LINE_INDEX_VERSION
+		and header.blockSize == LINE_INDEX_BLOCK_SIZE and header.fileSize == currentFileSize and header.modificationTime == currentModificationTime
+		and header.blocksCount == (currentFileSize + LINE_INDEX_BLOCK_SIZE - 1) / LINE_INDEX_BLOCK_SIZE;
+	if (isValid) {
+		try {
+			blocksNewlinesCounts.resize(static_cast<size_t>(header.blocksCount));
+			size_t countsSizeInBytes = blocksNewlinesCounts.size() * sizeof(uint32_t);
+			isValid = indexFile->read(reinterpret_cast<char*>(blocksNewlinesCounts.data()), countsSizeInBytes) == countsSizeInBytes;
+			if (isValid) computeNewlinesBeforeBlocks();
+		}
+		catch (...) {
+			isValid = false;
+		}
+	}
+	fileClose(indexFile);
+	// Строк не может быть меньше переносов строк и больше, чем на одну незаконченную строку в конце
+	if (isValid and (header.linesCount < newlinesBeforeBlocks.back() or header.linesCount > newlinesBeforeBlocks.back() + 1)) isValid = false;
+	if (not isValid) return false;
+
+	fileSize = currentFileSize;
+	modificationTime = currentModificationTime;
+	linesCount = header.linesCount;
+	isOutdated = false;
+	return true;
+}
+
+bool LineIndex::startBuilding(const wstring& filePath) noexcept {
+	if (not getFileSizeAndModificationTime(filePath, &fileSize, &modificationTime)) return false;
+	try {
+		blocksNewlinesCounts.assign(static_cast<size_t>((fileSize + LINE_INDEX_BLOCK_SIZE - 1) / LINE_INDEX_BLOCK_SIZE), 0);
+	}
+	catch (...) {
+		return false;
+	}
+	newlinesBeforeBlocks.clear();
+	isOutdated = false;
+	return true;
+}
+
+size_t LineIndex::addNewlines(ull offset, const char* data, size_t length) noexcept {
+	size_t newlinesCount = 0;
+	while (length > 0) {
+		// Данные делятся на куски по границам блоков индекса, каждый кусок добавляется к своему блоку
+		size_t blockNumber = static_cast<size_t>(offset / LINE_INDEX_BLOCK_SIZE);
+		size_t pieceLength = min(length, static_cast<size_t>(LINE_INDEX_BLOCK_SIZE - offset % LINE_INDEX_BLOCK_SIZE));
+		size_t pieceNewlinesCount = getLinesCountInBuffer(data, pieceLength);
+		/* Один блок могут дочитывать два потока, которые считают соседние части файла, поэтому счётчик блока
+		* увеличивается атомарно. Если файл вырос после начала построения, индекс уже устарел */
+		if (blockNumber < blocksNewlinesCounts.size()) {
+			atomic_ref<uint32_t>(blocksNewlinesCounts[blockNumber]).fetch_add(static_cast<uint32_t>(pieceNewlinesCount), memory_order_relaxed);
+		}
+		else isOutdated.store(true, memory_order_relaxed);
+		newlinesCount += pieceNewlinesCount;
+		offset += pieceLength;
+		data += pieceLength;
+		length -= pieceLength;
+	}
+	return newlinesCount;
+}
+
+bool LineIndex::finishBuilding(const wstring& filePath, ull fileLinesCount) noexcept {
+	linesCount = fileLinesCount;
+	computeNewlinesBeforeBlocks();
+	if (isOutdated) return false;
+
+	LineIndexFileHeader header = {};
+	memcpy(header.signature, LINE_INDEX_SIGNATURE, sizeof(LINE_INDEX_SIGNATURE));
+	header.version = LINE_INDEX_VERSION;
+	header.blockSize = LINE_INDEX_BLOCK_SIZE;
+	header.fileSize = fileSize;
+	header.modificationTime = modificationTime;
+	header.linesCount = linesCount;
+	header.blocksCount = blocksNewlinesCounts.size();
+
+	/* Индекс сначала записывается во временный файл и только потом переименовывается, чтобы другой запуск theo,
+	* читающий индекс того же файла, никогда не увидел его записанным наполовину */
+	wstring indexPath = getIndexPath(filePath);
+	wstring temporaryIndexPath = indexPath + L".tmp";
+	File* indexFile = openPlatformFile(temporaryIndexPath, FileOpenMode::Write);
+	if (indexFile == NULL) return false;
+	size_t countsSizeInBytes = blocksNewlinesCounts.size() * sizeof(uint32_t);
+	bool isSaved = indexFile->write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header)
+		and indexFile->write(reinterpret_cast<const char*>(blocksNewlinesCounts.data()), countsSizeInBytes) == countsSizeInBytes;
+	fileClose(indexFile);
+
+	error_code errorCode;
+	if (isSaved) fs::rename(toFilesystemPath(temporaryIndexPath), toFilesystemPath(indexPath), errorCode);
+	if (not isSaved or errorCode) {
+		fs::remove(toFilesystemPath(temporaryIndexPath), errorCode);
+		return false;
+	}
+	return true;
+}
+
+bool LineIndex::findLineStartOffset(const wstring& filePath, ull lineNumber, ull* offsetPtr) const {
+	if (lineNumber == 0) {
+		*offsetPtr = 0;
+		return true;
+	}
+	// Строка с номером lineNumber начинается сразу после переноса строки с тем же номером (считая с единицы)
+	if (newlinesBeforeBlocks.empty() or lineNumber > newlinesBeforeBlocks.back()) return false;
+	size_t blockNumber = static_cast<size_t>(lower_bound(newlinesBeforeBlocks.begin(), newlinesBeforeBlocks.end(), lineNumber) - newlinesBeforeBlocks.begin()) - 1;
+
+	File* file = fileOpen(filePath, "rb");
+	if (file == NULL) return false;
+	ull blockStart = static_cast<ull>(blockNumber) * LINE_INDEX_BLOCK_SIZE;
+	size_t blockLength = static_cast<size_t>(min(static_cast<ull>(LINE_INDEX_BLOCK_SIZE), fileSize - blockStart));
+	char* blockBuffer = allocateIOBuffer(LINE_INDEX_BLOCK_SIZE);
+	bool isReaded = file->seek(blockStart) and file->read(blockBuffer, blockLength) == blockLength;
+	fileClose(file);
+
+	size_t remainingNewlines = static_cast<size_t>(lineNumber - newlinesBeforeBlocks[blockNumber]);
+	size_t lineStartInBlock = isReaded ? readBufferByLinesUntilCount(blockBuffer, blockLength, 0, &remainingNewlines) : 0;
+	freeIOBuffer(blockBuffer);
+	// Если нужного переноса в блоке не оказалось, файл изменился после проверки индекса
+	if (not isReaded or remainingNewlines != 0) return false;
+	*offsetPtr = blockStart + lineStartInBlock;
+	return true;
+}
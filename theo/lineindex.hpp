@@ -0,0 +1,66 @@
+﻿#pragma once
+#ifndef THEO_LINE_INDEX
+#define THEO_LINE_INDEX
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Индекс строк файла - небольшой файл рядом с ним (base.txt.tidx), в котором записаны количество строк и количество
+* переносов строк в каждом мегабайте файла. Строится в том же проходе, в котором файл и так читается целиком
+* (подсчёт строк в count и split --parts), и используется следующими командами: количество строк берётся
+* из индекса без чтения файла, а начало N-ной строки находится чтением одного мегабайта вместо всего файла.
+* Вместе с индексом записываются размер файла и время его изменения: если файл изменился, индекс не используется
+* и строится заново. Индексируются только обычные несжатые файлы */
+
+// Параметры индекса строк, значение задаётся опцией запуска команды --index
+struct LineIndexParameters {
+	int isEnabled = 0; // Использовать ли индексы строк файлов и строить ли их, если их нет или они устарели
+};
+extern LineIndexParameters lineIndexParameters;
+
+// Размер блока файла, для которого в индексе хранится количество переносов строк
+constexpr unsigned LINE_INDEX_BLOCK_SIZE = 1024 * 1024;
+
+class LineIndex {
+private:
+	unsigned long long fileSize = 0;
+	long long modificationTime = 0;
+	unsigned long long linesCount = 0;
+	// Количество переносов строк в каждом блоке файла
+	std::vector<uint32_t> blocksNewlinesCounts;
+	// Количество переносов строк до начала каждого блока, на один элемент больше, чем блоков
+	std::vector<unsigned long long> newlinesBeforeBlocks;
+	/* Файл оказался больше, чем при начале построения, значит, он изменился и индекс сохранять нельзя.
+	* Устанавливается потоками, которые параллельно считают части файла, поэтому атомарный */
+	std::atomic<bool> isOutdated = false;
+
+	void computeNewlinesBeforeBlocks(void);
+public:
+	// Путь к файлу индекса для указанного файла
+	static std::wstring getIndexPath(const std::wstring& filePath);
+	// Можно ли построить индекс для файла: только для обычного несжатого файла, но не стандартного ввода
+	static bool isIndexable(const std::wstring& filePath) noexcept;
+
+	/* Загружает индекс файла. Возвращает false, если индекса нет, он повреждён или устарел (у файла другой
+	* размер или время изменения) */
+	bool load(const std::wstring& filePath) noexcept;
+
+	/* Начинает построение индекса: запоминает размер и время изменения файла до начала чтения. После этого
+	* addNewlines надо вызвать для всех байт файла (в любом порядке и из любых потоков), а затем finishBuilding */
+	bool startBuilding(const std::wstring& filePath) noexcept;
+	// Считает переносы строк в данных, прочитанных из файла начиная с позиции offset, и добавляет их в индекс
+	size_t addNewlines(unsigned long long offset, const char* data, size_t length) noexcept;
+	// Заканчивает построение индекса и сохраняет его рядом с файлом. Возвращает false, если сохранить не удалось
+	bool finishBuilding(const std::wstring& filePath, unsigned long long fileLinesCount) noexcept;
+
+	unsigned long long getLinesCount(void) const noexcept { return linesCount; }
+	unsigned long long getFileSize(void) const noexcept { return fileSize; }
+
+	/* Находит позицию начала строки с номером lineNumber (нумерация с нуля), читая из файла только блок,
+	* в котором она начинается. Возвращает false, если переносов строк в файле меньше lineNumber */
+	bool findLineStartOffset(const std::wstring& filePath, unsigned long long lineNumber, unsigned long long* offsetPtr) const;
+};
+
+#endif // !THEO_LINE_INDEX
@@ -0,0 +1,190 @@
+﻿#include "utils.hpp"
+#if defined(__x86_64__) or defined(_M_X64)
+#define THEO_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Векторные реализации собираются с атрибутом target, поэтому вся программа по-прежнему собирается под базовый
+* набор инструкций и запускается на любом процессоре, а AVX2 и AVX-512 вызываются, только если процессор их умеет.
+* MSVC разрешает использовать любые встроенные функции процессора без отдельных флагов */
+#if defined(THEO_X86_SIMD) and (defined(__GNUC__) or defined(__clang__))
+#define THEO_TARGET(instructionSets) __attribute__((target(instructionSets)))
+#else
+#define THEO_TARGET(instructionSets)
+#endif
+
+// Маски переносов для байт блока, начиная с from, побайтово. Используется для хвостов блоков и без SIMD
+static inline void findNewlinesScalarFrom(const char* block, size_t from, size_t length, ull* masks) noexcept {
+	for (size_t pos = from; pos < length; pos++) {
+		if (block[pos] == '\n') masks[pos / 64] |= 1ull << (pos % 64);
+	}
+}
+
+static void findNewlinesScalar(const char* block, size_t length, ull* masks) noexcept {
+	memset(masks, 0, (length + 63) / 64 * sizeof(ull));
+	findNewlinesScalarFrom(block, 0, length, masks);
+}
+
+static size_t countNewlinesScalar(const char* buffer, size_t length) noexcept {
+	size_t newlinesCount = 0;
+	for (size_t pos = 0; pos < length; pos++) newlinesCount += buffer[pos] == '\n';
+	return newlinesCount;
+}
+
+#ifdef THEO_X86_SIMD
+
+static void findNewlinesSSE2(const char* block, size_t length, ull* masks) noexcept {
+	const __m128i newlines = _mm_set1_epi8('\n');
+	size_t fullMasksCount = length / 64;
+	for (size_t maskNumber = 0; maskNumber < fullMasksCount; maskNumber++) {
+		const char* group = &block[maskNumber * 64];
+		ull mask = 0;
+		for (unsigned part = 0; part < 4; part++) {
+			__m128i bytes = _mm_loadu_si128((const __m128i*)&group[part * 16]);
+			mask |= static_cast<ull>(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newlines)))) << (part * 16);
+		}
+		masks[maskNumber] = mask;
+	}
+	if (fullMasksCount * 64 < length) {
+		masks[fullMasksCount] = 0;
+		findNewlinesScalarFrom(block, fullMasksCount * 64, length, masks);
+	}
+}
+
+/* Векторный подсчёт: сравнение даёт -1 в каждом байте-переносе, и вычитание накапливает количество переносов
+* в каждом из 16 байтовых счётчиков. Чтобы счётчики не переполнились, каждые 255 итераций они суммируются
+* в 64-битные (_mm_sad_epu8) */
+static size_t countNewlinesSSE2(const char* buffer, size_t length) noexcept {
+	const __m128i newlines = _mm_set1_epi8('\n');
+	size_t newlinesCount = 0, pos = 0;
+	while (pos + 16 <= length) {
+		__m128i byteCounters = _mm_setzero_si128();
+		for (unsigned iteration = 0; iteration < 255 and pos + 16 <= length; iteration++, pos += 16) {
+			byteCounters = _mm_sub_epi8(byteCounters, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&buffer[pos]), newlines));
+		}
+		__m128i sums = _mm_sad_epu8(byteCounters, _mm_setzero_si128());
+		newlinesCount += static_cast<size_t>(_mm_cvtsi128_si32(sums)) + static_cast<size_t>(_mm_extract_epi16(sums, 4));
+	}
+	return newlinesCount + countNewlinesScalar(&buffer[pos], length - pos);
+}
+
+THEO_TARGET("avx2")
+static void findNewlinesAVX2(const char* block, size_t length, ull* masks) noexcept {
+	const __m256i newlines = _mm256_set1_epi8('\n');
+	size_t fullMasksCount = length / 64;
+	for (size_t maskNumber = 0; maskNumber < fullMasksCount; maskNumber++) {
+		const char* group = &block[maskNumber * 64];
+		__m256i low = _mm256_loadu_si256((const __m256i*)group);
+		__m256i high = _mm256_loadu_si256((const __m256i*)&group[32]);
+		ull lowMask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newlines)));
+		ull highMask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newlines)));
+		masks[maskNumber] = lowMask | (highMask << 32);
+	}
+	if (fullMasksCount * 64 < length) {
+		masks[fullMasksCount] = 0;
+		findNewlinesScalarFrom(block, fullMasksCount * 64, length, masks);
+	}
+}
+
+THEO_TARGET("avx2")
+static size_t countNewlinesAVX2(const char* buffer, size_t length) noexcept {
+	const __m256i newlines = _mm256_set1_epi8('\n');
+	size_t newlinesCount = 0, pos = 0;
+	while (pos + 32 <= length) {
+		__m256i byteCounters = _mm256_setzero_si256();
+		for (unsigned iteration = 0; iteration < 255 and pos + 32 <= length; iteration++, pos += 32) {
+			byteCounters = _mm256_sub_epi8(byteCounters, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&buffer[pos]), newlines));
+		}
+		__m256i sums = _mm256_sad_epu8(byteCounters, _mm256_setzero_si256());
+		newlinesCount += static_cast<size_t>(_mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3));
+	}
+	return newlinesCount + countNewlinesScalar(&buffer[pos], length - pos);
+}
+
+// AVX-512BW сравнивает сразу 64 байта и возвращает готовую маску, а хвост блока читается загрузкой по маске
+THEO_TARGET("avx512f,avx512bw")
+static void findNewlinesAVX512(const char* block, size_t length, ull* masks) noexcept {
+	const __m512i newlines = _mm512_set1_epi8('\n');
+	size_t fullMasksCount = length / 64;
+	for (size_t maskNumber = 0; maskNumber < fullMasksCount; maskNumber++) {
+		masks[maskNumber] = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void*)&block[maskNumber * 64]), newlines);
+	}
+	size_t tailLength = length - fullMasksCount * 64;
+	if (tailLength) {
+		__mmask64 tailBytes = (1ull << tailLength) - 1;
+		masks[fullMasksCount] = _mm512_mask_cmpeq_epi8_mask(tailBytes, _mm512_maskz_loadu_epi8(tailBytes, &block[fullMasksCount * 64]), newlines);
+	}
+}
+
+THEO_TARGET("avx512f,avx512bw,popcnt")
+static size_t countNewlinesAVX512(const char* buffer, size_t length) noexcept {
+	const __m512i newlines = _mm512_set1_epi8('\n');
+	size_t newlinesCount = 0, pos = 0;
+	for (; pos + 64 <= length; pos += 64) {
+		newlinesCount += static_cast<size_t>(_mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void*)&buffer[pos]), newlines)));
+	}
+	return newlinesCount + countNewlinesScalar(&buffer[pos], length - pos);
+}
+
+#endif // THEO_X86_SIMD
+
+static const NewlineKernel scalarNewlineKernel = { "scalar", findNewlinesScalar, countNewlinesScalar };
+#ifdef THEO_X86_SIMD
+static const NewlineKernel sse2NewlineKernel = { "sse2", findNewlinesSSE2, countNewlinesSSE2 };
+static const NewlineKernel avx2NewlineKernel = { "avx2", findNewlinesAVX2, countNewlinesAVX2 };
+static const NewlineKernel avx512NewlineKernel = { "avx512", findNewlinesAVX512, countNewlinesAVX512 };
+#endif
+
+// Поддерживает ли процессор (и операционная система, сохраняющая его регистры) набор инструкций
+enum class SimdInstructionSet { SSE2, AVX2, AVX512 };
+static bool isInstructionSetSupported(SimdInstructionSet instructionSet) noexcept {
+#if not defined(THEO_X86_SIMD)
+	return false;
+#elif defined(_MSC_VER)
+	int cpuInfo[4];
+	__cpuid(cpuInfo, 0);
+	int maxFunctionNumber = cpuInfo[0];
+	__cpuid(cpuInfo, 1);
+	if (instructionSet == SimdInstructionSet::SSE2) return cpuInfo[3] & (1 << 26);
+	// Регистры AVX сохраняются операционной системой, только если она включила это в XCR0 (бит OSXSAVE)
+	bool isOSXSaveEnabled = cpuInfo[2] & (1 << 27);
+	if (not isOSXSaveEnabled or maxFunctionNumber < 7) return false;
+	unsigned long long enabledStates = _xgetbv(0);
+	__cpuidex(cpuInfo, 7, 0);
+	if (instructionSet == SimdInstructionSet::AVX2) return (enabledStates & 0x6) == 0x6 and (cpuInfo[1] & (1 << 5));
+	return (enabledStates & 0xE6) == 0xE6 and (cpuInfo[1] & (1 << 16)) and (cpuInfo[1] & (1 << 30));
+#else
+	__builtin_cpu_init();
+	if (instructionSet == SimdInstructionSet::SSE2) return __builtin_cpu_supports("sse2");
+	if (instructionSet == SimdInstructionSet::AVX2) return __builtin_cpu_supports("avx2");
+	return __builtin_cpu_supports("avx512f") and __builtin_cpu_supports("avx512bw") and __builtin_cpu_supports("popcnt");
+#endif
+}
+
+// Реализации, поддерживаемые процессором, от самой простой до самой быстрой
+static vector<const NewlineKernel*> getSupportedNewlineKernels(void) {
+	vector<const NewlineKernel*> kernels = { &scalarNewlineKernel };
+#ifdef THEO_X86_SIMD
+	if (isInstructionSetSupported(SimdInstructionSet::SSE2)) kernels.push_back(&sse2NewlineKernel);
+	if (isInstructionSetSupported(SimdInstructionSet::AVX2)) kernels.push_back(&avx2NewlineKernel);
+	if (isInstructionSetSupported(SimdInstructionSet::AVX512)) kernels.push_back(&avx512NewlineKernel);
+#endif
+	return kernels;
+}
+
+static const vector<const NewlineKernel*> supportedNewlineKernels = getSupportedNewlineKernels();
+const NewlineKernel* newlineKernel = supportedNewlineKernels.back();
+
+const NewlineKernel* const* getAvailableNewlineKernels(size_t* kernelsCount) noexcept {
+	*kernelsCount = supportedNewlineKernels.size();
+	return supportedNewlineKernels.data();
+}
+
+bool setNewlineKernel(const char* kernelName) noexcept {
+	for (const NewlineKernel* kernel : supportedNewlineKernels) {
+		if (string(kernel->name) != kernelName) continue;
+		newlineKernel = kernel;
+		return true;
+	}
+	return false;
+}
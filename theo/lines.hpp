@@ -0,0 +1,78 @@
+﻿#pragma once
+#ifndef THEO_LINES
+#define THEO_LINES
+
+#include <cstddef>
+#include <type_traits>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* Общий для всех команд проход по строкам буфера. Переносы строк ищутся не побайтово, а векторными инструкциями
+* процессора (SSE2, AVX2 или AVX-512, набор выбирается при запуске по возможностям процессора): для блока буфера
+* строится битовая маска позиций '\n', и обработчик каждой строки вызывается по установленным битам маски.
+* Обработчик строки - шаблонный параметр, поэтому он встраивается в цикл прохода, а через указатель на функцию
+* вызывается только поиск переносов - один раз на блок в несколько килобайт */
+
+// Размер блока, для которого за один вызов строится маска переносов строк. Маска блока лежит на стеке
+constexpr size_t NEWLINE_SCAN_BLOCK_SIZE = 4096;
+constexpr size_t NEWLINE_MASKS_IN_BLOCK = NEWLINE_SCAN_BLOCK_SIZE / 64;
+
+/* Реализация поиска переносов строк на одном наборе инструкций процессора.
+* findNewlines заполняет для первых length (не больше NEWLINE_SCAN_BLOCK_SIZE) байт блока маски по 64 байта:
+* бит i маски k установлен, если байт 64 * k + i - перенос строки. Биты после конца блока - нули.
+* countNewlines считает переносы строк в буфере любой длины */
+struct NewlineKernel {
+	const char* name;
+	void (*findNewlines)(const char* block, size_t length, unsigned long long* masks);
+	size_t (*countNewlines)(const char* buffer, size_t length);
+};
+
+// Реализация, выбранная для текущего процессора. Выбирается до запуска main, по самому быстрому доступному набору
+extern const NewlineKernel* newlineKernel;
+
+// Все реализации, которые поддерживает текущий процессор, начиная с самой простой (scalar). Нужны для замеров
+const NewlineKernel* const* getAvailableNewlineKernels(size_t* kernelsCount) noexcept;
+
+/* Выбирает реализацию поиска переносов по названию (scalar, sse2, avx2, avx512). Возвращает false, если такой
+* реализации нет или процессор её не поддерживает, тогда остаётся прежняя */
+bool setNewlineKernel(const char* kernelName) noexcept;
+
+// Номер младшего установленного бита ненулевой маски
+inline unsigned getLowestSetBitNumber(unsigned long long mask) noexcept {
+#ifdef _MSC_VER
+	unsigned long bitNumber;
+	_BitScanForward64(&bitNumber, mask);
+	return bitNumber;
+#else
+	return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+}
+
+/* Вызывает processLine(lineStart, lineLength) для каждой законченной переносом строки в буфере, по порядку.
+* Длина строки - без переноса '\n' (символ '\r' перед ним, если есть, остаётся в строке). Возвращает позицию
+* начала незаконченной строки в конце буфера (после последнего переноса) или длину буфера, если такой нет.
+* Указатель на строку - того же типа, что и буфер, поэтому обработчик может изменять строки неконстантного буфера */
+template <typename CharType, typename LineFunctor>
+inline size_t forEachLine(CharType* buffer, size_t bufferLength, LineFunctor&& processLine) {
+	static_assert(sizeof(CharType) == 1 and std::is_same_v<std::remove_const_t<CharType>, char>, "lines are iterated only in char buffers");
+	unsigned long long masks[NEWLINE_MASKS_IN_BLOCK];
+	size_t lineStart = 0;
+	for (size_t blockStart = 0; blockStart < bufferLength; blockStart += NEWLINE_SCAN_BLOCK_SIZE) {
+		size_t blockLength = bufferLength - blockStart < NEWLINE_SCAN_BLOCK_SIZE ? bufferLength - blockStart : NEWLINE_SCAN_BLOCK_SIZE;
+		newlineKernel->findNewlines(&buffer[blockStart], blockLength, masks);
+		size_t masksCount = (blockLength + 63) / 64;
+		for (size_t maskNumber = 0; maskNumber < masksCount; maskNumber++) {
+			unsigned long long mask = masks[maskNumber];
+			while (mask) {
+				size_t newlinePos = blockStart + maskNumber * 64 + getLowestSetBitNumber(mask);
+				processLine(&buffer[lineStart], newlinePos - lineStart);
+				lineStart = newlinePos + 1;
+				mask &= mask - 1; // Сбрасываем младший установленный бит - перенос, который уже обработан
+			}
+		}
+	}
+	return lineStart;
+}
+
+#endif // !THEO_LINES
@@ -1,9 +1,15 @@
 ﻿#include "utils.hpp"
 #include "commands.hpp"
 
+#ifdef _WIN32
 /* Добавляет директорию, где находится исполняемый файл theo.exe, в Windows PATH, чтобы софт можно было
 * запускать откуда угодно с помозью консоли, просто вызвав команду 'theo' с аргументами */
 static DWORD addExecutablePathToWindowsRegisrty();
+#else
+/* Настраивает консольный вывод: по умолчанию wcout на Linux не умеет выводить символы не из ASCII
+* (например, кириллицу в путях к файлам), поэтому используем локаль пользователя */
+static void setupConsoleOutput();
+#endif
 
 static const char* const usages[] = {
     "theo [command] [-command options] [command args]",
@@ -11,6 +17,9 @@ static const char* const usages[] = {
 };
 
 int main(int argc, const char** argv) {
+#ifndef _WIN32
+    setupConsoleOutput();
+#endif
 
     struct argparse argparse;
     struct argparse_option options[] = {
@@ -23,9 +32,11 @@ int main(int argc, const char** argv) {
     argc = argparse_parse(&argparse, argc, argv);
     if (argc < 1) {
         argparse_usage(&argparse);
+#ifdef _WIN32
         if (addExecutablePathToWindowsRegisrty() == ERROR_SUCCESS)
             cout << "\nProgram has been successfully added to the Windows PATH, now it can be called from anywhere by writing 'theo' in cmd!\n" << endl;
         system("pause");
+#endif
         return -1;
     }
 
@@ -42,6 +53,7 @@ int main(int argc, const char** argv) {
     return 0;
 }
 
+#ifdef _WIN32
 static DWORD addExecutablePathToWindowsRegisrty() {
     wstring programName = L"THEO_SOFT"; // Имя программы в user env, чтобы искать по нему при повторных запусках
     // Папка, в которой располагается исполняемый файл программы, на которую будет ссылаться Path
@@ -86,4 +98,32 @@ static DWORD addExecutablePathToWindowsRegisrty() {
     // Закрываем реестр после работы
     RegCloseKey(registryHkey);
     return ERROR_SUCCESS;
-}
\ No newline at end of file
+}
+#else
+static void setupConsoleOutput() {
+    /* Узкий и широкий потоки вывода в glibc не могут одновременно писать в один stdout, поэтому отвязываем их
+    * от stdio, а чтобы сообщения из cout и wcout не перемешивались, сбрасываем буферы после каждого вывода */
+    ios::sync_with_stdio(false);
+    locale consoleLocale = locale::classic();
+    try {
+        consoleLocale = locale("");
+    }
+    catch (const runtime_error&) {
+        // Локаль пользователя не установлена в системе, остаёмся на стандартной
+    }
+    /* В стандартной локале "C" (например, в контейнерах, где LANG не задан) wcout падает на первом же символе
+    * не из ASCII, поэтому в таком случае выводим в UTF-8, если такая локаль есть в системе */
+    if (consoleLocale.name() == "C" or consoleLocale.name() == "POSIX") {
+        try {
+            consoleLocale = locale("C.UTF-8");
+        }
+        catch (const runtime_error&) {}
+    }
+    locale::global(consoleLocale);
+    // В wcerr вывод переключается, когда итоговые строки записываются в стандартный вывод
+    wcout.imbue(consoleLocale);
+    wcerr.imbue(consoleLocale);
+    cout << unitbuf;
+    wcout << unitbuf;
+}
+#endif
@@ -7,7 +7,8 @@ static const char* const usages[] = {
 };
 
 int merge(int argc, const char** argv) {
-	const char* resultFilePath = "merged.txt";
+	const char* resultFilePath = NULL;
+	const char* outputCompression = NULL; // Формат и уровень сжатия итогового файла, если его надо сжимать
 	/* Требуется ли рекурсивно искать файлы для объединения в переданных пользователем директориях (то есть,
 	* надо ли проверять поддиректории и поддиректории поддиректорий и так далее до конца) */
 	int checkSourceDirectoriesRecursive = 0;
@@ -17,6 +18,12 @@ int merge(int argc, const char** argv) {
 		OPT_GROUP("File options"),
 		OPT_STRING('d', "destination", &resultFilePath, "Path to result file with all merged strings ('merged.txt' by default)"),
 		OPT_BOOLEAN('r', "recursive", &checkSourceDirectoriesRecursive, "check source directories recursive (default - false)"),
+		OPT_STRING(0, "compress", &outputCompression, "compress result file: 'zstd', 'gzip' or 'lz4' with optional level after colon, e.g. 'zstd:3'"),
+		OPT_GROUP("Performance options"),
+		OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+		OPT_STRING(0, "io-profile", &(fileIOParameters.ioProfilePath), "disk profile from 'theo bench-io' used to pick chunk size (default - profile saved by last calibration)"),
+		OPT_BOOLEAN(0, "progress", &(progressParameters.isEnabled), "show percent done, speed and remaining time in stderr while merging (default - false)"),
+		OPT_BOOLEAN(0, "perf-counters", &(perfCountersParameters.isEnabled), "measure hardware counters (cycles, instructions, cache and branch misses) of read and write phases (Linux only, default - false)"),
 		OPT_GROUP("All unmarked arguments are considered paths to files and folders with bases that need to be merged."),
 		OPT_END(),
 	};
@@ -31,41 +38,58 @@ int merge(int argc, const char** argv) {
 	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
 	sourcefiles_info sourceFilesPaths = getSourceFilesFromUserInput(remainingArgumentsCount, argv, checkSourceDirectoriesRecursive);
 
-	FILE* resultFilePtr = fopen(resultFilePath, "wb+");
+	processOutputCompressionOption(outputCompression);
+	processPerfCountersOption();
+	// Если итоговый файл сжимается, к его имени по умолчанию добавляется расширение сжатия (merged.txt.zst)
+	string resultFilePathWithExtension = resultFilePath != NULL ? resultFilePath : "merged.txt" + fromWstring(getCompressionExtension(compressionParameters.outputFormat));
+	resultFilePath = resultFilePathWithExtension.c_str();
+
+	File* resultFilePtr = fileOpen(string(resultFilePath), "wb+");
 
 	if (resultFilePtr == NULL) {
 		cout << "Error: Cannot open result file [" << resultFilePath << "] in write mode" << endl;
 		exit(1);
 	}
 
-	// Читаем по 64 мегабайта за одну итерацию, поскольку это оптимальный размер для чтения блока данных с ssd
-	size_t countBytesToReadInOneIteration = OPTIMAL_DISK_CHUNK_SIZE;
+	// Читаем чанками оптимального для диска размера (64 мегабайта для ssd, если нет профиля диска)
+	size_t countBytesToReadInOneIteration = getOptimalChunkSize(1);
 	char* buffer = new char[countBytesToReadInOneIteration + 1];
 	if (buffer == NULL) {
-		cout << "Error: not enough memory in heap to allocate 64MB temporary buffer" << endl;
+		cout << "Error: not enough memory in heap to allocate temporary buffer of " << countBytesToReadInOneIteration << " bytes" << endl;
 		exit(1);
 	}
 
+	startProgress("merge", getSourceFilesTotalSize(sourceFilesPaths));
 	for (const wstring& sourceFilePath : sourceFilesPaths) {
-		FILE* sourceFilePtr = fileOpen(sourceFilePath, "rb");
+		File* sourceFilePtr = fileOpen(sourceFilePath, "rb");
 		if (sourceFilePtr == NULL) {
 			wcout << "File is skipped. Cannot open [" << sourceFilePath << "] because of invalid path or due to security policy reasons." << endl;
 			continue;
 		}
 
-		while (!feof(sourceFilePtr)) {
-			size_t bytesReaded = fread(buffer, sizeof(char), countBytesToReadInOneIteration, sourceFilePtr);
+		while (!sourceFilePtr->isEndOfFile()) {
+			size_t bytesReaded = 0;
+			{
+				PerfPhaseScope perfScope(PerfPhase::Read);
+				bytesReaded = sourceFilePtr->read(buffer, countBytesToReadInOneIteration);
+			}
 			// Если файл дочитан до конца, добавим перенос строки, чтобы не соединилось с первой строкой следующего файла
-			if (feof(sourceFilePtr) and buffer[bytesReaded - 1] != '\n') buffer[bytesReaded++] = '\n';
-			fwrite(buffer, sizeof(char), bytesReaded, resultFilePtr);
+			if (sourceFilePtr->isEndOfFile() and bytesReaded > 0 and buffer[bytesReaded - 1] != '\n') buffer[bytesReaded++] = '\n';
+			{
+				PerfPhaseScope perfScope(PerfPhase::Write);
+				resultFilePtr->write(buffer, bytesReaded);
+			}
+			addProgress(bytesReaded);
 		}
-		fclose(sourceFilePtr);
+		fileClose(sourceFilePtr);
 	}
 
 	delete[] buffer;
-	fclose(resultFilePtr);
+	fileClose(resultFilePtr);
+	finishProgress();
 
 	chrono::steady_clock::time_point end = chrono::steady_clock::now();
 	cout << "\nFiles merged successfully! Execution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+	printPerfCounters("merge");
 	return ERROR_SUCCESS;
 }
\ No newline at end of file
@@ -59,6 +59,10 @@ static bool hasOccurency(const char* string, size_t stringLength, const char* co
 // Является ли текущий символ в строке одним из "дополнительно разрешенных" символов, указанных для текущего типа
 static bool isExtraAllowedSymbol(char symbol) { return strchr(normalizerParameters.firstPartAdditionallyAllowedSymbols, symbol) != NULL; }
 
+/* Устанавливает в параметрах нормализации тип баз (emailpass, numpass или logpass) и разрешённые для этого типа
+* дополнительные символы первой части, если пользователь не указал их сам. Возвращает false, если тип неверный */
+static bool setNormalizedBasesType(const char* basesType);
+
 // Опции для ввода аргументов вызова программы из cmd, показыаемые пользователю при использовании флага --help или -h
 static const char* const usages[] = {
 	"theo n [options] [paths]",
@@ -67,6 +71,7 @@ static const char* const usages[] = {
 
 int normalize(int argc, const char** argv) {
 	const char* destinationPath = NULL; // Путь к итоговой директории, куда будут сложены нормализованные файлы
+	const char* outputCompression = NULL; // Формат и уровень сжатия итоговых файлов, если их надо сжимать
 	const char* firstPartRegexString = NULL; // Строка с пользовательским регулярным выражением для проверки емейлов
 	const char* passwordRegexString = NULL; // Строка с пользовательским регулярным выражением для проверки паролей
 	// Итоговый сепаратор, которым будут разделены email/log/num и password в нормализованной базе
@@ -82,6 +87,7 @@ int normalize(int argc, const char** argv) {
 		OPT_STRING('d', "destination", &destinationPath, "absolute or relative path to result folder(default: current directory)\n\t\t\t\t  or file, if merge parameter is specified (default: normalized_merged.txt)"),
 		OPT_BOOLEAN('m', "merge", &needMerge, "merge strings from all normalized files to one destination file"),
 		OPT_BOOLEAN('r', "recursive", &checkSourceDirectoriesRecursive, "check source directories recursive (default - false)"),
+		OPT_STRING(0, "compress", &outputCompression, "compress result files: 'zstd', 'gzip' or 'lz4' with optional level after colon,\n\t\t\t\t  e.g. 'zstd:3' (default - without compression)"),
 		OPT_GROUP("All unmarked (positional) arguments are considered paths to files and folders with bases that need to be normalized.\nExample command: 'theo n -d result needNormalize1.txt needNormalize2.txt'. More: github.com/Theodikes/theo-bases-soft"),
 
 		OPT_GROUP("\nBasic normalize options:\n"),
@@ -102,6 +108,16 @@ int normalize(int argc, const char** argv) {
 		OPT_STRING(0, "fp-occurency", &(normalizerParameters.firstPartNeededOccurency), "Mandatory occurrence first part of string (email/num/login).\n\t\t\t\t  If possible, use istead of regex, because its much faster"),
 		OPT_STRING(0, "password-occurency", &(normalizerParameters.passwordNeededOccurency), "Mandatory occurrence in every string password.\n\t\t\t\t  If possible, use istead of regex, because its much faster"),
 		OPT_STRING(0, "fp-extra-allowed", &(normalizerParameters.firstPartAdditionallyAllowedSymbols), "Additional allowed symbols for first part of every string.\n\t\t\t\t  Read more with examples: https://github.com/Theodikes/theo-bases-soft"),
+
+		OPT_GROUP("\nPerformance options:\n"),
+		OPT_BOOLEAN(0, "mmap", &(chunksProcessingParameters.useMemoryMapping), "read input files via memory mapping, without copying to buffers (default - false)"),
+		OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+		OPT_BOOLEAN(0, "direct-io", &(fileIOParameters.useDirectIO), "read and write files bypassing page cache (O_DIRECT) and preallocate result files\n\t\t\t\t  (Linux only, default - false)"),
+		OPT_STRING(0, "io-profile", &(fileIOParameters.ioProfilePath), "disk profile from 'theo bench-io' used to pick chunk size (default - profile saved by last calibration)"),
+		OPT_INTEGER(0, "threads", &(chunksProcessingParameters.threadsCount), "number of threads normalizing chunks of file simultaneously (default - all CPU cores)"),
+		OPT_STRING(0, "stats", &(statisticsParameters.format), "print statistics of every file and total (bytes, lines, read, processing and write time)\n\t\t\t\t  after processing: 'json' - one line of JSON (default - don't print)"),
+		OPT_BOOLEAN(0, "progress", &(progressParameters.isEnabled), "show percent done, speed and remaining time in stderr while processing (default - false)"),
+		OPT_BOOLEAN(0, "perf-counters", &(perfCountersParameters.isEnabled), "measure hardware counters (cycles, instructions, cache and branch misses) of read, normalization\n\t\t\t\t  and write phases and print them at the end (Linux only, default - false)"),
 		OPT_END(),
 	};
 	struct argparse argparse;
@@ -117,38 +133,27 @@ int normalize(int argc, const char** argv) {
 	* то делаем так, что если добавилась единица, параметр становится false */
 	if (normalizerParameters.firstPartToLowerCase != 1) normalizerParameters.firstPartToLowerCase = false;
 
+	if (chunksProcessingParameters.threadsCount < 0) {
+		cout << "Error: invalid '--threads' parameter value, it must be positive number (or zero to use all CPU cores)" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	if (not processStatisticsOption()) return ERROR_INVALID_PARAMETER;
+	processPerfCountersOption();
+
 	sourcefiles_info sourceFilesPaths = getSourceFilesFromUserInput(remainingArgumentsCount, argv, checkSourceDirectoriesRecursive);
 
 
-	FILE* resultFile = NULL;
-	processDestinationPath(&destinationPath, needMerge, &resultFile, "normalized_merged.txt");
+	File* resultFile = NULL;
+	processOutputCompressionOption(outputCompression);
+	processDestinationPath(&destinationPath, &needMerge, &resultFile, "normalized_merged.txt");
 
 	/* Указываем в параметрах нормализации тот тип баз, который ввёл пользователь, и все базы будут обрабатываться
 	* по этому типу (как email:pass, num:pass или login:pass) */
-	if (not stringFirstPartTypeMap.contains(basesType)) {
+	if (not setNormalizedBasesType(basesType)) {
 		cout << "Error: wong bases type entered - [" << basesType << "] is invalid. Only three values are allowed: 'emailpass', 'numpass' or  'logpass'." << endl;
 		return ERROR_INVALID_LABEL;
 	}
-	normalizerParameters.firstPartType = stringFirstPartTypeMap[basesType];
-
-	/* Если пользователь сам не указал дополнительные разрешенные в строке символы, то указываем их по умолчанию
-	* в зависимости оти типа проверяемых баз */
-	if (normalizerParameters.firstPartAdditionallyAllowedSymbols == NULL) switch (normalizerParameters.firstPartType)
-	{
-	case StringFirstPartTypes::Email:
-		// У емейлов, кроме букв и цифр, могут быть собачка и точки
-		normalizerParameters.firstPartAdditionallyAllowedSymbols = ".@";
-		break;
-	case StringFirstPartTypes::Number:
-		// У номера, кроме цифр, + в начале и дефисы между частями самого номера
-		normalizerParameters.firstPartAdditionallyAllowedSymbols = "+-";
-		break;
-	case StringFirstPartTypes::Login:
-		// У логина, кроме букв и цифр, могут быть нижние подчеркивания, точки и дефисы между символами
-		normalizerParameters.firstPartAdditionallyAllowedSymbols = "_.-";
-		break;
-	}
-
 
 	if (resultSeparatorInputAsString != NULL) normalizerParameters.resultSeparator = resultSeparatorInputAsString[0];
 
@@ -187,13 +192,47 @@ int normalize(int argc, const char** argv) {
 	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
 	
 	// Обрабатываем все указанные пользователем файлы с помощью наших функций нормализации и записываем в итоговый файл
+	startProgress("normalize", getSourceFilesTotalSize(sourceFilesPaths));
 	processAllSourceFiles(sourceFilesPaths, needMerge, resultFile, toWstring(destinationPath), L"normalized", normalizeBufferLineByLine);
+	finishProgress();
 
 	chrono::steady_clock::time_point end = chrono::steady_clock::now();
 	cout << "\nBases normalized successfully! Execution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+	printStatistics("normalize");
+	printPerfCounters("normalize");
 	return ERROR_SUCCESS;
 }
 
+chunk_processor getNormalizePipeStage(const char* basesType) noexcept {
+	// Остальные параметры нормализации на этапе конвейера остаются по умолчанию
+	if (not setNormalizedBasesType(basesType != NULL ? basesType : "emailpass")) return NULL;
+	return normalizeBufferLineByLine;
+}
+
+static bool setNormalizedBasesType(const char* basesType) {
+	if (not stringFirstPartTypeMap.contains(basesType)) return false;
+	normalizerParameters.firstPartType = stringFirstPartTypeMap[basesType];
+
+	/* Если пользователь сам не указал дополнительные разрешенные в строке символы, то указываем их по умолчанию
+	* в зависимости оти типа проверяемых баз */
+	if (normalizerParameters.firstPartAdditionallyAllowedSymbols == NULL) switch (normalizerParameters.firstPartType)
+	{
+	case StringFirstPartTypes::Email:
+		// У емейлов, кроме букв и цифр, могут быть собачка и точки
+		normalizerParameters.firstPartAdditionallyAllowedSymbols = ".@";
+		break;
+	case StringFirstPartTypes::Number:
+		// У номера, кроме цифр, + в начале и дефисы между частями самого номера
+		normalizerParameters.firstPartAdditionallyAllowedSymbols = "+-";
+		break;
+	case StringFirstPartTypes::Login:
+		// У логина, кроме букв и цифр, могут быть нижние подчеркивания, точки и дефисы между символами
+		normalizerParameters.firstPartAdditionallyAllowedSymbols = "_.-";
+		break;
+	}
+	return true;
+}
+
 static bool hasOccurency(const char* string, size_t stringLength, const char* const substring, const size_t substringLength) {
 	if (string == NULL or stringLength == 0 or substring == NULL or substringLength == 0) return false; 
 
@@ -337,17 +376,11 @@ static void addStringIfItSatisfyingConditions(char* string, size_t stringLength,
 }
 
 static size_t normalizeBufferLineByLine(char* inputBuffer, size_t inputBufferLength, char* resultBuffer) {
-	size_t currentStringStartPosInInputBuffer = 0; // Позиция начала текущей строки в буфере (номер байта)
 	size_t resultBufferLength = 0;
-	for (size_t pos = 0; pos < inputBufferLength; pos++) {
-		if (inputBuffer[pos] == '\n') {
-			// В данном случае в строке не надо учитывать \n, оно будет автоматически вставлено после нормализации
-			size_t currentStringLength = pos - currentStringStartPosInInputBuffer;
-			addStringIfItSatisfyingConditions(&inputBuffer[currentStringStartPosInInputBuffer], currentStringLength, resultBuffer, &resultBufferLength);
-			// Начало следующей строки - следующий символ после тукущей позиции
-			currentStringStartPosInInputBuffer = pos + 1;
-		}
-	}
+	// В данном случае в строке не надо учитывать \n, оно будет автоматически вставлено после нормализации
+	forEachLine(inputBuffer, inputBufferLength, [&](char* string, size_t stringLength) {
+		addStringIfItSatisfyingConditions(string, stringLength, resultBuffer, &resultBufferLength);
+	});
 
 	return resultBufferLength;
 }
\ No newline at end of file
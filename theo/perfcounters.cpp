@@ -0,0 +1,218 @@
+﻿#include <sstream>
+#include <iomanip>
+#ifdef __linux__
+#include <cerrno>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "utils.hpp"
+
+PerfCountersParameters perfCountersParameters;
+
+// Названия событий для вывода, в том же порядке, что и сами события
+static const char* const perfEventsNames[PERF_EVENTS_COUNT] = { "cycles", "instructions", "branch-misses", "LLC-misses", "dTLB-misses" };
+
+// Суммы событий каждого этапа по всем потокам
+static struct PerfPhasesTotals {
+	mutex totalsMutex;
+	double values[3][PERF_EVENTS_COUNT] = {};
+	// Считалось ли событие этапа не всё время замера (ядро делило счётчики между событиями), тогда значение - оценка
+	bool isMultiplexed[3][PERF_EVENTS_COUNT] = {};
+	bool isEventAvailable[PERF_EVENTS_COUNT] = {};
+	bool isKernelExcluded = false; // Считаются ли события только в пространстве пользователя (без системных вызовов)
+} perfPhasesTotals;
+
+#ifdef __linux__
+
+// Тип и конфигурация события для perf_event_open
+struct PerfEventConfig {
+	__u32 type;
+	__u64 config;
+};
+
+// Событие кеша в формате PERF_TYPE_HW_CACHE: кеш, операция и результат
+static constexpr __u64 getCacheEventConfig(__u64 cache, __u64 operation, __u64 result) {
+	return cache | (operation << 8) | (result << 16);
+}
+
+/* Замеряемые события. Если процессор не поддерживает событие в основном варианте, пробуется запасной:
+* вместо промахов чтения LLC - общее событие промахов кеша, которое ядро обычно сопоставляет тому же LLC */
+static const PerfEventConfig perfEventsConfigs[PERF_EVENTS_COUNT] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ PERF_TYPE_HW_CACHE, getCacheEventConfig(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+	{ PERF_TYPE_HW_CACHE, getCacheEventConfig(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+};
+static const PerfEventConfig perfEventsFallbackConfigs[PERF_EVENTS_COUNT] = {
+	{}, {}, {},
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{},
+};
+
+/* Открывает счётчик события для текущего потока на любом ядре процессора. Возвращает дескриптор счётчика
+* или -1, errno - причина ошибки */
+static int openPerfEvent(const PerfEventConfig& eventConfig, bool excludeKernel) noexcept {
+	perf_event_attr attributes;
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.size = sizeof(attributes);
+	attributes.type = eventConfig.type;
+	attributes.config = eventConfig.config;
+	attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attributes.exclude_kernel = excludeKernel;
+	attributes.exclude_hv = 1;
+	return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+/* Счётчики одного потока. Счётчик perf_event_open, открытый для потока, считает события только этого потока,
+* поэтому у каждого потока свои счётчики, они закрываются при завершении потока */
+static thread_local struct ThreadPerfCounters {
+	int descriptors[PERF_EVENTS_COUNT] = { -1, -1, -1, -1, -1 };
+	bool isOpened = false;
+
+	void open() noexcept {
+		isOpened = true;
+		for (unsigned eventNumber = 0; eventNumber < PERF_EVENTS_COUNT; eventNumber++) {
+			if (not perfPhasesTotals.isEventAvailable[eventNumber]) continue;
+			descriptors[eventNumber] = openPerfEvent(perfEventsConfigs[eventNumber], perfPhasesTotals.isKernelExcluded);
+			if (descriptors[eventNumber] < 0 and perfEventsFallbackConfigs[eventNumber].type != 0) {
+				descriptors[eventNumber] = openPerfEvent(perfEventsFallbackConfigs[eventNumber], perfPhasesTotals.isKernelExcluded);
+			}
+		}
+	}
+
+	void read(PerfEventValue values[PERF_EVENTS_COUNT]) noexcept {
+		if (not isOpened) open();
+		for (unsigned eventNumber = 0; eventNumber < PERF_EVENTS_COUNT; eventNumber++) {
+			values[eventNumber] = PerfEventValue();
+			if (descriptors[eventNumber] < 0) continue;
+			if (::read(descriptors[eventNumber], &values[eventNumber], sizeof(PerfEventValue)) != sizeof(PerfEventValue)) values[eventNumber] = PerfEventValue();
+		}
+	}
+
+	~ThreadPerfCounters() {
+		for (int descriptor : descriptors) if (descriptor >= 0) close(descriptor);
+	}
+} threadPerfCounters;
+
+#endif // __linux__
+
+PerfPhaseScope::PerfPhaseScope(PerfPhase phase) noexcept : phase(phase) {
+#ifdef __linux__
+	if (not perfCountersParameters.isEnabled) return;
+	isActive = true;
+	threadPerfCounters.read(beginValues);
+#endif
+}
+
+PerfPhaseScope::~PerfPhaseScope() {
+	if (not isActive) return;
+#ifdef __linux__
+	PerfEventValue endValues[PERF_EVENTS_COUNT];
+	threadPerfCounters.read(endValues);
+	size_t phaseNumber = static_cast<size_t>(phase);
+	lock_guard<mutex> lock(perfPhasesTotals.totalsMutex);
+	for (unsigned eventNumber = 0; eventNumber < PERF_EVENTS_COUNT; eventNumber++) {
+		ull valueDelta = endValues[eventNumber].value - beginValues[eventNumber].value;
+		ull enabledDelta = endValues[eventNumber].timeEnabled - beginValues[eventNumber].timeEnabled;
+		ull runningDelta = endValues[eventNumber].timeRunning - beginValues[eventNumber].timeRunning;
+		if (runningDelta == 0) {
+			// Событие за время замера не считалось ни разу (или счётчик не открыт), оценить его нельзя
+			if (enabledDelta) perfPhasesTotals.isMultiplexed[phaseNumber][eventNumber] = true;
+			continue;
+		}
+		if (runningDelta < enabledDelta) perfPhasesTotals.isMultiplexed[phaseNumber][eventNumber] = true;
+		perfPhasesTotals.values[phaseNumber][eventNumber] += static_cast<double>(valueDelta) * enabledDelta / runningDelta;
+	}
+#endif
+}
+
+void processPerfCountersOption(void) noexcept {
+	if (not perfCountersParameters.isEnabled) return;
+#ifdef __linux__
+	/* Проверяем, какие события можно открыть. Если ядро запрещает считать события в пространстве ядра
+	* (perf_event_paranoid >= 2 без прав администратора), считаем только пространство пользователя */
+	int lastErrno = 0;
+	bool isAnyEventAvailable = false;
+	for (bool excludeKernel : { false, true }) {
+		for (unsigned eventNumber = 0; eventNumber < PERF_EVENTS_COUNT; eventNumber++) {
+			int descriptor = openPerfEvent(perfEventsConfigs[eventNumber], excludeKernel);
+			if (descriptor < 0 and perfEventsFallbackConfigs[eventNumber].type != 0) descriptor = openPerfEvent(perfEventsFallbackConfigs[eventNumber], excludeKernel);
+			if (descriptor < 0) {
+				lastErrno = errno;
+				continue;
+			}
+			close(descriptor);
+			perfPhasesTotals.isEventAvailable[eventNumber] = true;
+			isAnyEventAvailable = true;
+		}
+		perfPhasesTotals.isKernelExcluded = excludeKernel;
+		if (isAnyEventAvailable or (lastErrno != EACCES and lastErrno != EPERM)) break;
+	}
+	if (isAnyEventAvailable) return;
+	cout << "Warning: hardware performance counters are not available (" << strerror(lastErrno) << "), '--perf-counters' is ignored" << endl;
+#else
+	cout << "Warning: hardware performance counters are supported only on Linux, '--perf-counters' is ignored" << endl;
+#endif
+	perfCountersParameters.isEnabled = 0;
+}
+
+// Значение события в читаемом виде: в миллионах, со звёздочкой, если это оценка, или n/a, если событие недоступно
+static string formatPerfEventValue(double value, bool isAvailable, bool isMultiplexed) {
+	if (not isAvailable) return "n/a";
+	ostringstream result;
+	result << fixed << setprecision(1) << value / 1e6 << 'M' << (isMultiplexed ? "*" : "");
+	return result.str();
+}
+
+void printPerfCounters(const char* commandName) {
+	if (not perfCountersParameters.isEnabled) return;
+	lock_guard<mutex> lock(perfPhasesTotals.totalsMutex);
+
+	const char* const phasesNames[4] = { "read", "process", "write", "total" };
+	double values[4][PERF_EVENTS_COUNT] = {};
+	bool isMultiplexed[4][PERF_EVENTS_COUNT] = {};
+	bool isAnyMultiplexed = false;
+	for (unsigned phaseNumber = 0; phaseNumber < 3; phaseNumber++) {
+		for (unsigned eventNumber = 0; eventNumber < PERF_EVENTS_COUNT; eventNumber++) {
+			values[phaseNumber][eventNumber] = perfPhasesTotals.values[phaseNumber][eventNumber];
+			isMultiplexed[phaseNumber][eventNumber] = perfPhasesTotals.isMultiplexed[phaseNumber][eventNumber];
+			values[3][eventNumber] += values[phaseNumber][eventNumber];
+			isMultiplexed[3][eventNumber] = isMultiplexed[3][eventNumber] or isMultiplexed[phaseNumber][eventNumber];
+			isAnyMultiplexed = isAnyMultiplexed or isMultiplexed[phaseNumber][eventNumber];
+		}
+	}
+
+	/* Кроме самих событий выводятся количество инструкций за такт (IPC) и промахи на тысячу инструкций (MPKI):
+	* низкий IPC вместе с большим MPKI промахов LLC и dTLB - обработка ждёт память, а вместе с MPKI промахов
+	* переходов - упирается в ветвления */
+	bool isIpcAvailable = perfPhasesTotals.isEventAvailable[0] and perfPhasesTotals.isEventAvailable[1];
+	bool isMpkiAvailable = perfPhasesTotals.isEventAvailable[1];
+	cout << "\nHardware performance counters of '" << commandName << "' (" << (perfPhasesTotals.isKernelExcluded ? "user space only" : "user and kernel space") << "):" << endl;
+	cout << left << setw(9) << "phase";
+	for (unsigned eventNumber = 0; eventNumber < PERF_EVENTS_COUNT; eventNumber++) cout << right << setw(15) << perfEventsNames[eventNumber];
+	cout << setw(7) << "IPC" << setw(18) << "MPKI br/LLC/dTLB" << endl;
+	for (unsigned phaseNumber = 0; phaseNumber < 4; phaseNumber++) {
+		cout << left << setw(9) << phasesNames[phaseNumber] << right;
+		for (unsigned eventNumber = 0; eventNumber < PERF_EVENTS_COUNT; eventNumber++) {
+			cout << setw(15) << formatPerfEventValue(values[phaseNumber][eventNumber], perfPhasesTotals.isEventAvailable[eventNumber], isMultiplexed[phaseNumber][eventNumber]);
+		}
+		double cycles = values[phaseNumber][0], instructions = values[phaseNumber][1];
+		ostringstream ipc, mpki;
+		ipc << fixed << setprecision(2);
+		mpki << fixed << setprecision(1);
+		if (isIpcAvailable and cycles > 0) ipc << instructions / cycles;
+		else ipc << "n/a";
+		if (isMpkiAvailable and instructions > 0) {
+			for (unsigned eventNumber = 2; eventNumber < PERF_EVENTS_COUNT; eventNumber++) {
+				if (eventNumber > 2) mpki << '/';
+				if (perfPhasesTotals.isEventAvailable[eventNumber]) mpki << values[phaseNumber][eventNumber] / instructions * 1000;
+				else mpki << "n/a";
+			}
+		}
+		else mpki << "n/a";
+		cout << setw(7) << ipc.str() << setw(18) << mpki.str() << endl;
+	}
+	if (isAnyMultiplexed) cout << "* - event was counted only part of time (counters were shared between events), value is estimated" << endl;
+}
@@ -0,0 +1,53 @@
+﻿#pragma once
+#ifndef THEO_PERF_COUNTERS
+#define THEO_PERF_COUNTERS
+
+/* Аппаратные счётчики процессора отдельно для этапов чтения, обработки и записи: такты, инструкции, промахи
+* предсказания переходов, промахи кеша последнего уровня (LLC) и буфера трансляции адресов данных (dTLB).
+* Случайные обращения dedup к хеш-таблице и проверки строк в normalize нагружают процессор совсем по-разному,
+* и по счётчикам на реальных базах видно, во что упирается обработка - в память или в ветвления.
+* Счётчики читаются через perf_event_open, поэтому работают только на Linux */
+
+// Параметры замера счётчиков, значение задаётся опцией запуска команды --perf-counters
+struct PerfCountersParameters {
+	int isEnabled = 0; // Замерять ли аппаратные счётчики и выводить ли их после окончания работы команды
+};
+extern PerfCountersParameters perfCountersParameters;
+
+// Этапы работы команды, счётчики которых суммируются отдельно
+enum class PerfPhase { Read, Process, Write };
+
+// Количество замеряемых событий: такты, инструкции, промахи переходов, промахи LLC и промахи dTLB
+constexpr unsigned PERF_EVENTS_COUNT = 5;
+
+/* Значение счётчика события вместе со временем, в течение которого оно было включено и реально считалось.
+* Если событий больше, чем счётчиков в процессоре, ядро считает их по очереди, и значение надо масштабировать */
+struct PerfEventValue {
+	unsigned long long value = 0;
+	unsigned long long timeEnabled = 0;
+	unsigned long long timeRunning = 0;
+};
+
+/* Замер счётчиков этапа в текущем потоке - от создания объекта до его разрушения. Счётчики потока открываются
+* при первом замере в нём, а разница значений в конце замера добавляется к сумме этапа по всем потокам.
+* Если замер счётчиков не включён, объект ничего не делает */
+class PerfPhaseScope {
+private:
+	PerfPhase phase;
+	bool isActive = false;
+	PerfEventValue beginValues[PERF_EVENTS_COUNT];
+public:
+	explicit PerfPhaseScope(PerfPhase phase) noexcept;
+	~PerfPhaseScope();
+	PerfPhaseScope(const PerfPhaseScope&) = delete;
+	PerfPhaseScope& operator=(const PerfPhaseScope&) = delete;
+};
+
+/* Если пользователь включил замер счётчиков, проверяет, что их можно открыть. Если нельзя (не Linux, виртуальная
+* машина без доступа к счётчикам, запрет в perf_event_paranoid), выводит предупреждение и выключает замер */
+void processPerfCountersOption(void) noexcept;
+
+// Выводит в консоль таблицу счётчиков по этапам и их сумму. Если замер не включён, ничего не делает
+void printPerfCounters(const char* commandName);
+
+#endif // !THEO_PERF_COUNTERS
@@ -0,0 +1,186 @@
+﻿#include <sstream>
+#include "utils.hpp"
+
+/* Обработчики чанков всех этапов цепочки в том порядке, в котором их указал пользователь.
+* Каждый следующий этап обрабатывает результат предыдущего, пока чанк ещё находится в кеше процессора */
+static vector<chunk_processor> pipelineStages;
+
+/* Прогоняет чанк через все этапы цепочки по очереди. Результат каждого этапа записывается не в отдельный новый буфер,
+* а поочерёдно то в итоговый буфер, то в промежуточный буфер потока, так что последний этап всегда пишет в итоговый.
+* Ни один этап не увеличивает количество данных, поэтому обоим буферам хватает размера входного.
+* Возвращает длину итогового буфера, как и обработчик любой отдельной команды */
+static size_t processBufferByAllStages(char* inputBuffer, size_t inputBufferLength, char* resultBuffer);
+
+/* Разбирает цепочку этапов, введённую пользователем (например, 'normalize:emailpass,dedup,tokenize:last'),
+* и заполняет pipelineStages обработчиками этапов. Возвращает false и выводит ошибку, если цепочка неверная.
+* По указателю isStatefulPtr записывает, есть ли в цепочке этап, хранящий состояние между чанками (dedup) */
+static bool parsePipelineStages(const char* pipelineString, const wstring& dbParentDirectory, bool* isStatefulPtr);
+
+// Опции для ввода аргументов вызова программы из cmd, показыаемые пользователю при использовании флага --help или -h
+static const char* const usages[] = {
+	"theo pipe [options] stages [paths]",
+	NULL,
+};
+
+int runPipeline(int argc, const char** argv) {
+	const char* destinationPath = NULL; // Путь к итоговой папке или файлу (если needMerge = true)
+	const char* outputCompression = NULL; // Формат и уровень сжатия итоговых файлов, если их надо сжимать
+	int needMerge = 0; // Требуется ли объединять обработанные строки со всех файлов в один итоговый
+	// Брать ли файлы для обработки из указанных пользователем директорий рекурсивно (проверяя субдиректории)
+	int checkSourceDirectoriesRecursive = 0;
+
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_GROUP("File options"),
+		OPT_BOOLEAN('m', "merge", &needMerge, "merge strings from all processed files to one destination file"),
+		OPT_STRING('d', "destination", &destinationPath, "absolute or relative path to result folder(default: current directory)\n\t\t\t      or file, if merge parameter is specified (default: piped_merged.txt)"),
+		OPT_BOOLEAN('r', "recursive", &checkSourceDirectoriesRecursive, "check source directories recursive (default - false)"),
+		OPT_STRING(0, "compress", &outputCompression, "compress result files: 'zstd', 'gzip' or 'lz4' with optional level after colon,\n\t\t\t      e.g. 'zstd:3' (default - without compression)"),
+		OPT_GROUP("Performance options"),
+		OPT_BOOLEAN(0, "mmap", &(chunksProcessingParameters.useMemoryMapping), "read input files via memory mapping, without copying to buffers (default - false)"),
+		OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+		OPT_BOOLEAN(0, "direct-io", &(fileIOParameters.useDirectIO), "read and write files bypassing page cache (O_DIRECT) and preallocate result files\n\t\t\t      (Linux only, default - false)"),
+		OPT_STRING(0, "io-profile", &(fileIOParameters.ioProfilePath), "disk profile from 'theo bench-io' used to pick chunk size (default - profile saved by last calibration)"),
+		OPT_INTEGER(0, "threads", &(chunksProcessingParameters.threadsCount), "number of threads processing chunks of file simultaneously, ignored if chain contains dedup\n\t\t\t      (default - all CPU cores)"),
+		OPT_STRING(0, "stats", &(statisticsParameters.format), "print statistics of every file and total (bytes, lines, read, processing and write time)\n\t\t\t      after processing: 'json' - one line of JSON (default - don't print)"),
+		OPT_BOOLEAN(0, "progress", &(progressParameters.isEnabled), "show percent done, speed and remaining time in stderr while processing (default - false)"),
+		OPT_BOOLEAN(0, "perf-counters", &(perfCountersParameters.isEnabled), "measure hardware counters (cycles, instructions, cache and branch misses) of read, processing\n\t\t\t      and write phases and print them at the end (Linux only, default - false)"),
+		OPT_GROUP("First positional argument is comma-separated chain of stages, every stage is command name with optional argument:\n\
+'normalize[:emailpass|numpass|logpass]', 'dedup[:max RAM percent]', 'tokenize[:first|last]' (short names n, d, t also work).\n\
+All other positional arguments are considered paths to files and folders with bases. Every chunk of input passes all stages\n\
+at once, without intermediate files. Example command: 'theo pipe -d result n:emailpass,d,t:last base1.txt base2.txt'"),
+		OPT_END(),
+	};
+	struct argparse argparse;
+	argparse_init(&argparse, options, usages, ARGPARSE_STOP_AT_NON_OPTION);
+	int remainingArgumentsCount = argparse_parse(&argparse, argc, argv);
+	if (remainingArgumentsCount < 2) {
+		argparse_usage(&argparse);
+		return -1;
+	}
+
+	if (chunksProcessingParameters.threadsCount < 0) {
+		cout << "Error: invalid '--threads' parameter value, it must be positive number (or zero to use all CPU cores)" << endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	if (not processStatisticsOption()) return ERROR_INVALID_PARAMETER;
+	processPerfCountersOption();
+
+	// Засекаем время выполнения программы
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+	// Первый позиционный аргумент - цепочка этапов, остальные - пути к входным файлам и папкам
+	const char* pipelineString = argv[0];
+	sourcefiles_info sourceFilesPaths = getSourceFilesFromUserInput(remainingArgumentsCount - 1, argv + 1, checkSourceDirectoriesRecursive);
+
+	File* resultFile = NULL;
+	processOutputCompressionOption(outputCompression);
+	processDestinationPath(&destinationPath, &needMerge, &resultFile, "piped_merged.txt");
+	wstring destinationPathW = toWstring(destinationPath);
+
+	// Базы данных для этапа dedup создаются там же, где и у команды dedup
+	wstring dbParentDirectory = needMerge ? getDirectoryFromFilePath(destinationPathW) : destinationPathW;
+	if (isStandardStreamPath(destinationPathW)) dbParentDirectory = getWorkingDirectoryPath();
+
+	bool isStateful = false;
+	if (not parsePipelineStages(pipelineString, dbParentDirectory, &isStateful)) {
+		if (needMerge) fileClose(resultFile);
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	startProgress("pipe", getSourceFilesTotalSize(sourceFilesPaths));
+	if (not isStateful) {
+		// Все этапы независимы от предыдущих чанков, поэтому файлы и чанки обрабатываются так же, как у normalize и tokenize
+		processAllSourceFiles(sourceFilesPaths, needMerge, resultFile, destinationPathW, L"piped", processBufferByAllStages);
+	}
+	else {
+		/* Хеши этапа dedup хранятся в потоке, который обрабатывает чанки, поэтому, как и в команде dedup, чанки
+		* обрабатываются в одном (текущем) потоке, а чтение и запись всё равно идут в отдельных потоках */
+		chunksProcessingParameters.threadsCount = 1;
+		if (needMerge) processAllSourceFiles(sourceFilesPaths, needMerge, resultFile, destinationPathW, L"piped", processBufferByAllStages);
+		// Без объединения дубликаты в каждом файле ищутся отдельно, поэтому после каждого файла хеши очищаются
+		else for (const wstring& sourceFilePath : sourceFilesPaths) {
+			processAllSourceFiles({ sourceFilePath }, needMerge, resultFile, destinationPathW, L"piped", processBufferByAllStages);
+			clearDeduplicatePipeStage();
+		}
+		clearDeduplicatePipeStage();
+	}
+	finishProgress();
+
+	chrono::steady_clock::time_point end = chrono::steady_clock::now();
+	cout << endl << (sourceFilesPaths.size() == 1 ? "File" : "All files") << " processed successfully! Execution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+	printStatistics("pipe");
+	printPerfCounters("pipe");
+
+	return ERROR_SUCCESS;
+}
+
+static bool parsePipelineStages(const char* pipelineString, const wstring& dbParentDirectory, bool* isStatefulPtr) {
+	// Названия уже добавленных этапов: параметры каждой команды общие, поэтому один этап нельзя указать дважды
+	robin_hood::unordered_flat_set<string> addedStagesNames;
+	stringstream pipelineStream(pipelineString);
+	string stageString;
+	while (getline(pipelineStream, stageString, ',')) {
+		// Этап записывается как 'команда' или 'команда:аргумент'
+		size_t argumentSeparatorPos = stageString.find(':');
+		string stageName = stageString.substr(0, argumentSeparatorPos);
+		string stageArgument = argumentSeparatorPos == string::npos ? "" : stageString.substr(argumentSeparatorPos + 1);
+		const char* stageArgumentPtr = argumentSeparatorPos == string::npos ? NULL : stageArgument.c_str();
+
+		if (stageName == "n") stageName = "normalize";
+		else if (stageName == "d") stageName = "dedup";
+		else if (stageName == "t") stageName = "tokenize";
+
+		if (addedStagesNames.contains(stageName)) {
+			cout << "Error: stage [" << stageName << "] is specified twice in chain, every stage can be used only once" << endl;
+			return false;
+		}
+
+		chunk_processor stageProcessor = NULL;
+		if (stageName == "normalize") stageProcessor = getNormalizePipeStage(stageArgumentPtr);
+		else if (stageName == "tokenize") stageProcessor = getTokenizePipeStage(stageArgumentPtr);
+		else if (stageName == "dedup") {
+			stageProcessor = getDeduplicatePipeStage(stageArgumentPtr, dbParentDirectory);
+			*isStatefulPtr = true;
+		}
+		else {
+			cout << "Error: unknown stage [" << stageString << "] in chain. Valid stages: 'normalize', 'dedup', 'tokenize' (or 'n', 'd', 't')" << endl;
+			return false;
+		}
+		if (stageProcessor == NULL) {
+			cout << "Error: invalid argument in stage [" << stageString << "]. Valid arguments: 'emailpass', 'numpass' or 'logpass' for normalize,\n\
+percent of RAM from 1 to 100 for dedup, 'first' or 'last' for tokenize" << endl;
+			return false;
+		}
+		addedStagesNames.insert(stageName);
+		pipelineStages.push_back(stageProcessor);
+	}
+
+	if (pipelineStages.empty()) {
+		cout << "Error: chain of stages is empty. Example of chain: 'normalize:emailpass,dedup,tokenize:last'" << endl;
+		return false;
+	}
+	return true;
+}
+
+static size_t processBufferByAllStages(char* inputBuffer, size_t inputBufferLength, char* resultBuffer) {
+	if (pipelineStages.size() == 1) return pipelineStages[0](inputBuffer, inputBufferLength, resultBuffer);
+
+	// Промежуточный буфер свой у каждого потока обработки и переиспользуется для всех его чанков
+	static thread_local vector<char> intermediateBuffer;
+	if (intermediateBuffer.size() < inputBufferLength + 2) intermediateBuffer.resize(inputBufferLength + 2);
+
+	/* Этапы пишут поочерёдно в два буфера, начиная с того, который нужен, чтобы последний этап писал в итоговый:
+	* при трёх этапах это итоговый, промежуточный и снова итоговый, при двух - промежуточный и итоговый */
+	char* stageResultBuffers[2] = { resultBuffer, intermediateBuffer.data() };
+	size_t stagesCount = pipelineStages.size();
+	char* stageInputBuffer = inputBuffer;
+	size_t stageInputLength = inputBufferLength;
+	for (size_t stageNumber = 0; stageNumber < stagesCount; stageNumber++) {
+		char* stageResultBuffer = stageResultBuffers[(stagesCount - 1 - stageNumber) % 2];
+		stageInputLength = pipelineStages[stageNumber](stageInputBuffer, stageInputLength, stageResultBuffer);
+		stageInputBuffer = stageResultBuffer;
+	}
+	return stageInputLength;
+}
@@ -0,0 +1,31 @@
+﻿#pragma once
+#ifndef THEO_PLATFORM
+#define THEO_PLATFORM
+
+/* Определения из Windows API, которые используются во всей программе (коды возврата команд и т.д.),
+* и системные заголовки для сборки на системах, отличных от Windows. На Windows вместо этого файла подключается Windows.h */
+#ifndef _WIN32
+
+#include <sys/mman.h> // Отображение файлов в память
+#include <sys/wait.h> // Коды завершения команд, запущенных через system
+
+#define ERROR_SUCCESS 0
+#define ERROR_ACCESS_DENIED 5
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_OUTOFMEMORY 14
+#define ERROR_WRITE_FAULT 29
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_OPEN_FAILED 110
+#define ERROR_DIRECTORY 267
+#define ERROR_DIRECTORY_NOT_SUPPORTED 336
+#define ERROR_FILE_PROTECTED_UNDER_DPL 406
+#define ERROR_INVALID_LABEL 1299
+#define ERROR_FILE_CORRUPT 1392
+#define ERROR_CREATE_FAILED 1631
+#define ERROR_NDIS_INVALID_LENGTH 0xC0232014
+
+#define _countof(array) (sizeof(array) / sizeof(array[0]))
+
+#endif // !_WIN32
+
+#endif // !THEO_PLATFORM
@@ -0,0 +1,212 @@
+﻿#include <bit>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+#include "utils.hpp"
+
+DatasetProfileParameters datasetProfileParameters;
+
+// Профили всех файлов, построенные во время подсчёта, в порядке окончания подсчёта
+static vector<DatasetProfile> datasetProfiles;
+static mutex datasetProfilesMutex;
+
+// Выводит профиль одного файла (или всех файлов вместе) и оценку памяти под хеши его уникальных строк
+static void printDatasetProfile(const DatasetProfile& profile, const char* hashSetDescription);
+
+/* Оценивает, сколько байт займёт хеш-таблица dedup (FlatHashSet) с distinctLinesCount хешами: корзины по 8 хешей
+* занимают 64 байта, а количество корзин - степень двойки, заполненная не больше чем на 80% */
+static ull getDeduplicationHashSetSize(double distinctLinesCount) noexcept;
+
+// Доля part от whole в процентах с одним знаком после запятой, например "12.5%"
+static string formatPercent(ull part, ull whole);
+
+void DatasetProfile::addLine(const char* line, size_t hashedLength, ull lineLength, bool isCrlf) noexcept {
+	linesCount++;
+	crlfLinesCount += isCrlf;
+	totalLinesLength += lineLength;
+	maxLineLength = max(maxLineLength, lineLength);
+	// Номер корзины - количество значащих бит длины: 0 -> 0, 1 -> 1, 2-3 -> 2, 4-7 -> 3 и так далее
+	lengthHistogram[min(static_cast<size_t>(bit_width(lineLength)), PROFILE_LENGTH_BUCKETS_COUNT - 1)]++;
+
+	bool hasSeparator = false;
+	for (size_t separatorNumber = 0; separatorNumber < PROFILE_SEPARATORS_COUNT; separatorNumber++) {
+		if (memchr(line, PROFILE_SEPARATORS[separatorNumber], hashedLength) == NULL) continue;
+		linesWithSeparatorCounts[separatorNumber]++;
+		hasSeparator = true;
+	}
+	linesWithoutSeparatorCount += not hasSeparator;
+
+	// Хеш тот же, что и у dedup, поэтому оценка уникальных строк совпадает с тем, что найдёт dedup
+	uint64_t hash = hashLine(line, hashedLength);
+	// Старшие биты хеша выбирают регистр, в нём сохраняется максимальная позиция первой единицы в остальных битах
+	size_t registerNumber = static_cast<size_t>(hash >> (64 - PROFILE_HLL_PRECISION));
+	uint8_t rank = static_cast<uint8_t>(countl_zero((hash << PROFILE_HLL_PRECISION) | (1ull << (PROFILE_HLL_PRECISION - 1))) + 1);
+	if (hllRegisters[registerNumber] < rank) hllRegisters[registerNumber] = rank;
+}
+
+void DatasetProfile::add(const DatasetProfile& other) noexcept {
+	bytesCount += other.bytesCount;
+	nonAsciiBytesCount += other.nonAsciiBytesCount;
+	linesCount += other.linesCount;
+	crlfLinesCount += other.crlfLinesCount;
+	for (size_t i = 0; i < PROFILE_SEPARATORS_COUNT; i++) linesWithSeparatorCounts[i] += other.linesWithSeparatorCounts[i];
+	linesWithoutSeparatorCount += other.linesWithoutSeparatorCount;
+	totalLinesLength += other.totalLinesLength;
+	maxLineLength = max(maxLineLength, other.maxLineLength);
+	for (size_t i = 0; i < PROFILE_LENGTH_BUCKETS_COUNT; i++) lengthHistogram[i] += other.lengthHistogram[i];
+	// Регистры объединённого множества строк - максимумы регистров, поэтому уникальные строки не суммируются дважды
+	for (size_t i = 0; i < PROFILE_HLL_REGISTERS_COUNT; i++) hllRegisters[i] = max(hllRegisters[i], other.hllRegisters[i]);
+}
+
+double DatasetProfile::getDistinctLinesEstimate(void) const noexcept {
+	const double registersCount = static_cast<double>(PROFILE_HLL_REGISTERS_COUNT);
+	double inverseSum = 0;
+	size_t zeroRegistersCount = 0;
+	for (uint8_t rank : hllRegisters) {
+		inverseSum += ldexp(1.0, -static_cast<int>(rank));
+		zeroRegistersCount += rank == 0;
+	}
+	double estimate = 0.7213 / (1 + 1.079 / registersCount) * registersCount * registersCount / inverseSum;
+	// На малых количествах оценка HyperLogLog смещена, а точнее линейный подсчёт по пустым регистрам
+	if (estimate <= 2.5 * registersCount and zeroRegistersCount > 0) estimate = registersCount * log(registersCount / zeroRegistersCount);
+	// Уникальных строк не может быть больше, чем строк
+	return min(estimate, static_cast<double>(linesCount));
+}
+
+void DatasetProfiler::addLine(const char* line, size_t lineLength) noexcept {
+	bool isCrlf = lineLength > 0 and line[lineLength - 1] == '\r';
+	profile.addLine(line, lineLength - isCrlf, lineLength - isCrlf, isCrlf);
+}
+
+void DatasetProfiler::appendToCarriedLine(const char* data, size_t length) {
+	hasCarriedLine = true;
+	carriedLineLength += length;
+	if (length > 0) carriedLineLastChar = data[length - 1];
+	size_t savedLength = min(length, PROFILE_MAX_CARRIED_LINE_LENGTH - carriedLine.size());
+	carriedLine.insert(carriedLine.end(), data, data + savedLength);
+}
+
+void DatasetProfiler::addCarriedLine(void) noexcept {
+	bool isCrlf = carriedLineLength > 0 and carriedLineLastChar == '\r';
+	ull lineLength = carriedLineLength - isCrlf;
+	profile.addLine(carriedLine.data(), static_cast<size_t>(min(static_cast<ull>(carriedLine.size()), lineLength)), lineLength, isCrlf);
+	carriedLine.clear();
+	carriedLineLength = 0;
+	carriedLineLastChar = 0;
+	hasCarriedLine = false;
+}
+
+size_t DatasetProfiler::addBuffer(const char* buffer, size_t bufferLength) {
+	profile.bytesCount += bufferLength;
+	// Старший бит байта установлен только у не-ASCII символов, такой цикл компилятор векторизует сам
+	ull nonAsciiBytesCount = 0;
+	for (size_t i = 0; i < bufferLength; i++) nonAsciiBytesCount += static_cast<unsigned char>(buffer[i]) >> 7;
+	profile.nonAsciiBytesCount += nonAsciiBytesCount;
+
+	size_t newlinesCount = 0;
+	size_t position = 0;
+	// Начало буфера до первого переноса - конец строки из предыдущего буфера или строка, которую надо пропустить
+	if (hasCarriedLine or isSkippingFirstLine) {
+		const char* newline = static_cast<const char*>(memchr(buffer, '\n', bufferLength));
+		if (newline == NULL) {
+			if (hasCarriedLine) appendToCarriedLine(buffer, bufferLength);
+			return 0;
+		}
+		position = static_cast<size_t>(newline - buffer);
+		if (hasCarriedLine) {
+			appendToCarriedLine(buffer, position);
+			addCarriedLine();
+		}
+		isSkippingFirstLine = false;
+		position++;
+		newlinesCount++;
+	}
+
+	size_t remainderStart = position + forEachLine(buffer + position, bufferLength - position, [&](const char* line, size_t lineLength) {
+		addLine(line, lineLength);
+		newlinesCount++;
+	});
+	// Строка, не закончившаяся в этом буфере, продолжится в следующем
+	if (remainderStart < bufferLength) appendToCarriedLine(buffer + remainderStart, bufferLength - remainderStart);
+	return newlinesCount;
+}
+
+bool DatasetProfiler::addLineEnd(const char* data, size_t length) {
+	const char* newline = static_cast<const char*>(memchr(data, '\n', length));
+	appendToCarriedLine(data, newline != NULL ? static_cast<size_t>(newline - data) : length);
+	if (newline == NULL) return false;
+	addCarriedLine();
+	return true;
+}
+
+void DatasetProfiler::finish(void) noexcept {
+	if (hasCarriedLine) addCarriedLine();
+	isSkippingFirstLine = false;
+}
+
+void addDatasetProfile(const DatasetProfile& profile) {
+	if (not datasetProfileParameters.isEnabled) return;
+	lock_guard<mutex> lock(datasetProfilesMutex);
+	datasetProfiles.push_back(profile);
+}
+
+void printDatasetProfiles(void) {
+	if (not datasetProfileParameters.isEnabled or datasetProfiles.empty()) return;
+	// Файлы выводятся в порядке путей, а не окончания подсчёта, чтобы вывод не зависел от количества потоков
+	sort(datasetProfiles.begin(), datasetProfiles.end(), [](const DatasetProfile& first, const DatasetProfile& second) { return first.path < second.path; });
+	for (const DatasetProfile& profile : datasetProfiles) printDatasetProfile(profile, "Dedup hash set");
+	if (datasetProfiles.size() == 1) return;
+
+	DatasetProfile totalProfile;
+	for (const DatasetProfile& profile : datasetProfiles) totalProfile.add(profile);
+	// Без --merge dedup хранит хеши каждого файла отдельно, а с ним - хеши уникальных строк всех файлов сразу
+	printDatasetProfile(totalProfile, "Dedup hash set with --merge");
+}
+
+static void printDatasetProfile(const DatasetProfile& profile, const char* hashSetDescription) {
+	double distinctLinesCount = profile.getDistinctLinesEstimate();
+	ull distinctLinesRounded = static_cast<ull>(llround(distinctLinesCount));
+	ostringstream output;
+	output << fixed << setprecision(1);
+	output << "Lines: " << profile.linesCount << ", distinct lines (estimate): " << distinctLinesRounded << " (" << formatPercent(distinctLinesRounded, profile.linesCount) << ")\n";
+	output << "Line length: average " << (profile.linesCount ? static_cast<double>(profile.totalLinesLength) / profile.linesCount : 0.0) << ", max " << profile.maxLineLength << "\n";
+	for (size_t bucket = 0; bucket < PROFILE_LENGTH_BUCKETS_COUNT; bucket++) {
+		if (profile.lengthHistogram[bucket] == 0) continue;
+		ull bucketStart = bucket ? 1ull << (bucket - 1) : 0;
+		string bucketName = bucket == PROFILE_LENGTH_BUCKETS_COUNT - 1 ? to_string(bucketStart) + "+" : bucket <= 1 ? to_string(bucketStart) : to_string(bucketStart) + "-" + to_string((bucketStart << 1) - 1);
+		output << "  " << left << setw(10) << bucketName << right << setw(14) << profile.lengthHistogram[bucket] << "  " << formatPercent(profile.lengthHistogram[bucket], profile.linesCount) << "\n";
+	}
+	output << "Lines with separator";
+	for (size_t separatorNumber = 0; separatorNumber < PROFILE_SEPARATORS_COUNT; separatorNumber++) {
+		output << (separatorNumber ? ", '" : " '") << PROFILE_SEPARATORS[separatorNumber] << "': " << formatPercent(profile.linesWithSeparatorCounts[separatorNumber], profile.linesCount);
+	}
+	output << ", without separators: " << formatPercent(profile.linesWithoutSeparatorCount, profile.linesCount) << "\n";
+	output << "Lines ending with CRLF: " << formatPercent(profile.crlfLinesCount, profile.linesCount) << "\n";
+	output << "Non-ASCII bytes: " << formatPercent(profile.nonAsciiBytesCount, profile.bytesCount) << "\n";
+
+	/* dedup переходит на диск, когда занятая память превышает --memory процентов от всей, поэтому под хеши остаётся
+	* эта доля памяти минус уже занятая другими программами */
+	ull hashSetSize = getDeduplicationHashSetSize(distinctLinesCount);
+	ull totalMemory = getTotalMemoryInBytes();
+	ull usedMemory = totalMemory - min(getAvailableMemoryInBytes(), totalMemory);
+	ull memoryLimit = static_cast<ull>(static_cast<long double>(totalMemory) * DEDUP_DEFAULT_MEMORY_USAGE_MAX_PERCENT / 100);
+	ull memoryForHashes = memoryLimit > usedMemory ? memoryLimit - usedMemory : 0;
+	const ull megabyte = 1024 * 1024;
+	output << hashSetDescription << ": ~" << (hashSetSize + megabyte - 1) / megabyte << " MB of " << memoryForHashes / megabyte << " MB available before --memory "
+		<< DEDUP_DEFAULT_MEMORY_USAGE_MAX_PERCENT << "% limit, " << (hashSetSize <= memoryForHashes ? "fits in RAM" : "dedup will continue on disk (much slower)") << "\n";
+
+	if (profile.path.empty()) cout << "\nProfile of all files:\n";
+	else wcout << "\nProfile of [" << profile.path << "]:\n";
+	cout << output.str() << flush;
+}
+
+static ull getDeduplicationHashSetSize(double distinctLinesCount) noexcept {
+	ull minBucketsCount = static_cast<ull>(ceil(distinctLinesCount / (HASH_SET_MAX_LOAD_FACTOR * HASH_SET_BUCKET_SLOTS_COUNT)));
+	return bit_ceil(max(minBucketsCount, 16ull)) * HASH_SET_BUCKET_SLOTS_COUNT * sizeof(ull);
+}
+
+static string formatPercent(ull part, ull whole) {
+	ostringstream output;
+	output << fixed << setprecision(1) << (whole ? static_cast<double>(part) * 100 / whole : 0.0) << "%";
+	return output.str();
+}
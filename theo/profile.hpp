@@ -0,0 +1,104 @@
+﻿#pragma once
+#ifndef THEO_PROFILE
+#define THEO_PROFILE
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Профиль строк файлов, который команда count строит в том же проходе по файлу, что и подсчёт строк (опция --profile):
+* оценка количества уникальных строк (HyperLogLog), гистограмма длин строк, доли строк с разделителями ':' и ';',
+* строк с переносом CRLF и не-ASCII байт. По нему заранее видно, сколько памяти займут хеши при удалении
+* дубликатов и придётся ли dedup переходить на диск. Профиль строится для каждого файла и для всех файлов вместе */
+
+// Параметры профиля строк, значение задаётся опцией запуска команды --profile
+struct DatasetProfileParameters {
+	int isEnabled = 0; // Строить ли профиль строк во время подсчёта
+};
+extern DatasetProfileParameters datasetProfileParameters;
+
+/* Точность HyperLogLog: регистров 2^14 (16 килобайт на профиль), стандартная ошибка оценки уникальных
+* строк - 1.04 / sqrt(2^14), то есть около 0.8% */
+constexpr unsigned PROFILE_HLL_PRECISION = 14;
+constexpr size_t PROFILE_HLL_REGISTERS_COUNT = size_t(1) << PROFILE_HLL_PRECISION;
+
+// Корзины гистограммы длин строк: 0, 1, 2-3, 4-7 и так далее по степеням двойки, последняя - 1024 символа и длиннее
+constexpr size_t PROFILE_LENGTH_BUCKETS_COUNT = 12;
+
+// Разделители между первой частью строки и паролем, доля строк с каждым из них считается отдельно (как у tokenize)
+constexpr const char* PROFILE_SEPARATORS = ":;";
+constexpr size_t PROFILE_SEPARATORS_COUNT = 2;
+
+/* Сколько символов строки, начатой в одном буфере и продолженной в следующем, сохраняется между буферами.
+* Более длинные строки всё равно учитываются со своей полной длиной, но хешируется только их начало */
+constexpr size_t PROFILE_MAX_CARRIED_LINE_LENGTH = 1024 * 1024;
+
+// Сколько байт за раз читается после конца части файла, чтобы дочитать последнюю строку части
+constexpr size_t PROFILE_LINE_END_READ_SIZE = 64 * 1024;
+
+// Профиль строк одного файла, части файла или всех файлов. Длины строк считаются без переноса строки (\n или \r\n)
+struct DatasetProfile {
+	std::wstring path; // Путь к файлу, '-' - стандартный ввод, пустой - все файлы
+	unsigned long long bytesCount = 0;
+	unsigned long long nonAsciiBytesCount = 0; // Байт больше 127 (UTF-8 и другие не-ASCII кодировки)
+	unsigned long long linesCount = 0;
+	unsigned long long crlfLinesCount = 0; // Строк, заканчивающихся на \r\n
+	unsigned long long linesWithSeparatorCounts[PROFILE_SEPARATORS_COUNT] = {}; // Строк с каждым из разделителей
+	unsigned long long linesWithoutSeparatorCount = 0; // Строк без единого разделителя (tokenize их отбросит)
+	unsigned long long totalLinesLength = 0;
+	unsigned long long maxLineLength = 0;
+	unsigned long long lengthHistogram[PROFILE_LENGTH_BUCKETS_COUNT] = {};
+	// Регистры HyperLogLog: максимальный номер первого установленного бита среди хешей строк, попавших в регистр
+	std::vector<uint8_t> hllRegisters = std::vector<uint8_t>(PROFILE_HLL_REGISTERS_COUNT, 0);
+
+	/* Добавляет в профиль строку длиной lineLength (без \n и \r) и с переносом CRLF, если isCrlf. Хешируются и
+	* проверяются на разделители первые hashedLength символов - у строк длиннее PROFILE_MAX_CARRIED_LINE_LENGTH не вся строка */
+	void addLine(const char* line, size_t hashedLength, unsigned long long lineLength, bool isCrlf) noexcept;
+	// Объединяет профиль с профилем другой части файла или другого файла
+	void add(const DatasetProfile& other) noexcept;
+	// Оценка количества уникальных строк по регистрам HyperLogLog
+	double getDistinctLinesEstimate(void) const noexcept;
+};
+
+/* Строит профиль части файла, получая её буферами подряд. Строки, разрезанные границей буферов, склеиваются.
+* Часть файла, начинающаяся не с начала строки, пропускает свою первую неполную строку (её учтёт предыдущая часть),
+* а часть, заканчивающаяся посреди строки, дочитывает её после своего конца (addLineEnd) */
+class DatasetProfiler {
+private:
+	DatasetProfile profile;
+	std::vector<char> carriedLine; // Начало строки, не закончившейся в предыдущем буфере
+	unsigned long long carriedLineLength = 0; // Полная длина этой строки (может быть больше, чем сохранено в carriedLine)
+	char carriedLineLastChar = 0; // Последний символ этой строки, по нему определяется перенос CRLF
+	bool hasCarriedLine = false;
+	bool isSkippingFirstLine = false;
+
+	// Добавляет в профиль целую строку без \n
+	void addLine(const char* line, size_t lineLength) noexcept;
+	void appendToCarriedLine(const char* data, size_t length);
+	void addCarriedLine(void) noexcept;
+public:
+	// Пропустить первую строку: часть файла начинается с середины строки, которую учтёт предыдущая часть
+	void skipFirstLine(void) noexcept { isSkippingFirstLine = true; }
+	// Осталась ли незаконченная строка, конец которой надо дочитать после конца части
+	bool needsLineEnd(void) const noexcept { return hasCarriedLine; }
+
+	/* Добавляет в профиль очередной буфер части файла. Переносы строк ищутся векторно (forEachLine),
+	* поэтому их количество в буфере возвращается и отдельно считать его не нужно */
+	size_t addBuffer(const char* buffer, size_t bufferLength);
+	/* Добавляет к незаконченной строке данные, прочитанные после конца части, до первого переноса строки.
+	* Возвращает true, если строка закончилась. Байты после конца части в размер и не-ASCII байты профиля не входят */
+	bool addLineEnd(const char* data, size_t length);
+	// Заканчивает часть: незаконченная строка (последняя строка файла без переноса) тоже учитывается
+	void finish(void) noexcept;
+
+	const DatasetProfile& getProfile(void) const noexcept { return profile; }
+};
+
+// Сохраняет профиль файла для итогового вывода. Можно вызывать из нескольких потоков одновременно
+void addDatasetProfile(const DatasetProfile& profile);
+
+/* Выводит в консоль профили всех файлов и общий профиль, если файлов несколько, а также оценку памяти под хеши
+* уникальных строк при удалении дубликатов. Если профиль не включён, ничего не делает */
+void printDatasetProfiles(void);
+
+#endif // !THEO_PROFILE
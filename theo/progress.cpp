@@ -0,0 +1,183 @@
+﻿#include <sstream>
+#include <iomanip>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "utils.hpp"
+
+ProgressParameters progressParameters;
+
+/* Как часто обновляется строка прогресса: в терминале - каждую секунду, на месте предыдущей (через \r),
+* а если поток ошибок перенаправлен в файл или лог планировщика - отдельной строкой раз в 10 секунд */
+constexpr chrono::milliseconds PROGRESS_TERMINAL_REFRESH_INTERVAL(1000);
+constexpr chrono::milliseconds PROGRESS_LOG_REFRESH_INTERVAL(10000);
+
+// Состояние текущего этапа. Счётчики увеличиваются потоками обработки, всё остальное меняется только при смене этапа
+static struct ProgressState {
+	string stageName;
+	ull totalBytes = 0;
+	function<ull(void)> pollProcessedBytes;
+	atomic<ull> processedBytes{ 0 };
+	atomic<ull> processedLines{ 0 };
+	chrono::steady_clock::time_point begin;
+	bool isTerminal = false;
+	size_t lastLineLength = 0; // Длина последней выведенной строки, чтобы затирать её остатки в терминале
+
+	thread printerThread;
+	mutex stopMutex;
+	condition_variable stopCondition;
+	bool isStopRequested = false;
+
+	/* Если команда завершается через exit посреди этапа (при ошибке), поток вывода надо остановить до разрушения
+	* состояния, иначе деструктор незавершённого потока аварийно завершит программу */
+	~ProgressState() {
+		if (not printerThread.joinable()) return;
+		{
+			lock_guard<mutex> lock(stopMutex);
+			isStopRequested = true;
+		}
+		stopCondition.notify_all();
+		printerThread.join();
+	}
+} progressState;
+
+// Количество байт в читаемом виде с подходящей единицей измерения, например "1.25 GB"
+static string formatBytes(double bytes);
+
+// Длительность в формате чч:мм:сс
+static string formatDuration(double seconds);
+
+// Выводит строку прогресса в стандартный поток ошибок. isFinal - итоговая строка этапа, после неё перенос строки
+static void printProgressLine(const string& line, bool isFinal);
+
+// Обработанные на текущем этапе байты: из функции опроса, если она задана, иначе из счётчика
+static ull getProcessedBytes(void) noexcept;
+
+/* Поток вывода прогресса: по таймеру считает скорость за прошедший интервал и выводит строку прогресса,
+* пока этап не будет завершён */
+static void printProgressPeriodically(void);
+
+void startProgress(const string& stageName, ull totalBytes, function<ull(void)> pollProcessedBytes) {
+	if (not progressParameters.isEnabled) return;
+	finishProgress();
+	progressState.stageName = stageName;
+	progressState.totalBytes = totalBytes;
+	progressState.pollProcessedBytes = move(pollProcessedBytes);
+	progressState.processedBytes = 0;
+	progressState.processedLines = 0;
+	progressState.begin = chrono::steady_clock::now();
+#ifdef _WIN32
+	progressState.isTerminal = _isatty(_fileno(stderr));
+#else
+	progressState.isTerminal = isatty(fileno(stderr));
+#endif
+	progressState.isStopRequested = false;
+	progressState.printerThread = thread(printProgressPeriodically);
+}
+
+void addProgress(ull bytes, ull lines) noexcept {
+	// Порядок обновлений между счётчиками не важен, поэтому хватает самых дешёвых атомарных операций
+	progressState.processedBytes.fetch_add(bytes, memory_order_relaxed);
+	if (lines) progressState.processedLines.fetch_add(lines, memory_order_relaxed);
+}
+
+void finishProgress(void) {
+	if (not progressState.printerThread.joinable()) return;
+	{
+		lock_guard<mutex> lock(progressState.stopMutex);
+		progressState.isStopRequested = true;
+	}
+	progressState.stopCondition.notify_all();
+	progressState.printerThread.join();
+
+	// Итоговая строка этапа: сколько обработано, средняя скорость и полное время этапа
+	double elapsedSeconds = chrono::duration<double>(chrono::steady_clock::now() - progressState.begin).count();
+	ull processedBytes = getProcessedBytes();
+	ull processedLines = progressState.processedLines.load(memory_order_relaxed);
+	ostringstream line;
+	line << fixed << setprecision(1) << '[' << progressState.stageName << "] done | " << formatBytes(static_cast<double>(processedBytes));
+	if (elapsedSeconds > 0) {
+		line << " | avg " << processedBytes / elapsedSeconds / (1024 * 1024) << " MB/s";
+		if (processedLines) line << " | avg " << processedLines / elapsedSeconds / 1e6 << " Mlines/s";
+	}
+	line << " | " << formatDuration(elapsedSeconds);
+	printProgressLine(line.str(), true);
+	progressState.pollProcessedBytes = nullptr;
+}
+
+static void printProgressPeriodically(void) {
+	chrono::milliseconds refreshInterval = progressState.isTerminal ? PROGRESS_TERMINAL_REFRESH_INTERVAL : PROGRESS_LOG_REFRESH_INTERVAL;
+	chrono::steady_clock::time_point previousTime = progressState.begin;
+	ull previousBytes = 0, previousLines = 0;
+
+	unique_lock<mutex> lock(progressState.stopMutex);
+	while (not progressState.stopCondition.wait_for(lock, refreshInterval, []() { return progressState.isStopRequested; })) {
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		double intervalSeconds = chrono::duration<double>(now - previousTime).count();
+		double elapsedSeconds = chrono::duration<double>(now - progressState.begin).count();
+		ull processedBytes = getProcessedBytes();
+		ull processedLines = progressState.processedLines.load(memory_order_relaxed);
+
+		ostringstream line;
+		line << fixed << setprecision(1) << '[' << progressState.stageName << "] ";
+		if (progressState.totalBytes) {
+			// Сжатые данные после распаковки или дописанные переносы строк могут немного превысить ожидаемый объём
+			double donePart = min(static_cast<double>(processedBytes) / progressState.totalBytes, 1.0);
+			line << donePart * 100 << "% | " << formatBytes(static_cast<double>(processedBytes)) << " / " << formatBytes(static_cast<double>(progressState.totalBytes));
+		}
+		else line << formatBytes(static_cast<double>(processedBytes));
+		// Текущая скорость - за последний интервал, а не средняя с начала, чтобы было видно замедление (например, переход dedup на диск)
+		line << " | " << (processedBytes - previousBytes) / intervalSeconds / (1024 * 1024) << " MB/s";
+		if (processedLines) line << " | " << (processedLines - previousLines) / intervalSeconds / 1e6 << " Mlines/s";
+		// Оставшееся время считается по средней скорости с начала этапа, она меньше скачет от интервала к интервалу
+		if (progressState.totalBytes and processedBytes > 0 and processedBytes < progressState.totalBytes) {
+			double remainingSeconds = (progressState.totalBytes - processedBytes) / (processedBytes / elapsedSeconds);
+			line << " | ETA " << formatDuration(remainingSeconds);
+		}
+		else line << " | " << formatDuration(elapsedSeconds);
+		printProgressLine(line.str(), false);
+
+		previousTime = now;
+		previousBytes = processedBytes;
+		previousLines = processedLines;
+	}
+}
+
+static ull getProcessedBytes(void) noexcept {
+	if (progressState.pollProcessedBytes) return progressState.pollProcessedBytes();
+	return progressState.processedBytes.load(memory_order_relaxed);
+}
+
+static void printProgressLine(const string& line, bool isFinal) {
+	if (not progressState.isTerminal) {
+		cerr << line << endl;
+		return;
+	}
+	// В терминале строка перезаписывает предыдущую, её остатки затираются пробелами
+	size_t paddingLength = progressState.lastLineLength > line.size() ? progressState.lastLineLength - line.size() : 0;
+	cerr << '\r' << line << string(paddingLength, ' ');
+	if (isFinal) cerr << endl;
+	else cerr << flush;
+	progressState.lastLineLength = isFinal ? 0 : line.size();
+}
+
+static string formatBytes(double bytes) {
+	const char* const units[] = { "B", "KB", "MB", "GB", "TB" };
+	size_t unitNumber = 0;
+	while (bytes >= 1024 and unitNumber + 1 < _countof(units)) {
+		bytes /= 1024;
+		unitNumber++;
+	}
+	ostringstream result;
+	result << fixed << setprecision(unitNumber ? 2 : 0) << bytes << ' ' << units[unitNumber];
+	return result.str();
+}
+
+static string formatDuration(double seconds) {
+	ull totalSeconds = static_cast<ull>(max(seconds, 0.0));
+	ostringstream result;
+	result << setfill('0') << setw(2) << totalSeconds / 3600 << ':' << setw(2) << totalSeconds / 60 % 60 << ':' << setw(2) << totalSeconds % 60;
+	return result.str();
+}
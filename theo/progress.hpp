@@ -0,0 +1,32 @@
+﻿#pragma once
+#ifndef THEO_PROGRESS
+#define THEO_PROGRESS
+
+#include <string>
+#include <functional>
+
+/* Прогресс долгих команд в консоли: процент выполнения, текущая скорость в мегабайтах и строках в секунду и оставшееся
+* время. Команды сообщают об обработанных байтах раз на чанк, а не на строку, и только увеличивают атомарные
+* счётчики, а выводит прогресс отдельный поток по таймеру, поэтому на скорость обработки строк он не влияет */
+
+// Параметры вывода прогресса, значение задаётся опцией запуска команды --progress
+struct ProgressParameters {
+	int isEnabled = 0; // Выводить ли прогресс выполнения команды в стандартный поток ошибок
+};
+extern ProgressParameters progressParameters;
+
+/* Начинает показ прогресса этапа работы с названием stageName (например, "normalize" или "randomize: merging").
+* totalBytes - сколько байт всего надо обработать на этапе, ноль - неизвестно (стандартный ввод, сжатые файлы),
+* тогда процент и оставшееся время не выводятся. Если задана функция pollProcessedBytes, обработанные байты
+* берутся из неё при каждом обновлении (например, размер файла, который пишет дочерний процесс), а не из счётчика.
+* Предыдущий этап, если он не был завершён, завершается. Если прогресс не включён, ничего не делает */
+void startProgress(const std::string& stageName, unsigned long long totalBytes, std::function<unsigned long long(void)> pollProcessedBytes = nullptr);
+
+/* Добавляет к прогрессу текущего этапа обработанные байты и строки (строки - если они известны без лишнего
+* подсчёта, иначе ноль). Вызывается раз на чанк из любого потока */
+void addProgress(unsigned long long bytes, unsigned long long lines = 0) noexcept;
+
+// Завершает текущий этап: останавливает поток вывода и выводит итоговую строку этапа
+void finishProgress(void);
+
+#endif // !THEO_PROGRESS
@@ -9,7 +9,7 @@ static const char* const usages[] = {
 * Оба файла после окончания работы функции (и успешном, и ошибочном) закрываются.
 * Если параметр deallocate имеет значение false, то временный массив, в котором
 * перемешивались строки из файла, не очищается после завершения функции */
-static int shuffleFileInRAM(FILE* inputFile, FILE* outputFile, ull inputFileSizeInBytes, bool deallocate = true);
+static int shuffleFileInRAM(File* inputFile, File* outputFile, ull inputFileSizeInBytes, bool deallocate = true);
 
 /* Считывает все строки из файла и сохраняет и возвращает массив, в котором находятся указатели
  * на все строки (в каждой строке удалён символ переноса строки '\n').
@@ -17,10 +17,10 @@ static int shuffleFileInRAM(FILE* inputFile, FILE* outputFile, ull inputFileSize
  * так же размер итогового массива.
  * В переменную fileContentBuf записывается указатель на начало буфера, в котором находятся
  * все считанные из файла байты, для последующей его очистки */
-static char** getAllStringsFromFile(FILE* inputFile, size_t inputFileSize, size_t* resultStringsCount, char** fileContentBuf);
+static char** getAllStringsFromFile(File* inputFile, size_t inputFileSize, size_t* resultStringsCount, char** fileContentBuf);
 
 // Запись всех перемешанных строк из по массиву указателей строк в выходной файл.
-static int writeShuffledStringsToFile(FILE* resultFile, char** allStrings, size_t stringsCount, size_t inputFileSize);
+static int writeShuffledStringsToFile(File* resultFile, char** allStrings, size_t stringsCount, size_t inputFileSize);
 
 // Перемешивает элементы в массиве случайным образом, изменяя массив внутри функции
 static void randomShuffleArrayInplace(char** array, size_t arrayLength);
@@ -29,6 +29,19 @@ static void randomShuffleArrayInplace(char** array, size_t arrayLength);
  * Возвращает путь к новосозданной временной директории, где находятся ТОЛЬКО эти файлы */
 static wstring splitInputFileIntoTemporaryDirectory(const wstring& inputFilePath, size_t splittedFilesCount) noexcept;
 
+// Создаёт временную директорию с уникальным именем в temp-папке на компьютере и возвращает путь к ней
+static wstring createTemporaryDirectory(void) noexcept;
+
+/* Загружает индекс строк входного файла, а если его нет или он устарел - строит, подсчитывая строки.
+ * Возвращает false, если индекс получить не удалось (например, директория файла недоступна для записи) */
+static bool loadOrBuildLineIndex(const wstring& inputFilePath, LineIndex* lineIndexPtr);
+
+/* Перемешивает части входного файла по partsCount примерно равных по числу строк частей, находя их границы
+ * по индексу строк, и записывает перемешанные части во временную директорию, без промежуточного разбиения
+ * файла командой split. Возвращает список путей к перемешанным частям.
+ * Если возникла ошибка - завершает работу программы, перед этим вызывая cleanupFunction */
+static vector<wstring> shuffleInputFileParts(const wstring& inputFilePath, const LineIndex& lineIndex, size_t partsCount, const wstring& tempDirectory, auto& cleanupFunction);
+
 /* Объединяет все переданные временные файлы в один итоговый.
  * Если возникла ошибка - завершает работу программы, перед этим вызывая cleanupFunction */
 static void mergeAllShuffledTempfilesIntoResultFile(const vector<wstring>& shuffledTempfilesPaths, wstring resultFilePath, auto& cleanupFunction);
@@ -50,6 +63,12 @@ int randomize(int argc, const char** argv) {
         OPT_INTEGER(0, "memory", &memoryUsageMaxPercent, "Maximum percentage of RAM usage. Only number (whout percent symbol).\n\t\t\t      After reaching limit, shuffling continues on disk (default - 90%)"),
         OPT_GROUP("File options"),
         OPT_STRING('d', "destination", &destinationPath, "absolute or relative path to result file(default: current directory)"),
+        OPT_GROUP("Performance options"),
+        OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+        OPT_STRING(0, "io-profile", &(fileIOParameters.ioProfilePath), "disk profile from 'theo bench-io' used to pick chunk size (default - profile saved by last calibration)"),
+        OPT_BOOLEAN(0, "index", &(lineIndexParameters.isEnabled), "if file doesn't fit in RAM, find its parts by line index (file.txt.tidx, built if missing)\n\t\t\t      instead of splitting it to temporary files (default - false)"),
+        OPT_BOOLEAN(0, "progress", &(progressParameters.isEnabled), "show percent done, speed and remaining time in stderr while shuffling (default - false)"),
+        OPT_BOOLEAN(0, "perf-counters", &(perfCountersParameters.isEnabled), "measure hardware counters (cycles, instructions, cache and branch misses) of read, shuffling\n\t\t\t      and write phases and print them at the end (Linux only, default - false)"),
         OPT_GROUP("Unmarked (positional) argument will be considered as path to input file"),
         OPT_END(),
     };
@@ -73,20 +92,29 @@ int randomize(int argc, const char** argv) {
         cout << "Invalid '--memory' parameter value, it must be lower than 100 and higher than 0" << endl;
         return ERROR_INVALID_PARAMETER;
     }
+
+    processPerfCountersOption();
     
 	wstring inputFilePath = toWstring(argv[0]);
-    FILE* inputFile = fileOpen(inputFilePath, "rb");
+    File* inputFile = fileOpen(inputFilePath, "rb");
     if (inputFile == NULL) {
         wcout << "Error: cannot open input file [" << inputFilePath << "]. Enetered path is invalid or cannot get access due to security reason." << endl;
         return -1;
     }
 
     wstring destinationFilePath = destinationPath != NULL ? toWstring(destinationPath) : getFileNameWithoutExtension(inputFilePath) + L"_randomized.txt";
-    if (fs::exists(destinationFilePath)) {
+    if (fs::exists(toFilesystemPath(destinationFilePath))) {
         wcout << "Error: something already exists on destination file path [" << destinationFilePath << "]" << endl;
         return -1;
     }
 
+    /* Размер стандартного ввода и распакованного сжатого файла заранее неизвестен (-1), а без него нельзя
+    * рассчитать, поместится ли файл в оперативную память, поэтому перемешиваются только обычные файлы */
+    if (getFileSize(inputFile) < 0) {
+        wcout << "Error: cannot get size of [" << inputFilePath << "], only regular uncompressed files can be randomized" << endl;
+        fileClose(inputFile);
+        return ERROR_INVALID_PARAMETER;
+    }
     ull inputFileSizeInBytes = getFileSize(inputFile);
 
     /* Сколько процентов от общего объема оперативной памяти, занятой строками, считанными
@@ -116,7 +144,7 @@ int randomize(int argc, const char** argv) {
         exit(ERROR_OUTOFMEMORY);
     }
 
-    FILE* resultFile = fileOpen(destinationFilePath, "wb+");
+    File* resultFile = fileOpen(destinationFilePath, "wb+");
     if (resultFile == NULL) {
         wcout << "Error: cannot create result file - no access due to security reasons" << endl;
         return -1;
@@ -130,9 +158,12 @@ int randomize(int argc, const char** argv) {
         /* Перемешиваем строки из файла прямо в оперативке, последний параметр false,
         * поскольку деаллоцировать массив не надо - память сама очистится после завершения 
         * программы, а ручная деаллокация занимает очень много времени (почти 50% от общего) */
+        // В прогрессе учитываются и чтение, и запись файла, поэтому байт обрабатывается вдвое больше его размера
+        startProgress("randomize", inputFileSizeInBytes * 2);
         int retCode = shuffleFileInRAM(inputFile, resultFile, inputFileSizeInBytes, false);
+        finishProgress();
         if (retCode != ERROR_SUCCESS) {
-            fs::remove(destinationFilePath);
+            fs::remove(toFilesystemPath(destinationFilePath));
             exit(retCode);
         }
     }
@@ -143,25 +174,36 @@ int randomize(int argc, const char** argv) {
 
         /* Закрываем все открытые файлы(input и result), поскольку взаимодействие с ними
         * будет производиться не напрямую из функции, а вызовом других команд theo через
-        * _wsystem, например, `theo split` для разделения входного файла */
-        _fcloseall();
-
-        wstring tempDirectory = splitInputFileIntoTemporaryDirectory(inputFilePath, parts);
-
-        /* Перед выходом(даже в случае ошибки) закрываем все открытые файлы и удаляем
-         * временную директорию со всеми находящимися в ней файлами, чтобы не засорять диск */
+        * executeTheoCommand, например, `theo split` для разделения входного файла */
+        fileClose(inputFile);
+        fileClose(resultFile);
+
+        /* С индексом строк части перемешиваются прямо из входного файла: их границы находятся по индексу,
+        * и входной файл не надо целиком переписывать во временные части перед перемешиванием */
+        LineIndex lineIndex;
+        bool isLineIndexUsed = lineIndexParameters.isEnabled and loadOrBuildLineIndex(inputFilePath, &lineIndex);
+        wstring tempDirectory = isLineIndexUsed ? createTemporaryDirectory() : splitInputFileIntoTemporaryDirectory(inputFilePath, parts);
+
+        /* Перед выходом(даже в случае ошибки) удаляем временную директорию со всеми находящимися
+         * в ней файлами, чтобы не засорять диск. Временные файлы закрывает сама функция перемешивания */
         auto cleanup = [&]() {
-            _fcloseall();
-            fs::remove_all(tempDirectory);
+            fs::remove_all(toFilesystemPath(tempDirectory));
         };
 
-        vector<wstring> shuffledTempFilesPaths = shuffleTempFiles(tempDirectory, cleanup);
+        startProgress("randomize: shuffling parts", inputFileSizeInBytes * 2);
+        vector<wstring> shuffledTempFilesPaths = isLineIndexUsed ? shuffleInputFileParts(inputFilePath, lineIndex, parts, tempDirectory, cleanup) : shuffleTempFiles(tempDirectory, cleanup);
+        finishProgress();
+
+        // Объединяет части дочерний процесс theo merge, поэтому прогресс - это размер итогового файла, который он пишет
+        startProgress("randomize: merging", inputFileSizeInBytes, [&]() { return static_cast<ull>(max(getFileSize(destinationFilePath), 0LL)); });
         mergeAllShuffledTempfilesIntoResultFile(shuffledTempFilesPaths, destinationFilePath, cleanup);
+        finishProgress();
         cleanup();
     }
 
     chrono::steady_clock::time_point end = chrono::steady_clock::now();
     wcout << "\nFile random-shuffled successfully! Execution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+    printPerfCounters("randomize");
 
     return ERROR_SUCCESS;
 }
@@ -173,19 +215,21 @@ static vector<wstring> shuffleTempFiles(const wstring& tempDirectory, auto& clea
 
     /* Перемешиваем абсолютно все файлы в директории, поскольку в ней должны находиться
     * исключительно части основного исходного файла */
-    for (const auto& entry : fs::directory_iterator(tempDirectory)) {
-        wstring pathToCurrentPartOfInputFile = entry.path().wstring();
-        wstring pathToCurrentResultFile = (fs::path(tempDirectory) / (getFileNameWithoutExtension(pathToCurrentPartOfInputFile) + L"_shuffled.txt")).wstring();
+    for (const auto& entry : fs::directory_iterator(toFilesystemPath(tempDirectory))) {
+        wstring pathToCurrentPartOfInputFile = fromFilesystemPath(entry.path());
+        wstring pathToCurrentResultFile = joinPaths(tempDirectory, getFileNameWithoutExtension(pathToCurrentPartOfInputFile) + L"_shuffled.txt");
 
-        FILE* tempInputFile = fileOpen(pathToCurrentPartOfInputFile, "rb");
-        FILE* tempResultFile = fileOpen(pathToCurrentResultFile, "wb+");
+        File* tempInputFile = fileOpen(pathToCurrentPartOfInputFile, "rb");
+        File* tempResultFile = fileOpen(pathToCurrentResultFile, "wb+");
         if (tempInputFile == NULL) {
             wcout << "Error: cannot open temp shuffling input file [" << pathToCurrentPartOfInputFile << "]" << endl;
+            fileClose(tempResultFile);
             cleanupFunction();
             exit(ERROR_FILE_CORRUPT);
         }
         if (tempResultFile == NULL) {
             wcout << "Error: cannot open temp shuffling result file [" << pathToCurrentResultFile << "]" << endl;
+            fileClose(tempInputFile);
             cleanupFunction();
             exit(ERROR_FILE_PROTECTED_UNDER_DPL);
         }
@@ -211,15 +255,13 @@ static vector<wstring> shuffleTempFiles(const wstring& tempDirectory, auto& clea
 }
 
 static void mergeAllShuffledTempfilesIntoResultFile(const vector<wstring>& shuffledTempfilesPaths, wstring resultFilePath, auto& cleanupFunction) {
-    wstring mergeCommand = L"theo merge -d \"" + resultFilePath + L"\"";
+    wstring mergeCommand = L"merge" + getFileIOCommandOptions() + L" -d \"" + resultFilePath + L"\"";
     // Добавляем все файлы в команду merge, так как они уже перемешаны, добавляем по очереди
     for (const wstring& pathToTempShuffledFile : shuffledTempfilesPaths) {
-        mergeCommand += L" \"" + fs::absolute(pathToTempShuffledFile).wstring() + L'"';
+        mergeCommand += L" \"" + fromFilesystemPath(fs::absolute(toFilesystemPath(pathToTempShuffledFile))) + L'"';
     }
-    // Блокируем вывод выполнения merge в консоль пользователя
-    mergeCommand += SUPPRESS_CMD_WINDOWS_OUTPUT_END;
-
-    int execRetCode = _wsystem(mergeCommand.c_str());
+    // Запускаем merge, блокируя вывод его выполнения в консоль пользователя
+    int execRetCode = executeTheoCommand(mergeCommand);
     if (execRetCode != ERROR_SUCCESS) {
         wcout << "Error: cannot merge shuffled parts into one result file [" << resultFilePath << "]" << endl;
         cleanupFunction();
@@ -228,91 +270,150 @@ static void mergeAllShuffledTempfilesIntoResultFile(const vector<wstring>& shuff
 }
 
 
-static wstring splitInputFileIntoTemporaryDirectory(const wstring& inputFilePath, size_t splittedFilesCount) noexcept {
-
-    // Создаём временную директорию с уникальным именем в temp-папке на компьютере
-    wstring tempDirectoryPath = (fs::temp_directory_path() / tmpnam(NULL)).wstring();
+static wstring createTemporaryDirectory(void) noexcept {
+    wstring tempDirectoryPath = fromFilesystemPath(fs::temp_directory_path() / tmpnam(NULL));
     try {
-        fs::create_directory(tempDirectoryPath);
+        fs::create_directory(toFilesystemPath(tempDirectoryPath));
     }
     catch (...) {
         wcout << "Error: cannot create temporary folder [" << tempDirectoryPath << "]" << endl;
         exit(ERROR_DIRECTORY_NOT_SUPPORTED);
     }
+    return tempDirectoryPath;
+}
+
+static bool loadOrBuildLineIndex(const wstring& inputFilePath, LineIndex* lineIndexPtr) {
+    if (lineIndexPtr->load(inputFilePath)) return true;
+    startProgress("randomize: indexing lines", static_cast<ull>(max(getFileSize(inputFilePath), 0LL)));
+    long long linesCount = getStringCountInFile(inputFilePath);
+    finishProgress();
+    return linesCount >= 0 and lineIndexPtr->load(inputFilePath);
+}
+
+static vector<wstring> shuffleInputFileParts(const wstring& inputFilePath, const LineIndex& lineIndex, size_t partsCount, const wstring& tempDirectory, auto& cleanupFunction) {
+    vector<wstring> shuffledTempFilesPaths;
+    ull linesInOnePart = (lineIndex.getLinesCount() + partsCount - 1) / partsCount;
+    ull partStartOffset = 0;
+    for (size_t partNumber = 1; partStartOffset < lineIndex.getFileSize(); partNumber++) {
+        // Часть заканчивается там, где начинается первая строка следующей части, последняя - в конце файла
+        ull partEndOffset = lineIndex.getFileSize();
+        if (not lineIndex.findLineStartOffset(inputFilePath, partNumber * linesInOnePart, &partEndOffset)) partEndOffset = lineIndex.getFileSize();
+        wstring pathToCurrentResultFile = joinPaths(tempDirectory, L"part_" + to_wstring(partNumber) + L"_shuffled.txt");
+
+        File* partInputFile = fileOpen(inputFilePath, "rb");
+        File* tempResultFile = fileOpen(pathToCurrentResultFile, "wb+");
+        if (partInputFile == NULL or not partInputFile->seek(partStartOffset)) {
+            wcout << "Error: cannot read part of input file [" << inputFilePath << "] from byte " << partStartOffset << endl;
+            if (partInputFile != NULL) fileClose(partInputFile);
+            fileClose(tempResultFile);
+            cleanupFunction();
+            exit(ERROR_FILE_CORRUPT);
+        }
+        if (tempResultFile == NULL) {
+            wcout << "Error: cannot open temp shuffling result file [" << pathToCurrentResultFile << "]" << endl;
+            fileClose(partInputFile);
+            cleanupFunction();
+            exit(ERROR_FILE_PROTECTED_UNDER_DPL);
+        }
+
+        // Перемешиваем текущую часть основного файла, функция читает её с текущей позиции входного файла
+        int retCode = shuffleFileInRAM(partInputFile, tempResultFile, partEndOffset - partStartOffset);
+        if (retCode != ERROR_SUCCESS) {
+            wcout << "Error: cannot shuffle part of main input file from byte " << partStartOffset << " to byte " << partEndOffset << endl;
+            cleanupFunction();
+            exit(retCode);
+        }
+        shuffledTempFilesPaths.push_back(pathToCurrentResultFile);
+        partStartOffset = partEndOffset;
+    }
+
+    // Перемешиваем имена файлов в случайном порядке, чтобы потом их соединять не по очереди
+    Xoshiro256PlusPlus randomGenerator(time(NULL));
+    shuffle(shuffledTempFilesPaths.begin(), shuffledTempFilesPaths.end(), randomGenerator);
+
+    return shuffledTempFilesPaths;
+}
+
+static wstring splitInputFileIntoTemporaryDirectory(const wstring& inputFilePath, size_t splittedFilesCount) noexcept {
+
+    // Создаём временную директорию с уникальным именем в temp-папке на компьютере
+    wstring tempDirectoryPath = createTemporaryDirectory();
 
     /* Просто запускаем `theo split` для разделения файла на необходимое количество частей,
      * чтобы не писать повторяющийся код. Весь вывод в консоль от этой команды блокируем */
-    wstring splitCommand = L"theo split -p " + to_wstring(splittedFilesCount) + L" -d \"" + tempDirectoryPath + L"\" \"" + inputFilePath + L'"' + SUPPRESS_CMD_WINDOWS_OUTPUT_END;
-    int execRetCode = _wsystem(splitCommand.c_str());
+    wstring splitCommand = L"split" + getFileIOCommandOptions() + L" -p " + to_wstring(splittedFilesCount) + L" -d \"" + tempDirectoryPath + L"\" \"" + inputFilePath + L'"';
+    // Разбивает файл дочерний процесс, поэтому прогресс - это общий размер частей, которые он уже записал
+    startProgress("randomize: splitting", static_cast<ull>(max(getFileSize(inputFilePath), 0LL)), [tempDirectoryPath]() {
+        ull splittedBytes = 0;
+        error_code errorCode;
+        for (const auto& entry : fs::directory_iterator(toFilesystemPath(tempDirectoryPath), errorCode)) {
+            ull entrySize = entry.file_size(errorCode);
+            if (not errorCode) splittedBytes += entrySize;
+        }
+        return splittedBytes;
+    });
+    int execRetCode = executeTheoCommand(splitCommand);
+    finishProgress();
 
     /* Отлавливаем статус завершения выполнения команды, если файл разбит успешно - он будет
      * равен нулю (ERROR_SUCCESS), если выпала ошибка - выходим */
     if (execRetCode != ERROR_SUCCESS) {
         wcout << "Error: cannot split input file to temporary folder [" << tempDirectoryPath << "]" << endl;
-        fs::remove(tempDirectoryPath);
+        fs::remove(toFilesystemPath(tempDirectoryPath));
         exit(ERROR_CREATE_FAILED);
     }
 
     return tempDirectoryPath;
 }
 
-static char** getAllStringsFromFile(FILE* inputFile, size_t inputFileSize, size_t* resultStringsCount, char** fileContentBuf) {
+static char** getAllStringsFromFile(File* inputFile, size_t inputFileSize, size_t* resultStringsCount, char** fileContentBuf) {
     // Выделяем буфер под хранение всех байтов из входного файла
     char* allFileContent = new char[inputFileSize + 1];
     if (allFileContent == NULL) {
         wcout << "Error: not menough memory, cannot allocate buffer to store strings from input file";
         return NULL;
     }
-    // Пытаемся считать весь входной файл в выделенный выше буфер за один раз
-    size_t bytesReaded = fread(allFileContent, sizeof(char), inputFileSize, inputFile);
+    /* Считываем весь входной файл в выделенный выше буфер. Читаем блоками оптимального для диска размера,
+    * а не за один раз, чтобы по ходу чтения обновлялся прогресс */
+    size_t bytesReaded = 0;
+    size_t blockSize = getOptimalChunkSize(1);
+    while (bytesReaded < inputFileSize) {
+        PerfPhaseScope perfScope(PerfPhase::Read);
+        size_t blockBytesReaded = inputFile->read(&allFileContent[bytesReaded], min(blockSize, inputFileSize - bytesReaded));
+        if (blockBytesReaded == 0) break;
+        bytesReaded += blockBytesReaded;
+        addProgress(blockBytesReaded);
+    }
     if (bytesReaded != inputFileSize) {
         wcout << "Cannot read all input file" << endl;
         return NULL;
     }
 
-    // Примерное ожидаемое число строк в файле - размер файла, делённый на среднюю длину строки
-    size_t expectedStringsCount = inputFileSize / AVERAGE_STRING_LEGTH_IN_FILE;
+    PerfPhaseScope perfScope(PerfPhase::Process);
+    /* Число строк в файле заранее подсчитываем по переносам строк (это проход со скоростью чтения памяти),
+     * последняя строка может не оканчиваться переносом */
+    size_t stringsCount = getLinesCountInBuffer(allFileContent, inputFileSize);
+    if (inputFileSize > 0 and allFileContent[inputFileSize - 1] != '\n') stringsCount++;
     /* Создаем массив указателей на строки, каждый элемент будет указателем на начало новой
      * строки в буфере, где находится полностью считанный файл */
-    char** allStrings = (char**)malloc((expectedStringsCount + 1) * sizeof(char*));
+    char** allStrings = (char**)malloc((stringsCount + 1) * sizeof(char*));
+    if (allStrings == NULL) {
+        wcout << "Error: cannot allocate memory to store pointers to strings from input file" << endl;
+        delete[] allFileContent;
+        return NULL;
+    }
 
+    /* Добавляем указатель на начало каждой строки в итоговый массив строк и заменяем символ переноса строки
+     * на символ конца строки, чтобы каждая строка в буфере стала отдельной C-строкой */
     size_t currentStringNumber = 0;
-    for (size_t pos = 0; pos < inputFileSize; pos++) {
-        /* Добавляем указатель на начало строки в итоговый массив строк. Началом строки символ
-         * считается в том случае, если он либо первый во всем буфере (входном файле), либо если
-         * перед ним символ конца предыдущей строки */
-        if (pos == 0 or allFileContent[pos - 1] == '\0') {
-            /* Если в файле много коротких строк, может случиться такое, что строк будет больше,
-             * чем ожидалось заранее, и в массив новые не влезут. В таком случае требуется
-             * реаллоцировать массив, увеличив его вместительность ровно на половину от текущего
-             * размера */
-            if (currentStringNumber >= expectedStringsCount) {
-                size_t newExpectedStringsCount = (size_t)ceil(expectedStringsCount * 1.5);
-                char** reallocated = (char**)realloc(allStrings, (newExpectedStringsCount + 1) * sizeof(char*));
-                if (reallocated == NULL) {
-                    wcout << "Error: cannot allocate more memory to store short strings from input file" << endl;
-                    delete[] allFileContent;
-                    free(allStrings);
-                    return NULL;
-                }
-                allStrings = reallocated;
-                expectedStringsCount = newExpectedStringsCount;
-            }
-            /* Добавляем указатель на начало текущей строки в буфере, в котором находятся
-             * все байты из входного файла */
-            allStrings[currentStringNumber++] = &allFileContent[pos];
-        }
-        /* Заменяем символ переноса строки на символ конца строки, чтобы следующий символ
-         * был расценён как начало следующей строки. Не добавляем следующий символ
-         * как начало следующей строки сразу же, чтобы не делать лишних проверок
-         * на то, не конец ли это буфера, и чтобы корректно обработать начало первой строки
-         * во всём файле */
-        if (allFileContent[pos] == '\n') allFileContent[pos] = '\0';
-    }
-    /* Добавляем в конец буфера с содержимым файла, то есть, в конец последней считанной строки,
-    * символ завершения строки, если она не оканчивалась переносом строки и он не был установлен
-    * ранее, при удалении символа переноса */
-    if (allFileContent[inputFileSize - 1] != '\0') allFileContent[bytesReaded] = '\0';
+    size_t lastStringStartPos = forEachLine(allFileContent, inputFileSize, [&](char* string, size_t stringLength) {
+        allStrings[currentStringNumber++] = string;
+        string[stringLength] = '\0';
+    });
+    /* Последняя строка, не оканчивающаяся переносом строки, тоже добавляется в массив, а в конец буфера
+     * с содержимым файла добавляется символ завершения строки */
+    if (lastStringStartPos < inputFileSize) allStrings[currentStringNumber++] = &allFileContent[lastStringStartPos];
+    allFileContent[inputFileSize] = '\0';
     
     // Возврат значений путем присваивания их по указателям, переданным в функцию
     *fileContentBuf = allFileContent;
@@ -320,7 +421,7 @@ static char** getAllStringsFromFile(FILE* inputFile, size_t inputFileSize, size_
     return allStrings;
 }
 
-static int writeShuffledStringsToFile(FILE* resultFile, char** allStrings, size_t stringsCount, size_t inputFileSize) {
+static int writeShuffledStringsToFile(File* resultFile, char** allStrings, size_t stringsCount, size_t inputFileSize) {
     /* Размер inputFileSize, поскольку после перемешивания весь контент 
      * из входного файла должен оказаться в итоговом, ничего добавляться или удаляться не будет */
     char* resultBuffer = new char[inputFileSize + 2];
@@ -331,14 +432,18 @@ static int writeShuffledStringsToFile(FILE* resultFile, char** allStrings, size_
 
     // Пробегаемся по всему массиву перемешанными строками и записываем их в итоговый буфер
     size_t currentPosInBuffer = 0;
-    for (size_t stringNumber = 0; stringNumber < stringsCount; stringNumber++) {
-        size_t len = strlen(allStrings[stringNumber]);
-        memcpy(&resultBuffer[currentPosInBuffer], allStrings[stringNumber], len);
-        currentPosInBuffer += len;
-        /* В конце каждой строки вместо символа завершения строки вставляем символ
-         * переноса строки, так как эти символы были удалены при считывании буфера
-         * из входного файла и разбиении его на строки */
-        resultBuffer[currentPosInBuffer++] = '\n';
+    {
+        // Сборка строк в итоговый буфер - это ещё обработка: строки лежат в памяти вразброс, и копируются с промахами кеша
+        PerfPhaseScope perfScope(PerfPhase::Process);
+        for (size_t stringNumber = 0; stringNumber < stringsCount; stringNumber++) {
+            size_t len = strlen(allStrings[stringNumber]);
+            memcpy(&resultBuffer[currentPosInBuffer], allStrings[stringNumber], len);
+            currentPosInBuffer += len;
+            /* В конце каждой строки вместо символа завершения строки вставляем символ
+             * переноса строки, так как эти символы были удалены при считывании буфера
+             * из входного файла и разбиении его на строки */
+            resultBuffer[currentPosInBuffer++] = '\n';
+        }
     }
 
     /* Проверяем длину выходного файла.В нормальных обстоятельствах длина должна либо
@@ -351,7 +456,16 @@ static int writeShuffledStringsToFile(FILE* resultFile, char** allStrings, size_
         return ERROR_NDIS_INVALID_LENGTH;
     }
 
-    size_t bytesWrited = fwrite(resultBuffer, sizeof(char), currentPosInBuffer, resultFile);
+    // Записываем так же блоками, чтобы по ходу записи обновлялся прогресс
+    size_t bytesWrited = 0;
+    size_t blockSize = getOptimalChunkSize(1);
+    while (bytesWrited < currentPosInBuffer) {
+        PerfPhaseScope perfScope(PerfPhase::Write);
+        size_t blockBytesWrited = resultFile->write(&resultBuffer[bytesWrited], min(blockSize, currentPosInBuffer - bytesWrited));
+        if (blockBytesWrited == 0) break;
+        bytesWrited += blockBytesWrited;
+        addProgress(blockBytesWrited);
+    }
     if (bytesWrited != currentPosInBuffer) {
         cout << "Error: cannot write all shuffled strings to result file, write failure" << endl;
         delete[] resultBuffer;
@@ -365,6 +479,7 @@ static int writeShuffledStringsToFile(FILE* resultFile, char** allStrings, size_
 
 
 static void randomShuffleArrayInplace(char** array, size_t arrayLength) {
+    PerfPhaseScope perfScope(PerfPhase::Process);
     const ull seed = time(NULL);
     Xoshiro256PlusPlus randomGenerator(seed);
     uniform_int_distribution<ull> distribution(0, arrayLength - 1);
@@ -376,7 +491,7 @@ static void randomShuffleArrayInplace(char** array, size_t arrayLength) {
 }
 
 
-static int shuffleFileInRAM(FILE* inputFile, FILE* outputFile, ull inputFileSize, bool deallocate) {
+static int shuffleFileInRAM(File* inputFile, File* outputFile, ull inputFileSize, bool deallocate) {
     // Указатель на массив со всеми байтами из входного файла, хранит все строки
     char* allFileContent = NULL; 
     // Массив указателей на строки (на начало каждой строки строк) в allFileContent
@@ -386,8 +501,8 @@ static int shuffleFileInRAM(FILE* inputFile, FILE* outputFile, ull inputFileSize
 
     // Закрываем входной и итоговый файл даже в случае неуспешного выполнения функции
     auto cleanup = [&]() {
-        fclose(inputFile);
-        fclose(outputFile);
+        fileClose(inputFile);
+        fileClose(outputFile);
         if (allFileContent != NULL) free(allFileContent);
         if (allStrings != NULL) free(allStrings);
     };
@@ -0,0 +1,87 @@
+﻿#include "scheduler.hpp"
+
+// Номер исполнителя, которым является текущий поток. Для потоков, не являющихся исполнителями, - SIZE_MAX
+static thread_local size_t currentWorkerIndex = SIZE_MAX;
+
+WorkStealingScheduler::WorkStealingScheduler(size_t workersCount) {
+	if (workersCount == 0) workersCount = 1;
+	for (size_t i = 0; i < workersCount; i++) workersQueues.push_back(std::make_unique<WorkerQueues>());
+}
+
+void WorkStealingScheduler::submit(TaskKind kind, std::function<void()> task) {
+	size_t queueIndex = currentWorkerIndex;
+	if (queueIndex >= workersQueues.size()) queueIndex = nextQueueForExternalTask++ % workersQueues.size();
+
+	unfinishedTasksCount++;
+	{
+		std::lock_guard<std::mutex> lock(workersQueues[queueIndex]->queuesMutex);
+		if (kind == TaskKind::File) workersQueues[queueIndex]->fileTasks.push_back(std::move(task));
+		else workersQueues[queueIndex]->chunkTasks.push_back(std::move(task));
+	}
+	taskAddedOrFinished.notify_one();
+}
+
+bool WorkStealingScheduler::takeTask(TaskKind kind, std::function<void()>& task) {
+	size_t workersCount = workersQueues.size();
+	size_t ownIndex = currentWorkerIndex < workersCount ? currentWorkerIndex : 0;
+
+	for (size_t offset = 0; offset < workersCount; offset++) {
+		bool isOwnQueue = offset == 0;
+		WorkerQueues& queues = *workersQueues[(ownIndex + offset) % workersCount];
+		std::lock_guard<std::mutex> lock(queues.queuesMutex);
+		std::deque<std::function<void()>>& tasks = kind == TaskKind::File ? queues.fileTasks : queues.chunkTasks;
+		if (tasks.empty()) continue;
+
+		/* Свои чанки берём с конца (LIFO), чужие - с начала. Файлы и свои, и чужие берём с начала,
+		* поскольку они добавлены по убыванию размера и большие файлы надо начинать первыми */
+		if (kind == TaskKind::Chunk && isOwnQueue) {
+			task = std::move(tasks.back());
+			tasks.pop_back();
+		}
+		else {
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+
+void WorkStealingScheduler::executeTask(std::function<void()>& task) {
+	task();
+	if (--unfinishedTasksCount == 0) {
+		std::lock_guard<std::mutex> lock(idleMutex);
+		taskAddedOrFinished.notify_all();
+	}
+}
+
+bool WorkStealingScheduler::runOneChunkTask(void) {
+	std::function<void()> task;
+	if (!takeTask(TaskKind::Chunk, task)) return false;
+	executeTask(task);
+	return true;
+}
+
+void WorkStealingScheduler::workerLoop(size_t workerIndex) {
+	currentWorkerIndex = workerIndex;
+	std::function<void()> task;
+	while (unfinishedTasksCount > 0) {
+		// Сначала дообрабатываем уже начатые файлы, и только потом берём новые
+		if (takeTask(TaskKind::Chunk, task) || takeTask(TaskKind::File, task)) {
+			executeTask(task);
+			continue;
+		}
+		/* Задач сейчас нет, но они ещё могут появиться (кто-то читает следующий чанк файла).
+		* Ждём недолго, чтобы не пропустить задачу, добавленную между проверкой и ожиданием */
+		std::unique_lock<std::mutex> lock(idleMutex);
+		taskAddedOrFinished.wait_for(lock, std::chrono::milliseconds(1));
+	}
+	currentWorkerIndex = SIZE_MAX;
+}
+
+void WorkStealingScheduler::run(void) {
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < workersQueues.size(); i++) workers.emplace_back(&WorkStealingScheduler::workerLoop, this, i);
+	workerLoop(0);
+	for (std::thread& worker : workers) worker.join();
+}
@@ -0,0 +1,58 @@
+﻿#pragma once
+#ifndef THEO_SCHEDULER
+#define THEO_SCHEDULER
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+/* Планировщик задач с перехватом работы (work stealing). У каждого потока-исполнителя есть свои очереди задач:
+* задачи обработки целых файлов и задачи обработки отдельных чанков. Свои чанки исполнитель берёт с конца очереди
+* (последний считанный чанк ещё в кеше), а простаивающие исполнители забирают чанки у других с начала очереди
+* (самые старые чанки, которые быстрее всего освободят очередь записи). Новый файл исполнитель начинает только
+* тогда, когда ни у кого не осталось необработанных чанков, поэтому большие файлы дообрабатываются всеми потоками. */
+class WorkStealingScheduler {
+public:
+	enum class TaskKind { File, Chunk };
+private:
+	struct WorkerQueues {
+		std::mutex queuesMutex;
+		std::deque<std::function<void()>> fileTasks;
+		std::deque<std::function<void()>> chunkTasks;
+	};
+	std::vector<std::unique_ptr<WorkerQueues>> workersQueues;
+	// Количество добавленных, но ещё не выполненных до конца задач. Когда оно станет нулём, работа закончена
+	std::atomic<size_t> unfinishedTasksCount{ 0 };
+	// Очередь, в которую добавляются задачи из потоков, не являющихся исполнителями (при начальной раздаче файлов)
+	size_t nextQueueForExternalTask = 0;
+	std::mutex idleMutex;
+	std::condition_variable taskAddedOrFinished;
+
+	// Забирает задачу указанного вида: сначала из своей очереди, затем у других исполнителей
+	bool takeTask(TaskKind kind, std::function<void()>& task);
+	void executeTask(std::function<void()>& task);
+	void workerLoop(size_t workerIndex);
+public:
+	explicit WorkStealingScheduler(size_t workersCount);
+
+	/* Добавляет задачу в очередь текущего исполнителя. Если вызвано не из потока-исполнителя, задачи
+	* раздаются по очередям исполнителей по кругу, в порядке добавления */
+	void submit(TaskKind kind, std::function<void()> task);
+
+	/* Выполняет одну задачу обработки чанка (свою или перехваченную у другого исполнителя), если такая есть.
+	* Нужна, чтобы поток, ждущий освобождения ресурсов, не простаивал, а помогал остальным */
+	bool runOneChunkTask(void);
+
+	/* Запускает исполнителей (текущий поток тоже становится одним из них) и ждёт, пока не будут выполнены
+	* все задачи, в том числе добавленные во время работы */
+	void run(void);
+};
+
+#endif // !THEO_SCHEDULER
@@ -1,12 +1,7 @@
 ﻿#include "utils.hpp"
 
-/* Читает буфер побайтово, считая строки, пока remainingStrings не станет 0. Тогда перестаёт считать и возвращает
-позицию начала следующей строки в буфере. Если же прочитан весь буфер, но нужного количества строк не набралось,
-возвращает позицию последнего элемента в буфере. */
-static size_t readBufferByLinesUntilCount(char* buffer, size_t buflen, size_t startBufIndex, size_t* remainingStrings);
-
 // Создаёт следующий по счёту файл с N-ным количеством строк, открывает в режиме записи и возвращает указатель на него
-static FILE* getNextSplittedFilePtr(wstring destinationDirectory, size_t linesInOneFile, size_t currentFileNumber, wstring inputFilePath);
+static File* getNextSplittedFilePtr(wstring destinationDirectory, size_t linesInOneFile, size_t currentFileNumber, wstring inputFilePath);
 
 // Опции для ввода аргументов вызова программы из cmd, показыаемые пользователю при использовании флага --help или -h
 static const char* const usages[] = {
@@ -16,6 +11,7 @@ static const char* const usages[] = {
 
 int split(int argc, const char** argv) {
 	const char* destinationDirectoryPath = ".";
+	const char* outputCompression = NULL; // Формат и уровень сжатия итоговых файлов, если их надо сжимать
 	long long linesInOneResultFile = 0;
 	int parts = 0;
 
@@ -26,6 +22,13 @@ int split(int argc, const char** argv) {
 		OPT_INTEGER('p', "parts", &parts, "Into how many parts divide the source file"),
 		OPT_GROUP("File options"),
 		OPT_STRING('d', "destination", &destinationDirectoryPath, "Destination directory, where the splitted files will be written\n\t\t\t\t  (current directory by default)"),
+		OPT_STRING(0, "compress", &outputCompression, "compress splitted files: 'zstd', 'gzip' or 'lz4' with optional level after colon,\n\t\t\t\t  e.g. 'zstd:3' (default - without compression)"),
+		OPT_GROUP("Performance options"),
+		OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+		OPT_STRING(0, "io-profile", &(fileIOParameters.ioProfilePath), "disk profile from 'theo bench-io' used to pick chunk size (default - profile saved by last calibration)"),
+		OPT_BOOLEAN(0, "index", &(lineIndexParameters.isEnabled), "with '--parts' take line count from index file next to input (file.txt.tidx),\n\t\t\t\t  build it while counting if missing (default - false)"),
+		OPT_BOOLEAN(0, "progress", &(progressParameters.isEnabled), "show percent done, speed and remaining time in stderr while splitting (default - false)"),
+		OPT_BOOLEAN(0, "perf-counters", &(perfCountersParameters.isEnabled), "measure hardware counters (cycles, instructions, cache and branch misses) of read, splitting\n\t\t\t\t  and write phases and print them at the end (Linux only, default - false)"),
 		OPT_GROUP("    Unmarked (positional) argument are considered as path to file that need to be splitted. "),
 		OPT_END(),
 	};
@@ -47,11 +50,26 @@ int split(int argc, const char** argv) {
 		exit(1);
 	}
 
+	// Частей может быть много, а стандартный вывод один, поэтому записывать части можно только в директорию
+	if (isStandardStreamPath(toWstring(destinationDirectoryPath))) {
+		cout << "Error: splitted files cannot be written to standard output, specify destination directory" << endl;
+		exit(ERROR_INVALID_PARAMETER);
+	}
+
+	const char* inputFilePath = argv[0];
+	/* Чтобы разбить файл на заданное количество частей, строки в нём надо сначала посчитать, то есть прочитать файл
+	* дважды, а стандартный ввод можно прочитать только один раз */
+	if (parts and isStandardStreamPath(toWstring(inputFilePath))) {
+		cout << "Error: standard input can be splitted only by number of lines ('--lines'), not by '--parts'" << endl;
+		exit(ERROR_INVALID_PARAMETER);
+	}
+
+	processOutputCompressionOption(outputCompression);
+	processPerfCountersOption();
 	// Проверяем итоговую директорию, есть ли к ней доступ и существует ли она
 	checkDestinationDirectory(toWstring(destinationDirectoryPath));
 
-	const char* inputFilePath = argv[0];
-	FILE* inputFilePtr = fileOpen(inputFilePath, "rb");
+	File* inputFilePtr = fileOpen(inputFilePath, "rb");
 	if (inputFilePtr == NULL) {
 		cout << "Error: cannot open [" << inputFilePath << "] because of invalid path or due to security policy reasons." << endl;
 		exit(1);
@@ -60,10 +78,11 @@ int split(int argc, const char** argv) {
 	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
 	
 	/* Вычисляем размер временного буфера для хранения и обработки байтовых данных с файлов. 
-	* Обычно буфер должен иметь оптимальный размер для работы с диском (64 мегабайта, степень двойки в байтах),
-	* однако, если сам изначальный файл для разбиения меньше, используется его размер, чтобы не занимать лишнюю оперативку */
-	ull fileSize = getFileSize(toWstring(inputFilePath));
-	size_t countBytesToReadInOneIteration = min(OPTIMAL_DISK_CHUNK_SIZE, fileSize);
+	* Обычно буфер должен иметь оптимальный размер для работы с диском (из профиля диска или 64 мегабайта, степень двойки в байтах),
+	* однако, если сам изначальный файл для разбиения меньше, используется его размер, чтобы не занимать лишнюю оперативку.
+	* Размер стандартного ввода и распакованного сжатого файла неизвестен, они читаются буферами оптимального размера */
+	long long fileSize = getFileSize(inputFilePtr);
+	size_t countBytesToReadInOneIteration = fileSize < 0 ? getOptimalChunkSize(1) : min(getOptimalChunkSize(1), static_cast<ull>(fileSize));
 
 	/* Буфер, в который будет считываться информация с диска(со входящего файла) 
 	* и в котором будут считаться строки.
@@ -79,7 +98,9 @@ int split(int argc, const char** argv) {
 	 * на количество необходимых частей, получая так нужное количество строк на один итоговый файл.
 	 */
 	if (parts > 0) {
+		startProgress("split: counting lines", max(fileSize, 0LL));
 		long long linesInInputFileCount = getStringCountInFile(toWstring(inputFilePath));
+		finishProgress();
 		if (linesInInputFileCount == -1) {
 			cout << "Error: cannot get count of lines in input file [" << inputFilePath << "]." << endl;
 			return -1;
@@ -107,10 +128,17 @@ int split(int argc, const char** argv) {
 	/* Текущий номер файла, в который записываются строки из изначального. Имя каждого нового файла - 
 	* имя изначального файла без расширения + '_[порядковый номер файла].txt' в конце */
 	size_t currentFileNumber = 1;
-	FILE* currentSplittedFilePtr = getNextSplittedFilePtr(toWstring(destinationDirectoryPath), linesInOneResultFile, currentFileNumber, toWstring(inputFilePath));
-
-	while (!feof(inputFilePtr)) {
-		size_t bytesReaded = fread(buffer, sizeof(char), countBytesToReadInOneIteration, inputFilePtr);
+	File* currentSplittedFilePtr = getNextSplittedFilePtr(toWstring(destinationDirectoryPath), linesInOneResultFile, currentFileNumber, toWstring(inputFilePath));
+
+	startProgress("split", max(fileSize, 0LL));
+	while (!inputFilePtr->isEndOfFile()) {
+		size_t bytesReaded = 0;
+		{
+			PerfPhaseScope perfScope(PerfPhase::Read);
+			bytesReaded = inputFilePtr->read(buffer, countBytesToReadInOneIteration);
+		}
+		// Строки буфера и так считаются при разбиении, поэтому для прогресса их количество берётся из счётчика
+		size_t linesInBuffer = 0;
 
 		// Пробегаемся по считанному буферу, считая строки
 		size_t startPos = 0;
@@ -118,10 +146,19 @@ int split(int argc, const char** argv) {
 			/* Считает строки либо до конца буфера, либо пока не наберет lineInOneFileCount (это значит,
 			* что автодекрементирующийся счётчик remainingStrings станет равен нулю). 
 			* Возвращается итоговую позицию в буфере после чтения нужного числа строк или после окончания чтения буфера */
-			size_t endPos = readBufferByLinesUntilCount(buffer, bytesReaded, startPos, &remainingStrings);
+			size_t remainingStringsBefore = remainingStrings;
+			size_t endPos = 0;
+			{
+				PerfPhaseScope perfScope(PerfPhase::Process);
+				endPos = readBufferByLinesUntilCount(buffer, bytesReaded, startPos, &remainingStrings);
+			}
+			linesInBuffer += remainingStringsBefore - remainingStrings;
 
 			// Записываем считанные из буфера строки в текущий итоговый файл
-			fwrite(&buffer[startPos], sizeof(char), endPos - startPos, currentSplittedFilePtr);
+			{
+				PerfPhaseScope perfScope(PerfPhase::Write);
+				currentSplittedFilePtr->write(&buffer[startPos], endPos - startPos);
+			}
 
 			// В следующий раз мы будем считывать информацию из буфера, начиная с endPos, на котором закончили в этот раз
 			startPos = endPos;
@@ -129,28 +166,51 @@ int split(int argc, const char** argv) {
 			// Если мы набрали нужное число строк для текущего файла, обновляем счетчик строк, закрываем файл и создаем следующий
 			if (remainingStrings == 0) {
 				remainingStrings = linesInOneResultFile;
-				fclose(currentSplittedFilePtr);
+				fileClose(currentSplittedFilePtr);
+				currentSplittedFilePtr = NULL;
 				// Если конец входного файла, новый файл для строк создавать не надо, так как он будет пустым
-				if(!feof(inputFilePtr) or startPos < bytesReaded) currentSplittedFilePtr = getNextSplittedFilePtr(toWstring(destinationDirectoryPath), linesInOneResultFile, ++currentFileNumber, toWstring(inputFilePath));
+				if(!inputFilePtr->isEndOfFile() or startPos < bytesReaded) currentSplittedFilePtr = getNextSplittedFilePtr(toWstring(destinationDirectoryPath), linesInOneResultFile, ++currentFileNumber, toWstring(inputFilePath));
 			}
 		}
+		addProgress(bytesReaded, linesInBuffer);
 		// Если прочитали весь файл, который мы делим, закрываем текущий файл для записи (он будет неполным и последним)
-		if (feof(inputFilePtr)) fclose(currentSplittedFilePtr);
+		if (inputFilePtr->isEndOfFile()) fileClose(currentSplittedFilePtr);
 	}
+	fileClose(inputFilePtr);
+	finishProgress();
 
 	chrono::steady_clock::time_point end = chrono::steady_clock::now();
 	cout << "\nFile splitted successfully! Execution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+	printPerfCounters("split");
 
 	return ERROR_SUCCESS;
 }
 
-static size_t readBufferByLinesUntilCount(char* buffer, size_t buflen, size_t startBufIndex, size_t* remainingStrings) {
-	for (size_t i = startBufIndex; i < buflen; i++) if (buffer[i] == 10 and !-- * remainingStrings) return i + 1;
+size_t readBufferByLinesUntilCount(char* buffer, size_t buflen, size_t startBufIndex, size_t* remainingStrings) {
+	unsigned long long masks[NEWLINE_MASKS_IN_BLOCK];
+	for (size_t blockStart = startBufIndex; blockStart < buflen; blockStart += NEWLINE_SCAN_BLOCK_SIZE) {
+		size_t blockLength = min(buflen - blockStart, NEWLINE_SCAN_BLOCK_SIZE);
+		// Блоки, целиком входящие в текущий файл, только подсчитываем, не разбирая переносы по отдельности
+		size_t linesInBlock = newlineKernel->countNewlines(&buffer[blockStart], blockLength);
+		if (linesInBlock < *remainingStrings) {
+			*remainingStrings -= linesInBlock;
+			continue;
+		}
+		// В этом блоке набирается нужное число строк: ищем позицию переноса, которым заканчивается последняя из них
+		newlineKernel->findNewlines(&buffer[blockStart], blockLength, masks);
+		for (size_t maskNumber = 0; ; maskNumber++) {
+			unsigned long long mask = masks[maskNumber];
+			for (; mask; mask &= mask - 1) {
+				if (--*remainingStrings == 0) return blockStart + maskNumber * 64 + getLowestSetBitNumber(mask) + 1;
+			}
+		}
+	}
 	return buflen;
 }
 
-static FILE* getNextSplittedFilePtr(wstring destinationDirectory, size_t linesInOneFile, size_t currentFileNumber, wstring inputFilePath) {
-	wstring resultFilenameWithExtension = getFileNameWithoutExtension(inputFilePath) + L"_" + to_wstring(linesInOneFile) + L"_" + to_wstring(currentFileNumber) + L".txt";
+static File* getNextSplittedFilePtr(wstring destinationDirectory, size_t linesInOneFile, size_t currentFileNumber, wstring inputFilePath) {
+	wstring inputFileName = isStandardStreamPath(inputFilePath) ? L"stdin" : getFileNameWithoutExtension(inputFilePath);
+	wstring resultFilenameWithExtension = inputFileName + L"_" + to_wstring(linesInOneFile) + L"_" + to_wstring(currentFileNumber) + L".txt" + getCompressionExtension(compressionParameters.outputFormat);
 	wstring pathToSplittedFile = joinPaths(destinationDirectory, resultFilenameWithExtension);
 	return fileOpen(pathToSplittedFile, "wb+");
 }
\ No newline at end of file
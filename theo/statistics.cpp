@@ -0,0 +1,121 @@
+﻿#include <sstream>
+#include <iomanip>
+#include "utils.hpp"
+
+StatisticsParameters statisticsParameters;
+
+// Момент запуска программы: глобальные переменные инициализируются до main
+static const chrono::steady_clock::time_point programStart = chrono::steady_clock::now();
+
+// Статистика всех обработанных файлов в порядке окончания их обработки
+static vector<FileStatistics> filesStatistics;
+static mutex filesStatisticsMutex;
+
+// Экранирует строку для записи в JSON: кавычки, обратные слеши и управляющие символы
+static string escapeJsonString(const string& value);
+
+// Записывает поля статистики файла (без пути) в поток в виде пар "ключ": значение через запятую
+static void writeStatisticsJsonFields(ostringstream& output, const FileStatistics& statistics);
+
+void FileStatistics::add(const FileStatistics& other) noexcept {
+	bytesIn += other.bytesIn;
+	bytesOut += other.bytesOut;
+	linesIn += other.linesIn;
+	linesOut += other.linesOut;
+	chunksCount += other.chunksCount;
+	threadsCount = max(threadsCount, other.threadsCount);
+	readSeconds += other.readSeconds;
+	processSeconds += other.processSeconds;
+	writeSeconds += other.writeSeconds;
+	if (not other.hasDeduplicationStatistics) return;
+	// Ложные удаления в каждом файле считаются отдельно, поэтому в сумме складываются
+	if (other.expectedFalseDropsCount >= 0) expectedFalseDropsCount = max(expectedFalseDropsCount, 0.0) + other.expectedFalseDropsCount;
+	// Для хешей в сумме - самая большая таблица и самый ранний переход на диск среди всех файлов
+	hasDeduplicationStatistics = true;
+	if (other.hashSetSize >= hashSetSize) {
+		hashSetSize = other.hashSetSize;
+		hashSetLoadFactor = other.hashSetLoadFactor;
+	}
+	if (other.diskFallbackSecond >= 0 and (diskFallbackSecond < 0 or other.diskFallbackSecond < diskFallbackSecond)) {
+		diskFallbackSecond = other.diskFallbackSecond;
+		hashSetSizeAtDiskFallback = other.hashSetSizeAtDiskFallback;
+	}
+}
+
+bool isStatisticsEnabled(void) noexcept {
+	return statisticsParameters.format != NULL;
+}
+
+bool processStatisticsOption(void) noexcept {
+	if (statisticsParameters.format == NULL or string(statisticsParameters.format) == "json") return true;
+	cout << "Error: invalid '--stats' parameter value - [" << statisticsParameters.format << "]. Valid options: 'json' (without apostrophes)" << endl;
+	return false;
+}
+
+double getSecondsSinceProgramStart(void) noexcept {
+	return chrono::duration<double>(chrono::steady_clock::now() - programStart).count();
+}
+
+void addFileStatistics(const FileStatistics& statistics) {
+	if (not isStatisticsEnabled()) return;
+	lock_guard<mutex> lock(filesStatisticsMutex);
+	filesStatistics.push_back(statistics);
+}
+
+void printStatistics(const char* commandName) {
+	if (not isStatisticsEnabled()) return;
+
+	FileStatistics totalStatistics;
+	totalStatistics.threadsCount = 0;
+	totalStatistics.wallSeconds = getSecondsSinceProgramStart();
+
+	// Вся статистика выводится одной строкой, чтобы её было просто отделить от остального вывода команды
+	ostringstream output;
+	output << fixed << setprecision(6) << "{\"command\": \"" << commandName << "\", \"files\": [";
+	for (size_t i = 0; i < filesStatistics.size(); i++) {
+		output << (i ? ", " : "") << "{\"path\": \"" << escapeJsonString(fromWstring(filesStatistics[i].path)) << "\", ";
+		writeStatisticsJsonFields(output, filesStatistics[i]);
+		output << "}";
+		totalStatistics.add(filesStatistics[i]);
+	}
+	output << "], \"total\": {";
+	writeStatisticsJsonFields(output, totalStatistics);
+	output << "}}";
+	cout << output.str() << endl;
+}
+
+static void writeStatisticsJsonFields(ostringstream& output, const FileStatistics& statistics) {
+	/* Узкое место обработки - этап, занятый дольше всех: время обработки делится на количество потоков,
+	* поскольку потоки обрабатывают чанки одновременно, а чтение и запись идут каждое в одном потоке */
+	double processWallSeconds = statistics.processSeconds / max(statistics.threadsCount, (size_t)1);
+	const char* bottleneck = "process";
+	if (statistics.readSeconds > processWallSeconds and statistics.readSeconds >= statistics.writeSeconds) bottleneck = "read";
+	else if (statistics.writeSeconds > processWallSeconds) bottleneck = "write";
+
+	output << "\"bytes_in\": " << statistics.bytesIn << ", \"bytes_out\": " << statistics.bytesOut
+		<< ", \"lines_in\": " << statistics.linesIn << ", \"lines_kept\": " << statistics.linesOut << ", \"lines_dropped\": " << statistics.linesIn - min(statistics.linesOut, statistics.linesIn)
+		<< ", \"chunks\": " << statistics.chunksCount << ", \"threads\": " << statistics.threadsCount
+		<< ", \"read_seconds\": " << statistics.readSeconds << ", \"process_seconds\": " << statistics.processSeconds << ", \"write_seconds\": " << statistics.writeSeconds
+		<< ", \"wall_seconds\": " << statistics.wallSeconds << ", \"bottleneck\": \"" << bottleneck << "\"";
+	if (statistics.hasDeduplicationStatistics) {
+		output << ", \"dedup\": {\"hash_set_size\": " << statistics.hashSetSize << ", \"hash_set_load_factor\": " << statistics.hashSetLoadFactor
+			<< ", \"disk_fallback\": " << (statistics.diskFallbackSecond >= 0 ? "true" : "false");
+		if (statistics.diskFallbackSecond >= 0) output << ", \"disk_fallback_at_seconds\": " << statistics.diskFallbackSecond << ", \"hash_set_size_at_disk_fallback\": " << statistics.hashSetSizeAtDiskFallback;
+		if (statistics.expectedFalseDropsCount >= 0) output << ", \"approx_expected_false_drops\": " << statistics.expectedFalseDropsCount;
+		output << "}";
+	}
+}
+
+static string escapeJsonString(const string& value) {
+	string escaped;
+	for (unsigned char symbol : value) {
+		if (symbol == '"' or symbol == '\\') escaped += '\\';
+		if (symbol < 0x20) {
+			char escapedSymbol[8];
+			snprintf(escapedSymbol, sizeof(escapedSymbol), "\\u%04x", symbol);
+			escaped += escapedSymbol;
+		}
+		else escaped += static_cast<char>(symbol);
+	}
+	return escaped;
+}
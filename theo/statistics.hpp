@@ -0,0 +1,67 @@
+﻿#pragma once
+#ifndef THEO_STATISTICS
+#define THEO_STATISTICS
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+/* Статистика работы команд, обрабатывающих файлы почанково (normalize, dedup, tokenize, pipe): объём входных
+* и итоговых данных, количество строк и время чтения, обработки и записи каждого файла. По ней видно, во что
+* упирается обработка - в диск или в процессор, поэтому её удобно читать планировщикам задач и скриптам */
+
+// Параметры вывода статистики, значение задаётся опцией запуска команды --stats
+struct StatisticsParameters {
+	// Формат вывода статистики после окончания работы команды: NULL - не выводить, "json" - одна строка JSON
+	const char* format = NULL;
+};
+extern StatisticsParameters statisticsParameters;
+
+// Статистика обработки одного входного файла, а также сумма по всем файлам
+struct FileStatistics {
+	std::wstring path; // Путь к входному файлу, '-' - стандартный ввод
+	unsigned long long bytesIn = 0; // Прочитано байт строк (для сжатых файлов - после распаковки)
+	unsigned long long bytesOut = 0; // Записано байт строк (для сжатых итоговых файлов - до сжатия)
+	unsigned long long linesIn = 0; // Входных строк
+	unsigned long long linesOut = 0; // Строк, оставленных в итоговом файле, остальные отброшены
+	unsigned long long chunksCount = 0;
+	size_t threadsCount = 1; // Сколько потоков обрабатывали чанки файла
+	/* Время чтения, обработки и записи в секундах. Время обработки - сумма по всем потокам обработки, а время
+	* ожидания свободного буфера или очереди ни в одно из них не входит */
+	double readSeconds = 0;
+	double processSeconds = 0;
+	double writeSeconds = 0;
+	double wallSeconds = 0; // Время от начала до конца обработки файла
+	// Статистика хешей dedup после обработки файла, заполняется только при удалении дубликатов
+	bool hasDeduplicationStatistics = false;
+	unsigned long long hashSetSize = 0; // Количество хешей в оперативной памяти
+	double hashSetLoadFactor = 0; // Заполненность хеш-таблицы в оперативной памяти, от 0 до 1
+	// Момент перехода на хранение хешей на диске (секунды от запуска команды), отрицательный - хватило памяти
+	double diskFallbackSecond = -1;
+	unsigned long long hashSetSizeAtDiskFallback = 0; // Сколько хешей было в оперативной памяти в момент перехода
+	// Ожидаемое количество уникальных строк, ошибочно удалённых в приближённом режиме (--approx), отрицательное - режим выключен
+	double expectedFalseDropsCount = -1;
+
+	// Добавляет к статистике статистику ещё одного файла (для общей суммы по всем файлам)
+	void add(const FileStatistics& other) noexcept;
+};
+
+/* Возвращает true, если пользователь включил вывод статистики. Подсчёт строк нужен только для статистики и
+* занимает заметное время, поэтому выполняется только тогда */
+bool isStatisticsEnabled(void) noexcept;
+
+/* Проверяет формат статистики, указанный пользователем. Если формат неизвестен, выводит ошибку и
+* возвращает false */
+bool processStatisticsOption(void) noexcept;
+
+// Секунды с момента запуска программы, от него отсчитываются моменты событий в статистике
+double getSecondsSinceProgramStart(void) noexcept;
+
+// Сохраняет статистику обработанного файла для итогового вывода. Можно вызывать из нескольких потоков одновременно
+void addFileStatistics(const FileStatistics& statistics);
+
+/* Выводит в консоль статистику всех обработанных файлов и их сумму одной строкой в формате, выбранном пользователем.
+* Если статистика не включена, ничего не делает */
+void printStatistics(const char* commandName);
+
+#endif // !THEO_STATISTICS
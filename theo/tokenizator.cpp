@@ -11,6 +11,9 @@ static struct TokenizerParameters {
 * Возвращает длину итогового буфера, который надо записать в файл с нормализованными строками */
 static size_t tokenizeBufferLineByLine(char* inputBuffer, size_t inputBufferLength, char* resultBuffer);
 
+// Устанавливает в параметрах токенизации, какую часть строк брать ('first' или 'last'). Возвращает false, если значение неверное
+static bool setTokenizedStringPart(const char* resultStringPart);
+
 // Является ли текущий символ сепаратором между email/log/num и password в строке
 static bool isSeparator(char symbol) { return strchr(tokenizerParameters.separatorSymbols, symbol) != NULL; }
 
@@ -24,6 +27,7 @@ int tokenize(int argc, const char** argv) {
 	// Брать ли файлы для токенизации из указанных пользователем директорий рекурсивно (проверяя субдиректории)
 	int checkSourceDirectoriesRecursive = 0; 
 	const char* destinationPath = NULL; // Путь к итоговой папке или файлу (если needMerge = true)
+	const char* outputCompression = NULL; // Формат и уровень сжатия итоговых файлов, если их надо сжимать
 	int needMerge = 0; // Требуется ли объединять нормализованные строки со всех файлов в один итоговый
 	const char* resultStringPart = "first";
 
@@ -36,6 +40,16 @@ int tokenize(int argc, const char** argv) {
 		OPT_BOOLEAN('m', "merge", &needMerge, "merge strings from all tokenized files to one destination file"),
 		OPT_STRING('d', "destination", &destinationPath, "absolute or relative path to result folder(default: current directory)\n\t\t\t\t  or file, if merge parameter is specified (default: tokenized_merged.txt)"),
 		OPT_BOOLEAN('r', "recursive", &checkSourceDirectoriesRecursive, "check source directories recursive (default - false)"),
+		OPT_STRING(0, "compress", &outputCompression, "compress result files: 'zstd', 'gzip' or 'lz4' with optional level after colon,\n\t\t\t\t  e.g. 'zstd:3' (default - without compression)"),
+		OPT_GROUP("Performance options"),
+		OPT_BOOLEAN(0, "mmap", &(chunksProcessingParameters.useMemoryMapping), "read input files via memory mapping, without copying to buffers (default - false)"),
+		OPT_BOOLEAN(0, "io-uring", &(fileIOParameters.useIoUring), "read and write files via io_uring, keeping many large requests in flight (Linux only, default - false)"),
+		OPT_BOOLEAN(0, "direct-io", &(fileIOParameters.useDirectIO), "read and write files bypassing page cache (O_DIRECT) and preallocate result files\n\t\t\t\t  (Linux only, default - false)"),
+		OPT_STRING(0, "io-profile", &(fileIOParameters.ioProfilePath), "disk profile from 'theo bench-io' used to pick chunk size (default - profile saved by last calibration)"),
+		OPT_INTEGER(0, "threads", &(chunksProcessingParameters.threadsCount), "number of threads tokenizing chunks of file simultaneously (default - all CPU cores)"),
+		OPT_STRING(0, "stats", &(statisticsParameters.format), "print statistics of every file and total (bytes, lines, read, processing and write time)\n\t\t\t\t  after processing: 'json' - one line of JSON (default - don't print)"),
+		OPT_BOOLEAN(0, "progress", &(progressParameters.isEnabled), "show percent done, speed and remaining time in stderr while processing (default - false)"),
+		OPT_BOOLEAN(0, "perf-counters", &(perfCountersParameters.isEnabled), "measure hardware counters (cycles, instructions, cache and branch misses) of read, tokenization\n\t\t\t\t  and write phases and print them at the end (Linux only, default - false)"),
 		OPT_GROUP("All unmarked (positional) arguments are considered paths to files and folders with bases that need to be tokenized.\nExample command: 'theo t -d result base1.txt base2.txt'. More: github.com/Theodikes/theo-bases-soft"),
 		OPT_END(),
 	};
@@ -53,56 +67,78 @@ int tokenize(int argc, const char** argv) {
 	// Получаем список всех валидных файлов, которые надо токенизировать
 	sourcefiles_info sourceFilesPaths = getSourceFilesFromUserInput(remainingArgumentsCount, argv, checkSourceDirectoriesRecursive);
 
-	FILE* resultFile = NULL;
-	processDestinationPath(&destinationPath, needMerge, &resultFile, "tokenized_merged.txt");
+	File* resultFile = NULL;
+	processOutputCompressionOption(outputCompression);
+	processDestinationPath(&destinationPath, &needMerge, &resultFile, "tokenized_merged.txt");
 
-	if (string(resultStringPart) == "first") tokenizerParameters.onlyFirstPart = true;
-	else if (string(resultStringPart) == "last") tokenizerParameters.onlyLastPart = true;
-	else {
+	if (chunksProcessingParameters.threadsCount < 0) {
+		cout << "Error: invalid '--threads' parameter value, it must be positive number (or zero to use all CPU cores)" << endl;
+		exit(1);
+	}
+
+	if (not processStatisticsOption()) exit(1);
+	processPerfCountersOption();
+
+	if (not setTokenizedStringPart(resultStringPart)) {
 		cout << "Error: invalid 'part' parameter value - [" << resultStringPart << "]. Valid options: 'first', 'last' (without apostrophes)" << endl;
 		exit(1);
 	}
 
+	startProgress("tokenize", getSourceFilesTotalSize(sourceFilesPaths));
 	processAllSourceFiles(sourceFilesPaths, needMerge, resultFile, toWstring(destinationPath), L"tokenized", tokenizeBufferLineByLine);
+	finishProgress();
 
 	chrono::steady_clock::time_point end = chrono::steady_clock::now();
 	cout << endl << (sourceFilesPaths.size() == 1 ? "File" : "All files") << " tokenized successfully! Execution time: " << chrono::duration_cast<std::chrono::seconds>(end - begin).count() << "[s]\n" << endl;
+	printStatistics("tokenize");
+	printPerfCounters("tokenize");
 
 	return ERROR_SUCCESS;
 }
 
+chunk_processor getTokenizePipeStage(const char* resultStringPart) noexcept {
+	if (not setTokenizedStringPart(resultStringPart != NULL ? resultStringPart : "first")) return NULL;
+	return tokenizeBufferLineByLine;
+}
+
+static bool setTokenizedStringPart(const char* resultStringPart) {
+	if (string(resultStringPart) == "first") tokenizerParameters.onlyFirstPart = true;
+	else if (string(resultStringPart) == "last") tokenizerParameters.onlyLastPart = true;
+	else return false;
+	return true;
+}
+
 static size_t tokenizeBufferLineByLine(char* inputBuffer, size_t inputBufferLength, char* resultBuffer) {
-	size_t currentStringStartPosInInputBuffer = 0; // Позиция начала текущей строки в буфере (номер байта)
 	size_t resultBufferLength = 0;
-	for (size_t pos = 0; pos < inputBufferLength; pos++) {
-		if (inputBuffer[pos] == '\n') {
-			// В данном случае в строке не надо учитывать \n, оно будет автоматически вставлено после нормализации
-			size_t currentStringLength = pos - currentStringStartPosInInputBuffer;
-			size_t separatorPos = 0;
-			// Ищем разделитель в строке
-			for (size_t i = currentStringStartPosInInputBuffer; i < pos; i++) {
-				if (isSeparator(inputBuffer[i])) separatorPos = i;
-			}
-			// Если разделитель не найден, или он в самом конце или самом начале, строку пропускаем, она невалидна
-			if (not separatorPos or separatorPos == pos - 1 or separatorPos == currentStringStartPosInInputBuffer) continue;
-			// Если нам нужно получить первую часть, копируем в итоговый буфер строку до сепаратора
-			if (tokenizerParameters.onlyFirstPart) {
-				size_t partLength = separatorPos - currentStringStartPosInInputBuffer;
-				memcpy(&resultBuffer[resultBufferLength], &inputBuffer[currentStringStartPosInInputBuffer], partLength);
-				resultBufferLength += partLength;
-			}
-			// Если нам нужно получить вторую часть (пароль), копируем всё из строки от сепаратора (не вкл.) до конца
-			else {
-				size_t partLength = pos - (separatorPos + 1);
-				memcpy(&resultBuffer[resultBufferLength], &inputBuffer[separatorPos + 1], partLength);
-				resultBufferLength += partLength;
-			}
-			// Добавляем перенос строки в конец каждого взятого куска, чтобы они не слиплись в итоговом файле
-			resultBuffer[resultBufferLength++] = '\n';
-			// Начало следующей строки во входном буфере - следующий символ после текущей позиции
-			currentStringStartPosInInputBuffer = pos + 1;
+	/* Начало текущей строки. Как и раньше, после невалидной строки оно не сдвигается, и невалидная строка
+	* проверяется и записывается вместе со следующей (включая перенос строки между ними) */
+	const char* currentStringStart = NULL;
+	// В данном случае в строке не надо учитывать \n, оно будет автоматически вставлено после токенизации
+	forEachLine(inputBuffer, inputBufferLength, [&](const char* string, size_t stringLength) {
+		if (currentStringStart == NULL) currentStringStart = string;
+		const char* stringEnd = string + stringLength;
+		// Ищем последний разделитель в строке, проходя её с конца
+		const char* separator = stringEnd;
+		while (separator > currentStringStart and not isSeparator(separator[-1])) separator--;
+		// Если разделитель не найден, или он в самом конце или самом начале, строку пропускаем, она невалидна
+		if (separator <= currentStringStart + 1 or separator == stringEnd) return;
+		separator--;
+		// Если нам нужно получить первую часть, копируем в итоговый буфер строку до сепаратора
+		if (tokenizerParameters.onlyFirstPart) {
+			size_t partLength = separator - currentStringStart;
+			memcpy(&resultBuffer[resultBufferLength], currentStringStart, partLength);
+			resultBufferLength += partLength;
 		}
-	}
+		// Если нам нужно получить вторую часть (пароль), копируем всё из строки от сепаратора (не вкл.) до конца
+		else {
+			size_t partLength = stringEnd - (separator + 1);
+			memcpy(&resultBuffer[resultBufferLength], separator + 1, partLength);
+			resultBufferLength += partLength;
+		}
+		// Добавляем перенос строки в конец каждого взятого куска, чтобы они не слиплись в итоговом файле
+		resultBuffer[resultBufferLength++] = '\n';
+		currentStringStart = NULL;
+	});
 
 	return resultBufferLength;
 }
\ No newline at end of file
@@ -1,23 +1,33 @@
 ﻿#include "utils.hpp"
 
+/* На Windows wchar_t - это UTF-16, а на Linux - UTF-32, поэтому и конвертер из UTF-8 нужен разный */
+#ifdef _WIN32
+typedef codecvt_utf8_utf16<wchar_t> wide_string_codecvt;
+#else
+typedef codecvt_utf8<wchar_t> wide_string_codecvt;
+#endif
+
 wstring toWstring(string s) {
-	wstring_convert<codecvt_utf8_utf16<wchar_t>> converter;
+	wstring_convert<wide_string_codecvt> converter;
 	return converter.from_bytes(s);
 }
 
 string fromWstring(wstring s) {
-	wstring_convert<codecvt_utf8_utf16<wchar_t>> converter;
+	wstring_convert<wide_string_codecvt> converter;
 	return converter.to_bytes(s);
 }
 
 wstring joinPaths(wstring dirPath, wstring filePath) noexcept {
-	return (fs::path(dirPath) / fs::path(filePath)).wstring();
+	return fromFilesystemPath(toFilesystemPath(dirPath) / toFilesystemPath(filePath));
 }
 
 /* Конвертация длинного пути файла в короткий, если это возможно (если включён тип путей 8.3 на Windows)
 * О типах путей: https://learn.microsoft.com/ru-ru/windows/win32/fileio/naming-a-file#short-vs-long-names
-* Если конвертация не удалась, возвращает исходный длинный путь */
+* Если конвертация не удалась, возвращает исходный длинный путь. На других системах путь не меняется */
 wstring _maybeConvertLongPathToShort(wstring longPath) {
+#ifndef _WIN32
+	return longPath;
+#else
 	wchar_t shortPath[MAX_PATH];
 	DWORD shortPathSize = GetShortPathNameW(longPath.c_str(), shortPath, MAX_PATH);
 	if (shortPathSize == 0) return longPath;
@@ -26,30 +36,45 @@ wstring _maybeConvertLongPathToShort(wstring longPath) {
 	* и значение строки станет недоступно, если вернуть её */
 	wstring shortPathW = shortPath;
 	return shortPathW;
+#endif
 }
 
-FILE* fileOpen(string filePath, string openFlags) noexcept {
+File* fileOpen(string filePath, string openFlags) noexcept {
 	return fileOpen(toWstring(filePath), toWstring(openFlags).c_str());
 }
 
-FILE* fileOpen(wstring filePath, string openFlags) noexcept {
+File* fileOpen(wstring filePath, string openFlags) noexcept {
 	return fileOpen(filePath, toWstring(openFlags).c_str());
 }
 
-FILE* fileOpen(wstring filePath, const wchar_t* openFlags) noexcept {
-	wstring fileAbsolutePath = fs::absolute(filePath);
-	// Если путь длиннее MAX_PATH, надо добавить соответствующий идентификатор, чтобы его открыло корректно
-	if (fileAbsolutePath.length() >= MAX_PATH and not fileAbsolutePath.starts_with(WIN_LONG_PATH_START)) fileAbsolutePath.insert(0, WIN_LONG_PATH_START);
+/* Переключает весь консольный вывод программы (сообщения о ходе работы, ошибки) на stderr, чтобы
+* он не смешивался с итоговыми строками, которые записываются в стандартный вывод */
+static void redirectConsoleOutputToStderr(void) noexcept {
+	cout.rdbuf(cerr.rdbuf());
+	wcout.rdbuf(wcerr.rdbuf());
+}
 
+File* fileOpen(wstring filePath, const wchar_t* openFlags) noexcept {
+	// Вместо файла - стандартный ввод или вывод, например, для соединения команд через конвейер: theo n -d - - | theo d -
+	if (isStandardStreamPath(filePath)) {
+		if (openFlags[0] == L'r') return openDecompressingFileIfCompressed(openStandardStream(FileOpenMode::Read), filePath);
+		redirectConsoleOutputToStderr();
+		return openCompressingFileIfNeeded(openStandardStream(FileOpenMode::Write));
+	}
 	try {
+		wstring fileAbsolutePath = fromFilesystemPath(fs::absolute(toFilesystemPath(filePath)));
+#ifdef _WIN32
+		// Если путь длиннее MAX_PATH, надо добавить соответствующий идентификатор, чтобы его открыло корректно
+		if (fileAbsolutePath.length() >= MAX_PATH and not fileAbsolutePath.starts_with(WIN_LONG_PATH_START)) fileAbsolutePath.insert(0, WIN_LONG_PATH_START);
+#endif
 		/* Если нам нужно считать файлы, желательно превратить путь в short - формат, чтобы
 		* даже файлы в непонятной кодировке открывались корректно */
 		if (openFlags[0] == L'r') {
 			wstring simpleFilePath = _maybeConvertLongPathToShort(fileAbsolutePath);
-			return _wfopen(simpleFilePath.c_str(), openFlags);
+			return openDecompressingFileIfCompressed(openPlatformFile(simpleFilePath, FileOpenMode::Read), filePath);
 		}
 		// Поскольку записывать файлы надо ровно как указал пользователь, тут на short-формат не меняем
-		else return _wfopen(fileAbsolutePath.c_str(), openFlags);
+		else return openCompressingFileIfNeeded(openPlatformFile(fileAbsolutePath, FileOpenMode::Write));
 	}
 	catch (...) {
 		return NULL;
@@ -65,8 +90,8 @@ bool processSourceFileOrDirectory(sourcefiles_info& textFilesPaths, wstring path
 	}
 	if (!isDirectory(path)) return addFileToSourceList(textFilesPaths, path);
 
-	for (const auto& entry : fs::directory_iterator(path)) {
-		wstring subpath = entry.path().wstring();
+	for (const auto& entry : fs::directory_iterator(toFilesystemPath(path))) {
+		wstring subpath = fromFilesystemPath(entry.path());
 		if (isDirectory(subpath) and recursive) processSourceFileOrDirectory(textFilesPaths, subpath, recursive);
 		else addFileToSourceList(textFilesPaths, subpath);
 	}
@@ -75,7 +100,10 @@ bool processSourceFileOrDirectory(sourcefiles_info& textFilesPaths, wstring path
 }
 
 bool addFileToSourceList(sourcefiles_info& sourceTextFilesPaths, wstring filePath) noexcept {
-	if (not (fs::path(filePath).extension() == ".txt")) return false;
+	// У сжатого файла под расширением сжатия должно быть .txt (base.txt.zst)
+	fs::path systemPath = toFilesystemPath(filePath);
+	if (getCompressionFormatByExtension(filePath) != CompressionFormat::None) systemPath = systemPath.stem();
+	if (not (systemPath.extension() == ".txt")) return false;
 	if (getFileSize(filePath) < 1) return false;
 	sourceTextFilesPaths.insert(filePath);
 	return true;
@@ -87,12 +115,17 @@ sourcefiles_info getSourceFilesFromUserInput(size_t sourcePathsCount, const char
 
 	// Обрабатываем все пути, указанные пользователем, получаем оттуда все txt-файлы и сохраняем их в sourceFilesPaths
 	for (size_t i = 0; i < sourcePathsCount; i++) {
+		// Стандартный ввод добавляется как есть: это не файл, проверять его существование и расширение не нужно
+		if (isStandardStreamPath(toWstring(userSourcePaths[i]))) {
+			sourceFilesPaths.insert(toWstring(userSourcePaths[i]));
+			continue;
+		}
 		/* Добавляем в начале пути \\ ? \, чтобы библиотека filesystem обрабатывала длинные пути,
 		* если они будут (допустим, если какой-то файл превышает лимит, заданный в MAX_PATH */
 		wstring currentPath = toWstring(userSourcePaths[i]);
 		/* Превращаем каждый путь в абсолютный, так как относительные(релативные) становятся
 		* невалидными, если к ним добавить идентификатор длинного пути */
-		wstring absolutePath = fs::absolute(currentPath).wstring();
+		wstring absolutePath = fromFilesystemPath(fs::absolute(toFilesystemPath(currentPath)));
 		wstring currentLongPath = WIN_LONG_PATH_START + absolutePath;
 
 		processSourceFileOrDirectory(sourceFilesPaths, currentLongPath, checkDirectoriesRecursive);
@@ -108,84 +141,286 @@ sourcefiles_info getSourceFilesFromUserInput(size_t sourcePathsCount, const char
 }
 
 wstring getFileNameWithoutExtension(wstring pathToFile) noexcept {
-	if (not fs::exists(pathToFile)) return L"";
-	return filesystem::path(pathToFile).stem().wstring();
+	if (not fs::exists(toFilesystemPath(pathToFile))) return L"";
+	fs::path fileName = toFilesystemPath(pathToFile).stem();
+	if (getCompressionFormatByExtension(pathToFile) != CompressionFormat::None) fileName = fileName.stem();
+	return fromFilesystemPath(fileName);
 }
 
 
 size_t getLinesCountInText(char* bytes) noexcept {
-	size_t stringsCount = 0;
-	while (*bytes++) if (*bytes == 10) stringsCount++;
-	return stringsCount;
+	return newlineKernel->countNewlines(bytes, strlen(bytes));
 }
 
+size_t getLinesCountInBuffer(const char* buffer, size_t bufferLength) noexcept {
+	return newlineKernel->countNewlines(buffer, bufferLength);
+}
 
-long long getStringCountInFile(const wstring& filePath, size_t temporaryBufferSizeInBytes, char* temporaryInputBuffer) {
-	FILE* sourceFilePtr = fileOpen(filePath, "rb");
-	if (sourceFilePtr == NULL) return -1;
+/* Считает переносы строк в файле, читая его блоками с текущей позиции fileOffset, пока не будет прочитано bytesToRead байт
+* или пока файл не закончится. По указателю lastReadedCharPtr записывает последний прочитанный символ, если что-то прочитано.
+* Если передан строящийся индекс строк, переносы добавляются и в него, а если профиль строк - строки добавляются в профиль */
+static ull countNewlinesInFilePart(File* file, ull fileOffset, ull bytesToRead, char* buffer, size_t bufferSize, char* lastReadedCharPtr, LineIndex* lineIndex, DatasetProfiler* profiler) {
+	ull newlinesCount = 0;
+	while (bytesToRead > 0 and not file->isEndOfFile()) {
+		size_t bytesReaded = 0;
+		{
+			PerfPhaseScope perfScope(PerfPhase::Read);
+			bytesReaded = file->read(buffer, static_cast<size_t>(min(static_cast<ull>(bufferSize), bytesToRead)));
+		}
+		PerfPhaseScope perfScope(PerfPhase::Process);
+		size_t linesInBuffer = 0;
+		// Профиль проходит по всем строкам буфера и сам возвращает количество переносов, второй раз их считать не нужно
+		if (profiler != NULL) linesInBuffer = profiler->addBuffer(buffer, bytesReaded);
+		if (lineIndex != NULL) linesInBuffer = lineIndex->addNewlines(fileOffset, buffer, bytesReaded);
+		else if (profiler == NULL) linesInBuffer = getLinesCountInBuffer(buffer, bytesReaded);
+		newlinesCount += linesInBuffer;
+		addProgress(bytesReaded, linesInBuffer);
+		if (bytesReaded > 0) *lastReadedCharPtr = buffer[bytesReaded - 1];
+		fileOffset += bytesReaded;
+		bytesToRead -= bytesReaded;
+	}
+	return newlinesCount;
+}
 
-	// Если буфер не инициализирован при вызове функции, создаём его внутри функции
-	bool isBufferInitializedOnTopLevel = temporaryInputBuffer != NULL;
-	if (not isBufferInitializedOnTopLevel) temporaryInputBuffer = new char[temporaryBufferSizeInBytes];
+/* Подсчёт строк одного файла. Большой файл считают по частям сразу несколько потоков: каждая часть добавляет
+* свои переносы строк, а поток, закончивший последнюю часть, записывает итог в результаты */
+struct FileLinesCounting {
+	long long* resultPtr = NULL;
+	wstring filePath;
+	ull fileSize = 0;
+	atomic<ull> newlinesCount{ 0 };
+	atomic<size_t> unfinishedPartsCount{ 0 };
+	atomic<bool> isFailed{ false };
+	// Последний символ файла, записывается только потоком, считающим последнюю часть
+	char lastChar = '\n';
+	// Индекс строк, который строится во время подсчёта (если индексы включены и у файла нет актуального индекса)
+	LineIndex lineIndex;
+	bool isBuildingLineIndex = false;
+	// Профиль строк файла (--profile), в него добавляются профили всех частей
+	bool isProfiling = false;
+	DatasetProfile profile;
+	mutex profileMutex;
 
-	ull stringsCount = 0;
-	while (!feof(sourceFilePtr)) {
-		size_t bytesReaded = fread(temporaryInputBuffer, sizeof(char), temporaryBufferSizeInBytes, sourceFilePtr);
-		for (size_t i = 0; i < bytesReaded; i++) if (temporaryInputBuffer[i] == '\n') stringsCount++;
-		if (feof(sourceFilePtr) and temporaryInputBuffer[bytesReaded - 1] != '\n') stringsCount++;
+	void finishPart(void) {
+		if (unfinishedPartsCount.fetch_sub(1) != 1) return;
+		// Если файл не заканчивается переносом строки, последняя строка тоже считается
+		*resultPtr = isFailed ? -1 : static_cast<long long>(newlinesCount + (lastChar != '\n'));
+		if (isBuildingLineIndex and not isFailed and not lineIndex.finishBuilding(filePath, static_cast<ull>(*resultPtr))) {
+			wcout << "Warning: cannot save line index [" << LineIndex::getIndexPath(filePath) << "], file is changed while reading or directory is not writable" << endl;
+		}
+		if (isProfiling and not isFailed) {
+			profile.path = filePath;
+			addDatasetProfile(profile);
+		}
 	}
-	fclose(sourceFilePtr);
-	// Если буфер был создан в функии, после завершения функции его необходимо освободить
-	if (not isBufferInitializedOnTopLevel) delete[] temporaryInputBuffer;
+	LineIndex* getBuildingLineIndex(void) { return isBuildingLineIndex ? &lineIndex : NULL; }
+	void addPartProfile(const DatasetProfile& partProfile) {
+		lock_guard<mutex> lock(profileMutex);
+		profile.add(partProfile);
+	}
+};
 
-	return stringsCount;
+// Буфер для чтения, свой у каждого потока подсчёта и переиспользуемый для всех частей и файлов, которые он считает
+static char* getCountingBuffer(size_t bufferSize) {
+	static thread_local unique_ptr<char, void(*)(char*)> buffer(NULL, freeIOBuffer);
+	static thread_local size_t currentBufferSize = 0;
+	if (currentBufferSize < bufferSize) {
+		buffer.reset(allocateIOBuffer(bufferSize));
+		currentBufferSize = bufferSize;
+	}
+	return buffer.get();
+}
+
+/* Дочитывает после конца части файла последнюю строку профиля части, начавшуюся в части. Если файл закончился раньше
+* переноса строки, это последняя строка файла */
+static void readProfiledLineEnd(File* file, DatasetProfiler& profiler, char* buffer, size_t bufferSize) {
+	while (profiler.needsLineEnd() and not file->isEndOfFile()) {
+		size_t bytesReaded = file->read(buffer, min(bufferSize, PROFILE_LINE_END_READ_SIZE));
+		if (bytesReaded == 0 or profiler.addLineEnd(buffer, bytesReaded)) break;
+	}
+	profiler.finish();
 }
 
+// Считает строки в части файла [partStart, partStart + partSize), открывая файл заново, чтобы потоки не мешали друг другу
+static void countLinesInFilePart(FileLinesCounting& counting, ull partStart, ull partSize, size_t bufferSize) {
+	File* file = fileOpen(counting.filePath, "rb");
+	char* buffer = getCountingBuffer(bufferSize);
+	/* Строку, разрезанную границей частей, профиль учитывает в той части, где она начинается, поэтому для профиля
+	* часть начинается на символ раньше: если он не перенос строки, часть начинается с середины строки */
+	bool isProfiling = counting.isProfiling and partStart > 0;
+	if (file == NULL or not file->seek(isProfiling ? partStart - 1 : partStart) or (isProfiling and file->read(buffer, 1) != 1)) {
+		counting.isFailed = true;
+		if (file != NULL) fileClose(file);
+		counting.finishPart();
+		return;
+	}
+	DatasetProfiler profiler;
+	if (isProfiling and buffer[0] != '\n') profiler.skipFirstLine();
 
+	char lastReadedChar = '\n';
+	counting.newlinesCount += countNewlinesInFilePart(file, partStart, partSize, buffer, bufferSize, &lastReadedChar, counting.getBuildingLineIndex(), counting.isProfiling ? &profiler : NULL);
+	if (partStart + partSize >= counting.fileSize) counting.lastChar = lastReadedChar;
+	if (counting.isProfiling) {
+		readProfiledLineEnd(file, profiler, buffer, bufferSize);
+		counting.addPartProfile(profiler.getProfile());
+	}
+	fileClose(file);
+	counting.finishPart();
+}
 
-long long getFileSize(FILE* filePtr) noexcept {
-	if (filePtr == NULL) return -1; // Если файл недоступен, сразу же возвращаем код ошибки
+/* Считает строки в файле: целиком в текущем потоке или, если файл большой и по нему можно перемещаться
+* (не сжатый и не стандартный ввод), добавляет в планировщик задачи подсчёта его частей */
+static void countLinesInFile(FileLinesCounting& counting, size_t bufferSize, size_t threadsCount, WorkStealingScheduler& scheduler) {
+	counting.isProfiling = datasetProfileParameters.isEnabled;
+	/* Если у файла есть актуальный индекс строк, количество строк берётся из него, без чтения файла.
+	* Для профиля строк файл всё равно читается целиком, но актуальный индекс заново не строится */
+	if (lineIndexParameters.isEnabled and LineIndex::isIndexable(counting.filePath)) {
+		bool isLineIndexLoaded = counting.lineIndex.load(counting.filePath);
+		if (isLineIndexLoaded and not counting.isProfiling) {
+			*counting.resultPtr = static_cast<long long>(counting.lineIndex.getLinesCount());
+			addProgress(counting.lineIndex.getFileSize(), counting.lineIndex.getLinesCount());
+			return;
+		}
+		if (not isLineIndexLoaded) counting.isBuildingLineIndex = counting.lineIndex.startBuilding(counting.filePath);
+	}
+
+	File* file = fileOpen(counting.filePath, "rb");
+	if (file == NULL) {
+		*counting.resultPtr = -1;
+		return;
+	}
+	long long fileSize = file->size();
 
-	ull currentPos = _ftelli64(filePtr); // Получаем текущую позицию в файле по указателю
-	_fseeki64(filePtr, 0L, SEEK_END); // Перемещаем указатель в самый конец файла
-	// Получаем позицию в конце файла (то есть, по сути, количество байт в нём)
-	ull fileSizeInBytes = _ftelli64(filePtr); 
-	// Возвращаем позицию указателя на начальную, которая была до наших манипуляций
-	_fseeki64(filePtr, currentPos, SEEK_SET);
+	/* Частей примерно вчетверо больше, чем потоков, чтобы потоки, закончившие раньше, забирали оставшиеся части,
+	* но часть не меньше нескольких блоков чтения и не больше COUNT_MAX_FILE_PART_SIZE, чтобы огромные файлы
+	* тоже делились на много частей. Границы частей кратны размеру блока (так читать можно и с O_DIRECT) */
+	ull partSize = fileSize > 0 ? static_cast<ull>(fileSize) / (threadsCount * 4) : 0;
+	partSize = max(partSize, static_cast<ull>(bufferSize) * COUNT_MIN_BLOCKS_IN_FILE_PART);
+	partSize = min(partSize, COUNT_MAX_FILE_PART_SIZE);
+	partSize = (partSize + bufferSize - 1) / bufferSize * bufferSize;
+
+	if (threadsCount == 1 or fileSize < 0 or static_cast<ull>(fileSize) <= partSize or not file->seek(0)) {
+		char lastReadedChar = '\n';
+		DatasetProfiler profiler;
+		counting.newlinesCount = countNewlinesInFilePart(file, 0, ULLONG_MAX, getCountingBuffer(bufferSize), bufferSize, &lastReadedChar, counting.getBuildingLineIndex(), counting.isProfiling ? &profiler : NULL);
+		counting.lastChar = lastReadedChar;
+		if (counting.isProfiling) {
+			profiler.finish();
+			counting.profile = profiler.getProfile();
+		}
+		fileClose(file);
+		counting.unfinishedPartsCount = 1;
+		counting.finishPart();
+		return;
+	}
+	fileClose(file);
 
-	return fileSizeInBytes;
+	counting.fileSize = static_cast<ull>(fileSize);
+	size_t partsCount = static_cast<size_t>((counting.fileSize + partSize - 1) / partSize);
+	counting.unfinishedPartsCount = partsCount;
+	for (size_t partNumber = 0; partNumber < partsCount; partNumber++) {
+		ull partStart = partNumber * partSize;
+		ull currentPartSize = min(partSize, counting.fileSize - partStart);
+		scheduler.submit(WorkStealingScheduler::TaskKind::Chunk, [&counting, partStart, currentPartSize, bufferSize]() {
+			countLinesInFilePart(counting, partStart, currentPartSize, bufferSize);
+		});
+	}
+}
+
+vector<pair<wstring, long long>> getStringCountInFiles(const sourcefiles_info& sourceFilesPaths) {
+	vector<wstring> sortedFilesPaths = getSourceFilesSortedBySize(sourceFilesPaths);
+	vector<pair<wstring, long long>> results;
+	for (const wstring& filePath : sortedFilesPaths) results.emplace_back(filePath, -1);
+
+	size_t threadsCount = getProcessingThreadsCount();
+	size_t bufferSize = getOptimalChunkSize(threadsCount);
+	// Счётчики файлов не перемещаются, пока их части считаются в других потоках
+	vector<unique_ptr<FileLinesCounting>> countings;
+	WorkStealingScheduler scheduler(threadsCount);
+	// Файлы начинаются с самых больших, чтобы в конце не остался один поток с огромным файлом
+	for (size_t i = 0; i < results.size(); i++) {
+		countings.push_back(make_unique<FileLinesCounting>());
+		FileLinesCounting& counting = *countings.back();
+		counting.filePath = results[i].first;
+		counting.resultPtr = &results[i].second;
+		scheduler.submit(WorkStealingScheduler::TaskKind::File, [&counting, bufferSize, threadsCount, &scheduler]() {
+			countLinesInFile(counting, bufferSize, threadsCount, scheduler);
+		});
+	}
+	scheduler.run();
+	return results;
+}
+
+long long getStringCountInFile(const wstring& filePath) {
+	return getStringCountInFiles({ filePath })[0].second;
+}
+
+
+
+long long getFileSize(File* filePtr) noexcept {
+	if (filePtr == NULL) return -1; // Если файл недоступен, сразу же возвращаем код ошибки
+	return filePtr->size();
 }
 
 long long getFileSize(wstring pathToFile) noexcept {
+	if (isStandardStreamPath(pathToFile)) return -1;
 	try {
-		return fs::file_size(pathToFile);
+		return fs::file_size(toFilesystemPath(pathToFile));
 	}
 	catch (const fs::filesystem_error&) {
 		return -1;
 	}
 }
 
-static LPMEMORYSTATUSEX getMemoryInfo(void) noexcept {
+// Информация об оперативной памяти компьютера в байтах
+struct MemoryInfo {
+	ull totalBytes = 0;
+	ull availableBytes = 0;
+};
+
+// Получает информацию об оперативной памяти. Если получить не удалось, оба значения нулевые
+static MemoryInfo getMemoryInfo(void) noexcept {
+	MemoryInfo memoryInfo;
+#ifdef _WIN32
 	MEMORYSTATUSEX ms;
 	ms.dwLength = sizeof(ms);
 	DWORD ret = GlobalMemoryStatusEx(&ms);
 	if (ret == 0) {
 		cout << "Cannot get info about computer memory. Program may working incorrectly." << endl;
-		return NULL;
+		return memoryInfo;
+	}
+	memoryInfo.totalBytes = ms.ullTotalPhys;
+	memoryInfo.availableBytes = ms.ullAvailPhys;
+#else
+	/* Доступная память берётся из MemAvailable, а не MemFree: при чтении больших файлов почти всю свободную память
+	* занимает страничный кеш, который ядро отдаст по первому требованию, и его тоже надо считать доступным */
+	ull memoryFreeInKilobytes = 0;
+	bool isAvailableMemoryFound = false;
+	ifstream memoryInfoFile("/proc/meminfo");
+	string fieldName;
+	ull fieldValueInKilobytes;
+	string fieldUnits;
+	while (memoryInfoFile >> fieldName >> fieldValueInKilobytes >> fieldUnits) {
+		if (fieldName == "MemTotal:") memoryInfo.totalBytes = fieldValueInKilobytes * 1024;
+		else if (fieldName == "MemFree:") memoryFreeInKilobytes = fieldValueInKilobytes;
+		else if (fieldName == "MemAvailable:") {
+			memoryInfo.availableBytes = fieldValueInKilobytes * 1024;
+			isAvailableMemoryFound = true;
+		}
 	}
-	return &ms;
+	// В старых ядрах (до 3.14) поля MemAvailable нет
+	if (not isAvailableMemoryFound) memoryInfo.availableBytes = memoryFreeInKilobytes * 1024;
+	if (memoryInfo.totalBytes == 0) cout << "Cannot get info about computer memory. Program may working incorrectly." << endl;
+#endif
+	return memoryInfo;
 }
 
 ull getAvailableMemoryInBytes(void) noexcept {
-	LPMEMORYSTATUSEX ms = getMemoryInfo();
-	if (ms == NULL) return 0;
-	return ms->ullAvailPhys;
+	return getMemoryInfo().availableBytes;
 }
 
 ull getTotalMemoryInBytes(void) noexcept {
-	LPMEMORYSTATUSEX ms = getMemoryInfo();
-	if (ms == NULL) return 0;
-	return ms->ullTotalPhys;
+	return getMemoryInfo().totalBytes;
 }
 
 size_t getMemoryUsagePercent(void) noexcept {
@@ -196,11 +431,16 @@ size_t getMemoryUsagePercent(void) noexcept {
 }
 
 bool isAnythingExistsByPath(wstring path) noexcept {
+#ifdef _WIN32
 	return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+	error_code _;
+	return fs::exists(fs::symlink_status(toFilesystemPath(path), _));
+#endif
 }
 
 bool isDirectory(wstring path) noexcept {
-	return fs::is_directory(path);
+	return fs::is_directory(toFilesystemPath(path));
 }
 
 bool isValidRegex(string regularExpression) noexcept {
@@ -214,70 +454,633 @@ bool isValidRegex(string regularExpression) noexcept {
 }
 
 wstring getWorkingDirectoryPath() noexcept {
-	return fs::current_path().wstring();
+	return fromFilesystemPath(fs::current_path());
 }
 
 wstring getDirectoryFromFilePath(wstring filePath) noexcept {
-	if (not fs::exists(filePath)) return L"";
-	return fs::absolute(filePath).parent_path().wstring();
+	if (not fs::exists(toFilesystemPath(filePath))) return L"";
+	return fromFilesystemPath(fs::absolute(toFilesystemPath(filePath)).parent_path());
+}
+
+ChunksProcessingParameters chunksProcessingParameters;
+
+size_t getProcessingThreadsCount(void) noexcept {
+	if (chunksProcessingParameters.threadsCount > 0) return chunksProcessingParameters.threadsCount;
+	// hardware_concurrency может вернуть ноль, если количество ядер определить не удалось
+	return max(thread::hardware_concurrency(), 1u);
+}
+
+size_t getOptimalChunkSize(size_t workersCount) noexcept {
+	// Профиль диска загружается один раз за запуск, при первом же обращении из любого потока
+	static IOProfile ioProfile;
+	static once_flag ioProfileLoaded;
+	call_once(ioProfileLoaded, []() {
+		bool isProfileSpecified = fileIOParameters.ioProfilePath != NULL;
+		wstring profilePath = isProfileSpecified ? toWstring(fileIOParameters.ioProfilePath) : getDefaultIOProfilePath();
+		// Профиля по умолчанию может и не быть, если калибровка не запускалась, предупреждаем только о заданном явно
+		if (not ioProfile.load(profilePath) and isProfileSpecified) {
+			wcout << "Warning: cannot load I/O profile [" << profilePath << "], default chunk size will be used" << endl;
+		}
+	});
+
+	workersCount = max(workersCount, (size_t)1);
+	size_t chunkSize = ioProfile.getBestBlockSize(workersCount);
+	if (chunkSize == 0) chunkSize = OPTIMAL_DISK_CHUNK_SIZE;
+
+	// У каждого потока свои входной и итоговый буферы размером в чанк, плюс буферы конвейера для чтения и записи
+	ull buffersCount = static_cast<ull>(workersCount + PIPELINE_BUFFERS_COUNT - 1) * 2;
+	ull memoryLimit = getAvailableMemoryInBytes() / 2;
+	while (chunkSize > MIN_DISK_CHUNK_SIZE and chunkSize * buffersCount > memoryLimit) chunkSize /= 2;
+	return max(chunkSize, (size_t)MIN_DISK_CHUNK_SIZE);
+}
+
+bool MappedFile::map(File* file) noexcept {
+#ifdef _WIN32
+	HANDLE fileHandle = file->getNativeHandle();
+	if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+	// Пустой файл отобразить в память невозможно, такие файлы обрабатываются обычным чтением
+	LARGE_INTEGER fileSize;
+	if (not GetFileSizeEx(fileHandle, &fileSize) or fileSize.QuadPart == 0) return false;
+
+	/* Отображаем в режиме копирования при записи (PAGE_WRITECOPY + FILE_MAP_COPY): для такого отображения достаточно
+	* прав на чтение файла, а страницы, которые изменит обработчик чанка, копируются и в файл не записываются */
+	mappingHandle = CreateFileMappingW(fileHandle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mappingHandle == NULL) return false;
+	data = (char*)MapViewOfFile(mappingHandle, FILE_MAP_COPY, 0, 0, 0);
+	if (data == NULL) {
+		CloseHandle(mappingHandle);
+		mappingHandle = NULL;
+		return false;
+	}
+	size = fileSize.QuadPart;
+	return true;
+#else
+	long long fileSize = file->size();
+	if (fileSize <= 0) return false;
+	/* MAP_PRIVATE - то же самое копирование при записи: изменённые обработчиком страницы в файл не попадают.
+	* Чанки нарезаются из отображения строго по порядку, поэтому ядру можно подсказать читать наперёд */
+	void* mappedData = mmap(NULL, static_cast<size_t>(fileSize), PROT_READ | PROT_WRITE, MAP_PRIVATE, file->getNativeHandle(), 0);
+	if (mappedData == MAP_FAILED) return false;
+	madvise(mappedData, static_cast<size_t>(fileSize), MADV_SEQUENTIAL);
+	data = (char*)mappedData;
+	size = fileSize;
+	return true;
+#endif
+}
+
+void MappedFile::unmap() noexcept {
+#ifdef _WIN32
+	if (data != NULL) UnmapViewOfFile(data);
+	if (mappingHandle != NULL) CloseHandle(mappingHandle);
+	mappingHandle = NULL;
+#else
+	if (data != NULL) munmap(data, static_cast<size_t>(size));
+#endif
+	data = NULL;
+	size = 0;
+}
+
+// Пара буферов одного чанка в конвейере: входные данные, считанные с диска, и результат их обработки
+struct ChunkBuffers {
+	char* input = NULL; // Начало входных данных чанка: в собственном буфере inputStorage либо прямо в отображении файла
+	size_t inputLength = 0;
+	/* Собственный буфер для входных данных. При чтении через отображение файла в память он нужен только
+	* для последней строки файла без переноса в конце, поскольку дописать перенос в отображение нельзя */
+	char* inputStorage = NULL;
+	char* result = NULL;
+	size_t resultLength = 0;
+	size_t sequenceNumber = 0; // Порядковый номер чанка во входном файле, по нему результаты записываются по порядку
+	// Время обработки и количество входных и итоговых строк чанка, подсчитываются только для статистики (--stats)
+	double processingSeconds = 0;
+	size_t inputLinesCount = 0;
+	size_t resultLinesCount = 0;
+};
+
+/* Размер входного и итогового буферов чанка для чанков размером chunkSize. Сверх чанка нужен ещё один выровненный
+* блок: кусок незаконченной строки, перенесённый из предыдущего чанка, выравнивается до границы DIRECT_IO_ALIGNMENT,
+* а после него всё равно читается столько, чтобы вместе с ним в чанке было не меньше chunkSize байт. Ещё два байта -
+* под перенос строки, дописываемый в конце файла */
+static size_t getChunkBufferSize(size_t chunkSize) noexcept {
+	return chunkSize + DIRECT_IO_ALIGNMENT + 2;
+}
+
+/* Обрабатывает чанк обработчиком команды. Если включена статистика, замеряет время обработки и считает строки
+* до и после неё (входные - до, поскольку обработчик может изменять входной буфер). Аппаратные счётчики этапа
+* обработки замеряются только на самом обработчике, без подсчёта строк для статистики */
+static void processChunk(ChunkBuffers* chunk, chunk_processor processChunkBuffer) {
+	if (not isStatisticsEnabled()) {
+		PerfPhaseScope perfScope(PerfPhase::Process);
+		chunk->resultLength = processChunkBuffer(chunk->input, chunk->inputLength, chunk->result);
+		return;
+	}
+	// Если включён прогресс, входные строки уже посчитаны при чтении
+	if (not progressParameters.isEnabled) chunk->inputLinesCount = getLinesCountInBuffer(chunk->input, chunk->inputLength);
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	{
+		PerfPhaseScope perfScope(PerfPhase::Process);
+		chunk->resultLength = processChunkBuffer(chunk->input, chunk->inputLength, chunk->result);
+	}
+	chunk->processingSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+	chunk->resultLinesCount = getLinesCountInBuffer(chunk->result, chunk->resultLength);
 }
 
-void processStringsInFileByChunks(FILE* inputFile, FILE* resultFile, size_t processChunkBuffer(char*, size_t, char*)) {
-	/* Устанавливаем оптимальное количество байтов для чтения за один раз - если файл маленький,
-	* то считываем весь файл за один раз, если больше размера крупного чанка для чтения,
-	* заданного константой, считываем оптимальными чанками */
+/* Добавляет к статистике файла записанный чанк. Чанки записываются по одному и по порядку, поэтому
+* статистика обработки всех потоков собирается в одном месте, без отдельной синхронизации */
+static void addWrittenChunkToStatistics(FileStatistics& statistics, const ChunkBuffers* chunk, double writeSeconds) noexcept {
+	statistics.bytesOut += chunk->resultLength;
+	statistics.linesIn += chunk->inputLinesCount;
+	statistics.linesOut += chunk->resultLinesCount;
+	statistics.processSeconds += chunk->processingSeconds;
+	statistics.writeSeconds += writeSeconds;
+}
+
+/* Считает входные строки считанного чанка, если включён прогресс. Считаются они в потоке чтения, до того как
+* обработчик изменит входной буфер, а к прогрессу чанк добавляется уже после записи (addWrittenChunkToProgress) */
+static void countReadedChunkLinesForProgress(ChunkBuffers* chunk) noexcept {
+	if (progressParameters.isEnabled) chunk->inputLinesCount = getLinesCountInBuffer(chunk->input, chunk->inputLength);
+}
+
+/* Добавляет записанный чанк к прогрессу команды. Учитываются именно записанные, а не считанные чанки:
+* чтение идёт на несколько чанков впереди обработки, и иначе прогресс дошёл бы до конца раньше времени */
+static void addWrittenChunkToProgress(const ChunkBuffers* chunk) noexcept {
+	if (progressParameters.isEnabled) addProgress(chunk->inputLength, chunk->inputLinesCount);
+}
+
+/* Последовательное чтение входного файла чанками, выровненными по границам строк. Файл либо читается в буферы
+* чанков, и незаконченная строка в конце чанка переносится в начало следующего, либо, если файл отображён
+* в память, чанки нарезаются прямо из отображения без копирования */
+struct ChunksReader {
+	File* inputFile = NULL;
+	const MappedFile* mappedFile = NULL; // Если указан, чанки нарезаются из отображения, а не читаются из inputFile
+	size_t chunkSize = 0; // Максимальный размер чанка в байтах
+	ChunkBuffers* previousChunk = NULL; // Предыдущий чанк, в конце которого может остаться незаконченная строка
+	size_t remainingStringPartLength = 0; // Длина незаконченной строки в конце предыдущего чанка
+	ull currentMappedPos = 0; // Позиция начала следующего чанка в отображении
+	size_t chunksCount = 0; // Количество уже выданных чанков, номер следующего чанка
+	bool isFinished = false;
+
+	/* Заполняет переданный чанк следующими строками файла и присваивает ему порядковый номер.
+	* Возвращает false, если файл закончился и заполнять чанк больше нечем */
+	bool readNextChunk(ChunkBuffers* chunk) {
+		if (isFinished) return false;
+		PerfPhaseScope perfScope(PerfPhase::Read);
+		bool isChunkReaded = mappedFile != NULL ? sliceNextMappedChunk(chunk) : readNextChunkFromFile(chunk);
+		if (not isChunkReaded) {
+			isFinished = true;
+			return false;
+		}
+		chunk->sequenceNumber = chunksCount++;
+		return true;
+	}
+
+private:
+	bool readNextChunkFromFile(ChunkBuffers* chunk) {
+		while (true) {
+			/* Кусок неполной строки из предыдущего чанка кладётся в буфер так, чтобы он заканчивался на границе
+			* DIRECT_IO_ALIGNMENT. Тогда новые данные читаются в выровненный адрес выровненной длиной, и файл всегда
+			* читается с выровненного смещения, поэтому при --direct-io данные идут с диска прямо в буфер чанка */
+			size_t alignedRemainingPartLength = (remainingStringPartLength + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+			/* Начало куска запоминается до изменения chunk->input: предыдущий чанк могли уже записать и вернуть
+			* на чтение, и тогда это тот же самый буфер (memmove корректно копирует перекрывающиеся области) */
+			const char* remainingStringPart = remainingStringPartLength ? &previousChunk->input[previousChunk->inputLength] : NULL;
+			chunk->input = &chunk->inputStorage[alignedRemainingPartLength - remainingStringPartLength];
+			/* Переносим оставшийся кусок неполной строки из конца предыдущего чанка в начало текущего.
+			* Обработчик предыдущего чанка этот кусок не трогает, поскольку он не входит в длину его входного буфера */
+			if (remainingStringPartLength) memmove(chunk->input, remainingStringPart, remainingStringPartLength);
+			// Если файл дочитан до конца и переносить нечего, больше читать нечего
+			else if (inputFile->isEndOfFile()) return false;
+
+			/* Считываем нужное количество байт из входного файла в буфер после перенесённого куска, количество реально
+			* считаных байт нужно на случай, если файл закончился, и реально считалось меньше байт, чем предполагалось.
+			* Длина чтения округляется вверх до DIRECT_IO_ALIGNMENT, чтобы выравнивание куска не отнимало место у чанка:
+			* вместе с куском считывается не меньше chunkSize байт (излишек помещается в запас буфера, см. getChunkBufferSize),
+			* поэтому, как и без выравнивания, целиком обрабатываются все строки не длиннее чанка */
+			size_t bytesToRead = chunkSize - remainingStringPartLength / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+			size_t bytesReaded = inputFile->read(&chunk->input[remainingStringPartLength], bytesToRead);
+			size_t inputBufferLength = remainingStringPartLength + bytesReaded;
+			// Если ничего не считалось и переносить нечего, значит, файл закончился (или невалидный) и прекращаем сразу же
+			if (inputBufferLength == 0) return false;
+			/* Если это последняя строка во входном файле и после неё нет переноса строки, устанавливаем его после
+			* конца строки, чтобы в дальнейшем функция-обработчик считала это за цельную строку.
+			* Кроме того, увеличиваем длину входного буфера на единицу, чтобы последний перенос был считан */
+			if (bytesReaded < bytesToRead) {
+				if (chunk->input[inputBufferLength - 1] != '\n') chunk->input[inputBufferLength++] = '\n';
+				remainingStringPartLength = 0;
+			}
+			/* Если в этом считанном входном буфере осталась незаконченная строка, обрезанная при считывании побайтово,
+			* уменьшаем размер входного буфера, чтобы туда не попал неполный кусок строки, а сам кусок переносим
+			* в начало следующего чанка, чтобы обработать строку полностью */
+			else {
+				size_t fullChunkLength = inputBufferLength;
+				// Проверяем, что inputBufferLength > 0, так как может быть, что в буфере нет переносов строк
+				while (inputBufferLength > 0 and chunk->input[inputBufferLength - 1] != '\n') inputBufferLength--;
+				/* Если переносов строк в буфере не было вообще, пропускаем считанное
+				* так как нет смысла обрабатывать буфер, в котором нет строк (так как нет переносов строк) */
+				if (inputBufferLength == 0) {
+					remainingStringPartLength = 0;
+					continue;
+				}
+				remainingStringPartLength = fullChunkLength - inputBufferLength;
+			}
+			chunk->inputLength = inputBufferLength;
+			previousChunk = chunk;
+			return true;
+		}
+	}
+
+	bool sliceNextMappedChunk(ChunkBuffers* chunk) {
+		while (currentMappedPos < mappedFile->size) {
+			char* chunkStart = &mappedFile->data[currentMappedPos];
+			size_t chunkLength = static_cast<size_t>(min(static_cast<ull>(chunkSize), mappedFile->size - currentMappedPos));
+			bool isLastChunk = currentMappedPos + chunkLength == mappedFile->size;
+
+			// Отрезаем незаконченную строку в конце чанка, она станет началом следующего
+			size_t linesLength = chunkLength;
+			while (linesLength > 0 and chunkStart[linesLength - 1] != '\n') linesLength--;
+
+			if (linesLength > 0) {
+				chunk->input = chunkStart;
+				chunk->inputLength = linesLength;
+				currentMappedPos += linesLength;
+				return true;
+			}
+			/* Так же, как и при обычном чтении, чанк без единого переноса строки пропускаем, за исключением
+			* последней строки файла: её копируем в собственный буфер чанка и дописываем перенос строки */
+			if (not isLastChunk) {
+				currentMappedPos += chunkLength;
+				continue;
+			}
+			if (chunk->inputStorage == NULL) chunk->inputStorage = allocateIOBuffer(chunkLength + 1);
+			memcpy(chunk->inputStorage, chunkStart, chunkLength);
+			chunk->inputStorage[chunkLength] = '\n';
+			chunk->input = chunk->inputStorage;
+			chunk->inputLength = chunkLength + 1;
+			currentMappedPos += chunkLength;
+			return true;
+		}
+		return false;
+	}
+};
+
+/* Вычисляет оптимальный размер чанка для файла: если файл маленький, то он считывается за один раз,
+* если больше размера чанка, подобранного для workersCount одновременно работающих потоков, - чанками этого размера.
+* Размер всегда кратен DIRECT_IO_ALIGNMENT, чтобы чтения чанков оставались выровненными */
+static size_t getChunkSizeForFile(File* inputFile, size_t workersCount) noexcept {
 	long long fileSize = getFileSize(inputFile);
-	size_t countBytesToReadInOneIteration = min(OPTIMAL_DISK_CHUNK_SIZE, fileSize + 1);
-
-	/* Буфер, в который будет считываться информация с диска(со входящего файла) и в котором будут считаться строки.
-	* Аллоцируется в куче, потому что в стеке может быть ограничение на размер памяти */
-	char* inputBuffer = new char[countBytesToReadInOneIteration + 2];
-	char* resultBuffer = new char[countBytesToReadInOneIteration + 2];
-	if (inputBuffer == NULL or resultBuffer == NULL) {
-		cout << "Error: annot allocate buffer of " << countBytesToReadInOneIteration * 2 << "bytes" << endl;
-		exit(1);
+	// Размер стандартного ввода заранее неизвестен, его всегда читаем полными чанками
+	if (fileSize < 0) return getOptimalChunkSize(workersCount);
+	ull smallFileChunkSize = (static_cast<ull>(fileSize) + DIRECT_IO_ALIGNMENT) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+	return min(static_cast<ull>(getOptimalChunkSize(workersCount)), smallFileChunkSize);
+}
+
+/* Отображение файла в память читает его через системный кеш, поэтому при --direct-io не используется.
+* Возвращает true, если файл удалось отобразить */
+static bool mapInputFileIfNeeded(MappedFile& mappedFile, File* inputFile) noexcept {
+	if (not chunksProcessingParameters.useMemoryMapping or fileIOParameters.useDirectIO) return false;
+	return mappedFile.map(inputFile);
+}
+
+/* При --direct-io заранее выделяет в итоговом файле место под результат обработки входного. Ни одна команда
+* не записывает больше, чем прочитала, поэтому хватает размера входного файла, а лишнее освобождается при закрытии */
+static void preallocateResultFile(File* resultFile, File* inputFile) noexcept {
+	if (not fileIOParameters.useDirectIO or resultFile == NULL) return;
+	long long inputFileSize = getFileSize(inputFile);
+	if (inputFileSize > 0) resultFile->preallocate(static_cast<ull>(inputFileSize));
+}
+
+FileStatistics processStringsInFileByChunks(File* inputFile, File* resultFile, size_t processChunkBuffer(char*, size_t, char*), size_t processingThreadsCount) {
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	FileStatistics statistics;
+	statistics.threadsCount = processingThreadsCount;
+
+	/* Устанавливаем оптимальное количество байтов для чтения за один раз. С диском и памятью одновременно работают
+	* либо потоки обработки этого файла, либо потоки, обрабатывающие другие файлы параллельно с этим (как в dedup) */
+	size_t countBytesToReadInOneIteration = getChunkSizeForFile(inputFile, max(processingThreadsCount, getProcessingThreadsCount()));
+
+	/* Если пользователь выбрал чтение через отображение в память, пытаемся отобразить файл.
+	* Если не получилось (например, файл пустой), обрабатываем его обычным чтением */
+	MappedFile mappedFile;
+	bool isFileMapped = mapInputFileIfNeeded(mappedFile, inputFile);
+	preallocateResultFile(resultFile, inputFile);
+
+	/* Буферы, в которые будет считываться информация с диска(со входящего файла) и в которые будут записываться
+	* обработанные строки. Аллоцируются в куче, потому что в стеке может быть ограничение на размер памяти.
+	* При чтении через отображение файла входные буферы не нужны.
+	* Каждому потоку обработки нужен свой чанк, плюс ещё буферы для одновременного чтения и записи.
+	* Если потоков обработки больше одного, размер каждого буфера не меняется, поэтому памяти тратится больше */
+	size_t chunksCount = processingThreadsCount + PIPELINE_BUFFERS_COUNT - 1;
+	vector<ChunkBuffers> chunks(chunksCount);
+	for (ChunkBuffers& chunk : chunks) {
+		if (not isFileMapped) chunk.inputStorage = allocateIOBuffer(getChunkBufferSize(countBytesToReadInOneIteration));
+		chunk.result = allocateIOBuffer(getChunkBufferSize(countBytesToReadInOneIteration));
+		if ((not isFileMapped and chunk.inputStorage == NULL) or chunk.result == NULL) {
+			cout << "Error: annot allocate buffer of " << countBytesToReadInOneIteration * 2 << "bytes" << endl;
+			exit(1);
+		}
+	}
+
+	/* Очереди конвейера: свободные буферы ждут чтения, считанные - обработки, обработанные - записи.
+	* После записи буфер снова становится свободным и переиспользуется для чтения следующего чанка */
+	BoundedQueue<ChunkBuffers*> freeChunks(chunksCount), readedChunks(chunksCount), processedChunks(chunksCount);
+	for (ChunkBuffers& chunk : chunks) freeChunks.push(&chunk);
+
+	thread readerThread([&]() {
+		ChunksReader reader;
+		reader.inputFile = inputFile;
+		reader.mappedFile = isFileMapped ? &mappedFile : NULL;
+		reader.chunkSize = countBytesToReadInOneIteration;
+
+		ChunkBuffers* chunk;
+		while (freeChunks.pop(chunk)) {
+			chrono::steady_clock::time_point readBegin = chrono::steady_clock::now();
+			bool isChunkReaded = reader.readNextChunk(chunk);
+			statistics.readSeconds += chrono::duration<double>(chrono::steady_clock::now() - readBegin).count();
+			if (not isChunkReaded) break;
+			statistics.bytesIn += chunk->inputLength;
+			statistics.chunksCount++;
+			countReadedChunkLinesForProgress(chunk);
+			readedChunks.push(chunk);
+		}
+		readedChunks.close();
+	});
+
+	thread writerThread([&]() {
+		/* При обработке в нескольких потоках чанки могут быть обработаны не по порядку, поэтому обработанные раньше
+		* времени чанки ждут своей очереди здесь, пока не будут записаны все предыдущие */
+		map<size_t, ChunkBuffers*> waitingChunks;
+		size_t nextChunkToWriteNumber = 0;
+		ChunkBuffers* chunk;
+		while (processedChunks.pop(chunk)) {
+			waitingChunks[chunk->sequenceNumber] = chunk;
+			while (not waitingChunks.empty() and waitingChunks.begin()->first == nextChunkToWriteNumber) {
+				chunk = waitingChunks.begin()->second;
+				waitingChunks.erase(waitingChunks.begin());
+				nextChunkToWriteNumber++;
+				// Записываем данные из итогового буфера с обработанными строками в файл вывода
+				chrono::steady_clock::time_point writeBegin = chrono::steady_clock::now();
+				{
+					PerfPhaseScope perfScope(PerfPhase::Write);
+					if (resultFile != NULL) resultFile->write(chunk->result, chunk->resultLength);
+				}
+				addWrittenChunkToStatistics(statistics, chunk, chrono::duration<double>(chrono::steady_clock::now() - writeBegin).count());
+				addWrittenChunkToProgress(chunk);
+				freeChunks.push(chunk);
+			}
+		}
+	});
+
+	/* Обрабатываем считанные буферы: например, генерируем хеши для строк, проверяем на уникальность и записываем
+	* уникальные строки последовательно в итоговый буфер. Текущий поток тоже участвует в обработке */
+	auto processReadedChunks = [&]() {
+		ChunkBuffers* chunk;
+		while (readedChunks.pop(chunk)) {
+			processChunk(chunk, processChunkBuffer);
+			processedChunks.push(chunk);
+		}
+	};
+	vector<thread> processingThreads;
+	for (size_t i = 1; i < processingThreadsCount; i++) processingThreads.emplace_back(processReadedChunks);
+	processReadedChunks();
+	for (thread& processingThread : processingThreads) processingThread.join();
+	processedChunks.close();
+
+	writerThread.join();
+	// Поток чтения мог ждать свободный буфер, закрываем очередь, чтобы он точно завершился
+	freeChunks.close();
+	readerThread.join();
+
+	// Освобождение памяти буферов и закрытие отображения файла
+	for (ChunkBuffers& chunk : chunks) {
+		freeIOBuffer(chunk.inputStorage);
+		freeIOBuffer(chunk.result);
+	}
+	if (isFileMapped) mappedFile.unmap();
+
+	statistics.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+	return statistics;
+}
+
+/* Общий бюджет памяти на буферы чанков всех файлов, одновременно обрабатываемых планировщиком,
+* чтобы при обработке множества файлов сразу расход памяти не рос вместе с количеством файлов */
+class ChunkBuffersMemoryBudget {
+private:
+	mutex budgetMutex;
+	ull availableBytes;
+public:
+	explicit ChunkBuffersMemoryBudget(ull bytes) : availableBytes(bytes) {}
+	// Резервирует память под буферы, если её хватает в бюджете
+	bool tryReserve(ull bytes) {
+		lock_guard<mutex> lock(budgetMutex);
+		if (bytes > availableBytes) return false;
+		availableBytes -= bytes;
+		return true;
+	}
+	void release(ull bytes) {
+		lock_guard<mutex> lock(budgetMutex);
+		availableBytes += bytes;
+	}
+};
+
+/* Состояние обработки одного файла планировщиком: файл читает одна задача, а его чанки обрабатываются
+* задачами в разных потоках. Результаты записываются в итоговый файл строго в порядке чанков */
+struct ConcurrentFileProcessing {
+	File* inputFile = NULL;
+	File* resultFile = NULL;
+	MappedFile mappedFile;
+	bool isFileMapped = false;
+	ChunksReader reader;
+	size_t chunkSizeInBytes = 0;
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+	/* Статистика файла: чтение учитывает задача, читающая файл, а обработку и запись - тот поток,
+	* который записывает чанк, под stateMutex */
+	FileStatistics statistics;
+
+	// Всё, что ниже, изменяется разными потоками и защищено stateMutex
+	mutex stateMutex;
+	vector<unique_ptr<ChunkBuffers>> allocatedChunks; // Все буферы, выделенные для этого файла
+	ull allocatedBytes = 0; // Сколько памяти из общего бюджета занимают буферы файла
+	vector<ChunkBuffers*> freeChunks; // Буферы, которые уже записаны и могут быть переиспользованы
+	map<size_t, ChunkBuffers*> waitingChunks; // Обработанные чанки, ждущие записи предыдущих
+	size_t nextChunkToWriteNumber = 0;
+	size_t submittedChunksCount = 0;
+	bool isReadingFinished = false;
+	bool isFinalized = false;
+};
+
+/* Закрывает входной и итоговый файлы, освобождает буферы и возвращает их память в общий бюджет.
+* Вызывается ровно один раз, когда файл полностью прочитан и все его чанки записаны */
+static void finalizeConcurrentFileProcessing(ConcurrentFileProcessing& file, ChunkBuffersMemoryBudget& memoryBudget) {
+	fileClose(file.resultFile);
+	file.statistics.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - file.begin).count();
+	addFileStatistics(file.statistics);
+	if (file.isFileMapped) file.mappedFile.unmap();
+	fileClose(file.inputFile);
+	for (unique_ptr<ChunkBuffers>& chunk : file.allocatedChunks) {
+		freeIOBuffer(chunk->inputStorage);
+		freeIOBuffer(chunk->result);
 	}
+	file.allocatedChunks.clear();
+	memoryBudget.release(file.allocatedBytes);
+}
 
-	while (!feof(inputFile)) {
-		/* Считываем нужное количество байт из входного файла в буфер, количество реально считаных байт записывается
-		*  в переменную, нужную на случай, если файл закончился, и реально считалось меньше байт, чем предполагалось */
-		size_t bytesReaded = fread(inputBuffer, sizeof(char), countBytesToReadInOneIteration, inputFile);
-		// Если ничего не считалось, значит, файл невалидный и прекращаем сразу же
-		if (bytesReaded == 0) return;
-		size_t inputBufferLength = bytesReaded;
-		/* Если это последняя строка во входном файле и после неё нет переноса строки, устанавливаем его после
-		* конца строки, чтобы в дальнейшем функция-обработчик считала это за цельную строку.
-		* Кроме того, увеличиваем длину входного буфера на единицу, чтобы последний перенос был считан */
-		if (feof(inputFile) and inputBuffer[inputBufferLength - 1] != '\n') inputBuffer[inputBufferLength++] = '\n';
-		/* Если в этом считанном входном буфере осталась незаконченная строка, 
-		 * обрезанная при считывании побайтово делаем отступ в файле назад на длину 
-		 * оставшегося в буфере неполного куска строки, чтобы при следующем fread обработать её полностью. 
-		 * Также уменьшаем размер входного буфера для чтения, чтобы туда не попал неполный кусок строки */
-		else {
-			// Проверяем, что inputBufferLength > 0, так как может быть, что в буфере нет переносов строк
-			while (inputBufferLength > 0 and inputBuffer[inputBufferLength - 1] != '\n') inputBufferLength--;
-			/* Если переносов строк в буфере не было вообще, пропускаем считанное
-			* так как нет смысла обрабатывать буфер, в котором нет строк (так как нет переносов строк) */
-			if (inputBufferLength == 0) continue;
-			size_t remainingStringPartLength = bytesReaded - inputBufferLength;
-			if(remainingStringPartLength) fseek(inputFile, -static_cast<long>(remainingStringPartLength), SEEK_CUR);
+/* Возвращает свободный буфер чанка для файла: либо уже записанный буфер этого же файла, либо новый, если на него
+* хватает общего бюджета памяти. Пока буфера нет, поток не простаивает, а обрабатывает чанки других задач */
+static ChunkBuffers* acquireChunkForFile(ConcurrentFileProcessing& file, ChunkBuffersMemoryBudget& memoryBudget, WorkStealingScheduler& scheduler) {
+	/* При чтении через отображение входной буфер нужен только для последней строки, он выделяется
+	* отдельно при необходимости, поэтому в бюджете учитывается только итоговый буфер */
+	ull chunkBytes = static_cast<ull>(getChunkBufferSize(file.chunkSizeInBytes)) * (file.isFileMapped ? 1 : 2);
+	while (true) {
+		{
+			lock_guard<mutex> lock(file.stateMutex);
+			if (not file.freeChunks.empty()) {
+				ChunkBuffers* chunk = file.freeChunks.back();
+				file.freeChunks.pop_back();
+				return chunk;
+			}
+		}
+		if (memoryBudget.tryReserve(chunkBytes)) {
+			unique_ptr<ChunkBuffers> chunk = make_unique<ChunkBuffers>();
+			if (not file.isFileMapped) chunk->inputStorage = allocateIOBuffer(getChunkBufferSize(file.chunkSizeInBytes));
+			chunk->result = allocateIOBuffer(getChunkBufferSize(file.chunkSizeInBytes));
+			lock_guard<mutex> lock(file.stateMutex);
+			file.allocatedBytes += chunkBytes;
+			file.allocatedChunks.push_back(move(chunk));
+			return file.allocatedChunks.back().get();
 		}
-		/* Читаем буфер посимвольно, генерируем хеши для строк, проверяем на уникальность, записываем уникальные строки
-		* последовательно в итоговый буфер и получаем размер отступа назад для чтения в следующий раз (если буфер был
-		* обрезан на середине какой-то строки, отступ ненулевой, чтобы прочесть строку полностью)*/
-		size_t resultBufferLength = processChunkBuffer(inputBuffer, inputBufferLength, resultBuffer);
-		// Записываем данные из итогового буфера с уникальными строками в файл вывода
-		fwrite(resultBuffer, sizeof(char), resultBufferLength, resultFile);
+		if (not scheduler.runOneChunkTask()) this_thread::yield();
+	}
+}
+
+/* Записывает обработанный чанк, если все предыдущие уже записаны, а если нет - оставляет его ждать своей очереди.
+* Вместе с ним записываются и все ждавшие его чанки. Если это был последний чанк файла, завершает обработку файла */
+static void completeFileChunk(ConcurrentFileProcessing& file, ChunkBuffers* chunk, ChunkBuffersMemoryBudget& memoryBudget) {
+	bool needFinalize = false;
+	{
+		lock_guard<mutex> lock(file.stateMutex);
+		file.waitingChunks[chunk->sequenceNumber] = chunk;
+		while (not file.waitingChunks.empty() and file.waitingChunks.begin()->first == file.nextChunkToWriteNumber) {
+			ChunkBuffers* chunkToWrite = file.waitingChunks.begin()->second;
+			file.waitingChunks.erase(file.waitingChunks.begin());
+			file.nextChunkToWriteNumber++;
+			chrono::steady_clock::time_point writeBegin = chrono::steady_clock::now();
+			{
+				PerfPhaseScope perfScope(PerfPhase::Write);
+				file.resultFile->write(chunkToWrite->result, chunkToWrite->resultLength);
+			}
+			addWrittenChunkToStatistics(file.statistics, chunkToWrite, chrono::duration<double>(chrono::steady_clock::now() - writeBegin).count());
+			addWrittenChunkToProgress(chunkToWrite);
+			file.freeChunks.push_back(chunkToWrite);
+		}
+		needFinalize = file.isReadingFinished and file.nextChunkToWriteNumber == file.submittedChunksCount and not file.isFinalized;
+		if (needFinalize) file.isFinalized = true;
+	}
+	if (needFinalize) finalizeConcurrentFileProcessing(file, memoryBudget);
+}
+
+/* Задача обработки одного файла в планировщике: открывает входной и итоговый файлы, последовательно читает чанки
+* и на каждый чанк ставит отдельную задачу обработки, которую может перехватить любой свободный поток */
+static void processFileChunksInScheduler(const wstring& sourceFilePath, const wstring& destinationDirectoryPath, const wstring& resultFilesSuffix, size_t processChunkBuffer(char*, size_t, char*), ChunkBuffersMemoryBudget& memoryBudget, WorkStealingScheduler& scheduler) {
+	shared_ptr<ConcurrentFileProcessing> file = make_shared<ConcurrentFileProcessing>();
+
+	file->inputFile = fileOpen(sourceFilePath, "rb");
+	if (file->inputFile == NULL) {
+		wcout << "File is skipped. Cannot open [" << sourceFilePath << "] because of invalid path or due to security policy reasons." << endl;
+		return;
+	}
+	file->resultFile = getResultFilePtr(destinationDirectoryPath, sourceFilePath, resultFilesSuffix);
+	if (file->resultFile == NULL) {
+		wcout << "Error: cannot open result file [" << joinPaths(destinationDirectoryPath, sourceFilePath) << "] in write mode" << endl;
+		fileClose(file->inputFile);
+		return;
+	}
+
+	file->chunkSizeInBytes = getChunkSizeForFile(file->inputFile, getProcessingThreadsCount());
+	file->isFileMapped = mapInputFileIfNeeded(file->mappedFile, file->inputFile);
+	preallocateResultFile(file->resultFile, file->inputFile);
+	file->reader.inputFile = file->inputFile;
+	file->reader.mappedFile = file->isFileMapped ? &file->mappedFile : NULL;
+	file->reader.chunkSize = file->chunkSizeInBytes;
+	file->statistics.path = sourceFilePath;
+	file->statistics.threadsCount = getProcessingThreadsCount();
+
+	while (true) {
+		ChunkBuffers* chunk = acquireChunkForFile(*file, memoryBudget, scheduler);
+		chrono::steady_clock::time_point readBegin = chrono::steady_clock::now();
+		bool isChunkReaded = file->reader.readNextChunk(chunk);
+		double readSeconds = chrono::duration<double>(chrono::steady_clock::now() - readBegin).count();
+		{
+			lock_guard<mutex> lock(file->stateMutex);
+			file->statistics.readSeconds += readSeconds;
+			if (not isChunkReaded) {
+				file->freeChunks.push_back(chunk);
+				break;
+			}
+			file->statistics.bytesIn += chunk->inputLength;
+			file->statistics.chunksCount++;
+			file->submittedChunksCount++;
+		}
+		countReadedChunkLinesForProgress(chunk);
+		scheduler.submit(WorkStealingScheduler::TaskKind::Chunk, [file, chunk, processChunkBuffer, &memoryBudget]() {
+			processChunk(chunk, processChunkBuffer);
+			completeFileChunk(*file, chunk, memoryBudget);
+		});
+	}
+
+	// Если все чанки уже записаны к моменту окончания чтения, обработку файла надо завершить здесь
+	bool needFinalize = false;
+	{
+		lock_guard<mutex> lock(file->stateMutex);
+		file->isReadingFinished = true;
+		needFinalize = file->nextChunkToWriteNumber == file->submittedChunksCount and not file->isFinalized;
+		if (needFinalize) file->isFinalized = true;
 	}
-	// Освобождение памяти буферов и закрытие файлов
-	delete[] inputBuffer;
-	delete[] resultBuffer;
+	if (needFinalize) finalizeConcurrentFileProcessing(*file, memoryBudget);
+}
+
+vector<wstring> getSourceFilesSortedBySize(const sourcefiles_info& sourceFilesPaths) {
+	vector<pair<long long, wstring>> filesWithSizes;
+	for (const wstring& sourceFilePath : sourceFilesPaths) filesWithSizes.emplace_back(getFileSize(sourceFilePath), sourceFilePath);
+	sort(filesWithSizes.begin(), filesWithSizes.end(), [](const auto& first, const auto& second) { return first.first > second.first; });
+
+	vector<wstring> sortedFilesPaths;
+	for (auto& fileWithSize : filesWithSizes) sortedFilesPaths.push_back(move(fileWithSize.second));
+	return sortedFilesPaths;
 }
 
-void processAllSourceFiles(sourcefiles_info sourceFilesPaths, bool needMerge, FILE* resultFile, wstring destinationDirectoryPath, wstring resultFilesSuffix, size_t processChunkBuffer(char* inputBuffer, size_t inputBufferLength, char* resultBuffer)) {
-	for (wstring& sourceFilePath : sourceFilesPaths) {
+ull getSourceFilesTotalSize(const sourcefiles_info& sourceFilesPaths) noexcept {
+	ull totalSize = 0;
+	for (const wstring& sourceFilePath : sourceFilesPaths) {
+		long long fileSize = getFileSize(sourceFilePath);
+		if (fileSize < 0 or getCompressionFormatByExtension(sourceFilePath) != CompressionFormat::None) return 0;
+		totalSize += fileSize;
+	}
+	return totalSize;
+}
+
+void processAllSourceFiles(sourcefiles_info sourceFilesPaths, bool needMerge, File* resultFile, wstring destinationDirectoryPath, wstring resultFilesSuffix, size_t processChunkBuffer(char* inputBuffer, size_t inputBufferLength, char* resultBuffer)) {
+	size_t processingThreadsCount = getProcessingThreadsCount();
+
+	/* Если итоговые строки не складываются в один файл, то файлы друг от друга не зависят и их можно обрабатывать
+	* одновременно: каждый поток берёт свой файл (начиная с самых больших), а освободившиеся потоки помогают
+	* обрабатывать чанки файлов, которые ещё не закончены. Память на буферы всех файлов общая и ограничена так же,
+	* как при обработке одного файла в это же количество потоков */
+	if (not needMerge and processingThreadsCount > 1 and sourceFilesPaths.size() > 1) {
+		ChunkBuffersMemoryBudget memoryBudget(static_cast<ull>(processingThreadsCount + PIPELINE_BUFFERS_COUNT - 1) * getChunkBufferSize(getOptimalChunkSize(processingThreadsCount)) * 2);
+		WorkStealingScheduler scheduler(processingThreadsCount);
+		for (const wstring& sourceFilePath : getSourceFilesSortedBySize(sourceFilesPaths)) {
+			scheduler.submit(WorkStealingScheduler::TaskKind::File, [&, sourceFilePath]() {
+				processFileChunksInScheduler(sourceFilePath, destinationDirectoryPath, resultFilesSuffix, processChunkBuffer, memoryBudget, scheduler);
+			});
+		}
+		scheduler.run();
+		return;
+	}
+
+	for (const wstring& sourceFilePath : sourceFilesPaths) {
 
-		FILE* inputBaseFilePointer = fileOpen(sourceFilePath, "rb");
+		File* inputBaseFilePointer = fileOpen(sourceFilePath, "rb");
 		if (inputBaseFilePointer == NULL) {
 			wcout << "File is skipped. Cannot open [" << sourceFilePath << "] because of invalid path or due to security policy reasons." << endl;
 			continue;
@@ -294,19 +1097,32 @@ void processAllSourceFiles(sourcefiles_info sourceFilesPaths, bool needMerge, FI
 		}
 
 		// Обрабатываем весь файл почанково и записываем все нормализованные строки в итоговый файл
-		processStringsInFileByChunks(inputBaseFilePointer, resultFile, processChunkBuffer);
+		FileStatistics statistics = processStringsInFileByChunks(inputBaseFilePointer, resultFile, processChunkBuffer, processingThreadsCount);
+		statistics.path = sourceFilePath;
+		// Если среди обработчиков есть этап dedup (в pipe), его хеши хранятся в текущем потоке
+		fillDeduplicationStatistics(&statistics);
+		addFileStatistics(statistics);
 		// Закрываем входной файл
-		fclose(inputBaseFilePointer);
+		fileClose(inputBaseFilePointer);
+		// Итоговый файл этого входного больше не нужен, закрываем сразу, чтобы не держать открытыми тысячи файлов
+		if (!needMerge) fileClose(resultFile);
 
 	}
-	_fcloseall(); // Закрываем все итоговые файлы
+	if (needMerge) fileClose(resultFile); // Закрываем общий итоговый файл
 }
 
-void processDestinationPath(const char** destinationPathPtr, bool needMerge, FILE** resultFile, const char* defaultResultMergedFilePath) noexcept {
+void processDestinationPath(const char** destinationPathPtr, int* needMergePtr, File** resultFile, const char* defaultResultMergedFilePath) noexcept {
+	// В стандартный вывод можно записать только один поток строк, поэтому результаты всех файлов объединяются
+	bool isStandardOutput = *destinationPathPtr and isStandardStreamPath(toWstring(*destinationPathPtr));
+	if (isStandardOutput) *needMergePtr = 1;
+
 	// Проверяем, всё ли нормально с итоговой директорией (или итоговым файлом)
-	if (needMerge) {
-		if (not *destinationPathPtr) *destinationPathPtr = defaultResultMergedFilePath;
-		if (isAnythingExistsByPath(toWstring(*destinationPathPtr))) {
+	if (*needMergePtr) {
+		// Если итоговые файлы сжимаются, к имени итогового файла по умолчанию добавляется расширение сжатия
+		static string defaultResultMergedFilePathWithExtension;
+		defaultResultMergedFilePathWithExtension = defaultResultMergedFilePath + fromWstring(getCompressionExtension(compressionParameters.outputFormat));
+		if (not *destinationPathPtr) *destinationPathPtr = defaultResultMergedFilePathWithExtension.c_str();
+		if (not isStandardOutput and isAnythingExistsByPath(toWstring(*destinationPathPtr))) {
 			cout << "Error: cannot create result file, something exist on path [" << *destinationPathPtr << ']' << endl;
 			exit(1);
 		}
@@ -327,6 +1143,14 @@ void processDestinationPath(const char** destinationPathPtr, bool needMerge, FIL
 	}
 }
 
+void processOutputCompressionOption(const char* compressionString) noexcept {
+	if (compressionString == NULL) return;
+	if (not setOutputCompression(compressionString)) {
+		cout << "Error: invalid '--compress' parameter value - [" << compressionString << "]. Valid formats: 'zstd' (levels 1-22), 'gzip' (levels 1-9), 'lz4' (levels 1-12), level is optional, e.g. 'zstd:3'" << endl;
+		exit(ERROR_INVALID_PARAMETER);
+	}
+}
+
 void checkDestinationDirectory(wstring destinationDirectoryPath) noexcept {
 	// Если на указанном пользователем пути к итоговой директории что-то есть, и это что-то - не папка, выходим
 	if (isAnythingExistsByPath(destinationDirectoryPath) and not isDirectory(destinationDirectoryPath)) {
@@ -336,13 +1160,13 @@ void checkDestinationDirectory(wstring destinationDirectoryPath) noexcept {
 
 	error_code _;
 	// Если директории не существует и её невозможно создать, выходим
-	if (not isAnythingExistsByPath(destinationDirectoryPath) and not fs::create_directory(destinationDirectoryPath, _)) {
+	if (not isAnythingExistsByPath(destinationDirectoryPath) and not fs::create_directory(toFilesystemPath(destinationDirectoryPath), _)) {
 		wcout << "Error: cannot create directory by given path [" << destinationDirectoryPath << "]" << endl;
 		exit(ERROR_DIRECTORY);
 	}
 }
 
-FILE* getResultFilePtr(wstring pathToResultFolder, wstring pathToSourceFile, wstring fileSuffixName) {
+File* getResultFilePtr(wstring pathToResultFolder, wstring pathToSourceFile, wstring fileSuffixName) {
 
 	/* Поскольку могут быть файлы с одинаковыми названиями из разных директорий, выбираем имя итогового,
 	нормализованного файла, пока не найдём незанятое (допустим, если нормализуется два файла из разных директорий с
@@ -350,15 +1174,44 @@ FILE* getResultFilePtr(wstring pathToResultFolder, wstring pathToSourceFile, wst
 	как test_normalized_1.txt, а второй как test_normalized_2.txt)*/
 	wstring resultFilePath;
 	size_t i = 1;
+	/* Если файлы обрабатываются одновременно в нескольких потоках, имя надо выбирать и файл создавать
+	* под блокировкой, иначе два потока могут выбрать одно и то же свободное имя */
+	static mutex resultFileNameSelectionMutex;
+	lock_guard<mutex> lock(resultFileNameSelectionMutex);
 	do {
-		wstring resultFileName = getFileNameWithoutExtension(pathToSourceFile);
-		resultFilePath = joinPaths(pathToResultFolder, resultFileName + L'_' + fileSuffixName + L'_' + to_wstring(i++) + L".txt");
+		// У стандартного ввода имени нет, итоговый файл для него называется stdin_<суффикс>_<номер>.txt
+		wstring resultFileName = isStandardStreamPath(pathToSourceFile) ? L"stdin" : getFileNameWithoutExtension(pathToSourceFile);
+		resultFilePath = joinPaths(pathToResultFolder, resultFileName + L'_' + fileSuffixName + L'_' + to_wstring(i++) + L".txt" + getCompressionExtension(compressionParameters.outputFormat));
 	} while (isAnythingExistsByPath(resultFilePath));
 
-	// Записывать будем в открытый через fopen файл и в байтовом режиме для большей скорости
-	FILE* resultFilePtr = fileOpen(resultFilePath, "wb+");
+	// Записывать будем в байтовом режиме для большей скорости
+	File* resultFilePtr = fileOpen(resultFilePath, "wb+");
 	if (resultFilePtr == NULL) {
 		wcout << "Cannot create file for " << fileSuffixName << " base by path : [" << resultFilePath << "] " << endl;
 	}
 	return resultFilePtr;
-}
\ No newline at end of file
+}
+
+int executeTheoCommand(wstring commandArguments) {
+#ifdef _WIN32
+	// Исполняемый файл theo добавляется в PATH при первом запуске, поэтому вызывается просто по имени
+	return _wsystem((L"theo " + commandArguments + SUPPRESS_CMD_WINDOWS_OUTPUT_END).c_str());
+#else
+	// В PATH theo может и не быть, поэтому вызываем тот же исполняемый файл, который запущен сейчас
+	error_code _;
+	wstring executablePath = fromFilesystemPath(fs::read_symlink("/proc/self/exe", _));
+	if (executablePath.empty()) executablePath = L"theo";
+	int status = system(fromWstring(L"\"" + executablePath + L"\" " + commandArguments + SUPPRESS_CMD_WINDOWS_OUTPUT_END).c_str());
+	/* system возвращает не код завершения, а статус процесса, из которого его надо достать. Если команда
+	* не завершилась сама (например, была убита), возвращаем ненулевой код, чтобы это считалось ошибкой */
+	if (status == -1 or not WIFEXITED(status)) return ERROR_CREATE_FAILED;
+	return WEXITSTATUS(status);
+#endif
+}
+
+wstring getFileIOCommandOptions(void) {
+	wstring options;
+	if (fileIOParameters.useIoUring) options += L" --io-uring";
+	if (fileIOParameters.ioProfilePath != NULL) options += L" --io-profile \"" + toWstring(fileIOParameters.ioProfilePath) + L'"';
+	return options;
+}
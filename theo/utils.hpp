@@ -7,41 +7,83 @@
 
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <regex>
 #include <stdbool.h>
+#include <cstring>
 #include <filesystem>
 #include <locale>
 #include <codecvt>
 #include <random>
-#include <dbstl_set.h> // https://docs.oracle.com/cd/E17076_05/html/index.html (Berkeley DB)
+#include <vector>
+#include <map>
+#include <queue>
 #include "libs/argparse/argparse.h" // https://github.com/cofyc/argparse
 #include "libs/robinhood.h" // https://github.com/martinus/robin-hood-hashing
 #include "libs/xoroshiro.hpp" // https://github.com/Reputeless/Xoshiro-cpp
+#include "concurrency.hpp"
+#include "scheduler.hpp"
+#include "fileio.hpp"
+#include "compression.hpp"
+#include "corpus.hpp"
+#include "statistics.hpp"
+#include "progress.hpp"
+#include "perfcounters.hpp"
+#include "lines.hpp"
+#include "hashing.hpp"
+#include "hashset.hpp"
+#include "fingerprints.hpp"
+#include "hashruns.hpp"
+#include "lineindex.hpp"
+#include "profile.hpp"
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include "platform.hpp"
+#endif
 
 // Объявляем min и max, поскольку они были разыменованы ранее в библиотеке xoroshiro
 #define	min(a, b) (((a) < (b)) ? (a) : (b))
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 
 using namespace std;
-using namespace dbstl; // Неймспейс библиотеки для работы с базой данных
 namespace fs = std::filesystem;
 using namespace XoshiroCpp; // Неймспейс библиотеки для быстрого генератора рандомных чисел
 
-// Оптимальный размер чанка диска (ssd) для записи и чтения за одну операцию (fread/fwrite), вычислено тестированием
+/* Оптимальный размер чанка диска (ssd) для записи и чтения за одну операцию (fread/fwrite), вычислено тестированием.
+* Используется, если для диска нет профиля, созданного `theo bench-io`, иначе размер чанка берётся из профиля (getOptimalChunkSize) */
 constexpr unsigned OPTIMAL_DISK_CHUNK_SIZE = 1024 * 1024 * 64;
 
+// Минимальный размер чанка, до которого он может быть уменьшен, если буферам всех потоков не хватает оперативной памяти
+constexpr unsigned MIN_DISK_CHUNK_SIZE = 1024 * 1024;
+
+/* Границы частей, на которые делится большой файл при подсчёте строк в несколько потоков: часть не меньше
+* стольких блоков чтения (чтобы потоки не тратили время на открытие файла и перемещение по нему) и не больше 1 гигабайта */
+constexpr unsigned COUNT_MIN_BLOCKS_IN_FILE_PART = 2;
+constexpr unsigned long long COUNT_MAX_FILE_PART_SIZE = 1024ull * 1024 * 1024;
+
+/* Количество буферов, одновременно находящихся в конвейере чтение -> обработка -> запись.
+* Три буфера позволяют в один момент времени читать следующий чанк, обрабатывать текущий и записывать предыдущий */
+constexpr unsigned PIPELINE_BUFFERS_COUNT = 3;
+
+/* Процент занятой оперативной памяти, после которого dedup по умолчанию (без опции --memory) начинает хранить хеши
+* на диске. Им же оценивается, поместятся ли хеши в память, в профиле строк (count --profile) */
+constexpr int DEDUP_DEFAULT_MEMORY_USAGE_MAX_PERCENT = 90;
+
 // Средняя длина строки в файле обычной базы с аккаунтами
 #define AVERAGE_STRING_LEGTH_IN_FILE 16
 
-// Я люблю очевидные и чистые условия, как в питоне, извините
+// Я люблю очевидные и чистые условия, как в питоне, извините (в GCC и Clang это и так ключевые слова C++)
+#ifdef _MSC_VER
 #define and &&
 #define or ||
 #define not !
+#endif
 
 // Сокращение ull для уменьшения количества кода и размера аргументов функций
 #define ull unsigned long long
 
+#ifdef _WIN32
 /* Строка, которую надо добавлять в начало длинного пути(длиннее MAX_PATH), чтобы
 * система Windows считала его валидным. Например, \\?\C:\Users\Admin\somelooooo......ng */
 #define WIN_LONG_PATH_START LR"(\\?\)"
@@ -49,13 +91,54 @@ constexpr unsigned OPTIMAL_DISK_CHUNK_SIZE = 1024 * 1024 * 64;
 /* При добавлении этого в конец вызываемой через консоль команды с помощью `system(cmd)`,
  * весь вывод, генерирующийся во время выполнения команды, будет скрыт и не виден в консоли */
 #define SUPPRESS_CMD_WINDOWS_OUTPUT_END L" > nul"
-
-// Тип для хранилища уникальных хешей (чисел unsigned long long), расположенного в дисковой памяти
-typedef db_set<ull, ElementHolder<ull>> db_hashset;
+#else
+// На других системах длина пути не ограничена MAX_PATH, и добавлять к нему ничего не надо
+#define WIN_LONG_PATH_START L""
+#define SUPPRESS_CMD_WINDOWS_OUTPUT_END L" > /dev/null"
+#endif
 
 // Информация о входных файлах, переданных юзером для обработки, сделал отдельный тип для лучшего понимания
 #define sourcefiles_info robin_hood::unordered_flat_set<wstring>
 
+/* Обработчик чанка одной из команд (normalize, dedup, tokenize): обрабатывает строки входного буфера,
+* записывает результат в итоговый буфер и возвращает его длину в байтах */
+typedef size_t (*chunk_processor)(char* inputBuffer, size_t inputBufferLength, char* resultBuffer);
+
+// Общие для нескольких команд параметры почанковой обработки файлов, значения задаются опциями запуска команды
+struct ChunksProcessingParameters {
+	/* Читать входные файлы через отображение в память (memory mapping): обработчики чанков получают
+	* указатели прямо в отображение, без копирования данных во временный буфер */
+	int useMemoryMapping = 0;
+	/* Количество потоков, одновременно обрабатывающих чанки одного файла (только для команд, обработчики
+	* которых не хранят состояние между чанками). Ноль - по количеству ядер процессора */
+	int threadsCount = 0;
+};
+extern ChunksProcessingParameters chunksProcessingParameters;
+
+/* Отображение файла в память в режиме копирования при записи: изменения, которые обработчики чанков вносят
+* в строки прямо в отображении, не попадают в сам файл на диске */
+struct MappedFile {
+	char* data = NULL; // Указатель на начало отображённого в память содержимого файла
+	ull size = 0; // Размер отображённого файла в байтах
+#ifdef _WIN32
+	HANDLE mappingHandle = NULL; // Системный объект отображения, нужен для корректного закрытия
+#endif
+	// Отображает в память весь открытый файл целиком. Возвращает false, если отобразить файл не получилось
+	bool map(File* file) noexcept;
+	// Закрывает отображение, после этого указатель data становится невалидным
+	void unmap() noexcept;
+};
+
+/* Возвращает количество потоков для обработки чанков, заданное пользователем в chunksProcessingParameters,
+* а если оно не задано - количество логических ядер процессора */
+size_t getProcessingThreadsCount(void) noexcept;
+
+/* Возвращает размер чанка для чтения и записи, если с диском одновременно работают workersCount потоков (или файлов).
+* Размер берётся из профиля диска (fileIOParameters.ioProfilePath или профиль по умолчанию), а без профиля равен
+* OPTIMAL_DISK_CHUNK_SIZE. Если буферы конвейера всех потоков такого размера не помещаются в половину свободной
+* оперативной памяти, чанк уменьшается вдвое, пока не поместится (но не меньше MIN_DISK_CHUNK_SIZE) */
+size_t getOptimalChunkSize(size_t workersCount) noexcept;
+
 // Функции для конвертации обычных строк в wide-строки и обратно
 wstring toWstring(string s);
 string fromWstring(wstring s);
@@ -63,12 +146,16 @@ string fromWstring(wstring s);
 // Функция для объединения абсолютного пути к папке и имени файла в абсолютный путь к файлу. Возвращает итоговый путь
 wstring joinPaths(wstring dirPath, wstring filePath) noexcept;
 
-/* Открывает файлы с именем в любой кодировке верным образом, при невозможности открыть возвращает NULL */
-FILE* fileOpen(wstring filePath, const wchar_t* openFlags) noexcept;
-FILE* fileOpen(wstring filePath, string openFlags) noexcept;
-FILE* fileOpen(string filePath, string openFlags) noexcept;
+/* Открывает файлы с именем в любой кодировке верным образом, при невозможности открыть возвращает NULL.
+* Флаги как у fopen: "rb" - чтение, "wb+" - запись в новый файл. Файл открывается через платформенный слой
+* ввода-вывода (fileio.hpp), закрывать его нужно функцией fileClose. Сжатые входные файлы (zstd, gzip, lz4) при чтении
+* распаковываются на лету, а записываемые файлы сжимаются, если пользователь указал --compress (compression.hpp) */
+File* fileOpen(wstring filePath, const wchar_t* openFlags) noexcept;
+File* fileOpen(wstring filePath, string openFlags) noexcept;
+File* fileOpen(string filePath, string openFlags) noexcept;
 
-// Функция принимает в качестве аргумента валидный путь к файлу и возвращает имя файла (без расширения)
+/* Функция принимает в качестве аргумента валидный путь к файлу и возвращает имя файла (без расширения).
+* У сжатых файлов убирается и расширение сжатия, и расширение под ним: для base.txt.zst возвращает base */
 wstring getFileNameWithoutExtension(wstring pathToFile) noexcept;
 
 /* Добавляет в массив путей к файлам, который передан в первом аргументе, все .txt файлы, находящиеся в директории,
@@ -76,7 +163,8 @@ wstring getFileNameWithoutExtension(wstring pathToFile) noexcept;
 не к директории, а к файлу */
 bool processSourceFileOrDirectory(sourcefiles_info&, wstring path, bool recursive);
 
-// Заносит файл по указанному пути, если он имеет расширение .txt, в список файлов для обработки (нормализации, дедупликации etc)
+/* Заносит файл по указанному пути, если он имеет расширение .txt (в том числе сжатый .txt.zst, .txt.gz или .txt.lz4),
+* в список файлов для обработки (нормализации, дедупликации etc) */
 bool addFileToSourceList(sourcefiles_info&, wstring filePath) noexcept;
 
 /* Получает все входные пути для обработки из аргументов, введённых юзером (и папки, и файлы).
@@ -91,7 +179,7 @@ size_t getLinesCountInText(char* bytes) noexcept;
 long long getFileSize(wstring pathToFile) noexcept;
 
 // Возвращает количество байт информации в файле, если файл не найден или к нему нет доступа, возвращает -1
-long long getFileSize(FILE* filePtr) noexcept;
+long long getFileSize(File* filePtr) noexcept;
 
 // Возвращает количество свободной оперативной памяти в байтах
 ull getAvailableMemoryInBytes(void) noexcept;
@@ -117,25 +205,33 @@ bool isValidRegex(string regularExpression) noexcept;
 // Возвращает строку, содержащую путь к текущец директории (откуда вызвана программа, исполняемый файл)
 wstring getWorkingDirectoryPath() noexcept;
 
-/* Возвращает количество строк в указанном файле(один перенос строки '\n' = одна строка).
-* Если файл не открывается или не считывается - возвращает '-1'.
-* Если нужно обработать много файлов, то во избежание излишних аллокаций буфера
-* можно передавать временные буфер для считывания блоками из файла и его размер в качестве
-* параметров функции. Если оставить пустым - будет аллоцироваться и очищаться прямо в функции. 
-* Если буфер передан в качестве параметра функции, вызывающий функцию гарантирует,
-* что его размер не будет меньше указанного размера буфера в байтах, иначе может произойти
-* неожиданное завершение программы с ошибкой. 
-* Кроме того, переданный буфер НЕ будет очищен перед возвратом и может быть заполнен всяческим
-* мусором, оставшимся от работы.
-*/
-long long getStringCountInFile(const wstring& filePath, size_t temporaryBufferSizeInBytes = OPTIMAL_DISK_CHUNK_SIZE + 1, char* temporaryInputBuffer = NULL);
+// Возвращает количество переносов строк ('\n') в первых bufferLength байтах буфера
+size_t getLinesCountInBuffer(const char* buffer, size_t bufferLength) noexcept;
+
+/* Возвращает количество строк в указанном файле (один перенос строки '\n' = одна строка, последняя строка
+* без переноса тоже считается). Если файл не открывается или не считывается - возвращает '-1'.
+* Большой файл считается по частям во всех потоках обработки (getProcessingThreadsCount) */
+long long getStringCountInFile(const wstring& filePath);
+
+/* Считает строки во всех файлах сразу в нескольких потоках: маленькие файлы считаются одновременно,
+* по файлу на поток, а большие делятся на части, которые считают разные потоки (если файл не сжат
+* и не является стандартным вводом). Возвращает пары путь - количество строк (или -1, если файл не открылся
+* или не считался) в порядке уменьшения размера файлов */
+vector<pair<wstring, long long>> getStringCountInFiles(const sourcefiles_info& sourceFilesPaths);
 
 /* Обрабатывает путь к итоговому файлу или папке, указанный пользователем. Исходя из значения параметра
  * needMerge решает, требуется ли создавать итоговый файл, или надо просто проверить итоговую директорию.
  * Если пользователь не указал путь, то устанавливается значение пути на дефолтный по указателю:
  * если needMerge = false, то путь по умолчанию - рабочая директория, если needMerge = true, то путь
- * к итоговому файлу передаётся в последнем аргументе, так как он уникален для каждой команды. */
-void processDestinationPath(const char** destinationPathPtr, bool needMerge, FILE** resultFile, const char* defaultResultMergedFilePath) noexcept;
+ * к итоговому файлу передаётся в последнем аргументе, так как он уникален для каждой команды.
+* Если путь - "-" (стандартный вывод), строки из всех файлов объединяются и значение по указателю needMergePtr
+* становится равно 1, а весь остальной вывод программы в консоль переключается на stderr. */
+void processDestinationPath(const char** destinationPathPtr, int* needMergePtr, File** resultFile, const char* defaultResultMergedFilePath) noexcept;
+
+/* Обрабатывает значение опции --compress, указанное пользователем (NULL, если опция не указана): включает сжатие
+* всех итоговых файлов команды. Если значение неверное, завершает работу программы с подходящим кодом ошибки.
+* Вызывается до открытия итоговых файлов, в том числе до processDestinationPath */
+void processOutputCompressionOption(const char* compressionString) noexcept;
 
 /* Проверяет директорию, указанную пользователем как директорию вывода. 
  * Если директории не существует - создаёт её.
@@ -144,20 +240,63 @@ void processDestinationPath(const char** destinationPathPtr, bool needMerge, FIL
 void checkDestinationDirectory(wstring destinationDirectoryPath) noexcept;
 
 /* Считывает переданный файл оптимальными для чтения чанками (с записью чанков во временный буфер).
-* Каждый считанный чанк в буфере обрезается по границе последней строки, далее во входном файле идёт отступ назад
-* на отрезанный кусок неполной строки, а полученный буфер обрабатывается функцией processChunkBuffer, уникальной
+* Каждый считанный чанк в буфере обрезается по границе последней строки, отрезанный кусок неполной строки
+* переносится в начало следующего чанка, а полученный буфер обрабатывается функцией processChunkBuffer, уникальной
 * для каждой команды(у deduplicate будет одна функция, у normalize другая), и итоговые данные после обработки
-* входного буфера записываются в итоговый файл (будет ли это общий файл, определяет функция выше уровнем). */
-void processStringsInFileByChunks(FILE* inputFile, FILE* resultFile, size_t processChunkBuffer(char*, size_t, char*));
+* входного буфера записываются в итоговый файл (будет ли это общий файл, определяет функция выше уровнем).
+* Чтение, обработка и запись выполняются конвейером: отдельный поток читает чанки, текущий их обрабатывает,
+* ещё один поток записывает результат, буферы между ними передаются через ограниченные очереди.
+* По умолчанию функция processChunkBuffer вызывается в одном (текущем) потоке, последовательно, в порядке чанков.
+* Если processingThreadsCount больше единицы, чанки обрабатываются одновременно в нескольких потоках, но результат
+* всё равно записывается строго в порядке чанков во входном файле. Так можно делать только для обработчиков,
+* которые не хранят никакого состояния между чанками (как у normalize и tokenize, но не у deduplicate).
+* Если включён режим chunksProcessingParameters.useMemoryMapping, файл не читается в буферы, а отображается
+* в память, и обработчик получает чанки, выровненные по границам строк, прямо из отображения.
+* Если обработчик ничего не записывает в итоговый буфер (например, раскладывает строки по своим файлам), resultFile
+* может быть NULL. Возвращает статистику обработки файла (без пути к нему), строки в ней считаются только при
+* включённой статистике */
+FileStatistics processStringsInFileByChunks(File* inputFile, File* resultFile, size_t processChunkBuffer(char*, size_t, char*), size_t processingThreadsCount = 1);
 
 /* Обработка каждого файла из списка путей ко всем файлам, переданным пользователем. Обёртка верхнего уровня
 * для функции processStringsInFileByChunks, служит для корректной обработки ситуации со множеством входных файлов
 * (тогда как та функция работает исключительно с одним входным и одним выходным).
 * Обрабатывает ситуацию, когда пользователю требуется сложить все итоговые строки в один файл, если же нет - 
 * создаёт для каждого входного файла свой собственный итоговый с обработанными строками.
-* Для каждого конкретного входного файла все действия выполняются с помощью функции 'processStringsInFileByChunks'.
-* После полного выполнения функция закрывает все открытые файлы. */
-void processAllSourceFiles(sourcefiles_info sourceFilesPaths, bool needMerge, FILE* resultFile, wstring destinationDirectoryPath, wstring resultFilesSuffix, size_t processChunkBuffer(char* inputBuffer, size_t inputBufferLength, char* resultBuffer));
+* Для каждого конкретного входного файла все действия выполняются с помощью функции 'processStringsInFileByChunks',
+* чанки каждого файла обрабатываются в количестве потоков, возвращаемом getProcessingThreadsCount.
+* Если итоговые строки не надо складывать в один файл и потоков больше одного, разные файлы обрабатываются
+* одновременно планировщиком с перехватом работы: сначала самые большие, а освободившиеся потоки забирают
+* необработанные чанки ещё не законченных файлов.
+* После полного выполнения функция закрывает все открытые файлы, в том числе общий итоговый файл resultFile. */
+void processAllSourceFiles(sourcefiles_info sourceFilesPaths, bool needMerge, File* resultFile, wstring destinationDirectoryPath, wstring resultFilesSuffix, size_t processChunkBuffer(char* inputBuffer, size_t inputBufferLength, char* resultBuffer));
+
+/* Этапы команды pipe: каждая функция настраивает параметры своей команды по аргументу этапа (тексту после двоеточия
+* в цепочке, например 'emailpass' в 'normalize:emailpass', или NULL, если аргумента нет) и возвращает обработчик
+* чанков этой команды. Если аргумент неверный, возвращает NULL */
+chunk_processor getNormalizePipeStage(const char* basesType) noexcept;
+chunk_processor getTokenizePipeStage(const char* resultStringPart) noexcept;
+/* Если не хватит оперативной памяти, хеши переносятся на диск в отсортированные файлы-прогоны с фильтрами Блума
+* в памяти, прогоны создаются в директории dbParentDirectory */
+chunk_processor getDeduplicatePipeStage(const char* memoryUsageMaxPercentString, const wstring& dbParentDirectory) noexcept;
+/* Очищает хеши строк, накопленные этапом dedup в текущем потоке (и удаляет прогоны хешей на диске, если они
+* использовались), чтобы дубликаты в следующем файле искались отдельно от предыдущего */
+void clearDeduplicatePipeStage(void) noexcept;
+/* Дописывает в статистику файла размер и заполненность хеш-таблицы dedup текущего потока и момент перехода
+* на диск. Если в текущем потоке дубликаты не удалялись, ничего не делает */
+void fillDeduplicationStatistics(FileStatistics* statistics) noexcept;
+
+/* Читает буфер побайтово с позиции startBufIndex, считая строки, пока remainingStrings не станет 0. Тогда перестаёт
+* считать и возвращает позицию начала следующей строки в буфере. Если же прочитан весь буфер, но нужного количества
+* строк не набралось, возвращает длину буфера. Используется командой split для разбиения файла по количеству строк */
+size_t readBufferByLinesUntilCount(char* buffer, size_t buflen, size_t startBufIndex, size_t* remainingStrings);
+
+/* Возвращает список путей к входным файлам, отсортированный по убыванию размера файлов, чтобы при одновременной
+* обработке многих файлов самые большие начинали обрабатываться первыми */
+vector<wstring> getSourceFilesSortedBySize(const sourcefiles_info& sourceFilesPaths);
+
+/* Возвращает общий размер входных файлов в байтах для показа прогресса. Если размер хотя бы одного из них после
+* распаковки заранее неизвестен (стандартный ввод, сжатые файлы), возвращает ноль */
+ull getSourceFilesTotalSize(const sourcefiles_info& sourceFilesPaths) noexcept;
 
 /* Генерирует валидный путь к итоговому файлу и открывает сам файл, используя имя входного файла, 
  * итоговую директорию и суффикс функции, который надо добавлять ко всем обработанным файлам. 
@@ -166,6 +305,14 @@ void processAllSourceFiles(sourcefiles_info sourceFilesPaths, bool needMerge, FI
  * Например, после нормализации файла test.txt и если это первый нормализуемый файл с таким именем,
  * в итоговой директории создастся и откроется файл test_normalized_1.txt. Если функция-обработчик другая,
  * то и суффикс другой, например, после токенизации test.txt в результате будет test_tokenized_1.txt.
- * ВОзвращает указатель на открытый файл в режиме бинарной записи. */
-FILE* getResultFilePtr(wstring pathToResultFolder, wstring pathToSourceFile, wstring fileSuffixName);
+ * ВОзвращает указатель на открытый файл в режиме бинарной записи. Можно вызывать из нескольких потоков одновременно. */
+File* getResultFilePtr(wstring pathToResultFolder, wstring pathToSourceFile, wstring fileSuffixName);
+
+/* Запускает в консоли другую команду theo с указанными аргументами (например, L"split -p 2 base.txt"),
+* скрывая весь её вывод. Возвращает код завершения команды (ERROR_SUCCESS, если всё прошло успешно) */
+int executeTheoCommand(wstring commandArguments);
+
+/* Возвращает опции файлового ввода-вывода текущего запуска (например, L" --io-uring --io-profile \"disk.txt\"") для передачи
+* в команды, запускаемые через executeTheoCommand. Опции начинаются с пробела, пустая строка - если их нет */
+wstring getFileIOCommandOptions(void);
 #endif // !MY_UTILS
\ No newline at end of file